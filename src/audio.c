@@ -0,0 +1,611 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file audio.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source code of functions defined in audio.h
+ *
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include "audio.h"
+#include "util.h"
+
+//! WAV file header length
+#define AUDIO_WAV_HDRLEN 44
+
+/**
+ * @brief Decode a G.711 u-law sample (ITU-T G.711)
+ */
+static int16_t
+audio_ulaw_decode(u_char sample)
+{
+    int value;
+
+    sample = ~sample;
+    value = ((sample & 0x0F) << 3) + 0x84;
+    value <<= (sample & 0x70) >> 4;
+    return (sample & 0x80) ? (0x84 - value) : (value - 0x84);
+}
+
+/**
+ * @brief Decode a G.711 A-law sample (ITU-T G.711)
+ */
+static int16_t
+audio_alaw_decode(u_char sample)
+{
+    int value, segment;
+
+    sample ^= 0x55;
+    value = (sample & 0x0F) << 4;
+    segment = (sample & 0x70) >> 4;
+    if (segment == 0) {
+        value += 8;
+    } else {
+        value += 0x108;
+        if (segment > 1)
+            value <<= segment - 1;
+    }
+    return (sample & 0x80) ? value : -value;
+}
+
+/**
+ * @brief Check if payload type can be decoded (PCMU or PCMA)
+ */
+static bool
+audio_format_decodable(uint32_t format)
+{
+    return format == 0 || format == 8;
+}
+
+/**
+ * @brief Get RTP payload of a stored record
+ *
+ * Payload is only filled if the record contains RTP data
+ *
+ * @return record or NULL if index is out of range
+ */
+static rtp_record_t *
+audio_record_payload(rtp_stream_t *stream, uint32_t idx, const u_char **payload, uint32_t *len)
+{
+    rtp_record_t *record;
+    const u_char *data;
+    uint32_t hdrlen, size;
+
+    if (!(record = stream_store_record(stream, idx, &data)))
+        return NULL;
+
+    if (record->hdroff == RTP_RECORD_NO_HEADER || record->caplen < record->hdroff + RTP_HDR_LENGTH)
+        return record;
+
+    data += record->hdroff;
+    size = record->caplen - record->hdroff;
+
+    // Skip contributing sources and header extension
+    hdrlen = RTP_HDR_LENGTH + (data[0] & 0x0F) * 4;
+    if ((data[0] & 0x10) && size >= hdrlen + 4)
+        hdrlen += 4 + ((data[hdrlen + 2] << 8 | data[hdrlen + 3]) * 4);
+    // Remove padding
+    if ((data[0] & 0x20) && size > hdrlen && data[size - 1] <= size - hdrlen)
+        size -= data[size - 1];
+    if (size <= hdrlen)
+        return record;
+
+    *payload = data + hdrlen;
+    *len = size - hdrlen;
+    return record;
+}
+
+/**
+ * @brief Get samples elapsed from export start to record capture time
+ */
+static int64_t
+audio_record_pos(rtp_record_t *record, struct timeval start)
+{
+    return ((int64_t) record->sec - start.tv_sec) * AUDIO_SAMPLE_RATE
+           + ((int64_t) record->usec - start.tv_usec) * AUDIO_SAMPLE_RATE / 1000000;
+}
+
+/**
+ * @brief Add a packet to the channel reordering buffer
+ */
+static void
+audio_buffer_push(audio_channel_t *channel, audio_packet_t packet)
+{
+    audio_packet_t *buffer = channel->buffer;
+    uint32_t idx = channel->count++, parent;
+
+    while (idx > 0) {
+        parent = (idx - 1) / 2;
+        if (buffer[parent].pos <= packet.pos)
+            break;
+        buffer[idx] = buffer[parent];
+        idx = parent;
+    }
+    buffer[idx] = packet;
+}
+
+/**
+ * @brief Remove the packet with lowest playout position from the buffer
+ */
+static void
+audio_buffer_pop(audio_channel_t *channel)
+{
+    audio_packet_t *buffer = channel->buffer;
+    audio_packet_t last = buffer[--channel->count];
+    uint32_t idx = 0, child;
+
+    while ((child = idx * 2 + 1) < channel->count) {
+        if (child + 1 < channel->count && buffer[child + 1].pos < buffer[child].pos)
+            child++;
+        if (last.pos <= buffer[child].pos)
+            break;
+        buffer[idx] = buffer[child];
+        idx = child;
+    }
+    buffer[idx] = last;
+}
+
+/**
+ * @brief Fill the channel reordering buffer with next captured packets
+ *
+ * Packets of all channel streams are read in capture order. Playout
+ * position is calculated from the RTP timestamp, anchored to the capture
+ * time of the stream first packet (or after a big timestamp jump).
+ */
+static void
+audio_channel_fill(audio_channel_t *channel, struct timeval start)
+{
+    audio_source_t *source, *next;
+    rtp_record_t *record, *first;
+    audio_packet_t packet;
+    int64_t arrival, expected;
+    vector_iter_t it;
+
+    while (channel->count < AUDIO_BUFFER_PACKETS) {
+        // Get the source with the oldest pending record
+        next = NULL;
+        first = NULL;
+        it = vector_iterator(channel->sources);
+        while ((source = vector_iterator_next(&it))) {
+            if (!(record = stream_store_record(source->stream, source->idx, NULL)))
+                continue;
+            if (!first || record->sec < first->sec
+                || (record->sec == first->sec && record->usec < first->usec)) {
+                first = record;
+                next = source;
+            }
+        }
+
+        // No more packets to read
+        if (!next)
+            break;
+
+        memset(&packet, 0, sizeof(audio_packet_t));
+        record = audio_record_payload(next->stream, next->idx++, &packet.payload, &packet.len);
+        if (!packet.payload)
+            continue;
+
+        arrival = audio_record_pos(record, start);
+        expected = next->anchor_pos + (int32_t) (record->timestamp - next->anchor_ts);
+        if (!next->anchored || llabs(expected - arrival) > AUDIO_RESYNC_SAMPLES) {
+            next->anchor_ts = record->timestamp;
+            next->anchor_pos = arrival;
+            next->anchored = true;
+        }
+
+        packet.pos = next->anchor_pos + (int32_t) (record->timestamp - next->anchor_ts);
+        packet.format = RTP_PAYLOAD_TYPE(record->mpt);
+        audio_buffer_push(channel, packet);
+    }
+}
+
+/**
+ * @brief Decode next channel samples
+ *
+ * Gaps between packets are filled with silence. Packets that arrive after
+ * their playout position or can not be decoded are discarded.
+ *
+ * @return number of samples until the end of channel packets
+ */
+static uint32_t
+audio_channel_read(audio_channel_t *channel, int16_t *samples, uint32_t count,
+                   struct timeval start)
+{
+    audio_packet_t *packet;
+    uint32_t filled = 0, offset, len, i;
+
+    while (filled < count) {
+        audio_channel_fill(channel, start);
+        if (!channel->count)
+            break;
+
+        packet = &channel->buffer[0];
+        if (!audio_format_decodable(packet->format) || packet->pos + packet->len <= channel->pos) {
+            audio_buffer_pop(channel);
+            continue;
+        }
+
+        if (packet->pos > channel->pos) {
+            // Silence until next packet
+            len = count - filled;
+            if (packet->pos - channel->pos < len)
+                len = packet->pos - channel->pos;
+            memset(samples + filled, 0, len * sizeof(int16_t));
+        } else {
+            // Decode packet samples from current position
+            offset = channel->pos - packet->pos;
+            len = count - filled;
+            if (packet->len - offset < len)
+                len = packet->len - offset;
+            for (i = 0; i < len; i++) {
+                samples[filled + i] = (packet->format == 0)
+                                      ? audio_ulaw_decode(packet->payload[offset + i])
+                                      : audio_alaw_decode(packet->payload[offset + i]);
+            }
+            if (offset + len == packet->len)
+                audio_buffer_pop(channel);
+        }
+
+        filled += len;
+        channel->pos += len;
+    }
+
+    return filled;
+}
+
+/**
+ * @brief Write channel packets payload in playout order
+ *
+ * @return 0 on success, 1 on write error
+ */
+static int
+audio_channel_write_raw(audio_channel_t *channel, FILE *f, struct timeval start)
+{
+    audio_packet_t *packet;
+
+    while (audio_channel_fill(channel, start), channel->count) {
+        packet = &channel->buffer[0];
+        if (fwrite(packet->payload, 1, packet->len, f) != packet->len)
+            return 1;
+        audio_buffer_pop(channel);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Write a little endian value
+ */
+static void
+audio_put_le(u_char *data, uint32_t value, int len)
+{
+    int i;
+    for (i = 0; i < len; i++)
+        data[i] = (value >> (i * 8)) & 0xFF;
+}
+
+/**
+ * @brief Write WAV file header at the start of the file
+ *
+ * @return 0 on success, 1 on write error
+ */
+static int
+audio_wav_header(FILE *f, uint16_t channels, uint32_t datalen)
+{
+    u_char header[AUDIO_WAV_HDRLEN];
+
+    memcpy(header, "RIFF", 4);
+    audio_put_le(header + 4, datalen + AUDIO_WAV_HDRLEN - 8, 4);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    audio_put_le(header + 16, 16, 4);
+    // Linear PCM, 16 bits per sample
+    audio_put_le(header + 20, 1, 2);
+    audio_put_le(header + 22, channels, 2);
+    audio_put_le(header + 24, AUDIO_SAMPLE_RATE, 4);
+    audio_put_le(header + 28, AUDIO_SAMPLE_RATE * channels * 2, 4);
+    audio_put_le(header + 32, channels * 2, 2);
+    audio_put_le(header + 34, 16, 2);
+    memcpy(header + 36, "data", 4);
+    audio_put_le(header + 40, datalen, 4);
+
+    rewind(f);
+    return fwrite(header, 1, AUDIO_WAV_HDRLEN, f) != AUDIO_WAV_HDRLEN;
+}
+
+/**
+ * @brief Write channels samples interleaved in a WAV file
+ *
+ * @return 0 on success, 1 on write error
+ */
+static int
+audio_wav_write(FILE *f, int16_t samples[][AUDIO_BLOCK_SAMPLES], int channels, uint32_t count,
+                uint32_t *datalen)
+{
+    u_char data[AUDIO_BLOCK_SAMPLES * 2 * 2];
+    uint32_t i, len = 0;
+    int c;
+
+    for (i = 0; i < count; i++) {
+        for (c = 0; c < channels; c++, len += 2)
+            audio_put_le(data + len, (uint16_t) samples[c][i], 2);
+    }
+
+    if (fwrite(data, 1, len, f) != len)
+        return 1;
+
+    *datalen = (*datalen > UINT32_MAX - AUDIO_WAV_HDRLEN - len) ? *datalen : *datalen + len;
+    return 0;
+}
+
+/**
+ * @brief Write given channels to a WAV file
+ *
+ * @return 0 on success, 1 on write error
+ */
+static int
+audio_wav_export(audio_channel_t **channels, int count, FILE *f, struct timeval start)
+{
+    int16_t samples[2][AUDIO_BLOCK_SAMPLES];
+    uint32_t datalen = 0, len, read;
+    int c;
+
+    // Reserve header space until data length is known
+    if (audio_wav_header(f, count, 0) != 0)
+        return 1;
+
+    do {
+        len = 0;
+        for (c = 0; c < count; c++) {
+            read = audio_channel_read(channels[c], samples[c], AUDIO_BLOCK_SAMPLES, start);
+            if (read > len)
+                len = read;
+            // Keep channels aligned if one of them has ended
+            memset(samples[c] + read, 0, (AUDIO_BLOCK_SAMPLES - read) * sizeof(int16_t));
+        }
+        if (audio_wav_write(f, samples, count, len, &datalen) != 0)
+            return 1;
+    } while (len == AUDIO_BLOCK_SAMPLES);
+
+    return audio_wav_header(f, count, datalen);
+}
+
+/**
+ * @brief Copy filename without its WAV extension
+ */
+static void
+audio_filename_base(const char *filename, char *base, size_t baselen)
+{
+    size_t len;
+
+    sng_strncpy(base, filename, baselen);
+    len = strlen(base);
+    if (len > 4 && !strcasecmp(base + len - 4, ".wav"))
+        base[len - 4] = '\0';
+}
+
+/**
+ * @brief Build split mode filename for a channel
+ */
+static void
+audio_channel_filename(audio_channel_t *channel, const char *filename, char *out, size_t outlen)
+{
+    audio_source_t *source = vector_first(channel->sources);
+    const char *format, *ext = "wav";
+    char base[PATH_MAX], fmtext[20];
+    size_t i;
+
+    // Remove file extension
+    audio_filename_base(filename, base, sizeof(base));
+
+    // Raw files are named after their format
+    if (!channel->decode) {
+        ext = "raw";
+        if ((format = stream_get_format(source->stream))) {
+            for (i = 0; format[i] && format[i] != '/' && i < sizeof(fmtext) - 1; i++)
+                fmtext[i] = tolower(format[i]);
+            fmtext[i] = '\0';
+            if (i)
+                ext = fmtext;
+        }
+    }
+
+    snprintf(out, outlen, "%s-%s-%u.%s", base, source->stream->src.ip,
+             source->stream->src.port, ext);
+}
+
+/**
+ * @brief Get the channel of a stream direction, creating it if required
+ */
+static audio_channel_t *
+audio_stream_channel(vector_t *channels, rtp_stream_t *stream)
+{
+    audio_channel_t *channel;
+    audio_source_t *source;
+    vector_iter_t it;
+
+    it = vector_iterator(channels);
+    while ((channel = vector_iterator_next(&it))) {
+        source = vector_first(channel->sources);
+        if (address_equals(source->stream->src, stream->src)
+            && address_equals(source->stream->dst, stream->dst))
+            return channel;
+    }
+
+    if (!(channel = sng_malloc(sizeof(audio_channel_t))))
+        return NULL;
+    channel->sources = vector_create(1, 1);
+    vector_set_destroyer(channel->sources, vector_generic_destroyer);
+    // Direction format is the one of its first packet
+    channel->decode = audio_format_decodable(
+        stream->rtpinfo.fmtcount ? stream->rtpinfo.formats[0].code : stream->rtpinfo.fmtcode);
+    vector_append(channels, channel);
+    return channel;
+}
+
+/**
+ * @brief Free channel memory
+ */
+static void
+audio_channel_destroyer(void *item)
+{
+    audio_channel_t *channel = item;
+    vector_destroy(channel->sources);
+    sng_free(channel);
+}
+
+int
+audio_export(vector_t *streams, const char *filename, enum audio_mode mode)
+{
+    vector_t *channels;
+    audio_channel_t *channel, *stereo[2], silence = { 0 };
+    audio_source_t *source;
+    rtp_stream_t *stream;
+    rtp_record_t *record;
+    struct timeval start = { 0 };
+    char outfile[PATH_MAX];
+    vector_iter_t it;
+    FILE *f;
+    int count = 0, error = 0;
+
+    channels = vector_create(2, 2);
+    vector_set_destroyer(channels, audio_channel_destroyer);
+
+    // Group streams by direction
+    it = vector_iterator(streams);
+    while ((stream = vector_iterator_next(&it))) {
+        if (stream->type != PACKET_RTP || stream->telephone_event)
+            continue;
+        if (!(record = stream_store_record(stream, 0, NULL)))
+            continue;
+        if (!(channel = audio_stream_channel(channels, stream)))
+            continue;
+        source = sng_malloc(sizeof(audio_source_t));
+        source->stream = stream;
+        vector_append(channel->sources, source);
+
+        // Export starts with the oldest stored packet
+        if (!start.tv_sec || record->sec < start.tv_sec
+            || (record->sec == start.tv_sec && record->usec < start.tv_usec)) {
+            start.tv_sec = record->sec;
+            start.tv_usec = record->usec;
+        }
+    }
+
+    if (mode == AUDIO_STEREO) {
+        // Left and right channels with first decodable directions
+        it = vector_iterator(channels);
+        while ((channel = vector_iterator_next(&it)) && count < 2) {
+            if (channel->decode)
+                stereo[count++] = channel;
+        }
+        if (count) {
+            // Single direction, right channel is silent
+            if (count < 2)
+                stereo[1] = &silence;
+            if ((f = fopen(filename, "w"))) {
+                error = audio_wav_export(stereo, 2, f, start);
+                error |= fclose(f);
+            } else {
+                error = 1;
+            }
+            count = 1;
+        }
+    } else {
+        // One file per direction
+        it = vector_iterator(channels);
+        while (!error && (channel = vector_iterator_next(&it))) {
+            audio_channel_filename(channel, filename, outfile, sizeof(outfile));
+            if (!(f = fopen(outfile, "w"))) {
+                error = 1;
+                break;
+            }
+            if (channel->decode) {
+                error = audio_wav_export(&channel, 1, f, start);
+            } else {
+                error = audio_channel_write_raw(channel, f, start);
+            }
+            error |= fclose(f);
+            count++;
+        }
+    }
+
+    vector_destroy(channels);
+    return (error) ? -1 : count;
+}
+
+int
+audio_export_calls(vector_t *calls, const char *filename, enum audio_mode mode)
+{
+    vector_t *streams;
+    vector_iter_t it, sit;
+    sip_call_t *call;
+    rtp_stream_t *stream;
+    char base[PATH_MAX], outfile[PATH_MAX];
+    int count = 0, ret;
+
+    streams = vector_create(10, 10);
+
+    // Split mode exports all directions of all calls
+    if (mode == AUDIO_SPLIT) {
+        it = vector_iterator(calls);
+        while ((call = vector_iterator_next(&it))) {
+            sit = vector_iterator(call->streams);
+            while ((stream = vector_iterator_next(&sit)))
+                vector_append(streams, stream);
+        }
+        count = audio_export(streams, filename, mode);
+        vector_destroy(streams);
+        return count;
+    }
+
+    // Stereo mode exports one file per call
+    audio_filename_base(filename, base, sizeof(base));
+    it = vector_iterator(calls);
+    while ((call = vector_iterator_next(&it))) {
+        vector_clear(streams);
+        sit = vector_iterator(call->streams);
+        while ((stream = vector_iterator_next(&sit)))
+            vector_append(streams, stream);
+
+        // Files are named after the call index if there are several calls
+        if (vector_count(calls) == 1) {
+            sng_strncpy(outfile, filename, sizeof(outfile));
+        } else {
+            snprintf(outfile, sizeof(outfile), "%s-%d.wav", base, call->index);
+        }
+
+        if ((ret = audio_export(streams, outfile, mode)) < 0) {
+            count = -1;
+            break;
+        }
+        count += ret;
+    }
+
+    vector_destroy(streams);
+    return count;
+}
@@ -0,0 +1,151 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file audio.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to export RTP streams audio
+ *
+ * Stored packets of RTP streams are played out in RTP timestamp order
+ * through a small reordering buffer and written to the output file in
+ * fixed size blocks, so memory usage does not depend on recording length.
+ *
+ * Streams are grouped by direction (source and destination addresses).
+ * G.711 (PCMU and PCMA) payloads are decoded to 16 bit linear PCM WAV
+ * files, lost packets are replaced with silence. Directions with other
+ * formats are written as raw payload files.
+ */
+
+#ifndef __SNGREP_AUDIO_H
+#define __SNGREP_AUDIO_H
+
+#include "config.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include "rtp.h"
+#include "sip_call.h"
+#include "vector.h"
+
+//! Sample rate of exported audio (G.711)
+#define AUDIO_SAMPLE_RATE 8000
+//! Packets kept in each direction reordering buffer
+#define AUDIO_BUFFER_PACKETS 50
+//! Samples written to file on each step
+#define AUDIO_BLOCK_SAMPLES 1600
+//! Max difference between RTP timestamp and arrival time before resync
+#define AUDIO_RESYNC_SAMPLES (AUDIO_SAMPLE_RATE * 2)
+
+//! Shorter declaration of audio structures
+typedef struct audio_source audio_source_t;
+typedef struct audio_packet audio_packet_t;
+typedef struct audio_channel audio_channel_t;
+
+/**
+ * @brief Audio export modes
+ */
+enum audio_mode {
+    //! One file per direction
+    AUDIO_SPLIT = 0,
+    //! One stereo file per call with its first two directions
+    AUDIO_STEREO
+};
+
+/**
+ * @brief Read position of an exported stream
+ */
+struct audio_source {
+    //! Exported stream
+    rtp_stream_t *stream;
+    //! Next stored record to read
+    uint32_t idx;
+    //! RTP timestamp of playout anchor
+    uint32_t anchor_ts;
+    //! Playout position of anchor timestamp
+    int64_t anchor_pos;
+    //! Anchor has been set
+    bool anchored;
+};
+
+/**
+ * @brief Packet waiting in a reordering buffer
+ */
+struct audio_packet {
+    //! Playout position (samples since export start)
+    int64_t pos;
+    //! RTP payload data
+    const u_char *payload;
+    //! RTP payload length
+    uint32_t len;
+    //! RTP payload type
+    uint8_t format;
+};
+
+/**
+ * @brief Streams of a direction being exported
+ */
+struct audio_channel {
+    //! Streams of this direction (audio_source_t)
+    vector_t *sources;
+    //! Reordering buffer, min-heap by playout position
+    audio_packet_t buffer[AUDIO_BUFFER_PACKETS];
+    //! Packets in reordering buffer
+    uint32_t count;
+    //! Next sample position to play
+    int64_t pos;
+    //! Payloads are decoded to PCM
+    bool decode;
+};
+
+/**
+ * @brief Export audio of given RTP streams
+ *
+ * In split mode, each direction is written to a different file named
+ * after filename and the direction source address. In stereo mode, first
+ * two decodable directions are written to left and right channels of
+ * filename.
+ *
+ * Streams data must not change while exporting (capture must be paused).
+ *
+ * @param streams RTP streams to export (rtp_stream_t)
+ * @param filename Output filename
+ * @param mode Output mode
+ * @return number of written files or -1 on error (errno is set)
+ */
+int
+audio_export(vector_t *streams, const char *filename, enum audio_mode mode);
+
+/**
+ * @brief Export audio of given calls
+ *
+ * In split mode, all call directions are exported as audio_export does.
+ * In stereo mode, each call is exported to its own file, named after
+ * filename and the call index when more than one call is given.
+ *
+ * @param calls SIP calls to export (sip_call_t)
+ * @param filename Output filename
+ * @param mode Output mode
+ * @return number of written files or -1 on error (errno is set)
+ */
+int
+audio_export_calls(vector_t *calls, const char *filename, enum audio_mode mode);
+
+#endif /* __SNGREP_AUDIO_H */
@@ -37,6 +37,7 @@
 #include <signal.h>
 #include <sys/stat.h>
 #include "capture.h"
+#include "capture_merge.h"
 #ifdef USE_EEP
 #include "capture_eep.h"
 #endif
@@ -46,6 +47,9 @@
 #ifdef WITH_OPENSSL
 #include "capture_openssl.h"
 #endif
+#if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
+#include "capture_tls.h"
+#endif
 #ifdef WITH_ZLIB
 #include <zlib.h>
 #endif
@@ -53,6 +57,7 @@
 #include "rtp.h"
 #include "setting.h"
 #include "util.h"
+#include "storage.h"
 
 #if __STDC_VERSION__ >= 201112L && __STDC_NO_ATOMICS__ != 1
 // modern C with atomics
@@ -120,9 +125,24 @@ capture_init(size_t limit, bool rtp_capture, bool rotate, size_t pcap_buffer_siz
         capture_cfg.storage = CAPTURE_STORAGE_DISK;
     }
 
+    // Prepare spool directory for disk storage
+    if (capture_cfg.storage == CAPTURE_STORAGE_DISK) {
+        if (storage_init(setting_get_value(SETTING_CAPTURE_SPOOLDIR)) != 0) {
+            fprintf(stderr, "Unable to use spool directory for disk storage. Storing packets in memory.\n");
+            capture_cfg.storage = CAPTURE_STORAGE_MEMORY;
+        }
+    }
+
 #if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
     // Parse TLS Server setting
     capture_cfg.tlsserver = address_from_str(setting_get_value(SETTING_CAPTURE_TLSSERVER));
+
+    // Start TLS decryption workers
+    if (capture_cfg.keyfile) {
+        if (capture_tls_init(setting_get_intvalue(SETTING_CAPTURE_TLSWORKERS)) != 0) {
+            fprintf(stderr, "Unable to start TLS decryption threads. Decrypting in capture thread.\n");
+        }
+    }
 #endif
 
     // Initialize calls lock
@@ -143,10 +163,19 @@ capture_deinit()
     // Close pcap handler
     capture_close();
 
+#if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
+    // Stop TLS decryption workers
+    if (capture_cfg.keyfile)
+        capture_tls_deinit();
+#endif
+
     // Deallocate vectors
     vector_set_destroyer(capture_cfg.sources, vector_generic_destroyer);
     vector_destroy(capture_cfg.sources);
 
+    // Close disk storage segments
+    storage_deinit();
+
     // Remove capture mutex
     pthread_mutex_destroy(&capture_cfg.lock);
 }
@@ -306,6 +335,10 @@ openerror:
         return 3;
     }
 
+    // Read classic pcap files records in place, libpcap handles the rest
+    if (strcmp(infile, "/dev/stdin") != 0)
+        capinfo->file = capture_mmap_open(infile);
+
     // Create Vectors for IP and TCP reassembly
     capinfo->tcp_reasm = vector_create(0, 10);
     capinfo->ip_reasm = vector_create(0, 10);
@@ -321,16 +354,54 @@ parse_packet(u_char *info, const struct pcap_pkthdr *header, const u_char *packe
 {
     // Capture info
     capture_info_t *capinfo = (capture_info_t *) info;
+    // Reassembled IP fragments data
+    u_char reasm[MAX_CAPTURE_LEN];
+    // TCP header data
+    struct tcphdr *tcp = NULL;
+    // Captured packet info
+    packet_t *pkt;
+
+    // Ignore packets while capture is paused or limit is reached
+    if (capture_packet_skip())
+        return;
+
+    // Get transport payload of this packet
+    if (!(pkt = capture_packet_decode(capinfo, header, packet, reasm, &tcp)))
+        return;
+
+    capture_packet_dispatch(capinfo, pkt, tcp);
+}
+
+bool
+capture_packet_skip()
+{
+    // Ignore packets while capture is paused
+    if (capture_paused())
+        return true;
+
+    // Check if we have reached capture limit
+    if (capture_cfg.limit && sip_calls_count() >= capture_cfg.limit) {
+        // If capture rotation is disabled, just skip this packet
+        if (!capture_cfg.rotate) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+packet_t *
+capture_packet_decode(capture_info_t *capinfo, const struct pcap_pkthdr *header, const u_char *packet,
+                      u_char *buffer, struct tcphdr **tcp)
+{
     // UDP header data
     struct udphdr *udp;
     // UDP header size
     uint16_t udp_off;
-    // TCP header data
-    struct tcphdr *tcp;
     // TCP header size
     uint16_t tcp_off;
-    // Packet data
-    u_char data[MAX_CAPTURE_LEN];
+    // Packet data (captured or reassembled)
+    const u_char *data = packet;
     // Packet payload data
     u_char *payload = NULL;
     // Whole packet size
@@ -339,38 +410,29 @@ parse_packet(u_char *info, const struct pcap_pkthdr *header, const u_char *packe
     uint32_t size_payload =  size_capture - capinfo->link_hl;
     // Captured packet info
     packet_t *pkt;
+    // Captured packet transport protocol
+    uint8_t proto;
 #ifdef USE_EEP
     // Captured HEP3 packet info
     packet_t *pkt_hep3;
 #endif
 
-    // Ignore packets while capture is paused
-    if (capture_paused())
-        return;
-
-    // Check if we have reached capture limit
-    if (capture_cfg.limit && sip_calls_count() >= capture_cfg.limit) {
-        // If capture rotation is disabled, just skip this packet
-        if (!capture_cfg.rotate) {
-            return;
-        }
-    }
+    // UDP packets have no TCP header
+    *tcp = NULL;
 
     // Check maximum capture length
     if (header->caplen > MAX_CAPTURE_LEN)
-        return;
-
-    // Copy packet payload
-    memcpy(data, packet, header->caplen);
+        return NULL;
 
     // Check if we have a complete IP packet
-    if (!(pkt = capture_packet_reasm_ip(capinfo, header, data, &size_payload, &size_capture)))
-        return;
+    if (!(pkt = capture_packet_reasm_ip(capinfo, header, &data, buffer, &size_payload, &size_capture)))
+        return NULL;
 
     // Only interested in UDP packets
-    if (pkt->proto == IPPROTO_UDP) {
+    proto = pkt->proto;
+    if (proto == IPPROTO_UDP) {
         // Get UDP header
-        udp = (struct udphdr *)((u_char *)(data) + (size_capture - size_payload));
+        udp = (struct udphdr *)(data + (size_capture - size_payload));
         udp_off = sizeof(struct udphdr);
 
         // Set packet ports
@@ -412,14 +474,14 @@ parse_packet(u_char *info, const struct pcap_pkthdr *header, const u_char *packe
 #ifdef USE_EEP
         }
 #endif
-    } else if (pkt->proto == IPPROTO_TCP) {
+    } else if (proto == IPPROTO_TCP) {
         // Get TCP header
-        tcp = (struct tcphdr *)((u_char *)(data) + (size_capture - size_payload));
-        tcp_off = (tcp->th_off * 4);
+        *tcp = (struct tcphdr *)(data + (size_capture - size_payload));
+        tcp_off = ((*tcp)->th_off * 4);
 
         // Set packet ports
-        pkt->src.port = htons(tcp->th_sport);
-        pkt->dst.port = htons(tcp->th_dport);
+        pkt->src.port = htons((*tcp)->th_sport);
+        pkt->dst.port = htons((*tcp)->th_dport);
 
         // Get actual payload size
         size_payload -= tcp_off;
@@ -428,60 +490,94 @@ parse_packet(u_char *info, const struct pcap_pkthdr *header, const u_char *packe
             size_payload = 0;
 
         // Get payload start
-        payload = (u_char *)(tcp) + tcp_off;
+        payload = (u_char *)(*tcp) + tcp_off;
 
         // Complete packet with Transport information
         packet_set_type(pkt, PACKET_SIP_TCP);
         packet_set_payload(pkt, payload, size_payload);
+    } else {
+        // Not handled protocol
+        packet_destroy(pkt);
+        return NULL;
+    }
 
-        // Create a structure for this captured packet
-        if (!(pkt = capture_packet_reasm_tcp(capinfo, pkt, tcp, payload, size_payload)))
-            return;
+    return pkt;
+}
 
+void
+capture_packet_dispatch(capture_info_t *capinfo, packet_t *pkt, struct tcphdr *tcp)
+{
 #if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
-        // Check if packet is TLS
-        if (capture_cfg.keyfile) {
-            tls_process_segment(pkt, tcp);
-        }
+    // Check if packet is TLS. Decrypted data is assembled as plain TCP
+    if (capture_cfg.keyfile) {
+        capture_tls_packet(capinfo, pkt, tcp);
+        return;
+    }
 #endif
 
+    capture_packet_process(capinfo, pkt, tcp);
+}
+
+void
+capture_packet_process(capture_info_t *capinfo, packet_t *pkt, struct tcphdr *tcp)
+{
+    // Captured packet addresses
+    address_t src, dst;
+    // Packet parse result
+    int parsed;
+
+    if (tcp) {
+        // Segments are required to reassemble this connection again
+        capture_index_keep(capinfo);
+
+        // Create a structure for this captured packet
+        if (!(pkt = capture_packet_reasm_tcp(capinfo, pkt, tcp,
+                                             packet_payload(pkt), packet_payloadlen(pkt))))
+            return;
+
         // Check if packet is WS or WSS
         capture_ws_check_packet(pkt);
-    } else {
-        // Not handled protocol
-        packet_destroy(pkt);
-        return;
     }
 
+    // Keep connection addresses, packet may be destroyed after parsing
+    src = pkt->src;
+    dst = pkt->dst;
+
     // Avoid parsing from multiples sources.
     // Avoid parsing while screen in being redrawn
     capture_lock();
-    // Check if we can handle this packet
-    if (capture_packet_parse(pkt) == 0) {
+    do {
+        // Check if we can handle this packet
+        parsed = capture_packet_parse(pkt);
+        // Packets of streams are not required if index stores stream summaries
+        if (parsed == 0 || (parsed == 2 && capture_index_keep_rtp(capinfo)))
+            capture_index_keep(capinfo);
+
+        if (parsed == 0) {
 #ifdef USE_EEP
-        // Send this packet through eep
-        capture_eep_send(pkt);
+            // Send this packet through eep
+            capture_eep_send(pkt);
 #endif
-        // Store this packets in output file
-        capture_dump_packet(pkt);;
-        // If storage is disabled, delete frames payload
-        if (capture_cfg.storage == 0) {
-            packet_free_frames(pkt);
+            // Store this packets in output file
+            capture_dump_packet(pkt);
+            // Keep packet data according to storage setting
+            capture_store_packet(pkt);
+        } else {
+            // Not an interesting packet ...
+            packet_destroy(pkt);
         }
-        // Allow Interface refresh and user input actions
-        capture_unlock();
-        return;
-    }
-
-    // Not an interesting packet ...
-    packet_destroy(pkt);
+        // Parse following SIP messages received in the same TCP segment
+    } while (tcp && (pkt = capture_packet_reasm_tcp_next(capinfo, src, dst)));
     // Allow Interface refresh and user input actions
     capture_unlock();
 }
 
 packet_t *
-capture_packet_reasm_ip(capture_info_t *capinfo, const struct pcap_pkthdr *header, u_char *packet, uint32_t *size, uint32_t *caplen)
+capture_packet_reasm_ip(capture_info_t *capinfo, const struct pcap_pkthdr *header, const u_char **packet,
+                        u_char *buffer, uint32_t *size, uint32_t *caplen)
 {
+    // Packet contents
+    const u_char *data = *packet;
     // IP header data
     struct ip *ip4;
 #ifdef USE_IPV6
@@ -504,6 +600,8 @@ capture_packet_reasm_ip(capture_info_t *capinfo, const struct pcap_pkthdr *heade
     uint32_t ip_id = 0;
     // Fragmentation offset
     uint16_t ip_frag_off = 0;
+    // Reassembly packet memory
+    size_t memsize;
     //! Source Address
     address_t src = { };
     //! Destination Address
@@ -523,7 +621,7 @@ capture_packet_reasm_ip(capture_info_t *capinfo, const struct pcap_pkthdr *heade
 
     // Skip VLAN header if present
     if (capinfo->link == DLT_EN10MB) {
-        struct ether_header *eth = (struct ether_header *) packet;
+        struct ether_header *eth = (struct ether_header *) data;
         if (ntohs(eth->ether_type) == ETHERTYPE_8021Q) {
             link_hl += 4;
         }
@@ -531,7 +629,7 @@ capture_packet_reasm_ip(capture_info_t *capinfo, const struct pcap_pkthdr *heade
 
 #ifdef SLL_HDR_LEN
     if (capinfo->link == DLT_LINUX_SLL) {
-        struct sll_header *sll = (struct sll_header *) packet;
+        struct sll_header *sll = (struct sll_header *) data;
         if (ntohs(sll->sll_protocol) == ETHERTYPE_8021Q) {
             link_hl += 4;
         }
@@ -542,7 +640,7 @@ capture_packet_reasm_ip(capture_info_t *capinfo, const struct pcap_pkthdr *heade
     if (capinfo->link == DLT_NFLOG) {
         // Parse NFLOG TLV headers
         while (link_hl + 8 <= *caplen) {
-            nflog_tlv_t *tlv = (nflog_tlv_t *) (packet + link_hl);
+            nflog_tlv_t *tlv = (nflog_tlv_t *) (data + link_hl);
 
             if (!tlv) break;
 
@@ -563,11 +661,11 @@ capture_packet_reasm_ip(capture_info_t *capinfo, const struct pcap_pkthdr *heade
 
     while (*size >= sizeof(struct ip)) {
         // Get IP header
-        ip4 = (struct ip *) (packet + link_hl);
+        ip4 = (struct ip *) (data + link_hl);
 
 #ifdef USE_IPV6
         // Get IPv6 header
-        ip6 = (struct ip6_hdr *) (packet + link_hl);
+        ip6 = (struct ip6_hdr *) (data + link_hl);
 #endif
 
         // Get IP version
@@ -589,13 +687,15 @@ capture_packet_reasm_ip(capture_info_t *capinfo, const struct pcap_pkthdr *heade
                 break;
 #ifdef USE_IPV6
             case 6:
+                if (link_hl + sizeof(struct ip6_hdr) + sizeof(struct ip6_frag) > header->caplen)
+                    return NULL;
                 ip_hl = sizeof(struct ip6_hdr);
                 ip_proto = ip6->ip6_nxt;
                 ip_len = ntohs(ip6->ip6_ctlun.ip6_un1.ip6_un1_plen) + ip_hl;
 
                 if (ip_proto == IPPROTO_FRAGMENT) {
                     ip_frag = 1;
-                    ip6f = (struct ip6_frag *) (packet + link_hl + ip_hl);
+                    ip6f = (struct ip6_frag *) (data + link_hl + ip_hl);
                     ip_frag_off = ntohs(ip6f->ip6f_offlg & IP6F_OFF_MASK);
                     ip_id = ntohl(ip6f->ip6f_ident);
                 }
@@ -629,6 +729,14 @@ capture_packet_reasm_ip(capture_info_t *capinfo, const struct pcap_pkthdr *heade
     if (*caplen > MAX_CAPTURE_LEN)
         return NULL;
 
+    // Frame has been truncated, only use captured data
+    if (*caplen > header->caplen) {
+        if (header->caplen < link_hl + ip_hl)
+            return NULL;
+        *caplen = header->caplen;
+        *size = *caplen - link_hl - ip_hl;
+    }
+
     // Check frame has at least IP header length
     if (ip_ver == 4 && header->caplen < link_hl + sizeof(struct ip))
         return NULL;
@@ -642,10 +750,17 @@ capture_packet_reasm_ip(capture_info_t *capinfo, const struct pcap_pkthdr *heade
     if (ip_frag == 0) {
         // Just create a new packet with given network data
         pkt = packet_create(ip_ver, ip_proto, src, dst, ip_id);
-        packet_add_frame(pkt, header, packet);
+        packet_add_frame(pkt, header, data);
         return pkt;
     }
 
+    // Sessions without reassembly data leave fragments to the capture thread
+    if (!capinfo->ip_reasm)
+        return NULL;
+
+    // Fragments are required to reassemble this packet again
+    capture_index_keep(capinfo);
+
     // Look for another packet with same id in IP reassembly vector
     it = vector_iterator(capinfo->ip_reasm);
     while ((pkt = vector_iterator_next(&it))) {
@@ -658,12 +773,15 @@ capture_packet_reasm_ip(capture_info_t *capinfo, const struct pcap_pkthdr *heade
 
     // If we already have this packet stored, append this frames to existing one
     if (pkt) {
-        packet_add_frame(pkt, header, packet);
+        memsize = packet_memsize(pkt, true);
+        packet_add_frame(pkt, header, data);
+        memstat_resize(MEMSTAT_REASM, memsize, packet_memsize(pkt, true));
     } else {
         // Add To the possible reassembly list
         pkt = packet_create(ip_ver, ip_proto, src, dst, ip_id);
-        packet_add_frame(pkt, header, packet);
+        packet_add_frame(pkt, header, data);
         vector_append(capinfo->ip_reasm, pkt);
+        memstat_alloc(MEMSTAT_REASM, packet_memsize(pkt, true));
     }
 
     // Add this IP content length to the total captured of the packet
@@ -717,7 +835,7 @@ capture_packet_reasm_ip(capture_info_t *capinfo, const struct pcap_pkthdr *heade
             return NULL;
 
         // Initialize memory for the assembly packet
-        memset(packet, 0, link_hl + ip_hl + len_data);
+        memset(buffer, 0, link_hl + ip_hl + len_data);
 
         it = vector_iterator(pkt->frames);
         while ((frame = vector_iterator_next(&it))) {
@@ -725,7 +843,7 @@ capture_packet_reasm_ip(capture_info_t *capinfo, const struct pcap_pkthdr *heade
                 case 4: {
                     // Get IP header
                     struct ip *frame_ip = (struct ip *) (frame->data + link_hl);
-                    memcpy(packet + link_hl + ip_hl + (ntohs(frame_ip->ip_off) & IP_OFFMASK) * 8,
+                    memcpy(buffer + link_hl + ip_hl + (ntohs(frame_ip->ip_off) & IP_OFFMASK) * 8,
                            frame->data + link_hl + frame_ip->ip_hl * 4,
                            ntohs(frame_ip->ip_len) - frame_ip->ip_hl * 4);
 
@@ -736,7 +854,7 @@ capture_packet_reasm_ip(capture_info_t *capinfo, const struct pcap_pkthdr *heade
                     struct ip6_hdr *frame_ip6 = (struct ip6_hdr*)(frame->data + link_hl);
                     struct ip6_frag *frame_ip6f = (struct ip6_frag *)(frame->data + link_hl + ip_hl);
                     uint16_t frame_ip_frag_off = ntohs(frame_ip6f->ip6f_offlg & IP6F_OFF_MASK);
-                    memcpy(packet + link_hl + ip_hl + sizeof(struct ip6_frag) + frame_ip_frag_off,
+                    memcpy(buffer + link_hl + ip_hl + sizeof(struct ip6_frag) + frame_ip_frag_off,
                             frame->data + link_hl + ip_hl + sizeof (struct ip6_frag),
                             ntohs(frame_ip6->ip6_ctlun.ip6_un1.ip6_un1_plen));
                     pkt->proto = frame_ip6f->ip6f_nxt;
@@ -758,7 +876,9 @@ capture_packet_reasm_ip(capture_info_t *capinfo, const struct pcap_pkthdr *heade
         *size = len_data;
 
         // Return the assembled IP packet
+        *packet = buffer;
         vector_remove(capinfo->ip_reasm, pkt);
+        memstat_free(MEMSTAT_REASM, packet_memsize(pkt, true));
         return pkt;
     }
 
@@ -770,6 +890,7 @@ capture_packet_reasm_tcp(capture_info_t *capinfo, packet_t *packet, struct tcphd
 
     vector_iter_t it = vector_iterator(capinfo->tcp_reasm);
     packet_t *pkt;
+    size_t memsize = 0;
     u_char *new_payload;
     u_char full_payload[MAX_CAPTURE_LEN + 1];
 
@@ -787,17 +908,17 @@ capture_packet_reasm_tcp(capture_info_t *capinfo, packet_t *packet, struct tcphd
     // If we already have this packet stored
     if (pkt) {
         frame_t *frame;
+        memsize = packet_memsize(pkt, true);
         // Append this frames to the original packet
         vector_iter_t frames = vector_iterator(packet->frames);
         while ((frame = vector_iterator_next(&frames)))
             packet_add_frame(pkt, frame->header, frame->data);
-        // Destroy current packet as its frames belong to the stored packet
-        packet_destroy(packet);
     } else {
         // First time this packet has been seen
         pkt = packet;
         // Add To the possible reassembly list
         vector_append(capinfo->tcp_reasm, packet);
+        memstat_alloc(MEMSTAT_REASM, 0);
     }
 
     // Store firt tcp sequence
@@ -812,8 +933,10 @@ capture_packet_reasm_tcp(capture_info_t *capinfo, packet_t *packet, struct tcphd
     } else {
         // Check payload length. Dont handle too big payload packets
         if (pkt->payload_len + size_payload > MAX_CAPTURE_LEN) {
-            packet_destroy(pkt);
+            memstat_free(MEMSTAT_REASM, memsize);
             vector_remove(capinfo->tcp_reasm, pkt);
+            packet_destroy(pkt);
+            packet_destroy(packet);
             return NULL;
         }
         new_payload = sng_malloc(pkt->payload_len + size_payload);
@@ -829,10 +952,19 @@ capture_packet_reasm_tcp(capture_info_t *capinfo, packet_t *packet, struct tcphd
         }
         packet_set_payload(pkt, new_payload, pkt->payload_len + size_payload);
         sng_free(new_payload);
+
+        // Destroy current packet as its frames belong to the stored packet
+        // (payload may point to its data, so this is done once appended)
+        packet_destroy(packet);
     }
 
+    // Update reassembly queue memory with current packet size
+    memstat_resize(MEMSTAT_REASM, memsize, packet_memsize(pkt, true));
+    memsize = packet_memsize(pkt, true);
+
     // Check if packet is too large after assembly
     if (pkt->payload_len > MAX_CAPTURE_LEN) {
+        memstat_free(MEMSTAT_REASM, memsize);
         vector_remove(capinfo->tcp_reasm, pkt);
         return NULL;
     }
@@ -846,9 +978,11 @@ capture_packet_reasm_tcp(capture_info_t *capinfo, packet_t *packet, struct tcphd
     int valid = sip_validate_packet(pkt);
     if (valid == VALIDATE_COMPLETE_SIP) {
         // Full SIP packet!
+        memstat_free(MEMSTAT_REASM, memsize);
         vector_remove(capinfo->tcp_reasm, pkt);
         return pkt;
     } else if (valid == VALIDATE_MULTIPLE_SIP) {
+        memstat_free(MEMSTAT_REASM, memsize);
         vector_remove(capinfo->tcp_reasm, pkt);
 
         // We have a full SIP Packet, but do not remove everything from the reasm queue
@@ -857,6 +991,7 @@ capture_packet_reasm_tcp(capture_info_t *capinfo, packet_t *packet, struct tcphd
         if (pldiff > 0 && pldiff < MAX_CAPTURE_LEN) {
             packet_set_payload(cont, full_payload + pkt->payload_len, pldiff);
             vector_append(capinfo->tcp_reasm, cont);
+            memstat_alloc(MEMSTAT_REASM, packet_memsize(cont, true));
         }
 
         // Return the full initial packet
@@ -864,6 +999,7 @@ capture_packet_reasm_tcp(capture_info_t *capinfo, packet_t *packet, struct tcphd
     } else if (valid == VALIDATE_NOT_SIP) {
         // Not a SIP packet, store until PSH flag
         if (tcp->th_flags & TH_PUSH) {
+            memstat_free(MEMSTAT_REASM, memsize);
             vector_remove(capinfo->tcp_reasm, pkt);
             return pkt;
         }
@@ -873,6 +1009,57 @@ capture_packet_reasm_tcp(capture_info_t *capinfo, packet_t *packet, struct tcphd
     return NULL;
 }
 
+packet_t *
+capture_packet_reasm_tcp_next(capture_info_t *capinfo, address_t src, address_t dst)
+{
+    vector_iter_t it = vector_iterator(capinfo->tcp_reasm);
+    packet_t *pkt, *cont;
+    size_t memsize;
+    u_char full_payload[MAX_CAPTURE_LEN + 1];
+    int original_size, pldiff;
+
+    while ((pkt = vector_iterator_next(&it))) {
+        if (addressport_equals(pkt->src, src) &&
+                addressport_equals(pkt->dst, dst)) {
+            break;
+        }
+    }
+
+    // Nothing pending for this connection
+    if (!pkt || pkt->payload_len == 0)
+        return NULL;
+
+    // Store full payload content
+    memsize = packet_memsize(pkt, true);
+    original_size = pkt->payload_len;
+    memcpy(full_payload, pkt->payload, pkt->payload_len);
+
+    switch (sip_validate_packet(pkt)) {
+        case VALIDATE_COMPLETE_SIP:
+            memstat_free(MEMSTAT_REASM, memsize);
+            vector_remove(capinfo->tcp_reasm, pkt);
+            return pkt;
+        case VALIDATE_MULTIPLE_SIP:
+            memstat_free(MEMSTAT_REASM, memsize);
+            vector_remove(capinfo->tcp_reasm, pkt);
+
+            // Keep following messages in the reasm queue
+            cont = packet_clone(pkt);
+            pldiff = original_size - pkt->payload_len;
+            if (pldiff > 0 && pldiff < MAX_CAPTURE_LEN) {
+                packet_set_payload(cont, full_payload + pkt->payload_len, pldiff);
+                vector_append(capinfo->tcp_reasm, cont);
+                memstat_alloc(MEMSTAT_REASM, packet_memsize(cont, true));
+            } else {
+                packet_destroy(cont);
+            }
+            return pkt;
+        default:
+            // Wait for more segments
+            return NULL;
+    }
+}
+
 int
 capture_ws_check_packet(packet_t *packet)
 {
@@ -999,12 +1186,17 @@ capture_packet_parse(packet_t *packet)
         if ((stream = rtp_check_packet(packet))) {
             // We have an RTP packet!
             packet_set_type(packet, PACKET_RTP);
-            // Store this pacekt if capture rtp is enabled
-            if (capture_cfg.rtp_capture) {
-                call_add_rtp_packet(stream_get_call(stream), packet);
+            // Store this pacekt if capture rtp is enabled (orphan streams have no call)
+            if (capture_cfg.rtp_capture && stream_get_call(stream)) {
+                call_add_rtp_packet(stream_get_call(stream), stream, packet);
                 return 0;
             }
+            return 2;
         }
+
+        // Flows of streams without SDP are tracked until they are discovered
+        if (rtp_orphans_enabled())
+            return 2;
     }
     return 1;
 }
@@ -1018,11 +1210,6 @@ capture_close()
     if (vector_count(capture_cfg.sources) == 0)
         return;
 
-    // Close dump file
-    if (capture_cfg.pd) {
-        dump_close(capture_cfg.pd);
-    }
-
     // Stop all captures
     vector_iter_t it = vector_iterator(capture_cfg.sources);
     while ((capinfo = vector_iterator_next(&it))) {
@@ -1042,19 +1229,102 @@ capture_close()
         }
     }
 
+#if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
+    // Packets queued to TLS workers may still be parsed and dumped
+    if (capture_cfg.keyfile)
+        capture_tls_flush();
+#endif
+
+    // Close dump file
+    dump_close(capture_cfg.pd);
+    capture_cfg.pd = NULL;
+
+    it = vector_iterator(capture_cfg.sources);
+    while ((capinfo = vector_iterator_next(&it))) {
+        // Release capture filter program
+        if (capinfo->fp.bf_insns)
+            pcap_freecode(&capinfo->fp);
+
+        // Unmap input file
+        capture_index_close(capinfo);
+        capture_mmap_close(capinfo->file);
+        capinfo->file = NULL;
+    }
+
+}
+
+/**
+ * @brief Get a text describing the options that change parsed data
+ *
+ * @return true if the whole text fits in given buffer
+ */
+static bool
+capture_parse_options(char *out, size_t len)
+{
+    capture_info_t *capinfo;
+    vector_iter_t it;
+    size_t pos;
+    const char *name;
+    int i;
+
+    pos = snprintf(out, len, "filter=%s\nrtp=%d\nrotate=%d\n",
+                   capture_cfg.filter ? capture_cfg.filter : "", capture_cfg.rtp_capture, capture_cfg.rotate);
+    if (pos < len)
+        pos += sip_get_parse_options(out + pos, len - pos);
+
+    for (i = 1; i < SETTING_COUNT && pos < len; i++) {
+        name = setting_name(i);
+        if (!name)
+            continue;
+        if (strncmp(name, "capture.", 8) == 0 || strncmp(name, "sip.", 4) == 0 || strncmp(name, "eep.", 4) == 0)
+            pos += snprintf(out + pos, len - pos, "%s=%s\n", name, setting_get_value(i));
+    }
+
+    // Records required by merged files depend on the other files
+    it = vector_iterator(capture_cfg.sources);
+    while ((capinfo = vector_iterator_next(&it)) && pos < len) {
+        // Live captured packets are not parsed in a fixed order
+        if (!capinfo->infile)
+            return false;
+        pos += snprintf(out + pos, len - pos, "input=%s\n", capinfo->infile);
+    }
+
+    return pos < len;
 }
 
 int
 capture_launch_thread()
 {
     capture_info_t *capinfo = NULL;
+    //! Options used to validate input file indexes
+    char options[CAPTURE_INDEX_OPTIONS];
+    //! Store stream summaries in input file indexes
+    bool streams;
     //! capture thread attributes
     pthread_attr_t attr;
     pthread_attr_init(&attr);
 
+    // Stream summaries replace RTP packets that are not stored nor discovered
+    streams = !capture_cfg.rtp_capture && !rtp_orphans_enabled()
+              && vector_count(capture_cfg.sources) == 1;
+
+    // Read only required records of already indexed input files
+    if (capture_parse_options(options, sizeof(options))) {
+        vector_iter_t it = vector_iterator(capture_cfg.sources);
+        while ((capinfo = vector_iterator_next(&it)))
+            capture_index_open(capinfo, options, streams);
+    }
+
+    // Read input files together in timestamp order
+    if (capture_merge_start(capture_cfg.sources) != 0)
+        return 1;
+
     // Start all captures threads
     vector_iter_t it = vector_iterator(capture_cfg.sources);
     while ((capinfo = vector_iterator_next(&it))) {
+        // Merged input files are already running
+        if (capinfo->running)
+            continue;
         // Mark capture as running
         capinfo->running = true;
         if (pthread_create(&capinfo->capture_t, &attr, (void *) capinfo->capture_fn, capinfo)) {
@@ -1070,9 +1340,36 @@ void *
 capture_thread(void *info)
 {
     capture_info_t *capinfo = (capture_info_t *) info;
+    struct pcap_pkthdr header;
+    const u_char *data;
+
+    if (capinfo->file) {
+        // Decode mapped file records in worker threads if requested
+        if (capture_mmap_parse(capinfo, setting_get_intvalue(SETTING_CAPTURE_PARSEWORKERS)) != 0) {
+            // Parse mapped file records
+            while (capture_mmap_next(capinfo->file, &header, &data) > 0) {
+                // Stop here if capture is being closed
+                pthread_testcancel();
+                // Apply capture filter, as libpcap would do
+                if (!capture_filter_match(capinfo, &header, data))
+                    continue;
+                parse_packet((u_char *) capinfo, &header, data);
+                capture_index_add(capinfo, data);
+            }
+        }
+        // Restore streams of indexed records or store them for next loads
+        capture_index_restore(capinfo);
+        capture_index_save(capinfo);
+    } else {
+        // Parse available packets
+        pcap_loop(capinfo->handle, -1, parse_packet, (u_char *) capinfo);
+    }
 
-    // Parse available packets
-    pcap_loop(capinfo->handle, -1, parse_packet, (u_char *) capinfo);
+#if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
+    // Wait until all decrypted packets have been parsed
+    if (capture_cfg.keyfile)
+        capture_tls_flush();
+#endif
     capinfo->running = false;
 
     return NULL;
@@ -1114,12 +1411,16 @@ capture_set_bpf_filter(const char *filter)
         if (!capinfo->ispcap)
             continue;
 
-        //! Check if filter compiles
-        if (pcap_compile(capinfo->handle, &capture_cfg.fp, filter, 0, capinfo->mask) == -1)
+        // Release the program of a previous filter
+        if (capinfo->fp.bf_insns)
+            pcap_freecode(&capinfo->fp);
+
+        //! Check if filter compiles for this source link type
+        if (pcap_compile(capinfo->handle, &capinfo->fp, filter, 0, capinfo->mask) == -1)
             return 1;
 
         // Set capture filter
-        if (pcap_setfilter(capinfo->handle, &capture_cfg.fp) == -1)
+        if (pcap_setfilter(capinfo->handle, &capinfo->fp) == -1)
             return 1;
 
     }
@@ -1130,6 +1431,15 @@ capture_set_bpf_filter(const char *filter)
     return 0;
 }
 
+bool
+capture_filter_match(capture_info_t *capinfo, const struct pcap_pkthdr *header, const u_char *packet)
+{
+    if (!capture_cfg.filter || !capinfo->fp.bf_insns)
+        return true;
+
+    return pcap_offline_filter(&capinfo->fp, header, packet) != 0;
+}
+
 const char *
 capture_get_bpf_filter()
 {
@@ -1149,6 +1459,12 @@ capture_paused()
     return capture_cfg.paused;
 }
 
+enum capture_storage
+capture_storage()
+{
+    return capture_cfg.storage;
+}
+
 const char *
 capture_status_desc()
 {
@@ -1263,6 +1579,20 @@ capture_sources_count()
     return vector_count(capture_cfg.sources);
 }
 
+bool
+capture_sources_same_link()
+{
+    capture_info_t *first = vector_first(capture_cfg.sources);
+    capture_info_t *capinfo;
+    vector_iter_t it = vector_iterator(capture_cfg.sources);
+
+    while ((capinfo = vector_iterator_next(&it))) {
+        if (capinfo->link != first->link)
+            return false;
+    }
+    return true;
+}
+
 char *
 capture_last_error()
 {
@@ -1322,13 +1652,28 @@ capture_set_dumper(pcap_dumper_t *dumper, ino_t dump_inode)
     capture_cfg.dump_inode = dump_inode;
 }
 
+void
+capture_store_packet(packet_t *packet)
+{
+    if (packet->type == PACKET_RTP) {
+        // RTP packets data has already been copied into its stream
+        packet_destroy(packet);
+    } else if (capture_cfg.storage == CAPTURE_STORAGE_NONE) {
+        // If storage is disabled, delete frames payload
+        packet_free_frames(packet);
+    } else if (capture_cfg.storage == CAPTURE_STORAGE_DISK) {
+        // Move packet data to spool segments
+        storage_store_packet(packet);
+    }
+}
+
 void
 capture_dump_packet(packet_t *packet)
 {
     if (sigusr1_received && capture_cfg.pd) {
         // we got a SIGUSR1: reopen the dump file because it could have been renamed
         // we don't need to care about locking or other threads accessing in parallel
-        // because dump_open ensures count(capture_cfg.sources) == 1
+        // because packets are always dumped while holding the capture lock
 
         // check if the file has actually changed
         // only reopen if it has, otherwise we would overwrite the existing one
@@ -1412,8 +1757,14 @@ pcap_dumper_t *
 dump_open(const char *dumpfile, ino_t* dump_inode)
 {
     capture_info_t *capinfo;
+    pcap_dumper_t *pd;
+    pcap_t *handle, *dead = NULL;
 
-    if (vector_count(capture_cfg.sources) == 1) {
+    // All sources must share the same link type to be written in one file
+    if (!capture_sources_same_link())
+        return NULL;
+
+    if (vector_count(capture_cfg.sources) > 0) {
         capture_cfg.dumpfilename = dumpfile;
         capinfo = vector_first(capture_cfg.sources);
 
@@ -1457,7 +1808,20 @@ dump_open(const char *dumpfile, ino_t* dump_inode)
 #endif
         }
 
-        return pcap_dump_fopen(capinfo->handle, fp);
+        // Several sources (i.e. HEP listeners) are written through a new handle
+        handle = capinfo->handle;
+        if (vector_count(capture_cfg.sources) > 1) {
+            if (!(handle = dead = pcap_open_dead(capinfo->link, MAXIMUM_SNAPLEN))) {
+                fclose(fp);
+                return NULL;
+            }
+        }
+
+        // Dumper only uses the handle to write the file header
+        pd = pcap_dump_fopen(handle, fp);
+        if (dead)
+            pcap_close(dead);
+        return pd;
     }
     return NULL;
 }
@@ -72,6 +72,8 @@
 #include <stdbool.h>
 #include "packet.h"
 #include "vector.h"
+#include "capture_mmap.h"
+#include "capture_index.h"
 
 //! Max allowed packet assembled size
 #define MAX_CAPTURE_LEN 20480
@@ -135,8 +137,6 @@ struct capture_config {
     address_t tlsserver;
     //! capture filter expression text
     const char *filter;
-    //! The compiled filter expression
-    struct bpf_program fp;
     //! libpcap dump file handler
     pcap_dumper_t *pd;
     //! libpcap dump file name
@@ -166,12 +166,18 @@ struct capture_info
     int8_t link_hl;
     //! libpcap capture handler
     pcap_t *handle;
+    //! Capture filter compiled for this source link type
+    struct bpf_program fp;
     //! Netmask of our sniffing device
     bpf_u_int32 mask;
     //! The IP of our sniffing device
     bpf_u_int32 net;
     //! Input file in Offline capture
     const char *infile;
+    //! Input file mapped in memory (NULL if read by libpcap)
+    capture_mmap_t *file;
+    //! Index of mapped input file (NULL if not indexed)
+    capture_index_t *index;
     //! Capture device in Online mode
     const char *device;
     //! Packets pending IP reassembly
@@ -235,6 +241,45 @@ capture_offline(const char *infile);
 void
 parse_packet(u_char *capinfo, const struct pcap_pkthdr *header, const u_char *packet);
 
+/**
+ * @brief Check if captured packets must be discarded
+ *
+ * Packets are discarded while capture is paused or when calls limit
+ * has been reached and rotation is disabled.
+ *
+ * @return true if packets must be discarded, false otherwise
+ */
+bool
+capture_packet_skip();
+
+/**
+ * @brief Get transport information and payload of a captured frame
+ *
+ * If the session has no IP reassembly vector, fragmented frames are
+ * not decoded. Without TCP or IP reassembly involved, this function
+ * can be called from any thread.
+ *
+ * @param capinfo Packet capture session information
+ * @param header Header received from libpcap callback
+ * @param packet Packet contents received from libpcap callback
+ * @param buffer Memory to write reassembled packet contents (MAX_CAPTURE_LEN)
+ * @param tcp Filled with TCP header of the packet or NULL for UDP packets
+ * @return a Packet structure with transport payload or NULL
+ */
+packet_t *
+capture_packet_decode(capture_info_t *capinfo, const struct pcap_pkthdr *header, const u_char *packet,
+                      u_char *buffer, struct tcphdr **tcp);
+
+/**
+ * @brief Hand a decoded packet to TLS decryption or parse stage
+ *
+ * @param capinfo Packet capture session information
+ * @param pkt Captured packet with transport payload
+ * @param tcp TCP header of the packet or NULL for UDP packets
+ */
+void
+capture_packet_dispatch(capture_info_t *capinfo, packet_t *pkt, struct tcphdr *tcp);
+
 /**
  * @brief Reassembly capture IP fragments
  *
@@ -254,7 +299,9 @@ parse_packet(u_char *capinfo, const struct pcap_pkthdr *header, const u_char *pa
  *
  * @param capinfo Packet capture session information
  * @para header Header received from libpcap callback
- * @para packet Packet contents received from libpcap callback
+ * @para packet Packet contents received from libpcap callback. When a packet is
+ *       reassembled, it will point to the buffer
+ * @param buffer Memory to write reassembled packet contents (MAX_CAPTURE_LEN)
  * @param size Packet size (not including Layer and Network headers)
  * @param caplen Full packet size (current fragment -> whole assembled packet)
  * @return a Packet structure when packet is not fragmented or fully reassembled
@@ -262,7 +309,7 @@ parse_packet(u_char *capinfo, const struct pcap_pkthdr *header, const u_char *pa
  */
 packet_t *
 capture_packet_reasm_ip(capture_info_t *capinfo, const struct pcap_pkthdr *header,
-                        u_char *packet, uint32_t *size, uint32_t *caplen);
+                        const u_char **packet, u_char *buffer, uint32_t *size, uint32_t *caplen);
 
 /**
  * @brief Reassembly capture TCP segments
@@ -284,6 +331,34 @@ packet_t *
 capture_packet_reasm_tcp(capture_info_t *capinfo, packet_t *packet, struct tcphdr *tcp,
                          u_char *payload, int size_payload);
 
+/**
+ * @brief Get next complete SIP message pending in TCP reassembly
+ *
+ * When assembled TCP data contains more than one SIP message, only the first
+ * one is returned by capture_packet_reasm_tcp and the rest is kept in the
+ * reassembly queue. This returns the next message if it is already complete.
+ *
+ * @param capinfo Packet capture session information
+ * @param src Connection source address
+ * @param dst Connection destination address
+ * @return a Packet structure with a complete SIP message or NULL
+ */
+packet_t *
+capture_packet_reasm_tcp_next(capture_info_t *capinfo, address_t src, address_t dst);
+
+/**
+ * @brief Assemble and parse a captured packet
+ *
+ * Last stage of packet capture: TCP segments are assembled, then all
+ * complete SIP messages are parsed and stored.
+ *
+ * @param capinfo Packet capture session information
+ * @param pkt Captured packet with transport payload
+ * @param tcp TCP header of the packet or NULL for UDP packets
+ */
+void
+capture_packet_process(capture_info_t *capinfo, packet_t *pkt, struct tcphdr *tcp);
+
 /**
  * @brief Check if given payload belongs to a Websocket connection
  *
@@ -303,6 +378,7 @@ capture_ws_check_packet(packet_t *packet);
  *
  * @return 0 in case this packets has SIP/RTP data
  * @return 1 otherwise
+ * @return 2 if packet may have updated RTP streams but has not been stored
  */
 int
 capture_packet_parse(packet_t *pkt);
@@ -349,6 +425,18 @@ capture_is_running();
 int
 capture_set_bpf_filter(const char *filter);
 
+/**
+ * @brief Check if a captured frame matches the capture filter
+ *
+ * Used for frames not read through libpcap, that applies the
+ * filter itself. Each source uses the filter compiled for its link type.
+ *
+ * @param capinfo Packet capture session information
+ * @return true if there is no filter or frame matches it
+ */
+bool
+capture_filter_match(capture_info_t *capinfo, const struct pcap_pkthdr *header, const u_char *packet);
+
 /**
  * @brief Get the configured BPF filter
  *
@@ -373,6 +461,17 @@ capture_set_paused(int pause);
 bool
 capture_paused();
 
+/**
+ * @brief Get the storage used for captured packets data
+ *
+ * This may differ from capture.storage setting if disk storage could
+ * not be initialized.
+ *
+ * @return effective packets storage
+ */
+enum capture_storage
+capture_storage();
+
 /**
  * @brief Get capture status value
  */
@@ -439,6 +538,16 @@ capture_add_source(struct capture_info *capinfo);
 int
 capture_sources_count();
 
+/**
+ * @brief Check if all capture sources share the same link type
+ *
+ * Packets of all sources can only be saved in the same file in that case.
+ *
+ * @return true if all sources have the same link type
+ */
+bool
+capture_sources_same_link();
+
 /**
  * @brief Return the last capture error
  */
@@ -475,6 +584,16 @@ capture_close();
 void
 capture_set_dumper(pcap_dumper_t *dumper, ino_t dump_inode);
 
+/**
+ * @brief Keep parsed packet data in configured storage
+ *
+ * Frames data is freed when storage is disabled and moved to spool
+ * segments when disk storage is enabled. RTP packets are destroyed, as
+ * their data is already kept in their stream store.
+ */
+void
+capture_store_packet(packet_t *packet);
+
 /**
  * @brief Store a packet in dumper file
  */
@@ -46,19 +46,215 @@
 #include <netdb.h>
 #include <unistd.h>
 #include <pcap.h>
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
 #include "capture_eep.h"
 #include "util.h"
 #include "setting.h"
 
 capture_eep_config_t eep_cfg = { 0 };
 
+//! Max size of fake headers built in front of received payloads
+#ifdef USE_IPV6
+#define CAPTURE_EEP_FRAME_HDRLEN \
+    (sizeof(struct ether_header) + sizeof(struct ip6_hdr) + sizeof(struct tcphdr))
+#else
+#define CAPTURE_EEP_FRAME_HDRLEN \
+    (sizeof(struct ether_header) + sizeof(struct ip) + sizeof(struct tcphdr))
+#endif
+
 void *
 accept_eep_client(void *info);
 
+#ifdef HAVE_SYS_EPOLL_H
+void *
+accept_eep_tcp_client(void *info);
+#endif
+
+/**
+ * @brief Create a new EEP server socket and its capture source
+ *
+ * @param ai Address to bind the socket
+ * @param proto Transport protocol (IPPROTO_UDP or IPPROTO_TCP)
+ * @param reuseport Allow other sockets to be bound to the same address
+ * @return 0 on success, 1 otherwise
+ */
+static int
+capture_eep_listener_create(struct addrinfo *ai, int proto, bool reuseport)
+{
+    capture_eep_listener_t *listener = &eep_cfg.listeners[eep_cfg.listeners_count];
+    capture_info_t *capinfo;
+    int on = 1;
+
+    // Create a socket for a new UDP or TCP connection
+    listener->proto = proto;
+    listener->sock = socket(ai->ai_family, (proto == IPPROTO_TCP) ? SOCK_STREAM : SOCK_DGRAM, 0);
+    if (listener->sock < 0) {
+        fprintf(stderr, "Error creating server socket: %s\n", strerror(errno));
+        return 1;
+    }
+    eep_cfg.listeners_count++;
+
+    // Allow binding while previous connections are in TIME_WAIT
+    if (proto == IPPROTO_TCP && setsockopt(listener->sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == -1) {
+        fprintf(stderr, "Error setting server socket options: %s\n", strerror(errno));
+        return 1;
+    }
+
+#ifdef SO_REUSEPORT
+    // Kernel will balance received datagrams (or connections) between all sockets
+    if (reuseport && setsockopt(listener->sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == -1) {
+        fprintf(stderr, "Error setting server socket options: %s\n", strerror(errno));
+        return 1;
+    }
+#endif
+
+    // Bind that socket to the requested address and port
+    if (bind(listener->sock, ai->ai_addr, ai->ai_addrlen) == -1) {
+        fprintf(stderr, "Error binding address: %s\n", strerror(errno));
+        return 1;
+    }
+
+    // Accept agent connections without blocking the receiving thread
+    if (proto == IPPROTO_TCP) {
+        if (listen(listener->sock, SOMAXCONN) == -1) {
+            fprintf(stderr, "Error listening on server socket: %s\n", strerror(errno));
+            return 1;
+        }
+        fcntl(listener->sock, F_SETFL, fcntl(listener->sock, F_GETFL) | O_NONBLOCK);
+    }
+
+    // Create a new structure to handle this capture source
+    if (!(capinfo = sng_malloc(sizeof(capture_info_t)))) {
+        fprintf(stderr, "Can't allocate memory for capture data!\n");
+        return 1;
+    }
+
+    // Set capture thread function
+    capinfo->capture_fn = accept_eep_client;
+#ifdef HAVE_SYS_EPOLL_H
+    if (proto == IPPROTO_TCP)
+        capinfo->capture_fn = accept_eep_tcp_client;
+#endif
+    capinfo->ispcap = false;
+
+    // Open capture device
+    capinfo->handle = pcap_open_dead(DLT_EN10MB, MAXIMUM_SNAPLEN);
+
+    // Get datalink to parse packets correctly
+    capinfo->link = pcap_datalink(capinfo->handle);
+
+    // Check linktypes sngrep knowns before start parsing packets
+    if ((capinfo->link_hl = datalink_size(capinfo->link)) == -1) {
+        fprintf(stderr, "Unable to handle linktype %d\n", capinfo->link);
+        sng_free(capinfo);
+        return 1;
+    }
+
+    // Create Vectors for IP and TCP reassembly
+    capinfo->tcp_reasm = vector_create(0, 10);
+    capinfo->ip_reasm = vector_create(0, 10);
+
+    // Add this capture information as packet source
+    capture_add_source(capinfo);
+    listener->capinfo = capinfo;
+
+    return 0;
+}
+
+/**
+ * @brief Send a batch of EEP packets through the client socket
+ *
+ * @return number of sent packets
+ */
+static int
+capture_eep_send_batch(capture_eep_msg_t *batch, int count)
+{
+    int sent = 0, i;
+#ifdef HAVE_SENDMMSG
+    struct mmsghdr msgs[CAPTURE_EEP_BATCH];
+    struct iovec iov[CAPTURE_EEP_BATCH];
+    int ret;
+
+    memset(msgs, 0, sizeof(msgs));
+    for (i = 0; i < count; i++) {
+        iov[i].iov_base = batch[i].data;
+        iov[i].iov_len = batch[i].len;
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    for (i = 0; i < count;) {
+        if ((ret = sendmmsg(eep_cfg.client_sock, msgs + i, count - i, 0)) > 0) {
+            sent += ret;
+            i += ret;
+        } else if (errno != EINTR) {
+            // Skip the packet that failed and continue with the rest
+            i++;
+        }
+    }
+#else
+    for (i = 0; i < count; i++) {
+        if (send(eep_cfg.client_sock, batch[i].data, batch[i].len, 0) != -1)
+            sent++;
+    }
+#endif
+    return sent;
+}
+
+/**
+ * @brief EEP client sending thread main loop
+ *
+ * Queued packets are taken in batches swapping buffers with the thread
+ * ones, so packets can be sent without holding the queue lock and all
+ * buffers are reused. Pending packets are sent before leaving.
+ */
+static void *
+capture_eep_sender_thread(void *data)
+{
+    capture_eep_sender_t *sender = (capture_eep_sender_t *) data;
+    capture_eep_msg_t batch[CAPTURE_EEP_BATCH], msg;
+    int count, sent, i;
+
+    memset(batch, 0, sizeof(batch));
+
+    pthread_mutex_lock(&sender->lock);
+    while (sender->running || sender->count > 0) {
+        if (sender->count == 0) {
+            pthread_cond_wait(&sender->cond, &sender->lock);
+            continue;
+        }
+
+        count = (sender->count < CAPTURE_EEP_BATCH) ? sender->count : CAPTURE_EEP_BATCH;
+        for (i = 0; i < count; i++) {
+            msg = batch[i];
+            batch[i] = sender->queue[sender->first];
+            sender->queue[sender->first] = msg;
+            sender->first = (sender->first + 1) % CAPTURE_EEP_SEND_QUEUE;
+        }
+        sender->count -= count;
+        pthread_mutex_unlock(&sender->lock);
+
+        sent = capture_eep_send_batch(batch, count);
+
+        pthread_mutex_lock(&sender->lock);
+        sender->stats.sent += sent;
+        sender->stats.errors += count - sent;
+    }
+    pthread_mutex_unlock(&sender->lock);
+
+    for (i = 0; i < CAPTURE_EEP_BATCH; i++)
+        free(batch[i].data);
+
+    return NULL;
+}
+
 int
 capture_eep_init()
 {
     struct addrinfo *ai, hints[1] = { { 0 } };
+    int workers, proto, i;
 
     // Setting for EEP client
     if (setting_enabled(SETTING_EEP_SEND)) {
@@ -92,6 +288,17 @@ capture_eep_init()
                 return 1;
             }
         }
+
+        // Start sending thread
+        pthread_mutex_init(&eep_cfg.sender.lock, NULL);
+        pthread_cond_init(&eep_cfg.sender.cond, NULL);
+        eep_cfg.sender.running = true;
+        if (pthread_create(&eep_cfg.sender.thread, NULL, capture_eep_sender_thread, &eep_cfg.sender) != 0) {
+            fprintf(stderr, "Sender thread creation failed\n");
+            close(eep_cfg.client_sock);
+            eep_cfg.client_sock = 0;
+            return 1;
+        }
     }
 
     if (setting_enabled(SETTING_EEP_LISTEN)) {
@@ -100,11 +307,27 @@ capture_eep_init()
         eep_cfg.capt_srv_host = setting_get_value(SETTING_EEP_LISTEN_ADDR);
         eep_cfg.capt_srv_port = setting_get_value(SETTING_EEP_LISTEN_PORT);
         eep_cfg.capt_srv_password = setting_get_value(SETTING_EEP_LISTEN_PASS);
+        proto = setting_has_value(SETTING_EEP_LISTEN_PROTO, "tcp") ? IPPROTO_TCP : IPPROTO_UDP;
+
+        if (proto == IPPROTO_TCP) {
+#ifdef HAVE_SYS_EPOLL_H
+            // Only HEPv3 has packet length required to split TCP stream
+            if (eep_cfg.capt_srv_version != 3) {
+                fprintf(stderr, "EEP server: TCP transport requires HEP version 3\n");
+                return 1;
+            }
+            eep_cfg.agents = vector_create(0, 10);
+            vector_set_destroyer(eep_cfg.agents, vector_generic_destroyer);
+#else
+            fprintf(stderr, "EEP server: TCP transport not supported in this platform\n");
+            return 1;
+#endif
+        }
 
         hints->ai_flags = AI_NUMERICSERV;
         hints->ai_family = AF_UNSPEC;
-        hints->ai_socktype = SOCK_DGRAM;
-        hints->ai_protocol = IPPROTO_UDP;
+        hints->ai_socktype = (proto == IPPROTO_TCP) ? SOCK_STREAM : SOCK_DGRAM;
+        hints->ai_protocol = proto;
 
         if (getaddrinfo(eep_cfg.capt_srv_host, eep_cfg.capt_srv_port, hints, &ai)) {
             fprintf(stderr, "EEP server: failed getaddrinfo() for %s:%s\n",
@@ -112,79 +335,328 @@ capture_eep_init()
             return 1;
         }
 
-        // Create a socket for a new TCP IPv4 connection
-        eep_cfg.server_sock = socket(AF_INET, SOCK_DGRAM, 0);
-        if (eep_cfg.client_sock < 0) {
-            fprintf(stderr, "Error creating server socket: %s\n", strerror(errno));
-            return 1;
+        // Number of sockets receiving in the same address
+        workers = setting_get_intvalue(SETTING_EEP_LISTEN_WORKERS);
+        if (workers < 1)
+            workers = 1;
+        if (workers > CAPTURE_EEP_LISTENERS)
+            workers = CAPTURE_EEP_LISTENERS;
+#ifndef SO_REUSEPORT
+        if (workers > 1) {
+            fprintf(stderr, "EEP server: multiple sockets not supported, using one.\n");
+            workers = 1;
         }
+#endif
 
-        // Bind that socket to the requested address and port
-        if (bind(eep_cfg.server_sock, ai->ai_addr, ai->ai_addrlen) == -1) {
-            fprintf(stderr, "Error binding address: %s\n", strerror(errno));
-            return 1;
+        for (i = 0; i < workers; i++) {
+            if (capture_eep_listener_create(ai, proto, workers > 1) != 0) {
+                freeaddrinfo(ai);
+                return 1;
+            }
         }
+        freeaddrinfo(ai);
+    }
 
-        capture_info_t *capinfo;
+    // Settings for EEP server
+    return 0;
+}
 
-        // Create a new structure to handle this capture source
-        if (!(capinfo = sng_malloc(sizeof(capture_info_t)))) {
-            fprintf(stderr, "Can't allocate memory for capture data!\n");
-            return 1;
+/**
+ * @brief Parse and store a batch of received packets
+ *
+ * Capture lock must be held while calling this function.
+ */
+static void
+capture_eep_parse_packets(packet_t **pkts, int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (capture_packet_parse(pkts[i]) == 0) {
+            // Store this packets in output file
+            capture_dump_packet(pkts[i]);
+            // Keep packet data according to storage setting
+            capture_store_packet(pkts[i]);
+        } else {
+            packet_destroy(pkts[i]);
         }
+    }
+}
 
-        // Set capture thread function
-        capinfo->capture_fn = accept_eep_client;
-        capinfo->ispcap = false;
+void *
+accept_eep_client(void *info)
+{
+    packet_t *pkts[CAPTURE_EEP_BATCH];
+    capture_info_t *capinfo = (capture_info_t *) info;
+    capture_eep_listener_t *listener = NULL;
+    capture_eep_ring_t *ring;
+    uint64_t bytes;
+    int count, i, n;
+
+    // Find the socket of this capture source
+    for (i = 0; i < eep_cfg.listeners_count; i++) {
+        if (eep_cfg.listeners[i].capinfo == capinfo)
+            listener = &eep_cfg.listeners[i];
+    }
 
-        // Open capture device
-        capinfo->handle = pcap_open_dead(DLT_EN10MB, MAXIMUM_SNAPLEN);
+    if (!listener || !(ring = capture_eep_ring_create())) {
+        capinfo->running = false;
+        pthread_exit(NULL);
+    }
 
-        // Get datalink to parse packets correctly
-        capinfo->link = pcap_datalink(capinfo->handle);
+    // Begin accepting connections
+    while (listener->sock > 0) {
+        if ((count = capture_eep_receive_batch(listener->sock, ring)) <= 0)
+            continue;
 
-        // Check linktypes sngrep knowns before start parsing packets
-        if ((capinfo->link_hl = datalink_size(capinfo->link)) == -1) {
-            fprintf(stderr, "Unable to handle linktype %d\n", capinfo->link);
-            return 3;
+        // Build packets from received datagrams before locking
+        for (i = 0, n = 0, bytes = 0; i < count; i++) {
+            bytes += ring->len[i];
+            if ((pkts[n] = capture_eep_receive(ring->data[i], ring->len[i])))
+                n++;
         }
 
-        // Create Vectors for IP and TCP reassembly
-        capinfo->tcp_reasm = vector_create(0, 10);
-        capinfo->ip_reasm = vector_create(0, 10);
-
-        // Add this capture information as packet source
-        capture_add_source(capinfo);
+        // Avoid parsing from multiples sources.
+        // Avoid parsing while screen in being redrawn
+        capture_lock();
+        listener->received += count;
+        listener->bytes += bytes;
+        listener->parsed += n;
+        listener->invalid += count - n;
+        capture_eep_parse_packets(pkts, n);
+        capture_unlock();
     }
 
-    // Settings for EEP server
+    capture_eep_ring_destroy(ring);
+
+    // Mark capture as not longer running
+    capinfo->running = false;
+
+    // Leave the thread gracefully
+    pthread_exit(NULL);
     return 0;
 }
 
+#ifdef HAVE_SYS_EPOLL_H
+/**
+ * @brief Accept a new agent connection
+ *
+ * Connection is registered in the epoll instance and linked to the agent
+ * with the same address, that is created on its first connection.
+ *
+ * @return new allocated connection or NULL on failure
+ */
+static capture_eep_conn_t *
+capture_eep_conn_create(int sock, int epfd)
+{
+    capture_eep_conn_t *conn;
+    capture_eep_agent_t *agent;
+    struct sockaddr_storage addr;
+    socklen_t addrlen = sizeof(addr);
+    struct epoll_event event = { 0 };
+    address_t agent_addr = { 0 };
+    vector_iter_t it;
+    int fd;
+
+    if ((fd = accept(sock, (struct sockaddr *) &addr, &addrlen)) == -1)
+        return NULL;
 
-void *
-accept_eep_client(void *info)
+    if (!(conn = sng_malloc(sizeof(capture_eep_conn_t)))
+        || !(conn->buffer = sng_malloc(CAPTURE_EEP_TCP_BUFFER))) {
+        sng_free(conn);
+        close(fd);
+        return NULL;
+    }
+    conn->sock = fd;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    event.events = EPOLLIN;
+    event.data.ptr = conn;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        sng_free(conn->buffer);
+        sng_free(conn);
+        close(fd);
+        return NULL;
+    }
+
+    if (addr.ss_family == AF_INET) {
+        inet_ntop(AF_INET, &((struct sockaddr_in *) &addr)->sin_addr, agent_addr.ip, sizeof(agent_addr.ip));
+#ifdef USE_IPV6
+    } else if (addr.ss_family == AF_INET6) {
+        inet_ntop(AF_INET6, &((struct sockaddr_in6 *) &addr)->sin6_addr, agent_addr.ip, sizeof(agent_addr.ip));
+#endif
+    }
+
+    // Agents list is shared with all listeners and the interface
+    capture_lock();
+    it = vector_iterator(eep_cfg.agents);
+    while ((agent = vector_iterator_next(&it))) {
+        if (address_equals(agent->addr, agent_addr))
+            break;
+    }
+    if (!agent && (agent = sng_malloc(sizeof(capture_eep_agent_t)))) {
+        agent->addr = agent_addr;
+        vector_append(eep_cfg.agents, agent);
+    }
+    if ((conn->agent = agent))
+        agent->connections++;
+    capture_unlock();
+
+    return conn;
+}
+
+/**
+ * @brief Close an agent connection
+ */
+static void
+capture_eep_conn_destroy(capture_eep_conn_t *conn)
 {
-    packet_t *pkt;
-    capture_info_t *capinfo = (capture_info_t *) info;
+    capture_lock();
+    if (conn->agent)
+        conn->agent->connections--;
+    capture_unlock();
+
+    // Closing the socket also removes it from epoll instance
+    close(conn->sock);
+    sng_free(conn->buffer);
+    sng_free(conn);
+}
 
-    // Begin accepting connections
-    while (eep_cfg.server_sock > 0) {
-        if ((pkt = capture_eep_receive())) {
-            // Avoid parsing from multiples sources.
-            // Avoid parsing while screen in being redrawn
-            capture_lock();
-            if (capture_packet_parse(pkt) != 0) {
-                packet_destroy(pkt);
+/**
+ * @brief Read available data from an agent connection
+ *
+ * Received data is appended to the connection stream buffer and split
+ * into HEPv3 packets using their length field. When the stream does not
+ * start with a HEPv3 header, data is skipped until the next one.
+ *
+ * @return 0 if connection is still open, 1 otherwise
+ */
+static int
+capture_eep_conn_read(capture_eep_listener_t *listener, capture_eep_conn_t *conn)
+{
+    packet_t *pkts[CAPTURE_EEP_BATCH];
+    uint64_t frames = 0, parsed = 0, errors = 0;
+    uint32_t pos = 0, total_len;
+    hep_ctrl_t ctrl;
+    ssize_t bytes;
+    int n = 0;
+
+    bytes = recv(conn->sock, conn->buffer + conn->len, CAPTURE_EEP_TCP_BUFFER - conn->len, 0);
+    if (bytes == 0 || (bytes == -1 && errno != EAGAIN && errno != EINTR))
+        return 1;
+    if (bytes == -1)
+        return 0;
+    conn->len += bytes;
+
+    while (conn->len - pos >= sizeof(hep_ctrl_t)) {
+        memcpy(&ctrl, conn->buffer + pos, sizeof(hep_ctrl_t));
+        total_len = ntohs(ctrl.length);
+
+        // Lost packet boundaries, look for next packet header
+        if (memcmp(ctrl.id, "HEP3", 4) != 0 || total_len < sizeof(hep_ctrl_t)) {
+            errors++;
+            for (pos++; conn->len - pos >= 4; pos++) {
+                if (memcmp(conn->buffer + pos, "HEP3", 4) == 0)
+                    break;
             }
+            continue;
+        }
 
-            // Store this packets in output file
-            capture_dump_packet(pkt);
+        // Wait for the rest of the packet
+        if (conn->len - pos < total_len)
+            break;
+
+        frames++;
+        if ((pkts[n] = capture_eep_receive_v3(conn->buffer + pos, total_len)))
+            n++;
+        pos += total_len;
 
+        // Parse a batch of packets
+        if (n == CAPTURE_EEP_BATCH) {
+            capture_lock();
+            listener->parsed += n;
+            capture_eep_parse_packets(pkts, n);
             capture_unlock();
+            parsed += n;
+            n = 0;
+        }
+    }
+
+    // Keep the incomplete packet at the start of the buffer
+    memmove(conn->buffer, conn->buffer + pos, conn->len - pos);
+    conn->len -= pos;
+
+    // Avoid parsing from multiples sources.
+    // Avoid parsing while screen in being redrawn
+    capture_lock();
+    listener->received += frames;
+    listener->bytes += bytes;
+    listener->parsed += n;
+    listener->invalid += frames - parsed - n;
+    if (conn->agent) {
+        conn->agent->packets += frames;
+        conn->agent->bytes += bytes;
+        conn->agent->errors += errors;
+    }
+    capture_eep_parse_packets(pkts, n);
+    capture_unlock();
+
+    return 0;
+}
+
+void *
+accept_eep_tcp_client(void *info)
+{
+    capture_info_t *capinfo = (capture_info_t *) info;
+    capture_eep_listener_t *listener = NULL;
+    capture_eep_conn_t *conn;
+    struct epoll_event event = { 0 }, events[CAPTURE_EEP_BATCH];
+    vector_t *conns;
+    int epfd, count, i;
+
+    // Find the socket of this capture source
+    for (i = 0; i < eep_cfg.listeners_count; i++) {
+        if (eep_cfg.listeners[i].capinfo == capinfo)
+            listener = &eep_cfg.listeners[i];
+    }
+
+    if (!listener || (epfd = epoll_create1(0)) == -1) {
+        capinfo->running = false;
+        pthread_exit(NULL);
+    }
+
+    // Listening socket is registered without connection data
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, listener->sock, &event);
+    conns = vector_create(0, 10);
+
+    // Begin accepting connections
+    while (listener->sock > 0) {
+        // Wake up from time to time to check the listener is still open
+        if ((count = epoll_wait(epfd, events, CAPTURE_EEP_BATCH, 1000)) <= 0)
+            continue;
+
+        for (i = 0; i < count; i++) {
+            if (!(conn = events[i].data.ptr)) {
+                // Accept all pending connections
+                while ((conn = capture_eep_conn_create(listener->sock, epfd)))
+                    vector_append(conns, conn);
+            } else if (capture_eep_conn_read(listener, conn) != 0) {
+                vector_remove(conns, conn);
+                capture_eep_conn_destroy(conn);
+            }
         }
     }
 
+    // Close all agent connections
+    while ((conn = vector_first(conns))) {
+        vector_remove(conns, conn);
+        capture_eep_conn_destroy(conn);
+    }
+    vector_destroy(conns);
+    close(epfd);
+
     // Mark capture as not longer running
     capinfo->running = false;
 
@@ -192,17 +664,141 @@ accept_eep_client(void *info)
     pthread_exit(NULL);
     return 0;
 }
+#endif
 
 void
 capture_eep_deinit()
 {
-    if (eep_cfg.client_sock)
+    int i;
+
+    if (eep_cfg.client_sock) {
+        // Stop sending thread once all queued packets are sent
+        pthread_mutex_lock(&eep_cfg.sender.lock);
+        eep_cfg.sender.running = false;
+        pthread_cond_signal(&eep_cfg.sender.cond);
+        pthread_mutex_unlock(&eep_cfg.sender.lock);
+        pthread_join(eep_cfg.sender.thread, NULL);
+
+        for (i = 0; i < CAPTURE_EEP_SEND_QUEUE; i++)
+            free(eep_cfg.sender.queue[i].data);
+        pthread_mutex_destroy(&eep_cfg.sender.lock);
+        pthread_cond_destroy(&eep_cfg.sender.cond);
+
         close(eep_cfg.client_sock);
+        eep_cfg.client_sock = 0;
+    }
 
-    if (eep_cfg.server_sock) {
-        close(eep_cfg.server_sock);
-        eep_cfg.server_sock = -1;
+    for (i = 0; i < eep_cfg.listeners_count; i++) {
+        if (eep_cfg.listeners[i].sock > 0) {
+            close(eep_cfg.listeners[i].sock);
+            eep_cfg.listeners[i].sock = -1;
+        }
     }
+
+    vector_destroy(eep_cfg.agents);
+    eep_cfg.agents = NULL;
+}
+
+capture_eep_send_stats_t
+capture_eep_send_stats()
+{
+    capture_eep_send_stats_t stats = { 0 };
+
+    // EEP client not running
+    if (!eep_cfg.client_sock)
+        return stats;
+
+    pthread_mutex_lock(&eep_cfg.sender.lock);
+    stats = eep_cfg.sender.stats;
+    pthread_mutex_unlock(&eep_cfg.sender.lock);
+    return stats;
+}
+
+int
+capture_eep_listener_count()
+{
+    return eep_cfg.listeners_count;
+}
+
+capture_eep_listener_t
+capture_eep_listener_stats(int idx)
+{
+    capture_eep_listener_t listener = { 0 };
+
+    if (idx >= 0 && idx < eep_cfg.listeners_count)
+        listener = eep_cfg.listeners[idx];
+    return listener;
+}
+
+int
+capture_eep_agent_count()
+{
+    return vector_count(eep_cfg.agents);
+}
+
+capture_eep_agent_t
+capture_eep_agent_stats(int idx)
+{
+    capture_eep_agent_t agent = { 0 }, *item;
+
+    if ((item = vector_item(eep_cfg.agents, idx)))
+        agent = *item;
+    return agent;
+}
+
+capture_eep_ring_t *
+capture_eep_ring_create()
+{
+    capture_eep_ring_t *ring;
+#ifdef HAVE_RECVMMSG
+    int i;
+#endif
+
+    // Too big for sng_malloc
+    if (!(ring = calloc(1, sizeof(capture_eep_ring_t))))
+        return NULL;
+
+#ifdef HAVE_RECVMMSG
+    for (i = 0; i < CAPTURE_EEP_BATCH; i++) {
+        ring->iov[i].iov_base = ring->data[i];
+        ring->iov[i].iov_len = MAX_CAPTURE_LEN;
+        ring->msgs[i].msg_hdr.msg_iov = &ring->iov[i];
+        ring->msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+#endif
+
+    return ring;
+}
+
+void
+capture_eep_ring_destroy(capture_eep_ring_t *ring)
+{
+    free(ring);
+}
+
+int
+capture_eep_receive_batch(int sock, capture_eep_ring_t *ring)
+{
+#ifdef HAVE_RECVMMSG
+    int count, i;
+
+    // Wait for the first datagram, then take whatever is already queued
+    if ((count = recvmmsg(sock, ring->msgs, CAPTURE_EEP_BATCH, MSG_WAITFORONE, NULL)) <= 0)
+        return -1;
+
+    for (i = 0; i < count; i++) {
+        ring->len[i] = ring->msgs[i].msg_len;
+    }
+    return count;
+#else
+    ssize_t len;
+
+    if ((len = recvfrom(sock, ring->data[0], MAX_CAPTURE_LEN, 0, NULL, NULL)) <= 0)
+        return -1;
+
+    ring->len[0] = len;
+    return 1;
+#endif
 }
 
 const char *
@@ -220,6 +816,10 @@ capture_eep_listen_port()
 int
 capture_eep_send(packet_t *pkt)
 {
+    capture_eep_sender_t *sender = &eep_cfg.sender;
+    capture_eep_msg_t *msg;
+    int cancelstate, ret;
+
     // Dont send RTP packets
     if (pkt->type == PACKET_RTP)
         return 1;
@@ -228,27 +828,59 @@ capture_eep_send(packet_t *pkt)
     if (!eep_cfg.client_sock)
         return 1;
 
-    switch (eep_cfg.capt_version) {
-        case 2:
-            return capture_eep_send_v2(pkt);
-        case 3:
-            return capture_eep_send_v3(pkt);
+    // Don't leave queue lock held if capture thread is cancelled
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancelstate);
+    pthread_mutex_lock(&sender->lock);
+
+    // Queue is full, discard oldest packet
+    if (sender->count == CAPTURE_EEP_SEND_QUEUE) {
+        sender->first = (sender->first + 1) % CAPTURE_EEP_SEND_QUEUE;
+        sender->count--;
+        sender->stats.dropped++;
     }
-    return 1;
+
+    // Encapsulate the packet in the next free buffer
+    msg = &sender->queue[(sender->first + sender->count) % CAPTURE_EEP_SEND_QUEUE];
+    if (eep_cfg.capt_version == 2)
+        ret = capture_eep_send_v2(pkt, msg);
+    else
+        ret = capture_eep_send_v3(pkt, msg);
+
+    if (ret == 0) {
+        sender->count++;
+        sender->stats.queued++;
+        pthread_cond_signal(&sender->cond);
+    }
+
+    pthread_mutex_unlock(&sender->lock);
+    pthread_setcancelstate(cancelstate, NULL);
+    return ret;
 }
 
+/**
+ * @brief Build a full frame in front of a received payload
+ *
+ * HEP packets only contain the addresses and transport of the original
+ * packet, so Ethernet, IP and UDP (or TCP) headers are built from them
+ * with dummy MAC addresses, allowing received packets to be saved as a
+ * regular Ethernet capture.
+ *
+ * @return pcap header of the built frame
+ */
 struct pcap_pkthdr
 capture_eep_build_frame_data(
         const struct pcap_pkthdr header,
         const unsigned char *payload,
         const uint32_t payload_size,
+        const uint8_t family,
+        const uint8_t proto,
         const address_t src,
         const address_t dst,
-        unsigned char **frame_payload
+        unsigned char *frame_payload
 ) {
     //! Frame variables
     struct pcap_pkthdr frame_pcap_header;
-    uint32_t frame_size = 0;
+    uint32_t frame_size = 0, transport_size;
 
     // Build frame ethernet header
     struct ether_header ether_hdr = {
@@ -257,17 +889,6 @@ capture_eep_build_frame_data(
         .ether_type = htons(ETHERTYPE_IP),
     };
 
-    // Build frame IP header
-    struct ip ip_hdr = {
-        .ip_v = 4,
-        .ip_p = IPPROTO_UDP,
-        .ip_hl = sizeof(ip_hdr) / 4,
-        .ip_len = htons(sizeof(ip_hdr) + sizeof(struct udphdr) + payload_size),
-        .ip_ttl = 128,
-    };
-    inet_pton(AF_INET, src.ip, &ip_hdr.ip_src);
-    inet_pton(AF_INET, dst.ip, &ip_hdr.ip_dst);
-
     // Build frame UDP header
     struct udphdr udp_hdr = {
         .uh_sport = htons(src.port),
@@ -275,19 +896,66 @@ capture_eep_build_frame_data(
         .uh_ulen = htons(sizeof(struct udphdr) + payload_size),
     };
 
-    // Allocate memory for payload contents
-    if (!(*frame_payload = sng_malloc(sizeof(ether_hdr) + sizeof(ip_hdr) + sizeof(udp_hdr) + payload_size))) {
-        return frame_pcap_header;
+    // Build frame TCP header, sequence increases with each sent payload
+    struct tcphdr tcp_hdr = {
+        .th_sport = htons(src.port),
+        .th_dport = htons(dst.port),
+        .th_off = sizeof(struct tcphdr) / 4,
+        .th_flags = TH_PUSH | TH_ACK,
+        .th_win = htons(65535),
+    };
+    if (proto == IPPROTO_TCP) {
+        tcp_hdr.th_seq = htonl(__sync_fetch_and_add(&eep_cfg.frame_seq, payload_size));
+        transport_size = sizeof(struct tcphdr);
+    } else {
+        transport_size = sizeof(struct udphdr);
     }
 
-    // Append all headers to frame contents
-    memcpy(*frame_payload + frame_size, (void*) &ether_hdr, sizeof(ether_hdr));
-    frame_size += sizeof(ether_hdr);
-    memcpy(*frame_payload + frame_size, (void*) &ip_hdr, sizeof(ip_hdr));
-    frame_size += sizeof(ip_hdr);
-    memcpy(*frame_payload + frame_size, (void*) &udp_hdr, sizeof(udp_hdr));
-    frame_size += sizeof(udp_hdr);
-    memcpy(*frame_payload + frame_size, (void*) payload, payload_size);
+#ifdef USE_IPV6
+    if (family == AF_INET6) {
+        // Build frame IPv6 header
+        struct ip6_hdr ip6_hdr = {
+            .ip6_flow = htonl(6 << 28),
+            .ip6_plen = htons(transport_size + payload_size),
+            .ip6_nxt = (proto == IPPROTO_TCP) ? IPPROTO_TCP : IPPROTO_UDP,
+            .ip6_hlim = 128,
+        };
+        inet_pton(AF_INET6, src.ip, &ip6_hdr.ip6_src);
+        inet_pton(AF_INET6, dst.ip, &ip6_hdr.ip6_dst);
+
+        ether_hdr.ether_type = htons(ETHERTYPE_IPV6);
+        memcpy(frame_payload + frame_size, (void*) &ether_hdr, sizeof(ether_hdr));
+        frame_size += sizeof(ether_hdr);
+        memcpy(frame_payload + frame_size, (void*) &ip6_hdr, sizeof(ip6_hdr));
+        frame_size += sizeof(ip6_hdr);
+    } else
+#endif
+    {
+        // Build frame IP header
+        struct ip ip_hdr = {
+            .ip_v = 4,
+            .ip_p = (proto == IPPROTO_TCP) ? IPPROTO_TCP : IPPROTO_UDP,
+            .ip_hl = sizeof(ip_hdr) / 4,
+            .ip_len = htons(sizeof(ip_hdr) + transport_size + payload_size),
+            .ip_ttl = 128,
+        };
+        inet_pton(AF_INET, src.ip, &ip_hdr.ip_src);
+        inet_pton(AF_INET, dst.ip, &ip_hdr.ip_dst);
+
+        memcpy(frame_payload + frame_size, (void*) &ether_hdr, sizeof(ether_hdr));
+        frame_size += sizeof(ether_hdr);
+        memcpy(frame_payload + frame_size, (void*) &ip_hdr, sizeof(ip_hdr));
+        frame_size += sizeof(ip_hdr);
+    }
+
+    // Append transport header and payload to frame contents
+    if (proto == IPPROTO_TCP) {
+        memcpy(frame_payload + frame_size, (void*) &tcp_hdr, sizeof(tcp_hdr));
+    } else {
+        memcpy(frame_payload + frame_size, (void*) &udp_hdr, sizeof(udp_hdr));
+    }
+    frame_size += transport_size;
+    memcpy(frame_payload + frame_size, (void*) payload, payload_size);
     frame_size += payload_size;
 
     // Build a custom frame pcap header
@@ -298,8 +966,28 @@ capture_eep_build_frame_data(
     return frame_pcap_header;
 }
 
+/**
+ * @brief Make room for an EEP packet in a reusable buffer
+ *
+ * @return 0 on success, 1 otherwise
+ */
+static int
+capture_eep_msg_reserve(capture_eep_msg_t *msg, uint32_t size)
+{
+    u_char *data;
+
+    if (msg->size >= size)
+        return 0;
+
+    if (!(data = realloc(msg->data, size)))
+        return 1;
+    msg->data = data;
+    msg->size = size;
+    return 0;
+}
+
 int
-capture_eep_send_v2(packet_t *pkt)
+capture_eep_send_v2(packet_t *pkt, capture_eep_msg_t *msg)
 {
     void* buffer;
     uint32_t buflen = 0, tlen = 0;
@@ -313,6 +1001,9 @@ capture_eep_send_v2(packet_t *pkt)
     uint32_t len = packet_payloadlen(pkt);
     frame_t *frame = vector_first(pkt->frames);
 
+    memset(&hdr, 0, sizeof(struct hep_hdr));
+    memset(&hep_time, 0, sizeof(struct hep_timehdr));
+
     /* Version && proto */
     hdr.hp_v = 2;
     hdr.hp_f = pkt->ip_version == 4 ? AF_INET : AF_INET6;
@@ -350,9 +1041,10 @@ capture_eep_send_v2(packet_t *pkt)
     tlen += len;
     hdr.hp_l = htons(tlen);
 
-    // Allocate memory for HEPv2 packet
-    if (!(buffer = sng_malloc(tlen)))
+    // Make room for HEPv2 packet
+    if (capture_eep_msg_reserve(msg, tlen) != 0)
         return 1;
+    buffer = msg->data;
 
     // Copy basic headers
     buflen = 0;
@@ -379,20 +1071,14 @@ capture_eep_send_v2(packet_t *pkt)
     memcpy((void*) buffer + buflen, data, len);
     buflen += len;
 
-    if (send(eep_cfg.client_sock, buffer, buflen, 0) == -1) {
-        return 1;
-    }
-
-    /* FREE */
-    sng_free(buffer);
-
-    return 1;
+    msg->len = buflen;
+    return 0;
 }
 
 int
-capture_eep_send_v3(packet_t *pkt)
+capture_eep_send_v3(packet_t *pkt, capture_eep_msg_t *msg)
 {
-    struct hep_generic *hg = NULL;
+    struct hep_generic hg;
     void* buffer;
     uint32_t buflen = 0, iplen = 0, tlen = 0;
     hep_chunk_ip4_t src_ip4, dst_ip4;
@@ -405,23 +1091,22 @@ capture_eep_send_v3(packet_t *pkt)
     unsigned char *data = packet_payload(pkt);
     uint32_t len = packet_payloadlen(pkt);
 
-    if (!(hg = sng_malloc(sizeof(struct hep_generic))))
-        return 1;
+    memset(&hg, 0, sizeof(struct hep_generic));
 
     /* header set "HEP3" */
-    memcpy(hg->header.id, "\x48\x45\x50\x33", 4);
+    memcpy(hg.header.id, "\x48\x45\x50\x33", 4);
 
     /* IP proto */
-    hg->ip_family.chunk.vendor_id = htons(0x0000);
-    hg->ip_family.chunk.type_id = htons(0x0001);
-    hg->ip_family.data = pkt->ip_version == 4 ? AF_INET : AF_INET6;
-    hg->ip_family.chunk.length = htons(sizeof(hg->ip_family));
+    hg.ip_family.chunk.vendor_id = htons(0x0000);
+    hg.ip_family.chunk.type_id = htons(0x0001);
+    hg.ip_family.data = pkt->ip_version == 4 ? AF_INET : AF_INET6;
+    hg.ip_family.chunk.length = htons(sizeof(hg.ip_family));
 
     /* Proto ID */
-    hg->ip_proto.chunk.vendor_id = htons(0x0000);
-    hg->ip_proto.chunk.type_id = htons(0x0002);
-    hg->ip_proto.data = pkt->proto;
-    hg->ip_proto.chunk.length = htons(sizeof(hg->ip_proto));
+    hg.ip_proto.chunk.vendor_id = htons(0x0000);
+    hg.ip_proto.chunk.type_id = htons(0x0002);
+    hg.ip_proto.data = pkt->proto;
+    hg.ip_proto.chunk.length = htons(sizeof(hg.ip_proto));
 
     /* IPv4 */
     if (pkt->ip_version == 4) {
@@ -460,40 +1145,40 @@ capture_eep_send_v3(packet_t *pkt)
 #endif
 
     /* SRC PORT */
-    hg->src_port.chunk.vendor_id = htons(0x0000);
-    hg->src_port.chunk.type_id = htons(0x0007);
-    hg->src_port.data = htons(pkt->src.port);
-    hg->src_port.chunk.length = htons(sizeof(hg->src_port));
+    hg.src_port.chunk.vendor_id = htons(0x0000);
+    hg.src_port.chunk.type_id = htons(0x0007);
+    hg.src_port.data = htons(pkt->src.port);
+    hg.src_port.chunk.length = htons(sizeof(hg.src_port));
 
     /* DST PORT */
-    hg->dst_port.chunk.vendor_id = htons(0x0000);
-    hg->dst_port.chunk.type_id = htons(0x0008);
-    hg->dst_port.data = htons(pkt->dst.port);
-    hg->dst_port.chunk.length = htons(sizeof(hg->dst_port));
+    hg.dst_port.chunk.vendor_id = htons(0x0000);
+    hg.dst_port.chunk.type_id = htons(0x0008);
+    hg.dst_port.data = htons(pkt->dst.port);
+    hg.dst_port.chunk.length = htons(sizeof(hg.dst_port));
 
     /* TIMESTAMP SEC */
-    hg->time_sec.chunk.vendor_id = htons(0x0000);
-    hg->time_sec.chunk.type_id = htons(0x0009);
-    hg->time_sec.data = htonl(frame->header->ts.tv_sec);
-    hg->time_sec.chunk.length = htons(sizeof(hg->time_sec));
+    hg.time_sec.chunk.vendor_id = htons(0x0000);
+    hg.time_sec.chunk.type_id = htons(0x0009);
+    hg.time_sec.data = htonl(frame->header->ts.tv_sec);
+    hg.time_sec.chunk.length = htons(sizeof(hg.time_sec));
 
     /* TIMESTAMP USEC */
-    hg->time_usec.chunk.vendor_id = htons(0x0000);
-    hg->time_usec.chunk.type_id = htons(0x000a);
-    hg->time_usec.data = htonl(frame->header->ts.tv_usec);
-    hg->time_usec.chunk.length = htons(sizeof(hg->time_usec));
+    hg.time_usec.chunk.vendor_id = htons(0x0000);
+    hg.time_usec.chunk.type_id = htons(0x000a);
+    hg.time_usec.data = htonl(frame->header->ts.tv_usec);
+    hg.time_usec.chunk.length = htons(sizeof(hg.time_usec));
 
     /* Protocol TYPE */
-    hg->proto_t.chunk.vendor_id = htons(0x0000);
-    hg->proto_t.chunk.type_id = htons(0x000b);
-    hg->proto_t.data = 1;
-    hg->proto_t.chunk.length = htons(sizeof(hg->proto_t));
+    hg.proto_t.chunk.vendor_id = htons(0x0000);
+    hg.proto_t.chunk.type_id = htons(0x000b);
+    hg.proto_t.data = 1;
+    hg.proto_t.chunk.length = htons(sizeof(hg.proto_t));
 
     /* Capture ID */
-    hg->capt_id.chunk.vendor_id = htons(0x0000);
-    hg->capt_id.chunk.type_id = htons(0x000c);
-    hg->capt_id.data = htons(eep_cfg.capt_id);
-    hg->capt_id.chunk.length = htons(sizeof(hg->capt_id));
+    hg.capt_id.chunk.vendor_id = htons(0x0000);
+    hg.capt_id.chunk.type_id = htons(0x000c);
+    hg.capt_id.data = htons(eep_cfg.capt_id);
+    hg.capt_id.chunk.length = htons(sizeof(hg.capt_id));
 
     /* Payload */
     payload_chunk.vendor_id = htons(0x0000);
@@ -514,13 +1199,12 @@ capture_eep_send_v3(packet_t *pkt)
     }
 
     /* total */
-    hg->header.length = htons(tlen);
+    hg.header.length = htons(tlen);
 
-    if (!(buffer = sng_malloc(tlen))) {
-        sng_free(hg);
+    if (capture_eep_msg_reserve(msg, tlen) != 0)
         return 1;
-    }
-    memcpy((void*) buffer, hg, sizeof(struct hep_generic));
+    buffer = msg->data;
+    memcpy((void*) buffer, &hg, sizeof(struct hep_generic));
     buflen = sizeof(struct hep_generic);
 
     /* IPv4 */
@@ -564,35 +1248,28 @@ capture_eep_send_v3(packet_t *pkt)
     memcpy((void*) buffer + buflen, data, len);
     buflen += len;
 
-    if (send(eep_cfg.client_sock, buffer, buflen, 0) == -1) {
-        return 1;
-    }
-
-    /* FREE */
-    sng_free(buffer);
-    sng_free(hg);
+    msg->len = buflen;
     return 0;
 }
 
 packet_t *
-capture_eep_receive()
+capture_eep_receive(const u_char *pkt, uint32_t size)
 {
     switch (eep_cfg.capt_srv_version) {
         case 2:
-            return capture_eep_receive_v2();
+            return capture_eep_receive_v2(pkt, size);
         case 3:
-            return capture_eep_receive_v3(NULL, 0);
+            return capture_eep_receive_v3(pkt, size);
     }
     return NULL;
 }
 
 packet_t *
-capture_eep_receive_v2()
+capture_eep_receive_v2(const u_char *buffer, uint32_t size)
 {
     uint8_t family, proto;
-    unsigned char *payload = 0;
+    const u_char *payload;
     uint32_t pos;
-    char buffer[MAX_CAPTURE_LEN] ;
     //! Source Address
     address_t src;
     //! Destination address
@@ -601,24 +1278,20 @@ capture_eep_receive_v2()
     struct pcap_pkthdr header;
     //! New created packet pointer
     packet_t *pkt;
-    //! EEP client data
-    struct sockaddr_storage eep_client;
-    socklen_t eep_client_len=sizeof(eep_client);
     struct hep_hdr hdr;
     struct hep_timehdr hep_time;
     struct hep_iphdr hep_ipheader;
     //! Frame contents
     struct pcap_pkthdr frame_pcap_header;
-    unsigned char *frame_payload;
+    u_char frame_payload[CAPTURE_EEP_FRAME_HDRLEN + MAX_CAPTURE_LEN];
 #ifdef USE_IPV6
     struct hep_ip6hdr hep_ip6header;
 #endif
 
-    // Initialize buffer
-    memset(buffer, 0, MAX_CAPTURE_LEN);
+    memset(&src, 0, sizeof(address_t));
+    memset(&dst, 0, sizeof(address_t));
 
-    /* Receive EEP generic header */
-    if (recvfrom(eep_cfg.server_sock, buffer, MAX_CAPTURE_LEN, 0, (struct sockaddr*)&eep_client, &eep_client_len) == -1)
+    if (size < sizeof(struct hep_hdr))
         return NULL;
 
     /* Copy initial bytes to HEPv2 header */
@@ -637,6 +1310,8 @@ capture_eep_receive_v2()
 
     /* IPv4 */
     if (family == AF_INET) {
+        if (pos + sizeof(struct hep_iphdr) > size)
+            return NULL;
         memcpy(&hep_ipheader, (void*) buffer + pos, sizeof(struct hep_iphdr));
         inet_ntop(AF_INET, &hep_ipheader.hp_src, src.ip, sizeof(src.ip));
         inet_ntop(AF_INET, &hep_ipheader.hp_dst, dst.ip, sizeof(dst.ip));
@@ -645,6 +1320,8 @@ capture_eep_receive_v2()
 #ifdef USE_IPV6
     /* IPv6 */
     else if(family == AF_INET6) {
+        if (pos + sizeof(struct hep_ip6hdr) > size)
+            return NULL;
         memcpy(&hep_ip6header, (void*) buffer + pos, sizeof(struct hep_ip6hdr));
         inet_ntop(AF_INET6, &hep_ip6header.hp6_src, src.ip, sizeof(src.ip));
         inet_ntop(AF_INET6, &hep_ip6header.hp6_dst, dst.ip, sizeof(dst.ip));
@@ -663,6 +1340,8 @@ capture_eep_receive_v2()
     dst.port = ntohs(hdr.hp_dport);
 
     /* TIMESTAMP*/
+    if (pos + sizeof(struct hep_timehdr) > size)
+        return NULL;
     memcpy(&hep_time, (void*) buffer + pos, sizeof(struct hep_timehdr));
     pos += sizeof(struct hep_timehdr);
     header.ts.tv_sec = hep_time.tv_sec;
@@ -671,37 +1350,24 @@ capture_eep_receive_v2()
     /* Protocol TYPE */
     /* Capture ID */
 
-    // Calculate payload size (Total size - headers size)
-    header.caplen = header.len = ntohs(hdr.hp_l) - pos;
-    if (pos+header.caplen >= MAX_CAPTURE_LEN)
-        return NULL;
-
-    // Copy packet payload
-    if (!(payload = sng_malloc(header.caplen + 1)))
+    // Payload is the rest of the datagram
+    header.caplen = header.len = size - pos;
+    if (pos + header.caplen >= MAX_CAPTURE_LEN)
         return NULL;
-    memcpy(payload, (void*) buffer + pos, header.caplen);
+    payload = buffer + pos;
 
     // Build a custom frame pcap header
-    frame_pcap_header = capture_eep_build_frame_data(header, payload,header.caplen, src, dst, &frame_payload);
-    if (!frame_payload) {
-        sng_free(payload);
-        return NULL;
-    }
+    frame_pcap_header = capture_eep_build_frame_data(header, payload, header.caplen,
+                                                     family, proto, src, dst, frame_payload);
 
     // Create a new packet
     pkt = packet_create((family == AF_INET) ? 4 : 6, proto, src, dst, 0);
     packet_add_frame(pkt, &frame_pcap_header, frame_payload);
     packet_set_transport_data(pkt, src.port, dst.port);
     packet_set_type(pkt, PACKET_SIP_UDP);
-    packet_set_payload(pkt, payload, header.caplen);
-
-    // We don't longer require frame payload anymore, because adding the frame to packet clones its memory
-    sng_free(frame_payload);
+    packet_set_payload(pkt, (u_char *) payload, header.caplen);
 
-    /* FREE */
-    sng_free(payload);
     return pkt;
-
 }
 
 
@@ -715,7 +1381,7 @@ capture_eep_receive_v2()
  * @return packet pointer
  */
 packet_t *
-capture_eep_receive_v3(const u_char *pkt, uint32_t size)
+capture_eep_receive_v3(const u_char *buffer, uint32_t size)
 {
 
     struct hep_generic hg;
@@ -723,33 +1389,20 @@ capture_eep_receive_v3(const u_char *pkt, uint32_t size)
 #ifdef USE_IPV6
     hep_chunk_ip6_t src_ip6, dst_ip6;
 #endif
-    hep_chunk_t payload_chunk;
-    hep_chunk_t authkey_chunk;
-    char *password;
-    int password_len;
-    unsigned char *payload = 0;
+    hep_chunk_t chunk;
+    const char *password = NULL;
+    uint32_t password_len = 0;
+    const u_char *payload = NULL;
     uint32_t total_len, pos;
-    char buffer[MAX_CAPTURE_LEN] ;
     //! Source and Destination Address
     address_t src, dst;
-    //! EEP client data
-    struct sockaddr_storage eep_client;
-    socklen_t eep_client_len=sizeof(eep_client);
     //! Packet header
     struct pcap_pkthdr header;
     //! New created packet pointer
     packet_t *pkt_new;
-    //! Frame contents
+    //! Frame contents (HEPv3 packets received over TCP can be up to 64KiB)
     struct pcap_pkthdr frame_pcap_header;
-    unsigned char *frame_payload;
-
-    if(!pkt) {
-        /* Receive EEP generic header */
-        if (recvfrom(eep_cfg.server_sock, buffer, MAX_CAPTURE_LEN, 0, (struct sockaddr*)&eep_client, &eep_client_len) == -1)
-            return NULL;
-    } else {
-        memcpy(&buffer, pkt, size);
-    }
+    u_char frame_payload[CAPTURE_EEP_FRAME_HDRLEN + CAPTURE_EEP_TCP_BUFFER];
 
     // Initialize structs
     memset(&hg, 0, sizeof(hep_generic_t));
@@ -757,27 +1410,30 @@ capture_eep_receive_v3(const u_char *pkt, uint32_t size)
     memset(&dst, 0, sizeof(address_t));
     memset(&header, 0, sizeof(struct pcap_pkthdr));
 
+    if (size < sizeof(hep_ctrl_t))
+        return NULL;
+
     /* Copy initial bytes to EEP Generic header */
-    memcpy(&hg.header, buffer, sizeof(struct hep_generic));
+    memcpy(&hg.header, buffer, sizeof(hep_ctrl_t));
 
     /* header check */
     if (memcmp(hg.header.id, "\x48\x45\x50\x33", 4) != 0)
         return NULL;
 
     total_len = ntohs(hg.header.length);
-    if (total_len >= MAX_CAPTURE_LEN)
+    if (total_len > size)
         return NULL;
     pos = sizeof(hep_ctrl_t);
 
-    while (pos < total_len) {
+    while (pos + sizeof(hep_chunk_t) <= total_len) {
 
-        hep_chunk_t *chunk = (struct hep_chunk*) (buffer + pos);
-        int chunk_vendor = ntohs(chunk->vendor_id);
-        int chunk_type = ntohs(chunk->type_id);
-        int chunk_len = ntohs(chunk->length);
+        memcpy(&chunk, buffer + pos, sizeof(hep_chunk_t));
+        int chunk_vendor = ntohs(chunk.vendor_id);
+        int chunk_type = ntohs(chunk.type_id);
+        uint32_t chunk_len = ntohs(chunk.length);
 
         /* Bad length, drop packet */
-        if (chunk_len == 0) {
+        if (chunk_len < sizeof(hep_chunk_t) || pos + chunk_len > total_len) {
             return NULL;
         }
 
@@ -789,71 +1445,88 @@ capture_eep_receive_v3(const u_char *pkt, uint32_t size)
 
         switch (chunk_type) {
             case CAPTURE_EEP_CHUNK_INVALID:
-                if (payload)
-                    sng_free(payload);
                 return NULL;
             case CAPTURE_EEP_CHUNK_FAMILY:
+                if (chunk_len < sizeof(hep_chunk_uint8_t))
+                    return NULL;
                 memcpy(&hg.ip_family, (void*) buffer + pos, sizeof(hep_chunk_uint8_t));
                 break;
             case CAPTURE_EEP_CHUNK_PROTO:
+                if (chunk_len < sizeof(hep_chunk_uint8_t))
+                    return NULL;
                 memcpy(&hg.ip_proto, (void*) buffer + pos, sizeof(hep_chunk_uint8_t));
                 break;
             case CAPTURE_EEP_CHUNK_SRC_IP4:
+                if (chunk_len < sizeof(struct hep_chunk_ip4))
+                    return NULL;
                 memcpy(&src_ip4, (void*) buffer + pos, sizeof(struct hep_chunk_ip4));
                 inet_ntop(AF_INET, &src_ip4.data, src.ip, sizeof(src.ip));
                 break;
             case CAPTURE_EEP_CHUNK_DST_IP4:
+                if (chunk_len < sizeof(struct hep_chunk_ip4))
+                    return NULL;
                 memcpy(&dst_ip4, (void*) buffer + pos, sizeof(struct hep_chunk_ip4));
                 inet_ntop(AF_INET, &dst_ip4.data, dst.ip, sizeof(src.ip));
                 break;
 #ifdef USE_IPV6
             case CAPTURE_EEP_CHUNK_SRC_IP6:
+                if (chunk_len < sizeof(struct hep_chunk_ip6))
+                    return NULL;
                 memcpy(&src_ip6, (void*) buffer + pos, sizeof(struct hep_chunk_ip6));
                 inet_ntop(AF_INET6, &src_ip6.data, src.ip, sizeof(src.ip));
                 break;
             case CAPTURE_EEP_CHUNK_DST_IP6:
+                if (chunk_len < sizeof(struct hep_chunk_ip6))
+                    return NULL;
                 memcpy(&dst_ip6, (void*) buffer + pos, sizeof(struct hep_chunk_ip6));
                 inet_ntop(AF_INET6, &dst_ip6.data, dst.ip, sizeof(dst.ip));
                 break;
 #endif
             case CAPTURE_EEP_CHUNK_SRC_PORT:
+                if (chunk_len < sizeof(hep_chunk_uint16_t))
+                    return NULL;
                 memcpy(&hg.src_port, (void*) buffer + pos, sizeof(hep_chunk_uint16_t));
                 src.port = ntohs(hg.src_port.data);
                 break;
             case CAPTURE_EEP_CHUNK_DST_PORT:
+                if (chunk_len < sizeof(hep_chunk_uint16_t))
+                    return NULL;
                 memcpy(&hg.dst_port, (void*) buffer + pos, sizeof(hep_chunk_uint16_t));
                 dst.port = ntohs(hg.dst_port.data);
                 break;
             case CAPTURE_EEP_CHUNK_TS_SEC:
+                if (chunk_len < sizeof(hep_chunk_uint32_t))
+                    return NULL;
                 memcpy(&hg.time_sec, (void*) buffer + pos, sizeof(hep_chunk_uint32_t));
                 header.ts.tv_sec = ntohl(hg.time_sec.data);
                 break;
             case CAPTURE_EEP_CHUNK_TS_USEC:
+                if (chunk_len < sizeof(hep_chunk_uint32_t))
+                    return NULL;
                 memcpy(&hg.time_usec, (void*) buffer + pos, sizeof(hep_chunk_uint32_t));
                 header.ts.tv_usec = ntohl(hg.time_usec.data);
                 break;
             case CAPTURE_EEP_CHUNK_PROTO_TYPE:
+                if (chunk_len < sizeof(hep_chunk_uint8_t))
+                    return NULL;
                 memcpy(&hg.proto_t, (void*) buffer + pos, sizeof(hep_chunk_uint8_t));
                 break;
             case CAPTURE_EEP_CHUNK_CAPT_ID:
+                if (chunk_len < sizeof(hep_chunk_uint32_t))
+                    return NULL;
                 memcpy(&hg.capt_id, (void*) buffer + pos, sizeof(hep_chunk_uint32_t));
                 break;
             case CAPTURE_EEP_CHUNK_KEEP_TM:
                 break;
             case CAPTURE_EEP_CHUNK_AUTH_KEY:
-                memcpy(&authkey_chunk, (void*) buffer + pos, sizeof(authkey_chunk));
-                password_len = ntohs(authkey_chunk.length) - sizeof(authkey_chunk);
-                password = sng_malloc(password_len);
-                memcpy(password, (void*) buffer + pos + sizeof(hep_chunk_t), password_len);
+                // Point to the key in received data
+                password = (const char *) buffer + pos + sizeof(hep_chunk_t);
+                password_len = chunk_len - sizeof(hep_chunk_t);
                 break;
             case CAPTURE_EEP_CHUNK_PAYLOAD:
-                memcpy(&payload_chunk, (void*) buffer + pos, sizeof(payload_chunk));
+                // Point to the payload in received data
                 header.caplen = header.len = chunk_len - sizeof(hep_chunk_t);
-                if (pos+sizeof(hep_chunk_t)+header.caplen >= MAX_CAPTURE_LEN)
-                    return NULL;
-                if (!(payload = sng_malloc(header.caplen)))
-                    return NULL;
-                memcpy(payload, (void*) buffer + pos + sizeof(hep_chunk_t), header.caplen);
+                payload = buffer + pos + sizeof(hep_chunk_t);
                 break;
             case CAPTURE_EEP_CHUNK_CORRELATION_ID:
                 break;
@@ -868,32 +1541,30 @@ capture_eep_receive_v3(const u_char *pkt, uint32_t size)
     // Validate password
     if (eep_cfg.capt_srv_password != NULL) {
         // No password in packet
-        if (strlen(password) == 0)
+        if (password_len == 0)
             return NULL;
-        // Check password matches configured
-        if (strcmp(password, eep_cfg.capt_srv_password) != 0)
+        // Check password matches configured (key may be NULL terminated)
+        if (password[password_len - 1] == '\0')
+            password_len--;
+        if (password_len != strlen(eep_cfg.capt_srv_password)
+            || strncmp(password, eep_cfg.capt_srv_password, password_len) != 0)
             return NULL;
     }
 
-    // Build a custom frame pcap header
-    frame_pcap_header = capture_eep_build_frame_data(header, payload,header.caplen, src, dst, &frame_payload);
-    if (!frame_payload) {
-        sng_free(payload);
+    // Packet without payload
+    if (!payload)
         return NULL;
-    }
+
+    // Build a custom frame pcap header
+    frame_pcap_header = capture_eep_build_frame_data(header, payload, header.caplen,
+                                                     hg.ip_family.data, hg.ip_proto.data,
+                                                     src, dst, frame_payload);
 
     // Create a new packet
     pkt_new = packet_create((hg.ip_family.data == AF_INET)?4:6, hg.ip_proto.data, src, dst, 0);
     packet_add_frame(pkt_new, &frame_pcap_header, frame_payload);
     packet_set_type(pkt_new, PACKET_SIP_UDP);
-    packet_set_payload(pkt_new, payload, header.caplen);
-
-    // We don't longer require frame payload anymore, because adding the frame to packet clones its memory
-    sng_free(frame_payload);
-
-    /* FREE */
-    sng_free(payload);
-    sng_free(password);
+    packet_set_payload(pkt_new, (u_char *) payload, header.caplen);
 
     return pkt_new;
 }
@@ -902,16 +1573,21 @@ int
 capture_eep_set_server_url(const char *url)
 {
     char urlstr[256];
-    char address[ADDRESSLEN + 1], port[6];
+    char proto[4], address[ADDRESSLEN + 1], port[6], workers[4];
+    int fields;
 
     memset(address, 0, sizeof(address));
     memset(port, 0, sizeof(port));
 
     sng_strncpy(urlstr, url, sizeof(urlstr));
-    if (sscanf(urlstr, "%*[^:]:%" STRINGIFY(ADDRESSLEN) "[^:]:%5s", address, port) == 2) {
+    fields = sscanf(urlstr, "%3[^:]:%" STRINGIFY(ADDRESSLEN) "[^:]:%5[^:]:%3s", proto, address, port, workers);
+    if (fields >= 3) {
         setting_set_value(SETTING_EEP_LISTEN, SETTING_ON);
+        setting_set_value(SETTING_EEP_LISTEN_PROTO, strcasecmp(proto, "tcp") == 0 ? "tcp" : "udp");
         setting_set_value(SETTING_EEP_LISTEN_ADDR, address);
         setting_set_value(SETTING_EEP_LISTEN_PORT, port);
+        if (fields == 4)
+            setting_set_value(SETTING_EEP_LISTEN_WORKERS, workers);
         return 0;
     }
     return 1;
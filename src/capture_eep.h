@@ -41,9 +41,20 @@
  */
 #ifndef __SNGREP_CAPTURE_EEP_H
 #define __SNGREP_CAPTURE_EEP_H
+#include "config.h"
 #include <pthread.h>
+#include <sys/socket.h>
 #include "capture.h"
 
+//! Max number of datagrams received in a single batch
+#define CAPTURE_EEP_BATCH   32
+//! Max number of sockets receiving EEP data
+#define CAPTURE_EEP_LISTENERS   64
+//! Size of each TCP connection stream buffer (fits the largest HEP packet)
+#define CAPTURE_EEP_TCP_BUFFER  65536
+//! Max number of EEP packets waiting to be sent
+#define CAPTURE_EEP_SEND_QUEUE  4096
+
 //! HEP chunk types
 enum
 {
@@ -69,6 +80,138 @@ enum
 
 //! Shorter declaration of capture_eep_config structure
 typedef struct capture_eep_config  capture_eep_config_t;
+//! Shorter declaration of capture_eep_ring structure
+typedef struct capture_eep_ring capture_eep_ring_t;
+//! Shorter declaration of capture_eep_listener structure
+typedef struct capture_eep_listener capture_eep_listener_t;
+//! Shorter declaration of capture_eep_agent structure
+typedef struct capture_eep_agent capture_eep_agent_t;
+//! Shorter declaration of capture_eep_conn structure
+typedef struct capture_eep_conn capture_eep_conn_t;
+//! Shorter declaration of capture_eep_msg structure
+typedef struct capture_eep_msg capture_eep_msg_t;
+//! Shorter declaration of capture_eep_send_stats structure
+typedef struct capture_eep_send_stats capture_eep_send_stats_t;
+//! Shorter declaration of capture_eep_sender structure
+typedef struct capture_eep_sender capture_eep_sender_t;
+
+/**
+ * @brief EEP server socket
+ *
+ * Each socket is received by its own capture source thread. Counters are
+ * only updated while holding the capture lock.
+ */
+struct capture_eep_listener
+{
+    //! Server socket for receiving EEP data
+    int sock;
+    //! Transport protocol (IPPROTO_UDP or IPPROTO_TCP)
+    int proto;
+    //! Capture source receiving this socket
+    capture_info_t *capinfo;
+    //! Received datagrams
+    uint64_t received;
+    //! Received bytes
+    uint64_t bytes;
+    //! Datagrams parsed as EEP packets
+    uint64_t parsed;
+    //! Datagrams discarded (malformed or not authenticated)
+    uint64_t invalid;
+};
+
+/**
+ * @brief Agent sending EEP data over TCP
+ *
+ * Agents are identified by their address, so counters are kept when
+ * an agent reconnects. Counters are only updated while holding the
+ * capture lock.
+ */
+struct capture_eep_agent
+{
+    //! Agent address (port is not used)
+    address_t addr;
+    //! Open connections from this agent
+    uint32_t connections;
+    //! Received EEP packets
+    uint64_t packets;
+    //! Received bytes
+    uint64_t bytes;
+    //! Framing errors (invalid packet headers in the stream)
+    uint64_t errors;
+};
+
+/**
+ * @brief TCP connection from an EEP agent
+ */
+struct capture_eep_conn
+{
+    //! Connection socket
+    int sock;
+    //! Agent of this connection
+    capture_eep_agent_t *agent;
+    //! Received stream data not yet framed
+    u_char *buffer;
+    //! Bytes in stream buffer
+    uint32_t len;
+};
+
+/**
+ * @brief Encapsulated EEP packet
+ *
+ * Buffers are allocated on first use and reused for following packets,
+ * growing when required.
+ */
+struct capture_eep_msg
+{
+    //! Packet contents
+    u_char *data;
+    //! Packet length
+    uint32_t len;
+    //! Allocated buffer size
+    uint32_t size;
+};
+
+/**
+ * @brief EEP client counters
+ */
+struct capture_eep_send_stats
+{
+    //! Packets added to send queue
+    uint64_t queued;
+    //! Packets sent
+    uint64_t sent;
+    //! Packets discarded because send queue was full
+    uint64_t dropped;
+    //! Packets that failed to be sent
+    uint64_t errors;
+};
+
+/**
+ * @brief EEP client sending thread
+ *
+ * Captured packets are encapsulated in the capture thread into a bounded
+ * queue, that is drained by a dedicated thread. When the queue is full,
+ * oldest packets are discarded so sending never blocks packet capture.
+ */
+struct capture_eep_sender
+{
+    //! Sending thread
+    pthread_t thread;
+    //! Thread must keep running
+    bool running;
+    //! Queued packets (circular buffer)
+    capture_eep_msg_t queue[CAPTURE_EEP_SEND_QUEUE];
+    //! Position of the oldest queued packet
+    uint32_t first;
+    //! Number of queued packets
+    uint32_t count;
+    //! Counters
+    capture_eep_send_stats_t stats;
+    //! Queue lock
+    pthread_mutex_t lock;
+    //! Signaled when a packet is queued or thread is stopped
+    pthread_cond_t cond;
+};
 
 /**
  * @brief EEP  Client/Server configuration
@@ -77,8 +220,16 @@ struct capture_eep_config
 {
     //! Client socket for sending EEP data
     int client_sock;
-    //! Server socket for receiving EEP data
-    int server_sock;
+    //! Client sending thread
+    capture_eep_sender_t sender;
+    //! Server sockets for receiving EEP data
+    capture_eep_listener_t listeners[CAPTURE_EEP_LISTENERS];
+    //! Number of server sockets
+    int listeners_count;
+    //! Agents connected through TCP (capture_eep_agent_t)
+    vector_t *agents;
+    //! TCP sequence of built frames for received packets
+    uint32_t frame_seq;
     //! Capture agent id
     int capt_id;
     //! Hep Version for sending data (2 or 3)
@@ -97,8 +248,25 @@ struct capture_eep_config
     const char *capt_srv_port;
     //! Server password to authenticate incoming connections
     const char *capt_srv_password;
-    //! Server thread to parse incoming data
-    pthread_t server_thread;
+};
+
+/**
+ * @brief Reusable buffers for received EEP datagrams
+ *
+ * Each server thread owns a ring, so datagrams can be received in
+ * batches and parsed in place without further copies.
+ */
+struct capture_eep_ring
+{
+    //! Received datagrams contents
+    u_char data[CAPTURE_EEP_BATCH][MAX_CAPTURE_LEN];
+    //! Received datagrams length
+    uint32_t len[CAPTURE_EEP_BATCH];
+#ifdef HAVE_RECVMMSG
+    //! Message headers pointing to data buffers
+    struct mmsghdr msgs[CAPTURE_EEP_BATCH];
+    struct iovec iov[CAPTURE_EEP_BATCH];
+#endif
 };
 
 /* HEPv3 types */
@@ -266,7 +434,51 @@ const char *
 capture_eep_listen_port();
 
 /**
- * @brief Wrapper for sending packet in configured EEP version
+ * @brief Return the number of sockets receiving EEP data
+ */
+int
+capture_eep_listener_count();
+
+/**
+ * @brief Return a copy of an EEP server socket counters
+ *
+ * Capture lock must be held to get consistent values.
+ *
+ * @param idx Socket index (from 0 to capture_eep_listener_count)
+ * @return listener data
+ */
+capture_eep_listener_t
+capture_eep_listener_stats(int idx);
+
+/**
+ * @brief Return the number of agents that have connected through TCP
+ */
+int
+capture_eep_agent_count();
+
+/**
+ * @brief Return a copy of an EEP TCP agent counters
+ *
+ * Capture lock must be held to get consistent values.
+ *
+ * @param idx Agent index (from 0 to capture_eep_agent_count)
+ * @return agent data
+ */
+capture_eep_agent_t
+capture_eep_agent_stats(int idx);
+
+/**
+ * @brief Return a copy of EEP client counters
+ */
+capture_eep_send_stats_t
+capture_eep_send_stats();
+
+/**
+ * @brief Queue a packet to be sent in configured EEP version
+ *
+ * Packet is encapsulated before returning, so it can be destroyed
+ * afterwards. If the send queue is full, the oldest queued packet
+ * is discarded.
  *
  * @param pkt Packet Structure data
  * @return 1 on any error occurs, 0 otherwise
@@ -275,61 +487,90 @@ int
 capture_eep_send(packet_t *pkt);
 
 /**
- * @brief Send a captured packet (EEP version 2)
+ * @brief Encapsulate a captured packet (EEP version 2)
  *
- * Send a packet encapsulated into EEP through the client socket.
- * This function will only handle SIP packets if EEP client mode
- * has been enabled.
+ * Encapsulated packet is written into msg buffer, that is enlarged
+ * if required.
  *
  * @param pkt Packet Structure data
+ * @param msg Output EEP packet
  * @return 1 on any error occurs, 0 otherwise
  */
 int
-capture_eep_send_v2(packet_t *pkt);
+capture_eep_send_v2(packet_t *pkt, capture_eep_msg_t *msg);
 
 /**
- * @brief Send a captured packet (EEP version 3)
+ * @brief Encapsulate a captured packet (EEP version 3)
  *
- * Send a packet encapsulated into EEP through the client socket.
- * This function will only handle SIP packets if EEP client mode
- * has been enabled.
+ * Encapsulated packet is written into msg buffer, that is enlarged
+ * if required.
  *
  * @param pkt Packet Structure data
+ * @param msg Output EEP packet
  * @return 1 on any error occurs, 0 otherwise
  */
 int
-capture_eep_send_v3(packet_t *pkt);
+capture_eep_send_v3(packet_t *pkt, capture_eep_msg_t *msg);
+
+/**
+ * @brief Allocate a ring of buffers for receiving datagrams
+ *
+ * @return new allocated ring or NULL on failure
+ */
+capture_eep_ring_t *
+capture_eep_ring_create();
+
+/**
+ * @brief Free a ring of receiving buffers
+ */
+void
+capture_eep_ring_destroy(capture_eep_ring_t *ring);
+
+/**
+ * @brief Receive a batch of datagrams from EEP server socket
+ *
+ * Block until at least one datagram is received and then read as many
+ * pending datagrams as fit in the ring.
+ *
+ * @param sock Server socket
+ * @param ring Buffers to store received datagrams
+ * @return number of received datagrams or -1 on error
+ */
+int
+capture_eep_receive_batch(int sock, capture_eep_ring_t *ring);
 
 /**
- * @brief Wrapper for receiving packet in configured EEP version
+ * @brief Wrapper for parsing received data in configured EEP version
  *
+ * @param pkt received datagram data
+ * @param size received datagram size
  * @return NULL on any error, packet structure otherwise
  */
 packet_t *
-capture_eep_receive();
+capture_eep_receive(const u_char *pkt, uint32_t size);
 
 
 /**
- * @brief Received a captured packet (EEP version 2)
+ * @brief Parse a received packet (EEP version 2)
  *
- * Wait for a packet to be received through the EEP server. This
- * function will parse received EEP data and create a new packet
+ * This function will parse received EEP data and create a new packet
  * structure.
  *
+ * @param pkt received datagram data
+ * @param size received datagram size
  * @return NULL on any error, packet structure otherwise
  */
 packet_t *
-capture_eep_receive_v2();
+capture_eep_receive_v2(const u_char *pkt, uint32_t size);
 
 /**
- * @brief Received a captured packet (EEP version 3)
+ * @brief Parse a received packet (EEP version 3)
  *
- * Wait for a packet to be received through the EEP server. This
- * function will parse received EEP data and create a new packet
- * structure.
+ * This function will parse received EEP data and create a new packet
+ * structure. Chunks are read in place from given data.
  *
- * @param pkt packet structure data, NULL if socket should be used
- * @param size size of packet structure data
+ * @param pkt received datagram data
+ * @param size received datagram size
  * @return NULL on any error, packet structure otherwise
  */
 packet_t *
@@ -339,10 +580,11 @@ capture_eep_receive_v3(const u_char *pkt, uint32_t size);
  * @brief Set EEP server url
  *
  * Set EEP servermode settings using a url in the format:
- *  - proto:address:port
+ *  - proto:address:port[:workers]
  * For example:
  *  - udp:10.10.0.100:9060
- *  - udp:0.0.0.0:9960
+ *  - udp:0.0.0.0:9960:4
+ *  - tcp:0.0.0.0:9060
  *
  * @param url URL to be parsed
  * @return 0 if url has been parsed, 1 otherwise
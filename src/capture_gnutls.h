@@ -57,6 +57,17 @@
 //! Cast three bytes into decimal (Big Endian)
 #define UINT24_INT(i) ((i.x[0] << 16) | (i.x[1] << 8) | i.x[2])
 
+//! Number of buckets in the connections hash table (power of 2)
+#define TLS_CONNECTION_BUCKETS 1024
+//! Seconds without segments before a connection is expired
+#define TLS_CONNECTION_TIMEOUT 300
+//! Seconds between idle connections checks
+#define TLS_CONNECTION_SWEEP 10
+//! Max length of a TLS record (TLSCiphertext max length plus record header)
+#define TLS_RECORD_MAX_LEN (16384 + 2048 + 5)
+//! Initial size of connection buffers
+#define TLS_BUFFER_SIZE 4096
+
 //! Three bytes unsigned integer
 typedef struct uint16 {
     unsigned char x[2];
@@ -213,10 +224,37 @@ struct ClientKeyExchange {
     struct EncryptedPreMasterSecret exchange_keys;
 };
 
+/**
+ * Binary address and port of one side of a TLS connection
+ */
+struct SSLEndpoint {
+    //! Address family (AF_INET or AF_INET6)
+    int family;
+    //! Address in network byte order
+    union {
+        struct in_addr in;
+        struct in6_addr in6;
+    } addr;
+    //! Port
+    uint16_t port;
+};
+
+/**
+ * Growable buffer reused for all segments of a TLS connection
+ */
+struct SSLBuffer {
+    //! Buffer data
+    uint8_t *data;
+    //! Bytes used
+    uint32_t len;
+    //! Bytes allocated
+    uint32_t size;
+};
+
 /**
  * Structure to store all information from a TLS
- * connection. This is also used as linked list
- * node.
+ * connection. This is also used as hash table
+ * bucket node.
  */
 struct SSLConnection {
     //! Connection status
@@ -228,14 +266,20 @@ struct SSLConnection {
     //! TLS version
     int version;
 
-    //! Client IP address
-    struct in_addr client_addr;
-    //! Server IP address
-    struct in_addr server_addr;
-    //! Client port
-    uint16_t client_port;
-    //! Server port
-    uint16_t server_port;
+    //! Client address
+    struct SSLEndpoint client;
+    //! Server address
+    struct SSLEndpoint server;
+    //! Directions that have sent a FIN segment (bit mask)
+    int fin;
+    //! Time of last segment
+    struct timeval last;
+    //! Hash table where this connection is stored
+    struct SSLConnections *connections;
+    //! Incomplete record data of each direction (client, server)
+    struct SSLBuffer record[2];
+    //! Decrypted application data of current segment
+    struct SSLBuffer plaintext;
 
     gnutls_session_t ssl;
     int ciph;
@@ -259,9 +303,25 @@ struct SSLConnection {
     gcry_cipher_hd_t client_cipher_ctx;
     gcry_cipher_hd_t server_cipher_ctx;
 
+    //! Next connection in the same bucket
     struct SSLConnection *next;
 };
 
+/**
+ * Hash table of tracked TLS connections
+ *
+ * Connections are indexed by their binary address tuple. Both endpoints
+ * hashes are combined so client and server segments use the same bucket.
+ */
+struct SSLConnections {
+    //! Bucket chains
+    struct SSLConnection *buckets[TLS_CONNECTION_BUCKETS];
+    //! Number of tracked connections
+    uint32_t count;
+    //! Time of last idle connections check
+    struct timeval swept;
+};
+
 /**
  * @brief P_hash expansion function as defined in RFC5246
  *
@@ -305,22 +365,22 @@ PRF(struct SSLConnection *conn, unsigned char *dest, int dlen, unsigned char *pr
  *
  * This will allocate enough memory to store all connection data
  * from a detected SSL connection. This will also add this structure to
- * the connections linked list.
+ * the connections hash table.
  *
- * @param caddr Client address
- * @param cport Client port
- * @param saddr Server address
- * @param sport Server port
+ * @param connections Connections hash table
+ * @param client Client address and port
+ * @param server Server address and port
  * @return a pointer to a new allocated SSLConnection structure
  */
 struct SSLConnection *
-tls_connection_create(struct in_addr caddr, uint16_t cport, struct in_addr saddr, uint16_t sport);
+tls_connection_create(struct SSLConnections *connections, struct SSLEndpoint client,
+                      struct SSLEndpoint server);
 
 /**
  * @brief Destroys an existing SSLConnection
  *
  * This will free all allocated memory of SSLConnection also removing
- * the connection from connections list.
+ * the connection from connections hash table.
  *
  * @param conn Existing connection pointer
  */
@@ -338,63 +398,20 @@ tls_connection_destroy(struct SSLConnection *conn);
 int
 tls_check_keyfile(const char *keyfile);
 
-/**
- * @brief Determines packet direction
- *
- * Determine if the given address is from client or server.
- *
- * @param conn Existing connection pointer
- * @param addr Client or server address
- * @param port Client or server port
- * @return 0 if address belongs to client, 1 to server or -1 otherwise
- */
-int
-tls_connection_dir(struct SSLConnection *conn, struct in_addr addr, uint16_t port);
-
-/**
- * @brief Find a connection
- *
- * Try to find connection data for a given address and port.
- * This address:port convination can be the client or server one.
- *
- * @param addr Client or server address
- * @param port Client or server port
- * @return an existing Connection pointer or NULL if not found
- */
-struct SSLConnection*
-tls_connection_find(struct in_addr src, uint16_t sport, struct in_addr dst, uint16_t dport);
-
-/**
- * @brief Process a TCP segment to check TLS data
- *
- * Check if a TCP segment contains TLS data. In case a TLS record is found
- * process it and return decrypted data if case of application_data record.
- *
- * @param tcp Pointer to tcp header of the packet
- * @param out Pointer to the output char array. Memory must be already allocated
- * @param out Number of bytes returned by this function
- * @return 0 in all cases
- */
-int
-tls_process_segment(packet_t *packet, struct tcphdr *tcp);
-
 /**
  * @brief Process TLS record data
  *
- * Process a TLS record
+ * Process a complete TLS record
  *  - If the record type is Handshake process it in tls_process_record_handshake
  *  - If the record type is Application Data process it in tls_process_record_data
  *
  * @param conn Existing connection pointer
- * @param payload Packet peyload
- * @param len Payload length
- * @param out pointer to store decryted data
- * @param outl decrypted data length
- * @return Decrypted data length
+ * @param payload Record data (including record header)
+ * @param len Record length
+ * @return 0 on valid record processed, 1 otherwise
  */
 int
-tls_process_record(struct SSLConnection *conn, const uint8_t *payload, const int len, uint8_t **out,
-                   uint32_t *outl);
+tls_process_record(struct SSLConnection *conn, const uint8_t *payload, const int len);
 
 /**
  * @brief Check if this Record looks like SSLv2
@@ -425,7 +442,7 @@ tls_record_handshake_is_ssl2(struct SSLConnection *conn, const uint8_t *payload,
  */
 int
 tls_process_record_ssl2(struct SSLConnection *conn, const uint8_t *payload,
-                   const int len, uint8_t **out, uint32_t *outl);
+                   const int len);
 
 /**
  * @brief Process TLS Handshake record types
@@ -445,19 +462,15 @@ tls_process_record_handshake(struct SSLConnection *conn, const opaque *fragment,
  * @brief Process TLS ApplicationData record types
  *
  * Process application data record, trying to decrypt it with connection
- * information
+ * information. Decrypted data is appended to connection plaintext buffer.
  *
  * @param conn Existing connection pointer
  * @param fragment Application record data
  * @param len record length in bytes
- * @param out pointer to store decryted data
- * @param outl decrypted data length
  * @return decoded data length
  */
 int
-tls_process_record_data(struct SSLConnection *conn, const opaque *fragment, const int len,
-                        uint8_t **out, uint32_t *outl);
-
+tls_process_record_data(struct SSLConnection *conn, const opaque *fragment, const int len);
 
 /**
  * @brief Get the cipher data from the given connection
@@ -0,0 +1,621 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file capture_index.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source code of functions defined in capture_index.h
+ *
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "capture_index.h"
+#include "capture.h"
+#include "sip.h"
+#include "rtp.h"
+#include "setting.h"
+#include "util.h"
+
+//! Classic pcap file header size
+#define CAPTURE_INDEX_FILE_HDRLEN   24
+//! Classic pcap record header size
+#define CAPTURE_INDEX_RECORD_HDRLEN 16
+
+//! Shorter declaration of stream summary record
+typedef struct capture_index_stream capture_index_stream_t;
+
+/**
+ * @brief Index file stream summary record
+ *
+ * Record is followed by the Call-ID of the stream call, its RTCP reports
+ * (if any) and its telephone events. Summaries of each call are stored
+ * together in call streams order.
+ */
+struct capture_index_stream
+{
+    //! Length of Call-ID (including the ending NUL)
+    uint32_t callidlen;
+    //! Position of the SDP message in the call and media in the message
+    uint32_t msgpos, mediapos;
+    //! RTCP reports of the stream follow the Call-ID
+    uint32_t reports;
+    //! Number of telephone events of the stream
+    uint32_t events;
+    //! Stream data (pointers are not valid)
+    rtp_stream_t stream;
+};
+
+//! Parsed data has been changed by the user
+static bool modified = false;
+
+/**
+ * @brief Get the next stream summary of read index data
+ *
+ * @param data Stream summary data
+ * @param end End of stream summaries data
+ * @param record Filled with the summary record
+ * @param callid Filled with the summary Call-ID
+ * @param reports Filled with the summary RTCP reports (NULL if none)
+ * @param events Filled with the summary telephone events
+ * @return data of the next summary or NULL if summary is not valid
+ */
+static const u_char *
+capture_index_stream_next(const u_char *data, const u_char *end, capture_index_stream_t *record,
+                          const char **callid, const u_char **reports, const u_char **events)
+{
+    size_t len;
+
+    if ((size_t) (end - data) < sizeof(capture_index_stream_t))
+        return NULL;
+    memcpy(record, data, sizeof(capture_index_stream_t));
+    data += sizeof(capture_index_stream_t);
+
+    len = (size_t) record->callidlen
+          + (record->reports ? sizeof(rtcp_reports_t) : 0)
+          + (size_t) record->events * sizeof(rtp_event_t);
+    if (record->callidlen == 0 || (size_t) (end - data) < len
+        || data[record->callidlen - 1] != '\0')
+        return NULL;
+
+    *callid = (const char *) data;
+    data += record->callidlen;
+    *reports = (record->reports) ? data : NULL;
+    data += (record->reports) ? sizeof(rtcp_reports_t) : 0;
+    *events = data;
+    return data + (size_t) record->events * sizeof(rtp_event_t);
+}
+
+/**
+ * @brief Read stream summaries from index file
+ *
+ * Summaries are stored at the end of index file.
+ *
+ * @return true if all summaries are valid
+ */
+static bool
+capture_index_read_streams(capture_index_t *index, FILE *fp, uint64_t count)
+{
+    capture_index_stream_t record;
+    const u_char *data, *end, *reports, *events;
+    const char *callid;
+    long start, len;
+
+    if ((start = ftell(fp)) < 0 || fseek(fp, 0, SEEK_END) != 0
+        || (len = ftell(fp) - start) < 0 || fseek(fp, start, SEEK_SET) != 0)
+        return false;
+
+    // Always allocate something, files may have no streams
+    if (!(index->summaries = malloc(len + 1))
+        || fread(index->summaries, 1, len, fp) != (size_t) len)
+        return false;
+    index->summarylen = len;
+
+    // Check all summaries can be restored
+    data = index->summaries;
+    end = data + len;
+    while (data < end && count > 0) {
+        if (!(data = capture_index_stream_next(data, end, &record, &callid, &reports, &events)))
+            return false;
+        count--;
+    }
+
+    return data == end && count == 0;
+}
+
+/**
+ * @brief Read record offsets from index file
+ *
+ * @return true if index file is valid for given mapped file
+ */
+static bool
+capture_index_read(capture_index_t *index, capture_mmap_t *file)
+{
+    capture_index_header_t header;
+    char *options = NULL;
+    uint64_t *offsets = NULL;
+    bool valid = false;
+    FILE *fp;
+    size_t i;
+
+    if (!(fp = fopen(index->filename, "rb")))
+        return false;
+
+    // Check index has been created for this file contents
+    if (fread(&header, sizeof(header), 1, fp) != 1
+        || memcmp(header.magic, CAPTURE_INDEX_MAGIC, sizeof(header.magic)) != 0
+        || header.size != file->size
+        || header.mtime_sec != (int64_t) file->mtime.tv_sec
+        || header.mtime_nsec != (int64_t) file->mtime.tv_nsec
+        || header.optlen != strlen(index->options)
+        || header.recsize != sizeof(capture_index_stream_t)
+        || header.count > file->size / CAPTURE_INDEX_RECORD_HDRLEN
+        || (header.streams && !index->streams))
+        goto done;
+
+    // Check index has been created with the same parse options
+    if (!(options = malloc(header.optlen + 1))
+        || fread(options, 1, header.optlen, fp) != header.optlen
+        || memcmp(options, index->options, header.optlen) != 0)
+        goto done;
+
+    // Always allocate something, an empty index reads no records
+    if (!(offsets = malloc((header.count + 1) * sizeof(uint64_t)))
+        || fread(offsets, sizeof(uint64_t), header.count, fp) != header.count)
+        goto done;
+
+    // Offsets must point to records in file order
+    for (i = 0; i < header.count; i++) {
+        if (offsets[i] < CAPTURE_INDEX_FILE_HDRLEN || offsets[i] >= file->size
+            || (i > 0 && offsets[i] <= offsets[i - 1]))
+            goto done;
+    }
+
+    // Stream summaries follow record offsets
+    if (index->streams && !capture_index_read_streams(index, fp, header.streams))
+        goto done;
+
+    index->offsets = offsets;
+    index->count = index->size = header.count;
+    offsets = NULL;
+    valid = true;
+
+done:
+    if (!valid) {
+        free(index->summaries);
+        index->summaries = NULL;
+        index->summarylen = 0;
+    }
+    free(offsets);
+    free(options);
+    fclose(fp);
+    return valid;
+}
+
+/**
+ * @brief Write the summaries of all call streams
+ *
+ * Streams without SDP media can not be restored and are not written.
+ *
+ * @return true if all summaries have been written
+ */
+static bool
+capture_index_write_streams(FILE *fp, uint64_t *count)
+{
+    capture_index_stream_t record;
+    sip_call_t *call;
+    rtp_stream_t *stream;
+    rtp_event_t *item, event;
+    vector_iter_t calls, streams, events;
+    int msgpos, mediapos;
+
+    calls = sip_calls_iterator();
+    while ((call = vector_iterator_next(&calls))) {
+        streams = vector_iterator(call->streams);
+        while ((stream = vector_iterator_next(&streams))) {
+            if (!stream->media || !stream->media->msg || !stream->media->msg->medias)
+                continue;
+            msgpos = vector_index(call->msgs, stream->media->msg);
+            mediapos = vector_index(stream->media->msg->medias, stream->media);
+            if (msgpos == -1 || mediapos == -1)
+                continue;
+
+            memset(&record, 0, sizeof(record));
+            record.callidlen = strlen(call->callid) + 1;
+            record.msgpos = msgpos;
+            record.mediapos = mediapos;
+            record.reports = (stream->reports != NULL);
+            record.events = vector_count(stream->events);
+            memcpy(&record.stream, stream, sizeof(rtp_stream_t));
+            record.stream.media = NULL;
+            record.stream.events = NULL;
+            record.stream.store = NULL;
+            record.stream.bucket = NULL;
+            record.stream.reports = NULL;
+
+            if (fwrite(&record, sizeof(record), 1, fp) != 1
+                || fwrite(call->callid, 1, record.callidlen, fp) != record.callidlen
+                || (stream->reports && fwrite(stream->reports, sizeof(rtcp_reports_t), 1, fp) != 1))
+                return false;
+
+            events = vector_iterator(stream->events);
+            while ((item = vector_iterator_next(&events))) {
+                memcpy(&event, item, sizeof(rtp_event_t));
+                event.stream = NULL;
+                if (fwrite(&event, sizeof(rtp_event_t), 1, fp) != 1)
+                    return false;
+            }
+
+            (*count)++;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Write recorded offsets to a new index file
+ *
+ * @return true if index file has been written
+ */
+static bool
+capture_index_write(capture_index_t *index, capture_mmap_t *file)
+{
+    capture_index_header_t header;
+    char *tmpname;
+    bool written;
+    FILE *fp;
+
+    // Write a temporary file that replaces the index once complete
+    if (!(tmpname = sng_malloc(strlen(index->filename) + 5)))
+        return false;
+    sprintf(tmpname, "%s.tmp", index->filename);
+
+    if (!(fp = fopen(tmpname, "wb"))) {
+        sng_free(tmpname);
+        return false;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CAPTURE_INDEX_MAGIC, sizeof(header.magic));
+    header.size = file->size;
+    header.mtime_sec = file->mtime.tv_sec;
+    header.mtime_nsec = file->mtime.tv_nsec;
+    header.count = index->count;
+    header.optlen = strlen(index->options);
+    header.recsize = sizeof(capture_index_stream_t);
+
+    written = fwrite(&header, sizeof(header), 1, fp) == 1
+              && fwrite(index->options, 1, header.optlen, fp) == header.optlen
+              && fwrite(index->offsets, sizeof(uint64_t), index->count, fp) == index->count;
+
+    // Header is written again with the number of stream summaries
+    if (written && index->streams) {
+        capture_lock();
+        written = capture_index_write_streams(fp, &header.streams);
+        capture_unlock();
+        written = written && fseek(fp, 0, SEEK_SET) == 0
+                  && fwrite(&header, sizeof(header), 1, fp) == 1;
+    }
+
+    if (fclose(fp) != 0)
+        written = false;
+
+    if (!written || rename(tmpname, index->filename) != 0) {
+        unlink(tmpname);
+        written = false;
+    }
+
+    sng_free(tmpname);
+    return written;
+}
+
+void
+capture_index_open(capture_info_t *capinfo, const char *options, bool streams)
+{
+    capture_index_t *index;
+
+    // Only mapped input files can be indexed
+    if (!capinfo->file || !setting_enabled(SETTING_CAPTURE_INDEX))
+        return;
+
+    // Decrypted TLS packets are not parsed in record order
+    if (capture_keyfile())
+        return;
+
+    if (!(index = sng_malloc(sizeof(capture_index_t))))
+        return;
+
+    index->filename = sng_malloc(strlen(capinfo->infile) + strlen(CAPTURE_INDEX_SUFFIX) + 1);
+    index->options = strdup(options);
+    if (!index->filename || !index->options) {
+        sng_free(index->filename);
+        free(index->options);
+        sng_free(index);
+        return;
+    }
+    sprintf(index->filename, "%s%s", capinfo->infile, CAPTURE_INDEX_SUFFIX);
+    index->streams = streams;
+
+    // Read only indexed records if index file is still valid
+    if (capture_index_read(index, capinfo->file)) {
+        capinfo->file->offsets = index->offsets;
+        capinfo->file->count = index->count;
+        index->loaded = true;
+    }
+
+    capinfo->index = index;
+}
+
+void
+capture_index_close(capture_info_t *capinfo)
+{
+    capture_index_t *index = capinfo->index;
+
+    if (!index)
+        return;
+
+    if (capinfo->file)
+        capinfo->file->offsets = NULL;
+
+    free(index->offsets);
+    free(index->summaries);
+    free(index->options);
+    sng_free(index->filename);
+    sng_free(index);
+    capinfo->index = NULL;
+}
+
+void
+capture_index_keep(capture_info_t *capinfo)
+{
+    if (capinfo->index)
+        capinfo->index->keep = true;
+}
+
+/**
+ * @brief Restore a stream from its summary
+ *
+ * Streams created while parsing SDP of indexed records are reused, the
+ * rest of streams are created again.
+ *
+ * @param call Call of the stream
+ * @param restored Already restored streams of this call
+ * @return restored stream or NULL if SDP media has not been found
+ */
+static rtp_stream_t *
+capture_index_restore_stream(sip_call_t *call, vector_t *restored, capture_index_stream_t *record,
+                             const u_char *reports, const u_char *events)
+{
+    rtp_stream_t *stream = NULL, *item;
+    rtp_event_t *event;
+    sdp_media_t *media;
+    sip_msg_t *msg;
+    vector_iter_t it;
+    uint32_t i;
+
+    if (!(msg = vector_item(call->msgs, record->msgpos))
+        || !(media = vector_item(msg->medias, record->mediapos)))
+        return NULL;
+
+    it = vector_iterator(call->streams);
+    while ((item = vector_iterator_next(&it))) {
+        if (item->media == media && item->type == record->stream.type
+            && addressport_equals(item->dst, record->stream.dst)
+            && vector_index(restored, item) == -1) {
+            stream = item;
+            break;
+        }
+    }
+
+    if (!stream) {
+        if (!(stream = stream_create(media, record->stream.dst, record->stream.type)))
+            return NULL;
+        sip_calls_account(call, NULL, sizeof(rtp_stream_t));
+    }
+
+    // Stream will be indexed again with its restored addresses
+    rtp_index_remove(stream);
+
+    stream->src = record->stream.src;
+    stream->pktcnt = record->stream.pktcnt;
+    stream->time = record->stream.time;
+    stream->lasttm = record->stream.lasttm;
+    stream->telephone_event = record->stream.telephone_event;
+    stream->stats = record->stream.stats;
+    stream->activity = record->stream.activity;
+    // RTP information is the larger member of stream information
+    stream->rtpinfo = record->stream.rtpinfo;
+
+    if (reports && !stream->reports) {
+        if ((stream->reports = sng_malloc(sizeof(rtcp_reports_t))))
+            memstat_resize(MEMSTAT_STREAMS, 0, sizeof(rtcp_reports_t));
+    } else if (!reports && stream->reports) {
+        memstat_resize(MEMSTAT_STREAMS, sizeof(rtcp_reports_t), 0);
+        sng_free(stream->reports);
+        stream->reports = NULL;
+    }
+    if (reports && stream->reports)
+        memcpy(stream->reports, reports, sizeof(rtcp_reports_t));
+
+    if (stream->events) {
+        vector_set_destroyer(stream->events, vector_generic_destroyer);
+        vector_destroy(stream->events);
+        stream->events = NULL;
+    }
+    for (i = 0; i < record->events; i++) {
+        if (!stream->events && !(stream->events = vector_create(0, 1)))
+            break;
+        if (!(event = sng_malloc(sizeof(rtp_event_t))))
+            break;
+        memcpy(event, events + i * sizeof(rtp_event_t), sizeof(rtp_event_t));
+        event->stream = stream;
+        vector_append(stream->events, event);
+    }
+
+    return stream;
+}
+
+/**
+ * @brief Replace call streams with the restored ones
+ *
+ * @param call Call of the streams
+ * @param restored Restored streams in call streams order
+ */
+static void
+capture_index_restore_call(sip_call_t *call, vector_t *restored)
+{
+    rtp_stream_t *stream;
+    vector_iter_t it;
+    int i;
+
+    // Remove streams that did not exist once the whole file was parsed
+    for (i = vector_count(call->streams) - 1; i >= 0; i--) {
+        stream = vector_item(call->streams, i);
+        if (vector_index(restored, stream) == -1) {
+            vector_remove(call->streams, stream);
+            sip_calls_account(call, NULL, -(ssize_t) sizeof(rtp_stream_t));
+        }
+    }
+
+    // Store streams in their original order
+    vector_set_destroyer(call->streams, NULL);
+    vector_clear(call->streams);
+    vector_set_destroyer(call->streams, stream_destroyer);
+
+    it = vector_iterator(restored);
+    while ((stream = vector_iterator_next(&it))) {
+        vector_append(call->streams, stream);
+        rtp_index_add(stream);
+    }
+
+    call->changed = true;
+}
+
+void
+capture_index_restore(capture_info_t *capinfo)
+{
+    capture_index_t *index = capinfo->index;
+    capture_index_stream_t record;
+    const u_char *data, *end, *reports, *events;
+    const char *callid;
+    sip_call_t *call, *current = NULL;
+    rtp_stream_t *stream;
+    vector_t *restored;
+
+    if (!index || !index->loaded || !index->summaries)
+        return;
+
+    if (!(restored = vector_create(0, 4)))
+        return;
+
+    capture_lock();
+    data = index->summaries;
+    end = data + index->summarylen;
+    while (data < end) {
+        // Summaries have been validated while reading the index file
+        data = capture_index_stream_next(data, end, &record, &callid, &reports, &events);
+
+        // Calls may have been rotated
+        if (!(call = sip_find_by_callid(callid)))
+            continue;
+
+        if (call != current) {
+            if (current)
+                capture_index_restore_call(current, restored);
+            vector_clear(restored);
+            current = call;
+        }
+
+        if ((stream = capture_index_restore_stream(call, restored, &record, reports, events)))
+            vector_append(restored, stream);
+    }
+    if (current)
+        capture_index_restore_call(current, restored);
+    capture_unlock();
+
+    vector_destroy(restored);
+}
+
+bool
+capture_index_keep_rtp(capture_info_t *capinfo)
+{
+    return !capinfo->index || !capinfo->index->streams;
+}
+
+void
+capture_index_add(capture_info_t *capinfo, const u_char *data)
+{
+    capture_index_t *index = capinfo->index;
+    uint64_t *offsets;
+    size_t size;
+
+    // Not recording record offsets
+    if (!index || index->loaded || index->invalid)
+        return;
+
+    // Skipped records may have been required
+    if (capture_paused()) {
+        index->invalid = true;
+        return;
+    }
+
+    if (!index->keep)
+        return;
+    index->keep = false;
+
+    if (index->count == index->size) {
+        size = (index->size) ? index->size * 2 : 1024;
+        if (!(offsets = realloc(index->offsets, size * sizeof(uint64_t)))) {
+            index->invalid = true;
+            return;
+        }
+        index->offsets = offsets;
+        index->size = size;
+    }
+
+    index->offsets[index->count++] = capture_mmap_offset(capinfo->file, data);
+}
+
+void
+capture_index_save(capture_info_t *capinfo)
+{
+    capture_index_t *index = capinfo->index;
+    int cancelstate;
+
+    if (!index || index->loaded || index->invalid || modified)
+        return;
+
+    // Do not leave partial files if capture is being closed
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancelstate);
+    capture_index_write(index, capinfo->file);
+    pthread_setcancelstate(cancelstate, NULL);
+}
+
+void
+capture_index_invalidate()
+{
+    modified = true;
+}
@@ -0,0 +1,198 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file capture_index.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to manage index files of mapped pcap files
+ *
+ * While a mapped pcap file is loaded, the offsets of the records that
+ * changed parsed data (SIP messages, RTP packets of known streams, TCP
+ * segments and IP fragments) are stored in an index file next to it.
+ *
+ * When the same file is loaded again with the same parse options, only
+ * the indexed records are read, which gives the same calls and streams
+ * without walking the rest of the file. Index files are discarded if
+ * the pcap file size or modification time changes.
+ *
+ * If RTP packets are not stored and orphan streams are not discovered,
+ * a single input file index stores a summary of each call stream
+ * (counters, quality statistics, activity, RTCP reports and telephone
+ * events) instead of the RTP packet records, which are not read again.
+ * Otherwise every RTP packet of known streams is indexed, as stream
+ * statistics are built from them.
+ */
+
+#ifndef __SNGREP_CAPTURE_INDEX_H
+#define __SNGREP_CAPTURE_INDEX_H
+
+#include "config.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <pcap.h>
+
+//! Index file name suffix
+#define CAPTURE_INDEX_SUFFIX    ".sngidx"
+//! Index file format identifier
+#define CAPTURE_INDEX_MAGIC     "SNGIDX03"
+//! Max length of parse options text
+#define CAPTURE_INDEX_OPTIONS   4096
+
+//! Shorter declaration of capture_index structures
+typedef struct capture_index capture_index_t;
+typedef struct capture_index_header capture_index_header_t;
+
+struct capture_info;
+
+/**
+ * @brief Index file header
+ *
+ * Header is followed by parse options text, record offsets and stream
+ * summaries.
+ */
+struct capture_index_header
+{
+    //! File format identifier
+    char magic[8];
+    //! Indexed file size
+    uint64_t size;
+    //! Indexed file modification time (seconds and nanoseconds)
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    //! Number of record offsets
+    uint64_t count;
+    //! Number of stream summaries
+    uint64_t streams;
+    //! Length of parse options text
+    uint32_t optlen;
+    //! Size of stream summary records
+    uint32_t recsize;
+};
+
+/**
+ * @brief Index of a mapped pcap file
+ */
+struct capture_index
+{
+    //! Index file path
+    char *filename;
+    //! Parse options used to load the file
+    char *options;
+    //! Offsets of required records
+    uint64_t *offsets;
+    //! Number of offsets
+    size_t count;
+    //! Allocated offsets
+    size_t size;
+    //! Stream summaries read from index file
+    u_char *summaries;
+    //! Length of stream summaries data
+    size_t summarylen;
+    //! Stream summaries replace RTP packet records
+    bool streams;
+    //! Offsets have been read from index file
+    bool loaded;
+    //! Last handled record is required
+    bool keep;
+    //! Recorded offsets can not be saved
+    bool invalid;
+};
+
+/**
+ * @brief Open the index file of a capture input file
+ *
+ * If a valid index file exists, only indexed records of the input file
+ * will be read. Otherwise, required records are recorded while file is
+ * parsed.
+ *
+ * @param capinfo Packet capture session information
+ * @param options Text describing current parse options
+ * @param streams Store stream summaries instead of RTP packet records
+ */
+void
+capture_index_open(struct capture_info *capinfo, const char *options, bool streams);
+
+/**
+ * @brief Free index data of a capture input file
+ */
+void
+capture_index_close(struct capture_info *capinfo);
+
+/**
+ * @brief Mark the record being parsed as required
+ *
+ * @param capinfo Packet capture session information
+ */
+void
+capture_index_keep(struct capture_info *capinfo);
+
+/**
+ * @brief Check if RTP packets of known streams are required
+ *
+ * @param capinfo Packet capture session information
+ * @return false if stream summaries replace RTP packet records
+ */
+bool
+capture_index_keep_rtp(struct capture_info *capinfo);
+
+/**
+ * @brief Record the offset of a parsed record if it was required
+ *
+ * @param capinfo Packet capture session information
+ * @param data Record data returned by capture_mmap_next
+ */
+void
+capture_index_add(struct capture_info *capinfo, const u_char *data);
+
+/**
+ * @brief Restore call streams from the summaries of a loaded index
+ *
+ * Must be called once all indexed records have been parsed. Call streams
+ * are replaced with the streams that existed when the index was saved.
+ *
+ * @param capinfo Packet capture session information
+ */
+void
+capture_index_restore(struct capture_info *capinfo);
+
+/**
+ * @brief Write recorded offsets after the input file has been parsed
+ *
+ * Summaries of all call streams are written too if enabled. Nothing is
+ * written if file could not be indexed. Errors writing the index file
+ * are ignored.
+ *
+ * @param capinfo Packet capture session information
+ */
+void
+capture_index_save(struct capture_info *capinfo);
+
+/**
+ * @brief Avoid saving indexes of files being loaded
+ *
+ * Used when parsed data is changed by the user.
+ */
+void
+capture_index_invalidate();
+
+#endif /* __SNGREP_CAPTURE_INDEX_H */
@@ -0,0 +1,434 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file capture_merge.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source code of functions defined in capture_merge.h
+ *
+ */
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include "capture_merge.h"
+#if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
+#include "capture_tls.h"
+#endif
+#include "util.h"
+
+/**
+ * @brief Merge stage global data
+ */
+static capture_merge_t merge = { 0 };
+
+/**
+ * @brief Free a packet that will not be parsed
+ */
+static void
+capture_merge_item_free(capture_merge_item_t *item)
+{
+    if (item->packet)
+        packet_destroy(item->packet);
+    free(item->copy);
+}
+
+/**
+ * @brief Read and decode next packet of an input file
+ *
+ * @return true if a packet has been read, false at end of file
+ */
+static bool
+capture_merge_read(capture_merge_input_t *input, capture_merge_item_t *item)
+{
+    struct pcap_pkthdr *header;
+    const u_char *data;
+    struct tcphdr *tcp;
+    int ret;
+
+    memset(item, 0, sizeof(capture_merge_item_t));
+
+    if (input->capinfo->file) {
+        // Apply capture filter, as libpcap would do
+        do {
+            if (capture_mmap_next(input->capinfo->file, &item->header, &item->data) <= 0)
+                return false;
+        } while (!capture_filter_match(input->capinfo, &item->header, item->data));
+    } else {
+        // Pipes may block here, allow closing capture meanwhile
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+        ret = pcap_next_ex(input->capinfo->handle, &header, &data);
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+        if (ret != 1)
+            return false;
+        // Data is only valid until next record is read
+        if (!(item->copy = malloc(header->caplen)))
+            return false;
+        memcpy(item->copy, data, header->caplen);
+        item->header = *header;
+        item->data = item->copy;
+    }
+
+    // Records that can not be decoded here are parsed by merge thread
+    if ((item->packet = capture_packet_decode(&input->decoder, &item->header, item->data, NULL, &tcp))) {
+        if (tcp) {
+            item->tcp = *tcp;
+            item->segment = true;
+        }
+        // Decoded packets have their own copy of frame data
+        if (item->copy) {
+            free(item->copy);
+            item->copy = NULL;
+            item->data = NULL;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Reader thread main loop
+ */
+static void *
+capture_merge_reader_thread(void *data)
+{
+    capture_merge_input_t *input = (capture_merge_input_t *) data;
+    capture_merge_item_t *item;
+
+    // Only stop while waiting for input data
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+    pthread_mutex_lock(&input->lock);
+    while (input->running) {
+        if (input->count == CAPTURE_MERGE_QUEUE) {
+            pthread_cond_wait(&input->cond, &input->lock);
+            continue;
+        }
+        // Slots after the last queued packet are only used by reader
+        item = &input->queue[(input->first + input->count) % CAPTURE_MERGE_QUEUE];
+        pthread_mutex_unlock(&input->lock);
+
+        if (!capture_merge_read(input, item)) {
+            pthread_mutex_lock(&input->lock);
+            break;
+        }
+
+        pthread_mutex_lock(&input->lock);
+        input->count++;
+        pthread_cond_broadcast(&input->cond);
+    }
+    input->eof = true;
+    pthread_cond_broadcast(&input->cond);
+    pthread_mutex_unlock(&input->lock);
+
+    return NULL;
+}
+
+/**
+ * @brief Check if oldest packet of input a is older than input b one
+ *
+ * Packets with the same timestamp are sorted by input file order.
+ */
+static bool
+capture_merge_before(capture_merge_input_t *a, capture_merge_input_t *b)
+{
+    const struct timeval *ta = &a->queue[a->first].header.ts;
+    const struct timeval *tb = &b->queue[b->first].header.ts;
+
+    if (ta->tv_sec != tb->tv_sec)
+        return ta->tv_sec < tb->tv_sec;
+    if (ta->tv_usec != tb->tv_usec)
+        return ta->tv_usec < tb->tv_usec;
+    return a < b;
+}
+
+/**
+ * @brief Move heap entry down until its children are newer
+ */
+static void
+capture_merge_sift_down(int pos)
+{
+    capture_merge_input_t *input = merge.heap[pos];
+    int child;
+
+    while ((child = pos * 2 + 1) < merge.heapsize) {
+        if (child + 1 < merge.heapsize && capture_merge_before(merge.heap[child + 1], merge.heap[child]))
+            child++;
+        if (!capture_merge_before(merge.heap[child], input))
+            break;
+        merge.heap[pos] = merge.heap[child];
+        pos = child;
+    }
+    merge.heap[pos] = input;
+}
+
+/**
+ * @brief Add an input file with pending packets to the heap
+ */
+static void
+capture_merge_push(capture_merge_input_t *input)
+{
+    int pos = merge.heapsize++;
+    int parent;
+
+    while (pos > 0) {
+        parent = (pos - 1) / 2;
+        if (!capture_merge_before(input, merge.heap[parent]))
+            break;
+        merge.heap[pos] = merge.heap[parent];
+        pos = parent;
+    }
+    merge.heap[pos] = input;
+}
+
+/**
+ * @brief Release an input queue lock when merge thread is cancelled
+ */
+static void
+capture_merge_unlock(void *lock)
+{
+    pthread_mutex_unlock((pthread_mutex_t *) lock);
+}
+
+/**
+ * @brief Wait until an input file has a packet or has been completely read
+ *
+ * @return true if input file has a pending packet
+ */
+static bool
+capture_merge_wait(capture_merge_input_t *input)
+{
+    bool pending;
+    int cancelstate;
+
+    pthread_mutex_lock(&input->lock);
+    pthread_cleanup_push(capture_merge_unlock, &input->lock);
+
+    // Input may be stalled, allow closing capture meanwhile
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &cancelstate);
+    while (input->count == 0 && !input->eof)
+        pthread_cond_wait(&input->cond, &input->lock);
+    pthread_setcancelstate(cancelstate, NULL);
+
+    pending = (input->count > 0);
+    pthread_cleanup_pop(1);
+
+    return pending;
+}
+
+/**
+ * @brief Parse the oldest packet of an input file
+ */
+static void
+capture_merge_parse(capture_merge_input_t *input)
+{
+    capture_merge_item_t item = input->queue[input->first];
+
+    // Free its queue slot
+    pthread_mutex_lock(&input->lock);
+    input->first = (input->first + 1) % CAPTURE_MERGE_QUEUE;
+    input->count--;
+    pthread_cond_broadcast(&input->cond);
+    pthread_mutex_unlock(&input->lock);
+
+    if (item.packet) {
+        if (capture_packet_skip()) {
+            packet_destroy(item.packet);
+        } else {
+            capture_packet_dispatch(input->capinfo, item.packet, item.segment ? &item.tcp : NULL);
+        }
+    } else {
+        parse_packet((u_char *) input->capinfo, &item.header, item.data);
+        free(item.copy);
+    }
+
+    // Only mapped input files are indexed, their records data is kept
+    capture_index_add(input->capinfo, item.data);
+}
+
+/**
+ * @brief Stop reader threads and free all pending packets
+ *
+ * This is also run when merge thread is cancelled.
+ */
+static void
+capture_merge_stop(void *data)
+{
+    capture_merge_input_t *input;
+    int i;
+
+    for (i = 0; i < merge.count; i++) {
+        input = &merge.inputs[i];
+        pthread_mutex_lock(&input->lock);
+        input->running = false;
+        pthread_cond_broadcast(&input->cond);
+        pthread_mutex_unlock(&input->lock);
+        // Reader may be blocked reading a pipe
+        pthread_cancel(input->thread);
+        pthread_join(input->thread, NULL);
+
+        // Discard packets that have not been parsed
+        for (; input->count > 0; input->count--) {
+            capture_merge_item_free(&input->queue[input->first]);
+            input->first = (input->first + 1) % CAPTURE_MERGE_QUEUE;
+        }
+
+        pthread_mutex_destroy(&input->lock);
+        pthread_cond_destroy(&input->cond);
+        free(input->queue);
+        input->capinfo->running = false;
+    }
+
+    free(merge.inputs);
+    free(merge.heap);
+    memset(&merge, 0, sizeof(capture_merge_t));
+}
+
+/**
+ * @brief Merge thread main loop
+ */
+static void *
+capture_merge_thread(void *data)
+{
+    capture_merge_input_t *input;
+    int cancelstate;
+    int i;
+
+    // Only stop between packets if capture is being closed
+    pthread_cleanup_push(capture_merge_stop, NULL);
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancelstate);
+
+    // Sort input files by their oldest packet
+    for (i = 0; i < merge.count; i++) {
+        if (capture_merge_wait(&merge.inputs[i]))
+            capture_merge_push(&merge.inputs[i]);
+    }
+
+    while (merge.heapsize > 0) {
+        input = merge.heap[0];
+        capture_merge_parse(input);
+
+        // Place the input file according to its next packet
+        if (!capture_merge_wait(input))
+            merge.heap[0] = merge.heap[--merge.heapsize];
+        if (merge.heapsize > 0)
+            capture_merge_sift_down(0);
+
+        // Stop here if capture is being closed
+        pthread_setcancelstate(cancelstate, NULL);
+        pthread_testcancel();
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    }
+
+#if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
+    // Wait until all decrypted packets have been parsed
+    if (capture_keyfile())
+        capture_tls_flush();
+#endif
+
+    // Restore streams of indexed records or store them for next loads
+    for (i = 0; i < merge.count; i++) {
+        capture_index_restore(merge.inputs[i].capinfo);
+        capture_index_save(merge.inputs[i].capinfo);
+    }
+
+    pthread_setcancelstate(cancelstate, NULL);
+    pthread_cleanup_pop(1);
+
+    return NULL;
+}
+
+int
+capture_merge_start(vector_t *sources)
+{
+    capture_merge_input_t *input;
+    capture_info_t *capinfo;
+    pthread_t thread;
+    vector_iter_t it;
+    int i;
+
+    // Count input files
+    it = vector_iterator(sources);
+    while ((capinfo = vector_iterator_next(&it))) {
+        if (capinfo->infile)
+            merge.count++;
+    }
+
+    // Nothing to merge
+    if (merge.count < 2) {
+        merge.count = 0;
+        return 0;
+    }
+
+    merge.inputs = calloc(merge.count, sizeof(capture_merge_input_t));
+    merge.heap = calloc(merge.count, sizeof(capture_merge_input_t *));
+    if (!merge.inputs || !merge.heap) {
+        free(merge.inputs);
+        free(merge.heap);
+        memset(&merge, 0, sizeof(capture_merge_t));
+        return 1;
+    }
+
+    // Start one reader thread per input file
+    i = 0;
+    it = vector_iterator(sources);
+    while ((capinfo = vector_iterator_next(&it))) {
+        if (!capinfo->infile)
+            continue;
+
+        input = &merge.inputs[i++];
+        input->capinfo = capinfo;
+        // Readers decode packets without touching reassembly data
+        input->decoder = *capinfo;
+        input->decoder.ip_reasm = NULL;
+        input->decoder.tcp_reasm = NULL;
+        input->queue = calloc(CAPTURE_MERGE_QUEUE, sizeof(capture_merge_item_t));
+        input->running = true;
+        pthread_mutex_init(&input->lock, NULL);
+        pthread_cond_init(&input->cond, NULL);
+        capinfo->running = true;
+
+        if (!input->queue || pthread_create(&input->thread, NULL, capture_merge_reader_thread, input) != 0) {
+            // Stop readers started so far
+            merge.count = i - 1;
+            pthread_mutex_destroy(&input->lock);
+            pthread_cond_destroy(&input->cond);
+            free(input->queue);
+            capinfo->running = false;
+            capture_merge_stop(NULL);
+            return 1;
+        }
+    }
+
+    if (pthread_create(&thread, NULL, capture_merge_thread, NULL) != 0) {
+        capture_merge_stop(NULL);
+        return 1;
+    }
+
+    // Merged sources are stopped through the merge thread
+    it = vector_iterator(sources);
+    while ((capinfo = vector_iterator_next(&it))) {
+        if (capinfo->infile)
+            capinfo->capture_t = thread;
+    }
+
+    return 0;
+}
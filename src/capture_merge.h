@@ -0,0 +1,124 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file capture_merge.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to read several input files in timestamp order
+ *
+ * When more than one input file is loaded, each file is read by its own
+ * thread that also decodes its packets ahead of the parse stage. A single
+ * merge thread then takes the oldest pending packet of all files and
+ * parses it, so calls captured in several points get their messages in
+ * timestamp order.
+ */
+
+#ifndef __SNGREP_CAPTURE_MERGE_H
+#define __SNGREP_CAPTURE_MERGE_H
+
+#include "config.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include "capture.h"
+#include "packet.h"
+
+//! Max number of packets read ahead from each input file
+#define CAPTURE_MERGE_QUEUE 1024
+
+//! Shorter declaration of capture merge structures
+typedef struct capture_merge_item capture_merge_item_t;
+typedef struct capture_merge_input capture_merge_input_t;
+typedef struct capture_merge capture_merge_t;
+
+/**
+ * @brief Packet read from an input file waiting to be parsed
+ */
+struct capture_merge_item
+{
+    //! Record header
+    struct pcap_pkthdr header;
+    //! Record data
+    const u_char *data;
+    //! Copy of record data (NULL if data is in a mapped file)
+    u_char *copy;
+    //! Decoded packet (NULL if record must be parsed by merge thread)
+    packet_t *packet;
+    //! Copy of packet TCP header
+    struct tcphdr tcp;
+    //! Packet is a TCP segment
+    bool segment;
+};
+
+/**
+ * @brief Input file being merged
+ */
+struct capture_merge_input
+{
+    //! Input file capture session
+    capture_info_t *capinfo;
+    //! Copy of capture session without reassembly data
+    capture_info_t decoder;
+    //! Reader thread
+    pthread_t thread;
+    //! Packets read ahead
+    capture_merge_item_t *queue;
+    //! Position of oldest packet and number of packets in queue
+    int first, count;
+    //! All packets have been read
+    bool eof;
+    //! Reader must keep running
+    bool running;
+    //! Queue lock
+    pthread_mutex_t lock;
+    //! Signaled when a packet is queued or dequeued
+    pthread_cond_t cond;
+};
+
+/**
+ * @brief Merge stage data
+ */
+struct capture_merge
+{
+    //! Input files
+    capture_merge_input_t *inputs;
+    //! Number of input files
+    int count;
+    //! Input files with pending packets, sorted by their oldest packet
+    capture_merge_input_t **heap;
+    //! Number of input files in heap
+    int heapsize;
+};
+
+/**
+ * @brief Start reading all input files in timestamp order
+ *
+ * Nothing is done with less than two input files. Otherwise, merged
+ * sources are marked as running and share the merge thread as their
+ * capture thread.
+ *
+ * @param sources Capture sources
+ * @return 0 on success, 1 otherwise
+ */
+int
+capture_merge_start(vector_t *sources);
+
+#endif /* __SNGREP_CAPTURE_MERGE_H */
@@ -0,0 +1,400 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file capture_mmap.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source code of functions defined in capture_mmap.h
+ *
+ */
+#include "config.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "capture_mmap.h"
+#include "capture.h"
+#include "sip.h"
+#include "util.h"
+
+//! Classic pcap file header size
+#define CAPTURE_MMAP_FILE_HDRLEN    24
+//! Classic pcap record header size
+#define CAPTURE_MMAP_RECORD_HDRLEN  16
+
+/**
+ * @brief Read a 32 bits value from file contents
+ */
+static uint32_t
+capture_mmap_read32(capture_mmap_t *file, size_t pos)
+{
+    uint32_t value;
+
+    memcpy(&value, file->data + pos, sizeof(value));
+    return (file->swapped) ? __builtin_bswap32(value) : value;
+}
+
+capture_mmap_t *
+capture_mmap_open(const char *filename)
+{
+    capture_mmap_t *file;
+    struct stat sb;
+    void *data;
+    uint32_t magic;
+    uint16_t major;
+    int fd;
+
+    if ((fd = open(filename, O_RDONLY)) == -1)
+        return NULL;
+
+    // Only regular files can be mapped
+    if (fstat(fd, &sb) == -1 || !S_ISREG(sb.st_mode)
+        || sb.st_size < CAPTURE_MMAP_FILE_HDRLEN || (uint64_t) sb.st_size > SIZE_MAX) {
+        close(fd);
+        return NULL;
+    }
+
+    data = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return NULL;
+
+#ifdef MADV_SEQUENTIAL
+    // File will be read once from start to end
+    madvise(data, sb.st_size, MADV_SEQUENTIAL);
+#endif
+
+    if (!(file = sng_malloc(sizeof(capture_mmap_t)))) {
+        munmap(data, sb.st_size);
+        return NULL;
+    }
+    file->data = data;
+    file->size = sb.st_size;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+    file->mtime = sb.st_mtim;
+#else
+    file->mtime.tv_sec = sb.st_mtime;
+#endif
+    file->pos = CAPTURE_MMAP_FILE_HDRLEN;
+
+    // Check file format and byte order
+    memcpy(&magic, file->data, sizeof(magic));
+    if (magic == __builtin_bswap32(CAPTURE_MMAP_MAGIC_USEC)
+        || magic == __builtin_bswap32(CAPTURE_MMAP_MAGIC_NSEC)) {
+        file->swapped = true;
+        magic = __builtin_bswap32(magic);
+    }
+    memcpy(&major, file->data + 4, sizeof(major));
+    if (file->swapped)
+        major = __builtin_bswap16(major);
+
+    if ((magic != CAPTURE_MMAP_MAGIC_USEC && magic != CAPTURE_MMAP_MAGIC_NSEC) || major != 2) {
+        capture_mmap_close(file);
+        return NULL;
+    }
+    file->nsec = (magic == CAPTURE_MMAP_MAGIC_NSEC);
+
+    // Same limits libpcap applies to record lengths
+    file->snaplen = capture_mmap_read32(file, 16);
+    if (file->snaplen == 0 || file->snaplen > MAXIMUM_SNAPLEN)
+        file->snaplen = MAXIMUM_SNAPLEN;
+
+    return file;
+}
+
+void
+capture_mmap_close(capture_mmap_t *file)
+{
+    if (!file)
+        return;
+
+    munmap((void *) file->data, file->size);
+    sng_free(file);
+}
+
+int
+capture_mmap_next(capture_mmap_t *file, struct pcap_pkthdr *header, const u_char **data)
+{
+    uint32_t caplen;
+
+    // Only read the given records
+    if (file->offsets) {
+        if (file->next == file->count)
+            return 0;
+        file->pos = file->offsets[file->next++];
+    }
+
+    // End of file
+    if (file->pos == file->size)
+        return 0;
+
+    if (file->size - file->pos < CAPTURE_MMAP_RECORD_HDRLEN)
+        return -1;
+
+    header->ts.tv_sec = capture_mmap_read32(file, file->pos);
+    header->ts.tv_usec = capture_mmap_read32(file, file->pos + 4);
+    if (file->nsec)
+        header->ts.tv_usec /= 1000;
+    caplen = capture_mmap_read32(file, file->pos + 8);
+    header->len = capture_mmap_read32(file, file->pos + 12);
+    file->pos += CAPTURE_MMAP_RECORD_HDRLEN;
+
+    // Invalid or incomplete record
+    if (caplen > MAXIMUM_SNAPLEN || file->size - file->pos < caplen)
+        return -1;
+
+    // Data after snaplen is not handled
+    header->caplen = (caplen > file->snaplen) ? file->snaplen : caplen;
+    *data = file->data + file->pos;
+    file->pos += caplen;
+
+    return 1;
+}
+
+uint64_t
+capture_mmap_offset(capture_mmap_t *file, const u_char *data)
+{
+    return data - file->data - CAPTURE_MMAP_RECORD_HDRLEN;
+}
+
+/**
+ * @brief Fill a parse chunk with the next records of a mapped file
+ *
+ * @return number of records in the chunk
+ */
+static int
+capture_mmap_fill(capture_mmap_t *file, capture_mmap_chunk_t *chunk)
+{
+    capture_mmap_record_t *record;
+
+    for (chunk->count = 0; chunk->count < CAPTURE_MMAP_CHUNK; chunk->count++) {
+        record = &chunk->records[chunk->count];
+        if (capture_mmap_next(file, &record->header, &record->data) <= 0)
+            break;
+        record->packet = NULL;
+        record->segment = false;
+        record->filtered = false;
+    }
+    chunk->done = false;
+
+    return chunk->count;
+}
+
+/**
+ * @brief Filter and decode the records of a parse chunk
+ */
+static void
+capture_mmap_decode(capture_mmap_parser_t *parser, capture_mmap_chunk_t *chunk)
+{
+    capture_mmap_record_t *record;
+    struct tcphdr *tcp;
+    int i;
+
+    for (i = 0; i < chunk->count; i++) {
+        record = &chunk->records[i];
+
+        // Apply capture filter, as libpcap would do
+        if (!capture_filter_match(parser->capinfo, &record->header, record->data)) {
+            record->filtered = true;
+            continue;
+        }
+
+        // Records that can not be decoded here are parsed by capture thread
+        record->packet = capture_packet_decode(parser->capinfo, &record->header, record->data, NULL, &tcp);
+        if (record->packet && tcp) {
+            record->tcp = *tcp;
+            record->segment = true;
+        } else if (record->packet) {
+            // Check SIP first line here (TCP payloads change when reassembled)
+            sip_precheck_packet(record->packet);
+        }
+    }
+}
+
+/**
+ * @brief Decoding thread main loop
+ */
+static void *
+capture_mmap_worker_thread(void *data)
+{
+    capture_mmap_parser_t *parser = (capture_mmap_parser_t *) data;
+    capture_mmap_chunk_t *chunk;
+
+    pthread_mutex_lock(&parser->lock);
+    while (parser->running) {
+        if (parser->decode == parser->read) {
+            pthread_cond_wait(&parser->cond, &parser->lock);
+            continue;
+        }
+        chunk = &parser->chunks[parser->decode++ % parser->size];
+        pthread_mutex_unlock(&parser->lock);
+
+        capture_mmap_decode(parser, chunk);
+
+        pthread_mutex_lock(&parser->lock);
+        chunk->done = true;
+        pthread_cond_broadcast(&parser->cond);
+    }
+    pthread_mutex_unlock(&parser->lock);
+
+    return NULL;
+}
+
+/**
+ * @brief Stop decoding threads and free all pending packets
+ *
+ * This is also run when capture thread is cancelled while parsing.
+ */
+static void
+capture_mmap_parser_stop(void *data)
+{
+    capture_mmap_parser_t *parser = (capture_mmap_parser_t *) data;
+    capture_mmap_chunk_t *chunk;
+    uint32_t seq;
+    int i;
+
+    pthread_mutex_lock(&parser->lock);
+    parser->running = false;
+    pthread_cond_broadcast(&parser->cond);
+    pthread_mutex_unlock(&parser->lock);
+
+    for (i = 0; i < parser->count; i++)
+        pthread_join(parser->workers[i], NULL);
+
+    // Discard packets that have not been parsed
+    for (seq = parser->parse; seq != parser->read; seq++) {
+        chunk = &parser->chunks[seq % parser->size];
+        for (i = 0; i < chunk->count; i++) {
+            if (chunk->records[i].packet)
+                packet_destroy(chunk->records[i].packet);
+        }
+    }
+
+    pthread_mutex_destroy(&parser->lock);
+    pthread_cond_destroy(&parser->cond);
+    free(parser->chunks);
+    free(parser->workers);
+    sng_free(parser->capinfo);
+}
+
+int
+capture_mmap_parse(capture_info_t *capinfo, int workers)
+{
+    capture_mmap_parser_t parser = { 0 };
+    capture_mmap_chunk_t *chunk;
+    capture_mmap_record_t *record;
+    bool eof = false;
+    int cancelstate;
+    int i;
+
+    if (workers <= 0)
+        return 1;
+
+    if (workers > CAPTURE_MMAP_WORKERS)
+        workers = CAPTURE_MMAP_WORKERS;
+
+    // Workers decode packets without touching reassembly data
+    if (!(parser.capinfo = sng_malloc(sizeof(capture_info_t))))
+        return 1;
+    memcpy(parser.capinfo, capinfo, sizeof(capture_info_t));
+    parser.capinfo->ip_reasm = NULL;
+    parser.capinfo->tcp_reasm = NULL;
+
+    parser.size = workers * CAPTURE_MMAP_PENDING;
+    parser.chunks = calloc(parser.size, sizeof(capture_mmap_chunk_t));
+    parser.workers = calloc(workers, sizeof(pthread_t));
+    parser.running = true;
+    pthread_mutex_init(&parser.lock, NULL);
+    pthread_cond_init(&parser.cond, NULL);
+
+    if (parser.chunks && parser.workers) {
+        for (i = 0; i < workers; i++) {
+            if (pthread_create(&parser.workers[i], NULL, capture_mmap_worker_thread, &parser) != 0)
+                break;
+            parser.count++;
+        }
+    }
+
+    // Unable to start any thread, parse in capture thread
+    if (parser.count == 0) {
+        capture_mmap_parser_stop(&parser);
+        return 1;
+    }
+
+    // Only stop between records if capture thread is cancelled
+    pthread_cleanup_push(capture_mmap_parser_stop, &parser);
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancelstate);
+
+    while (true) {
+        // Split file in chunks while there are free ones
+        while (!eof && parser.read - parser.parse < parser.size) {
+            if (capture_mmap_fill(capinfo->file, &parser.chunks[parser.read % parser.size]) == 0) {
+                eof = true;
+                break;
+            }
+            pthread_mutex_lock(&parser.lock);
+            parser.read++;
+            pthread_cond_broadcast(&parser.cond);
+            pthread_mutex_unlock(&parser.lock);
+        }
+
+        // All records have been parsed
+        if (parser.parse == parser.read)
+            break;
+
+        // Wait until oldest chunk has been decoded
+        chunk = &parser.chunks[parser.parse % parser.size];
+        pthread_mutex_lock(&parser.lock);
+        while (!chunk->done)
+            pthread_cond_wait(&parser.cond, &parser.lock);
+        pthread_mutex_unlock(&parser.lock);
+
+        // Parse decoded packets in file order
+        for (i = 0; i < chunk->count; i++) {
+            record = &chunk->records[i];
+            if (record->packet) {
+                if (capture_packet_skip()) {
+                    packet_destroy(record->packet);
+                } else {
+                    capture_packet_dispatch(capinfo, record->packet, record->segment ? &record->tcp : NULL);
+                }
+                record->packet = NULL;
+            } else if (!record->filtered) {
+                parse_packet((u_char *) capinfo, &record->header, record->data);
+            }
+            capture_index_add(capinfo, record->data);
+
+            // Stop here if capture is being closed
+            pthread_setcancelstate(cancelstate, NULL);
+            pthread_testcancel();
+            pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+        }
+        parser.parse++;
+    }
+
+    pthread_setcancelstate(cancelstate, NULL);
+    pthread_cleanup_pop(1);
+
+    return 0;
+}
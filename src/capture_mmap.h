@@ -0,0 +1,209 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file capture_mmap.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to read pcap files mapped in memory
+ *
+ * Classic pcap files (any byte order, microsecond or nanosecond
+ * timestamps) stored in regular files are mapped in memory and their
+ * records are walked in place, so packet data is handed to the parse
+ * stage without being read into intermediate buffers.
+ *
+ * Other inputs (pcapng files, pipes, compressed files) are read using
+ * libpcap.
+ *
+ * Mapped files can also be decoded by worker threads: the capture thread
+ * splits the file in chunks of records that workers filter and decode in
+ * parallel, then handles the decoded packets of each chunk in file order,
+ * so IP and TCP reassembly and SIP/RTP parsing see the same packets in the
+ * same order as a sequential load.
+ */
+
+#ifndef __SNGREP_CAPTURE_MMAP_H
+#define __SNGREP_CAPTURE_MMAP_H
+
+#include "config.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <pcap.h>
+#include <pthread.h>
+#include <netinet/tcp.h>
+#include "packet.h"
+
+//! Classic pcap file magic numbers
+#define CAPTURE_MMAP_MAGIC_USEC 0xa1b2c3d4
+#define CAPTURE_MMAP_MAGIC_NSEC 0xa1b23c4d
+
+//! Number of records in a parse chunk
+#define CAPTURE_MMAP_CHUNK      256
+//! Max number of parse chunks per worker
+#define CAPTURE_MMAP_PENDING    2
+//! Max number of parse threads
+#define CAPTURE_MMAP_WORKERS    64
+
+//! Shorter declaration of capture_mmap structures
+typedef struct capture_mmap capture_mmap_t;
+typedef struct capture_mmap_record capture_mmap_record_t;
+typedef struct capture_mmap_chunk capture_mmap_chunk_t;
+typedef struct capture_mmap_parser capture_mmap_parser_t;
+
+struct capture_info;
+
+/**
+ * @brief Memory mapped pcap file
+ */
+struct capture_mmap
+{
+    //! File contents
+    const u_char *data;
+    //! File size
+    size_t size;
+    //! File modification time
+    struct timespec mtime;
+    //! Offset of next record
+    size_t pos;
+    //! Offsets of the only records to read (NULL to read all records)
+    const uint64_t *offsets;
+    //! Number of offsets and position of next one
+    size_t count, next;
+    //! Max length of record data
+    uint32_t snaplen;
+    //! File was written with different byte order
+    bool swapped;
+    //! Record timestamps have nanosecond precision
+    bool nsec;
+};
+
+/**
+ * @brief Record of a parse chunk
+ */
+struct capture_mmap_record
+{
+    //! Record header
+    struct pcap_pkthdr header;
+    //! Record data
+    const u_char *data;
+    //! Decoded packet (NULL if record must be parsed by capture thread)
+    packet_t *packet;
+    //! Copy of packet TCP header
+    struct tcphdr tcp;
+    //! Packet is a TCP segment
+    bool segment;
+    //! Record does not match capture filter
+    bool filtered;
+};
+
+/**
+ * @brief Group of consecutive records decoded by the same worker
+ */
+struct capture_mmap_chunk
+{
+    //! Chunk records
+    capture_mmap_record_t records[CAPTURE_MMAP_CHUNK];
+    //! Number of records in chunk
+    int count;
+    //! Chunk records have been decoded
+    bool done;
+};
+
+/**
+ * @brief Parallel decoding data of a mapped file
+ */
+struct capture_mmap_parser
+{
+    //! Copy of capture session without reassembly data
+    struct capture_info *capinfo;
+    //! Decoding threads
+    pthread_t *workers;
+    //! Number of decoding threads
+    int count;
+    //! Circular list of chunks
+    capture_mmap_chunk_t *chunks;
+    //! Number of chunks in the list
+    uint32_t size;
+    //! Sequence of next chunk to fill, decode and parse
+    uint32_t read, decode, parse;
+    //! Chunk indexes lock
+    pthread_mutex_t lock;
+    //! Signaled when a chunk is filled or decoded
+    pthread_cond_t cond;
+    //! Workers must keep running
+    bool running;
+};
+
+/**
+ * @brief Map a pcap file in memory
+ *
+ * @param filename Pcap file path
+ * @return mapped file or NULL if file can not be read this way
+ */
+capture_mmap_t *
+capture_mmap_open(const char *filename);
+
+/**
+ * @brief Unmap a pcap file
+ */
+void
+capture_mmap_close(capture_mmap_t *file);
+
+/**
+ * @brief Get next record of a mapped pcap file
+ *
+ * Record data points to the mapped file contents and is valid until
+ * the file is closed.
+ *
+ * @param file Mapped pcap file
+ * @param header Filled with record header
+ * @param data Filled with record data
+ * @return 1 if a record has been read, 0 at end of file, -1 if file is truncated
+ */
+int
+capture_mmap_next(capture_mmap_t *file, struct pcap_pkthdr *header, const u_char **data);
+
+/**
+ * @brief Get the file offset of a record
+ *
+ * @param file Mapped pcap file
+ * @param data Record data returned by capture_mmap_next
+ * @return offset of record header
+ */
+uint64_t
+capture_mmap_offset(capture_mmap_t *file, const u_char *data);
+
+/**
+ * @brief Parse all records of a mapped file using worker threads
+ *
+ * Packets are parsed in the calling thread in the same order they are
+ * stored in the file.
+ *
+ * @param capinfo Packet capture session information
+ * @param workers Number of decoding threads
+ * @return 0 if file has been parsed, 1 if no decoding thread could be started
+ */
+int
+capture_mmap_parse(struct capture_info *capinfo, int workers);
+
+#endif /* __SNGREP_CAPTURE_MMAP_H */
@@ -33,12 +33,11 @@
 #include <unistd.h>
 #include "capture.h"
 #include "capture_openssl.h"
+#include "capture_tls.h"
 #include "option.h"
 #include "util.h"
 #include "sip.h"
 
-struct SSLConnection *connections;
-
 struct CipherData ciphers[] = {
 /*  { number, encoder,    ivlen, bits, digest, diglen, mode }, */
     { 0x002F, ENC_AES,    16, 128, DIG_SHA1,   20, MODE_CBC },   /* TLS_RSA_WITH_AES_128_CBC_SHA     */
@@ -191,14 +190,13 @@ PRF(struct SSLConnection *conn,
 }
 
 struct SSLConnection *
-tls_connection_create(struct in_addr caddr, uint16_t cport, struct in_addr saddr, uint16_t sport) {
+tls_connection_create(struct SSLConnections *connections, struct SSLEndpoint client,
+                      struct SSLEndpoint server) {
     struct SSLConnection *conn = NULL;
     conn = sng_malloc(sizeof(struct SSLConnection));
 
-    memcpy(&conn->client_addr, &caddr, sizeof(struct in_addr));
-    memcpy(&conn->server_addr, &saddr, sizeof(struct in_addr));
-    memcpy(&conn->client_port, &cport, sizeof(uint16_t));
-    memcpy(&conn->server_port, &sport, sizeof(uint16_t));
+    conn->client = client;
+    conn->server = server;
 
 #if MODSSL_USE_OPENSSL_PRE_1_1_API
     SSL_library_init();
@@ -220,9 +218,8 @@ tls_connection_create(struct in_addr caddr, uint16_t cport, struct in_addr saddr
     conn->client_cipher_ctx = EVP_CIPHER_CTX_new();
     conn->server_cipher_ctx = EVP_CIPHER_CTX_new();
 
-    // Add this connection to the list
-    conn->next = connections;
-    connections = conn;
+    // Add this connection to the hash table
+    tls_connection_add(connections, conn);
 
     return conn;
 }
@@ -230,21 +227,13 @@ tls_connection_create(struct in_addr caddr, uint16_t cport, struct in_addr saddr
 void
 tls_connection_destroy(struct SSLConnection *conn)
 {
-    struct SSLConnection *c;
-
-    // Remove connection from connections list
-    if (conn == connections) {
-        connections = conn->next;
-    } else {
-        for (c = connections; c; c = c->next) {
-            if (c->next == conn) {
-                c->next = conn->next;
-                break;
-            }
-        }
-    }
+    // Remove connection from connections hash table
+    tls_connection_remove(conn);
 
     // Deallocate connection memory
+    free(conn->record[0].data);
+    free(conn->record[1].data);
+    free(conn->plaintext.data);
     EVP_CIPHER_CTX_free(conn->client_cipher_ctx);
     EVP_CIPHER_CTX_free(conn->server_cipher_ctx);
     SSL_CTX_free(conn->ssl_ctx);
@@ -297,113 +286,6 @@ tls_check_keyfile(const char *keyfile)
     return 1;
 }
 
-int
-tls_connection_dir(struct SSLConnection *conn, struct in_addr addr, uint16_t port)
-{
-    if (conn->client_addr.s_addr == addr.s_addr && conn->client_port == port)
-        return 0;
-    if (conn->server_addr.s_addr == addr.s_addr && conn->server_port == port)
-        return 1;
-    return -1;
-}
-
-struct SSLConnection*
-tls_connection_find(struct in_addr src, uint16_t sport, struct in_addr dst, uint16_t dport) {
-    struct SSLConnection *conn;
-
-    for (conn = connections; conn; conn = conn->next) {
-        if (tls_connection_dir(conn, src, sport) == 0 &&
-                tls_connection_dir(conn, dst, dport) == 1) {
-            return conn;
-        }
-        if (tls_connection_dir(conn, src, sport) == 1 &&
-                tls_connection_dir(conn, dst, dport) == 0) {
-            return conn;
-        }
-    }
-    return NULL;
-}
-
-int
-tls_process_segment(packet_t *packet, struct tcphdr *tcp)
-{
-    struct SSLConnection *conn;
-    const u_char *payload = packet_payload(packet);
-    uint32_t size_payload = packet_payloadlen(packet);
-    uint8_t *out;
-    uint32_t outl = packet->payload_len;
-    out = sng_malloc(outl);
-    struct in_addr ip_src, ip_dst;
-    uint16_t sport = packet->src.port;
-    uint16_t dport = packet->dst.port;
-    address_t tlsserver = capture_tls_server();
-
-    // Convert addresses
-    inet_pton(AF_INET, packet->src.ip, &ip_src);
-    inet_pton(AF_INET, packet->dst.ip, &ip_dst);
-
-    // Try to find a session for this ip
-    if ((conn = tls_connection_find(ip_src, sport, ip_dst, dport))) {
-        // Update last connection direction
-        conn->direction = tls_connection_dir(conn, ip_src, sport);
-
-        // Check current connection state
-        switch (conn->state) {
-            case TCP_STATE_SYN:
-                // First SYN received, this package must be SYN/ACK
-                if (tcp->th_flags & TH_SYN & ~TH_ACK)
-                    conn->state = TCP_STATE_SYN_ACK;
-                break;
-            case TCP_STATE_SYN_ACK:
-                // We expect an ACK packet here
-                if (tcp->th_flags & ~TH_SYN & TH_ACK)
-                    conn->state = TCP_STATE_ESTABLISHED;
-                break;
-            case TCP_STATE_ACK:
-            case TCP_STATE_ESTABLISHED:
-                // Check if we have a SSLv2 Handshake
-                if(tls_record_handshake_is_ssl2(conn, payload, size_payload)) {
-                    if (tls_process_record_ssl2(conn, payload, size_payload, &out, &outl) != 0)
-                        outl = 0;
-
-                } else {
-                    // Process data segment!
-                    if (tls_process_record(conn, payload, size_payload, &out, &outl) != 0)
-                        outl = 0;
-                }
-
-                // This seems a SIP TLS packet ;-)
-                if ((int32_t) outl > 0) {
-                    packet_set_payload(packet, out, outl);
-                    packet_set_type(packet, PACKET_SIP_TLS);
-                    return 0;
-                }
-                break;
-            case TCP_STATE_FIN:
-            case TCP_STATE_CLOSED:
-                // We can delete this connection
-                tls_connection_destroy(conn);
-                break;
-        }
-    } else {
-        if (tcp->th_flags & TH_SYN & ~TH_ACK) {
-            // Only create new connections whose destination is tlsserver
-            if (tlsserver.port) {
-                if (addressport_equals(tlsserver, packet->dst)) {
-                    // New connection, store it status and leave
-                    tls_connection_create(ip_src, sport, ip_dst, dport);
-                }
-            } else {
-                // New connection, store it status and leave
-                tls_connection_create(ip_src, sport, ip_dst, dport);
-            }
-        }
-    }
-
-    sng_free(out);
-    return 0;
-}
-
 int
 tls_record_handshake_is_ssl2(struct SSLConnection *conn, const uint8_t *payload,
                    const int len)
@@ -420,7 +302,7 @@ tls_record_handshake_is_ssl2(struct SSLConnection *conn, const uint8_t *payload,
 
 int
 tls_process_record_ssl2(struct SSLConnection *conn, const uint8_t *payload,
-                   const int len, uint8_t **out, uint32_t *outl)
+                   const int len)
 {
     int record_len_len;
     uint32_t record_len;
@@ -458,7 +340,7 @@ tls_process_record_ssl2(struct SSLConnection *conn, const uint8_t *payload,
 
         // Check we have a TLS handshake
         if (clienthello->client_version.major != 0x03) {
-            tls_connection_destroy(conn);
+            conn->state = TCP_STATE_CLOSED;
             return 1;
         }
 
@@ -466,7 +348,7 @@ tls_process_record_ssl2(struct SSLConnection *conn, const uint8_t *payload,
         if (clienthello->client_version.minor != 0x01
                 && clienthello->client_version.minor != 0x02
                 && clienthello->client_version.minor != 0x03) {
-            tls_connection_destroy(conn);
+            conn->state = TCP_STATE_CLOSED;
             return 1;
         }
 
@@ -487,19 +369,13 @@ tls_process_record_ssl2(struct SSLConnection *conn, const uint8_t *payload,
 
 int
 tls_process_record(struct SSLConnection *conn, const uint8_t *payload,
-                   const int len, uint8_t **out, uint32_t *outl)
+                   const int len)
 {
     struct TLSPlaintext *record;
-    int record_len;
     const opaque *fragment;
 
-    // No record data here!
-    if (len == 0)
-        return 1;
-
     // Get Record data
     record = (struct TLSPlaintext *) payload;
-    record_len = sizeof(struct TLSPlaintext) + UINT16_INT(record->length);
 
     // Process record fragment
     if (UINT16_INT(record->length) > 0) {
@@ -526,7 +402,7 @@ tls_process_record(struct SSLConnection *conn, const uint8_t *payload,
             case application_data:
                 if (conn->encrypted) {
                     // Decrypt application data using MasterSecret
-                    tls_process_record_data(conn, fragment, UINT16_INT(record->length), out, outl);
+                    tls_process_record_data(conn, fragment, UINT16_INT(record->length));
                 }
                 break;
             default:
@@ -534,12 +410,6 @@ tls_process_record(struct SSLConnection *conn, const uint8_t *payload,
         }
     }
 
-    // MultiRecord packet
-    if (len > record_len) {
-        *outl = len;
-        return tls_process_record(conn, payload + record_len, len - record_len, out, outl);
-    }
-
     return 0;
 }
 
@@ -569,7 +439,7 @@ tls_process_record_handshake(struct SSLConnection *conn, const opaque *fragment,
 
                 // Check we have a TLS handshake
                 if (!(clienthello->client_version.major == 0x03)) {
-                    tls_connection_destroy(conn);
+                    conn->state = TCP_STATE_CLOSED;
                     return 1;
                 }
 
@@ -577,7 +447,7 @@ tls_process_record_handshake(struct SSLConnection *conn, const opaque *fragment,
                 if (clienthello->client_version.minor != 0x01
                         && clienthello->client_version.minor != 0x02
                         && clienthello->client_version.minor != 0x03) {
-                    tls_connection_destroy(conn);
+                    conn->state = TCP_STATE_CLOSED;
                     return 1;
                 }
 
@@ -594,7 +464,7 @@ tls_process_record_handshake(struct SSLConnection *conn, const opaque *fragment,
                        sizeof(uint16_t));
                 // Check if we have a handled cipher
                 if (tls_connection_load_cipher(conn) != 0) {
-                    tls_connection_destroy(conn);
+                    conn->state = TCP_STATE_CLOSED;
                     return 1;
                 }
                 break;
@@ -718,11 +588,10 @@ tls_process_record_handshake(struct SSLConnection *conn, const opaque *fragment,
                 break;
             default:
                 if (conn->encrypted) {
-                    // Encrypted Hanshake Message
-                    uint8_t *decoded = sng_malloc(len);
-                    uint32_t decodedlen = len;
-                    tls_process_record_data(conn, fragment, len, &decoded, &decodedlen);
-                    sng_free(decoded);
+                    // Encrypted Hanshake Message (decrypted data is discarded)
+                    uint32_t plainlen = conn->plaintext.len;
+                    tls_process_record_data(conn, fragment, len);
+                    conn->plaintext.len = plainlen;
                 }
                 break;
         }
@@ -733,7 +602,7 @@ tls_process_record_handshake(struct SSLConnection *conn, const opaque *fragment,
 
 int
 tls_process_record_data(struct SSLConnection *conn, const opaque *fragment,
-                        const int len, uint8_t **out, uint32_t *outl)
+                        const int len)
 {
     EVP_CIPHER_CTX *evp;
     uint8_t pad;
@@ -782,8 +651,15 @@ tls_process_record_data(struct SSLConnection *conn, const opaque *fragment,
         fragment += 8;
     }
 
-    size_t dlen = len;
-    uint8_t *decoded = sng_malloc(dlen);
+    // Not enough data to decrypt
+    if ((int32_t) flen <= 0)
+        return 0;
+
+    // Decrypt into connection plaintext buffer
+    size_t dlen = 0;
+    uint8_t *decoded = tls_buffer_reserve(&conn->plaintext, flen);
+    if (!decoded)
+        return 0;
     EVP_Cipher(evp, decoded, (unsigned char *) fragment, flen);
     tls_debug_print_hex("Plaintext", decoded, flen);
 
@@ -793,23 +669,17 @@ tls_process_record_data(struct SSLConnection *conn, const opaque *fragment,
         dlen = flen - (pad + 1);
         tls_debug_print_hex("Mac", decoded + (dlen - 20), 20);
 
-        if ((int32_t) dlen > 0 && dlen <= *outl) {
-            memcpy(*out, decoded, dlen);
-            *outl = dlen - 20 /* Trailing MAC */;
-        }
+        // Strip trailing MAC
+        dlen = ((int32_t) dlen > 20) ? dlen - 20 : 0;
     }
 
     // Strip auth tag from decoded data
     if (conn->cipher_data.mode == MODE_GCM) {
-        if ((int32_t)flen > 16) {
-            memcpy(*out, decoded, dlen);
-            *outl = flen - 16;
-        }
+        dlen = ((int32_t) flen > 16) ? flen - 16 : 0;
     }
 
-    // Cleanup decoded memory
-    sng_free(decoded);
-    return *outl;
+    conn->plaintext.len += dlen;
+    return dlen;
 }
 
 int
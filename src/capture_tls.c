@@ -0,0 +1,614 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file capture_tls.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source code of functions defined in capture_tls.h
+ *
+ */
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "capture_tls.h"
+#include "util.h"
+
+/**
+ * @brief TLS decryption stage global data
+ */
+static capture_tls_t tls = { 0 };
+
+/**
+ * @brief Hash function for connection endpoints
+ */
+static size_t
+tls_endpoint_hash(struct SSLEndpoint addr)
+{
+    // dbj2 - http://www.cse.yorku.ca/~oz/hash.html
+    const uint8_t *data = (const uint8_t *) &addr.addr;
+    size_t len = (addr.family == AF_INET6) ? sizeof(struct in6_addr) : sizeof(struct in_addr);
+    size_t hash = 5381;
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        hash = ((hash << 5) + hash) ^ data[i];
+    hash = ((hash << 5) + hash) ^ (addr.port >> 8);
+    hash = ((hash << 5) + hash) ^ (addr.port & 0xff);
+    return hash;
+}
+
+/**
+ * @brief Get the hash table bucket of a connection
+ *
+ * Endpoints hashes are combined in a symmetric way, so the bucket is the
+ * same no matter which side sent the segment.
+ */
+static size_t
+tls_connection_bucket(struct SSLEndpoint src, struct SSLEndpoint dst)
+{
+    return (tls_endpoint_hash(src) ^ tls_endpoint_hash(dst)) & (TLS_CONNECTION_BUCKETS - 1);
+}
+
+/**
+ * @brief Check if two endpoints have the same address and port
+ */
+static bool
+tls_endpoint_equals(struct SSLEndpoint addr1, struct SSLEndpoint addr2)
+{
+    return addr1.family == addr2.family && addr1.port == addr2.port
+           && !memcmp(&addr1.addr, &addr2.addr, sizeof(addr1.addr));
+}
+
+void
+tls_connection_add(struct SSLConnections *connections, struct SSLConnection *conn)
+{
+    size_t pos = tls_connection_bucket(conn->client, conn->server);
+
+    conn->connections = connections;
+    conn->next = connections->buckets[pos];
+    connections->buckets[pos] = conn;
+    connections->count++;
+}
+
+void
+tls_connection_remove(struct SSLConnection *conn)
+{
+    struct SSLConnections *connections = conn->connections;
+    struct SSLConnection **c;
+
+    c = &connections->buckets[tls_connection_bucket(conn->client, conn->server)];
+    for (; *c; c = &(*c)->next) {
+        if (*c == conn) {
+            *c = conn->next;
+            connections->count--;
+            break;
+        }
+    }
+}
+
+struct SSLEndpoint
+tls_endpoint(packet_t *packet, address_t addr)
+{
+    struct SSLEndpoint endpoint;
+
+    memset(&endpoint, 0, sizeof(struct SSLEndpoint));
+    endpoint.family = (packet->ip_version == 6) ? AF_INET6 : AF_INET;
+    endpoint.port = addr.port;
+    inet_pton(endpoint.family, addr.ip, &endpoint.addr);
+    return endpoint;
+}
+
+uint8_t *
+tls_buffer_reserve(struct SSLBuffer *buffer, uint32_t len)
+{
+    uint8_t *data;
+    uint32_t size = (buffer->size) ? buffer->size : TLS_BUFFER_SIZE;
+
+    if (buffer->len + len > buffer->size) {
+        while (size < buffer->len + len)
+            size *= 2;
+        if (!(data = realloc(buffer->data, size)))
+            return NULL;
+        buffer->data = data;
+        buffer->size = size;
+    }
+
+    return buffer->data + buffer->len;
+}
+
+/**
+ * @brief Append data at the end of a connection buffer
+ *
+ * @return 0 if data has been added, 1 otherwise
+ */
+static int
+tls_buffer_append(struct SSLBuffer *buffer, const uint8_t *data, uint32_t len)
+{
+    uint8_t *dest;
+
+    if (!(dest = tls_buffer_reserve(buffer, len)))
+        return 1;
+
+    memcpy(dest, data, len);
+    buffer->len += len;
+    return 0;
+}
+
+int
+tls_connection_dir(struct SSLConnection *conn, struct SSLEndpoint addr)
+{
+    if (tls_endpoint_equals(conn->client, addr))
+        return 0;
+    if (tls_endpoint_equals(conn->server, addr))
+        return 1;
+    return -1;
+}
+
+struct SSLConnection*
+tls_connection_find(struct SSLConnections *connections, struct SSLEndpoint src, struct SSLEndpoint dst) {
+    struct SSLConnection *conn;
+
+    for (conn = connections->buckets[tls_connection_bucket(src, dst)]; conn; conn = conn->next) {
+        if (tls_connection_dir(conn, src) == 0 &&
+                tls_connection_dir(conn, dst) == 1) {
+            return conn;
+        }
+        if (tls_connection_dir(conn, src) == 1 &&
+                tls_connection_dir(conn, dst) == 0) {
+            return conn;
+        }
+    }
+    return NULL;
+}
+
+void
+tls_connection_expire(struct SSLConnections *connections, struct timeval now)
+{
+    struct SSLConnection *conn, *next;
+    int i;
+
+    // Only check idle connections once in a while
+    if (now.tv_sec < connections->swept.tv_sec + TLS_CONNECTION_SWEEP)
+        return;
+    connections->swept = now;
+
+    for (i = 0; i < TLS_CONNECTION_BUCKETS && connections->count; i++) {
+        for (conn = connections->buckets[i]; conn; conn = next) {
+            next = conn->next;
+            if (conn->last.tv_sec + TLS_CONNECTION_TIMEOUT < now.tv_sec)
+                tls_connection_destroy(conn);
+        }
+    }
+}
+
+struct SSLConnections *
+tls_connections_create()
+{
+    return sng_malloc(sizeof(struct SSLConnections));
+}
+
+void
+tls_connections_destroy(struct SSLConnections *connections)
+{
+    int i;
+
+    if (!connections)
+        return;
+
+    for (i = 0; i < TLS_CONNECTION_BUCKETS; i++) {
+        while (connections->buckets[i])
+            tls_connection_destroy(connections->buckets[i]);
+    }
+    sng_free(connections);
+}
+
+int
+tls_process_segment(struct SSLConnections *connections, packet_t *packet, struct tcphdr *tcp)
+{
+    struct SSLConnection *conn;
+    const u_char *payload = packet_payload(packet);
+    uint32_t size_payload = packet_payloadlen(packet);
+    struct SSLEndpoint src = tls_endpoint(packet, packet->src);
+    struct SSLEndpoint dst = tls_endpoint(packet, packet->dst);
+    struct timeval now = packet_time(packet);
+    address_t tlsserver = capture_tls_server();
+
+    // Remove connections without activity
+    tls_connection_expire(connections, now);
+
+    // Try to find a session for this ip
+    if ((conn = tls_connection_find(connections, src, dst))) {
+        // Update last connection direction and activity
+        conn->direction = tls_connection_dir(conn, src);
+        conn->last = now;
+
+        // Check current connection state
+        switch (conn->state) {
+            case TCP_STATE_SYN:
+                // First SYN received, this package must be SYN/ACK
+                if (tcp->th_flags & TH_SYN & ~TH_ACK)
+                    conn->state = TCP_STATE_SYN_ACK;
+                break;
+            case TCP_STATE_SYN_ACK:
+                // We expect an ACK packet here
+                if (tcp->th_flags & ~TH_SYN & TH_ACK)
+                    conn->state = TCP_STATE_ESTABLISHED;
+                break;
+            case TCP_STATE_ACK:
+            case TCP_STATE_ESTABLISHED:
+            case TCP_STATE_FIN:
+                // Decrypted data of previous segments has already been used
+                conn->plaintext.len = 0;
+
+                // Check if we have a SSLv2 Handshake
+                if (!conn->record[conn->direction].len
+                        && tls_record_handshake_is_ssl2(conn, payload, size_payload)) {
+                    tls_process_record_ssl2(conn, payload, size_payload);
+                } else if (tls_process_records(conn, payload, size_payload) != 0) {
+                    // Not a TLS connection (or we lost track of it)
+                    conn->state = TCP_STATE_CLOSED;
+                    break;
+                }
+
+                if (conn->plaintext.len > 0) {
+                    // This seems a SIP TLS packet ;-)
+                    packet_set_payload(packet, conn->plaintext.data, conn->plaintext.len);
+                    packet_set_type(packet, PACKET_SIP_TLS);
+                } else {
+                    // Nothing to parse until a record is complete
+                    packet_set_payload(packet, NULL, 0);
+                }
+                break;
+            case TCP_STATE_CLOSED:
+                break;
+        }
+
+        // Track connection shutdown
+        if (tcp->th_flags & TH_RST) {
+            conn->state = TCP_STATE_CLOSED;
+        } else if (tcp->th_flags & TH_FIN) {
+            // Connection is closed once both sides have sent their FIN
+            conn->fin |= 1 << conn->direction;
+            if (conn->fin == 3) {
+                conn->state = TCP_STATE_CLOSED;
+            } else if (conn->state == TCP_STATE_ESTABLISHED) {
+                conn->state = TCP_STATE_FIN;
+            }
+        }
+
+        // We can delete this connection
+        if (conn->state == TCP_STATE_CLOSED)
+            tls_connection_destroy(conn);
+    } else {
+        if (tcp->th_flags & TH_SYN & ~TH_ACK) {
+            // Only create new connections whose destination is tlsserver
+            if (tlsserver.port) {
+                if (addressport_equals(tlsserver, packet->dst)) {
+                    // New connection, store it status and leave
+                    if ((conn = tls_connection_create(connections, src, dst)))
+                        conn->last = now;
+                }
+            } else {
+                // New connection, store it status and leave
+                if ((conn = tls_connection_create(connections, src, dst)))
+                    conn->last = now;
+            }
+        }
+    }
+
+    return 0;
+}
+
+int
+tls_process_records(struct SSLConnection *conn, const uint8_t *payload, const int len)
+{
+    struct SSLBuffer *pending = &conn->record[conn->direction];
+    struct TLSPlaintext *record;
+    const uint8_t *data = payload;
+    uint32_t datalen = len;
+    uint32_t record_len;
+    uint32_t offset = 0;
+
+    // Continue the record started in previous segments
+    if (pending->len) {
+        if (tls_buffer_append(pending, payload, len) != 0) {
+            pending->len = 0;
+            return 1;
+        }
+        data = pending->data;
+        datalen = pending->len;
+    }
+
+    // Process all complete records
+    while (datalen - offset >= sizeof(struct TLSPlaintext)) {
+        record = (struct TLSPlaintext *) (data + offset);
+        record_len = sizeof(struct TLSPlaintext) + UINT16_INT(record->length);
+
+        // Not a TLS record
+        if (record_len > TLS_RECORD_MAX_LEN) {
+            pending->len = 0;
+            return 1;
+        }
+
+        // Record continues in next segments
+        if (datalen - offset < record_len)
+            break;
+
+        if (tls_process_record(conn, data + offset, record_len) != 0) {
+            pending->len = 0;
+            return 1;
+        }
+        offset += record_len;
+    }
+
+    // Keep incomplete record data
+    if (data == pending->data) {
+        memmove(pending->data, pending->data + offset, datalen - offset);
+        pending->len = datalen - offset;
+    } else if (offset < datalen) {
+        if (tls_buffer_append(pending, data + offset, datalen - offset) != 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Hash an address and port
+ */
+static uint32_t
+capture_tls_hash(address_t addr)
+{
+    uint32_t hash = 5381;
+    const char *c;
+
+    for (c = addr.ip; *c; c++)
+        hash = hash * 33 + *c;
+    return hash * 33 + addr.port;
+}
+
+/**
+ * @brief Hand decrypted packets to parse stage in capture order
+ *
+ * Every thread that completes a packet calls this function, so the
+ * thread decrypting the oldest pending packet will parse it.
+ */
+static void
+capture_tls_drain()
+{
+    capture_tls_job_t *job;
+
+    pthread_mutex_lock(&tls.parse_lock);
+    while (true) {
+        pthread_mutex_lock(&tls.lock);
+        if (!(job = tls.first) || !job->done) {
+            pthread_mutex_unlock(&tls.lock);
+            break;
+        }
+        if (!(tls.first = job->next))
+            tls.last = NULL;
+        pthread_mutex_unlock(&tls.lock);
+
+        capture_packet_process(job->capinfo, job->packet, job->segment ? &job->tcp : NULL);
+        sng_free(job);
+
+        // Packet is no longer pending once it has been parsed
+        pthread_mutex_lock(&tls.lock);
+        tls.pending--;
+        pthread_cond_broadcast(&tls.cond);
+        pthread_mutex_unlock(&tls.lock);
+    }
+    pthread_mutex_unlock(&tls.parse_lock);
+}
+
+/**
+ * @brief Decryption thread main loop
+ */
+static void *
+capture_tls_worker_thread(void *data)
+{
+    capture_tls_worker_t *worker = (capture_tls_worker_t *) data;
+    capture_tls_job_t *job;
+
+    pthread_mutex_lock(&worker->lock);
+    while (worker->running) {
+        if (!(job = worker->first)) {
+            pthread_cond_wait(&worker->cond, &worker->lock);
+            continue;
+        }
+        if (!(worker->first = job->wnext))
+            worker->last = NULL;
+        pthread_mutex_unlock(&worker->lock);
+
+        tls_process_segment(worker->connections, job->packet, &job->tcp);
+
+        pthread_mutex_lock(&tls.lock);
+        job->done = true;
+        pthread_mutex_unlock(&tls.lock);
+        capture_tls_drain();
+
+        pthread_mutex_lock(&worker->lock);
+    }
+    pthread_mutex_unlock(&worker->lock);
+
+    return NULL;
+}
+
+int
+capture_tls_init(int workers)
+{
+    capture_tls_worker_t *worker;
+    int i;
+
+    if (workers > CAPTURE_TLS_WORKERS)
+        workers = CAPTURE_TLS_WORKERS;
+
+    pthread_mutex_init(&tls.lock, NULL);
+    pthread_mutex_init(&tls.parse_lock, NULL);
+    pthread_cond_init(&tls.cond, NULL);
+
+    // Decrypt in capture thread
+    if (workers <= 0) {
+        tls.connections = tls_connections_create();
+        return 0;
+    }
+
+    tls.workers = sng_malloc(sizeof(capture_tls_worker_t) * workers);
+    for (i = 0; i < workers; i++) {
+        worker = &tls.workers[i];
+        worker->connections = tls_connections_create();
+        worker->running = true;
+        pthread_mutex_init(&worker->lock, NULL);
+        pthread_cond_init(&worker->cond, NULL);
+        if (pthread_create(&worker->thread, NULL, capture_tls_worker_thread, worker) != 0) {
+            tls_connections_destroy(worker->connections);
+            pthread_mutex_destroy(&worker->lock);
+            pthread_cond_destroy(&worker->cond);
+            break;
+        }
+        tls.count++;
+    }
+
+    // Unable to start any thread, decrypt in capture thread
+    if (tls.count == 0) {
+        sng_free(tls.workers);
+        tls.workers = NULL;
+        tls.connections = tls_connections_create();
+        return 1;
+    }
+
+    return 0;
+}
+
+void
+capture_tls_deinit()
+{
+    capture_tls_worker_t *worker;
+    capture_tls_job_t *job;
+    int i;
+
+    // Stop decryption threads
+    for (i = 0; i < tls.count; i++) {
+        worker = &tls.workers[i];
+        pthread_mutex_lock(&worker->lock);
+        worker->running = false;
+        pthread_cond_signal(&worker->cond);
+        pthread_mutex_unlock(&worker->lock);
+        pthread_join(worker->thread, NULL);
+        tls_connections_destroy(worker->connections);
+        pthread_mutex_destroy(&worker->lock);
+        pthread_cond_destroy(&worker->cond);
+    }
+    sng_free(tls.workers);
+
+    // Discard packets that have not been parsed
+    while ((job = tls.first)) {
+        tls.first = job->next;
+        packet_destroy(job->packet);
+        sng_free(job);
+    }
+
+    tls_connections_destroy(tls.connections);
+    pthread_mutex_destroy(&tls.lock);
+    pthread_mutex_destroy(&tls.parse_lock);
+    pthread_cond_destroy(&tls.cond);
+    memset(&tls, 0, sizeof(capture_tls_t));
+}
+
+void
+capture_tls_packet(capture_info_t *capinfo, packet_t *packet, struct tcphdr *tcp)
+{
+    capture_tls_worker_t *worker;
+    capture_tls_job_t *job;
+    bool segment = (tcp != NULL);
+    int cancelstate;
+
+    // Decrypt in capture thread
+    if (tls.count == 0) {
+        if (tcp)
+            tls_process_segment(tls.connections, packet, tcp);
+        capture_packet_process(capinfo, packet, tcp);
+        return;
+    }
+
+    if (!(job = sng_malloc(sizeof(capture_tls_job_t)))) {
+        packet_destroy(packet);
+        return;
+    }
+
+    job->capinfo = capinfo;
+    job->packet = packet;
+    if ((job->segment = segment))
+        job->tcp = *tcp;
+    // Only TCP segments need decryption
+    job->done = !segment;
+
+    // Don't leave queue locks held if capture thread is cancelled
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancelstate);
+
+    // Append to capture order queue, waiting for parse stage if full
+    pthread_mutex_lock(&tls.lock);
+    while (tls.pending >= CAPTURE_TLS_QUEUE)
+        pthread_cond_wait(&tls.cond, &tls.lock);
+    if (tls.last)
+        tls.last->next = job;
+    else
+        tls.first = job;
+    tls.last = job;
+    tls.pending++;
+    pthread_mutex_unlock(&tls.lock);
+
+    // Job can not be accessed once queued unless it is pending to decrypt
+    if (segment) {
+        // Both directions of a connection go to the same worker
+        worker = &tls.workers[(capture_tls_hash(packet->src) ^ capture_tls_hash(packet->dst)) % tls.count];
+        pthread_mutex_lock(&worker->lock);
+        if (worker->last)
+            worker->last->wnext = job;
+        else
+            worker->first = job;
+        worker->last = job;
+        pthread_cond_signal(&worker->cond);
+        pthread_mutex_unlock(&worker->lock);
+    } else {
+        capture_tls_drain();
+    }
+
+    pthread_setcancelstate(cancelstate, NULL);
+}
+
+void
+capture_tls_flush()
+{
+    int cancelstate;
+
+    // Don't leave pending queue locked if capture thread is cancelled
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancelstate);
+
+    pthread_mutex_lock(&tls.lock);
+    while (tls.pending > 0)
+        pthread_cond_wait(&tls.cond, &tls.lock);
+    pthread_mutex_unlock(&tls.lock);
+
+    pthread_setcancelstate(cancelstate, NULL);
+}
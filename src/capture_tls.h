@@ -0,0 +1,291 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file capture_tls.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to dispatch TLS decryption to worker threads
+ *
+ * Connection tracking and TLS record reassembly are also implemented here,
+ * as they do not depend on the library used to decrypt records. Each
+ * backend (capture_openssl.c or capture_gnutls.c) only implements the
+ * handshake and cipher functions.
+ *
+ * When a keyfile is configured, captured packets go through this stage
+ * before being assembled and parsed.
+ *
+ * Without workers, TCP segments are decrypted in the capture thread.
+ * Otherwise each TLS connection is pinned to one worker thread, that owns
+ * its decryption state, so segments of a connection are decrypted in order.
+ * Packets are queued in capture order and only handed to the parse stage
+ * once all previous packets have been decrypted.
+ */
+
+#ifndef __SNGREP_CAPTURE_TLS_H
+#define __SNGREP_CAPTURE_TLS_H
+
+#include "config.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include "capture.h"
+#include "packet.h"
+#ifdef WITH_GNUTLS
+#include "capture_gnutls.h"
+#endif
+#ifdef WITH_OPENSSL
+#include "capture_openssl.h"
+#endif
+
+//! Max number of packets waiting to be parsed
+#define CAPTURE_TLS_QUEUE   4096
+//! Max number of decryption threads
+#define CAPTURE_TLS_WORKERS 64
+
+//! Shorter declaration of capture tls structures
+typedef struct capture_tls_job capture_tls_job_t;
+typedef struct capture_tls_worker capture_tls_worker_t;
+typedef struct capture_tls capture_tls_t;
+
+/**
+ * @brief Captured packet waiting to be parsed
+ */
+struct capture_tls_job {
+    //! Packet capture session
+    capture_info_t *capinfo;
+    //! Captured packet
+    packet_t *packet;
+    //! Copy of packet TCP header
+    struct tcphdr tcp;
+    //! Packet is a TCP segment
+    bool segment;
+    //! Packet has been decrypted
+    bool done;
+    //! Next packet in capture order
+    capture_tls_job_t *next;
+    //! Next packet in worker queue
+    capture_tls_job_t *wnext;
+};
+
+/**
+ * @brief Decryption thread
+ */
+struct capture_tls_worker {
+    //! Worker thread
+    pthread_t thread;
+    //! Connections decrypted by this worker
+    struct SSLConnections *connections;
+    //! Segments pending to decrypt
+    capture_tls_job_t *first, *last;
+    //! Queue lock
+    pthread_mutex_t lock;
+    //! Signaled when a segment is queued or worker is stopped
+    pthread_cond_t cond;
+    //! Worker must keep running
+    bool running;
+};
+
+/**
+ * @brief TLS decryption stage data
+ */
+struct capture_tls {
+    //! Connections decrypted in capture thread (no workers)
+    struct SSLConnections *connections;
+    //! Decryption threads
+    capture_tls_worker_t *workers;
+    //! Number of decryption threads
+    int count;
+    //! Packets pending to parse in capture order
+    capture_tls_job_t *first, *last;
+    //! Number of packets queued or being parsed
+    uint32_t pending;
+    //! Pending queue lock
+    pthread_mutex_t lock;
+    //! Signaled when a queued packet has been parsed
+    pthread_cond_t cond;
+    //! Only one thread hands packets to parse stage
+    pthread_mutex_t parse_lock;
+};
+
+/**
+ * @brief Add a connection to a connections hash table
+ *
+ * @param connections Connections hash table
+ * @param conn New connection
+ */
+void
+tls_connection_add(struct SSLConnections *connections, struct SSLConnection *conn);
+
+/**
+ * @brief Remove a connection from its connections hash table
+ *
+ * @param conn Existing connection pointer
+ */
+void
+tls_connection_remove(struct SSLConnection *conn);
+
+/**
+ * @brief Determines packet direction
+ *
+ * Determine if the given address is from client or server.
+ *
+ * @param conn Existing connection pointer
+ * @param addr Client or server address and port
+ * @return 0 if address belongs to client, 1 to server or -1 otherwise
+ */
+int
+tls_connection_dir(struct SSLConnection *conn, struct SSLEndpoint addr);
+
+/**
+ * @brief Find a connection
+ *
+ * Try to find connection data for a given address tuple.
+ * Source and destination can be the client or server ones.
+ *
+ * @param connections Connections hash table
+ * @param src Source address and port
+ * @param dst Destination address and port
+ * @return an existing Connection pointer or NULL if not found
+ */
+struct SSLConnection*
+tls_connection_find(struct SSLConnections *connections, struct SSLEndpoint src, struct SSLEndpoint dst);
+
+/**
+ * @brief Destroy idle connections
+ *
+ * Remove all connections that have not received segments in the last
+ * TLS_CONNECTION_TIMEOUT seconds. This is only checked once every
+ * TLS_CONNECTION_SWEEP seconds.
+ *
+ * @param connections Connections hash table
+ * @param now Current packet time
+ */
+void
+tls_connection_expire(struct SSLConnections *connections, struct timeval now);
+
+/**
+ * @brief Create an empty connections hash table
+ *
+ * Each table must only be used from one thread at a time.
+ *
+ * @return new allocated connections hash table
+ */
+struct SSLConnections *
+tls_connections_create();
+
+/**
+ * @brief Destroy a connections hash table and all its connections
+ *
+ * @param connections Connections hash table
+ */
+void
+tls_connections_destroy(struct SSLConnections *connections);
+
+/**
+ * @brief Get binary address and port of a packet side
+ *
+ * @param packet Captured packet
+ * @param addr Source or destination address of the packet
+ * @return packet side address and port
+ */
+struct SSLEndpoint
+tls_endpoint(packet_t *packet, address_t addr);
+
+/**
+ * @brief Process a TCP segment to check TLS data
+ *
+ * Check if a TCP segment contains TLS data. Segment data is added to the
+ * connection record buffer and all completed records are processed.
+ *
+ * If application_data records are decrypted, packet payload is replaced with
+ * the decrypted data. If the segment only contains handshake data or an
+ * incomplete record, packet payload is removed.
+ *
+ * @param connections Connections hash table
+ * @param packet Packet with TCP segment payload
+ * @param tcp Pointer to tcp header of the packet
+ * @return 0 in all cases
+ */
+int
+tls_process_segment(struct SSLConnections *connections, packet_t *packet, struct tcphdr *tcp);
+
+/**
+ * @brief Process TLS records in segment data
+ *
+ * Append segment data to pending record data of current direction and
+ * process all complete records. Data of an incomplete record is kept
+ * until following segments arrive.
+ *
+ * @param conn Existing connection pointer
+ * @param payload Segment payload
+ * @param len Payload length
+ * @return 0 if data looks like TLS records, 1 otherwise
+ */
+int
+tls_process_records(struct SSLConnection *conn, const uint8_t *payload, const int len);
+
+/**
+ * @brief Make room for more data in a connection buffer
+ *
+ * @param buffer Connection buffer
+ * @param len Number of bytes that will be added
+ * @return pointer to the buffer free space or NULL if buffer can not grow
+ */
+uint8_t *
+tls_buffer_reserve(struct SSLBuffer *buffer, uint32_t len);
+
+/**
+ * @brief Initialize TLS decryption stage
+ *
+ * @param workers Number of decryption threads (0 to decrypt in capture thread)
+ * @return 0 on success, 1 otherwise
+ */
+int
+capture_tls_init(int workers);
+
+/**
+ * @brief Stop decryption threads and free all pending packets
+ */
+void
+capture_tls_deinit();
+
+/**
+ * @brief Decrypt and parse a captured packet
+ *
+ * When decryption threads are running, the packet is queued and this
+ * function returns before it has been parsed.
+ *
+ * @param capinfo Packet capture session information
+ * @param packet Captured packet with transport payload
+ * @param tcp TCP header of the packet or NULL for UDP packets
+ */
+void
+capture_tls_packet(capture_info_t *capinfo, packet_t *packet, struct tcphdr *tcp);
+
+/**
+ * @brief Wait until all queued packets have been parsed
+ *
+ * Calling thread can not be cancelled while waiting.
+ */
+void
+capture_tls_flush();
+
+#endif /* __SNGREP_CAPTURE_TLS_H */
@@ -42,6 +42,18 @@
 /* Define if you have the `fopencookie' function */
 #cmakedefine HAVE_FOPENCOOKIE
 
+/* Define if you have the `recvmmsg' function */
+#cmakedefine HAVE_RECVMMSG
+
+/* Define if you have the `sendmmsg' function */
+#cmakedefine HAVE_SENDMMSG
+
+/* Define if you have the <sys/epoll.h> header file */
+#cmakedefine HAVE_SYS_EPOLL_H
+
+/* Define if `st_mtim.tv_nsec' is a member of `struct stat' */
+#cmakedefine HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+
 /* Compile With Unicode compatibility */
 #cmakedefine WITH_UNICODE
 
@@ -425,7 +425,7 @@ call_flow_draw_preview(ui_t *ui)
         } else if (arrow->type == CF_ARROW_EVENT) {
             call_flow_draw_raw_event(ui, arrow->item);
         } else {
-            call_flow_draw_raw_rtcp(ui, arrow->item);
+            call_flow_draw_raw_stream(ui, arrow->item);
         }
     }
 }
@@ -687,7 +687,7 @@ call_flow_draw_rtp_stream(ui_t *ui, call_flow_arrow_t *arrow, int cline)
 {
     call_flow_info_t *info;
     WINDOW *win;
-    char text[50], time[20];
+    char text[80], stats[30], time[20];
     int height;
     rtp_stream_t *stream = arrow->item;
     sip_msg_t *msg;
@@ -813,6 +813,13 @@ call_flow_draw_rtp_stream(ui_t *ui, call_flow_arrow_t *arrow, int cline)
         }
     }
 
+    // Add stream loss and jitter if they fit in the arrow
+    if (stream->type == PACKET_RTP && stream_get_expected(stream)) {
+        snprintf(stats, sizeof(stats), " %.1f%% %.1fms", stream_get_loss(stream), stream_get_jitter(stream));
+        if (strlen(text) + strlen(stats) + 2 <= (size_t) distance)
+            strcat(text, stats);
+    }
+
     // Highlight current message
     if (arrow == vector_item(info->darrows, info->cur_arrow)) {
         if (setting_has_value(SETTING_CF_HIGHTLIGHT, "reverse")) {
@@ -1340,14 +1347,14 @@ call_flow_draw_raw_event(ui_t *ui, rtp_event_t *event)
 
 
 int
-call_flow_draw_raw_rtcp(ui_t *ui, rtp_stream_t *stream)
+call_flow_draw_raw_stream(ui_t *ui, rtp_stream_t *stream)
 {
-    /**
-     * TODO This is too experimental to even display it
-     */
-    return 0;
-
     call_flow_info_t *info;
+    rtcp_report_t *report;
+    char time[20];
+    uint32_t i, count, buckets;
+    int line;
+    const char *fmt;
     WINDOW *raw_win;
     int raw_width, raw_height;
     int min_raw_width, fixed_raw_width;
@@ -1396,14 +1403,79 @@ call_flow_draw_raw_rtcp(ui_t *ui, rtp_stream_t *stream)
     mvwvline(ui->win, 1, ui->width - raw_width - 2, ACS_VLINE, ui->height - 2);
     wattroff(ui->win, COLOR_PAIR(CP_BLUE_ON_DEF));
 
-    mvwprintw(raw_win, 0, 0, "============ RTCP Information ============");
-    mvwprintw(raw_win, 2, 0, "Sender's packet count: %d", stream->rtcpinfo.spc);
-    mvwprintw(raw_win, 3, 0, "Fraction Lost: %d / 256", stream->rtcpinfo.flost);
-    mvwprintw(raw_win, 4, 0, "Fraction discarded: %d / 256", stream->rtcpinfo.fdiscard);
-    mvwprintw(raw_win, 6, 0, "MOS - Listening Quality: %.1f", (float) stream->rtcpinfo.mosl / 10);
-    mvwprintw(raw_win, 7, 0, "MOS - Conversational Quality: %.1f", (float) stream->rtcpinfo.mosc / 10);
-
+    mvwprintw(raw_win, 0, 0, "============ RTP Stream Information ============");
+    mvwprintw(raw_win, 2, 0, "Source: %s:%u", stream->src.ip, stream->src.port);
+    mvwprintw(raw_win, 3, 0, "Destination: %s:%u", stream->dst.ip, stream->dst.port);
+    mvwprintw(raw_win, 4, 0, "Format: %s  SSRC: 0x%08X", stream_get_format(stream), stream->stats.ssrc);
+    mvwprintw(raw_win, 5, 0, "Packets: %u  Expected: %u  Lost: %u (%.1f%%)",
+              stream_get_count(stream), stream_get_expected(stream),
+              stream_get_lost(stream), stream_get_loss(stream));
+    mvwprintw(raw_win, 6, 0, "Out of order: %u  Duplicated: %u",
+              stream->stats.out_of_order, stream->stats.duplicates);
+    mvwprintw(raw_win, 7, 0, "Jitter: %.1f ms  Max delta: %.1f ms",
+              stream_get_jitter(stream), stream->stats.max_delta);
+    if (stream_get_rfactor(stream) >= 0) {
+        mvwprintw(raw_win, 8, 0, "Estimated MOS: %.2f  R-factor: %.0f",
+                  stream_get_mos(stream), stream_get_rfactor(stream));
+    } else if (stream->type == PACKET_RTP && stream_get_count(stream)) {
+        mvwprintw(raw_win, 8, 0, "Estimated MOS: n/a (unknown codec)");
+    }
+    if (stream_get_rtt(stream) >= 0)
+        mvwprintw(raw_win, 9, 0, "RTCP Round trip time: %d ms", stream_get_rtt(stream));
+
+    // Received packets of each format if the stream changed its codec
+    if (stream->type == PACKET_RTP && stream->rtpinfo.fmtcount > 1) {
+        mvwprintw(raw_win, 10, 0, "Formats:");
+        for (i = 0; i < stream->rtpinfo.fmtcount; i++) {
+            fmt = stream_get_format_name(stream, stream->rtpinfo.formats[i].code);
+            if (fmt) {
+                wprintw(raw_win, " %s (%u)", fmt, stream->rtpinfo.formats[i].count);
+            } else {
+                wprintw(raw_win, " %u (%u)", stream->rtpinfo.formats[i].code,
+                        stream->rtpinfo.formats[i].count);
+            }
+        }
+    }
 
+    // Silences and packets received in the last activity buckets (oldest first)
+    if (stream->type == PACKET_RTP && stream_get_count(stream)) {
+        mvwprintw(raw_win, 11, 0, "Gaps: %u  Longest silence: %u ms",
+                  stream->activity.gaps, stream_get_max_gap(stream));
+        buckets = stream->activity.last + 1;
+        if (buckets > RTP_ACTIVITY_BUCKETS)
+            buckets = RTP_ACTIVITY_BUCKETS;
+        if (raw_width > 12 && buckets > (uint32_t) raw_width - 12)
+            buckets = raw_width - 12;
+        mvwprintw(raw_win, 12, 0, "Activity: [");
+        for (i = buckets; i > 0; i--) {
+            count = stream_get_activity(stream, i - 1);
+            waddch(raw_win, (count == 0) ? '_' : (count < 3) ? '.' : (count < 5) ? ':' : '|');
+        }
+        waddch(raw_win, ']');
+    }
+
+    mvwprintw(raw_win, 14, 0, "============ RTCP Reports ============");
+    line = 16;
+    for (i = 0; (report = stream_get_report(stream, i)) && line < raw_height; i++, line++) {
+        timeval_to_time(report->time, time);
+        if (report->type == RTCP_HDR_SR && report->source == report->sender) {
+            mvwprintw(raw_win, line, 0, "%s SR 0x%08X Sent: %u packets %u bytes",
+                      time, report->sender, report->spc, report->soc);
+        } else if (report->type == RTCP_XR && report->block == RTCP_XR_VOIP_METRCS) {
+            mvwprintw(raw_win, line, 0, "%s XR 0x%08X Lost: %d/256 Discarded: %d/256 MOS: %.1f/%.1f",
+                      time, report->sender, report->flost, report->fdiscard,
+                      (float) report->mosl / 10, (float) report->mosc / 10);
+        } else if (report->type == RTCP_XR && report->block == RTCP_XR_DLRR) {
+            mvwprintw(raw_win, line, 0, "%s XR 0x%08X RTT: %d ms", time, report->sender, report->rtt);
+        } else if (report->type == RTCP_XR) {
+            mvwprintw(raw_win, line, 0, "%s XR 0x%08X Lost: %d Jitter: %u",
+                      time, report->sender, report->plost, report->jitter);
+        } else {
+            mvwprintw(raw_win, line, 0, "%s %s 0x%08X Lost: %d/256 (%d) Jitter: %u RTT: %d ms",
+                      time, (report->type == RTCP_HDR_SR) ? "SR" : "RR", report->sender,
+                      report->flost, report->plost, report->jitter, report->rtt);
+        }
+    }
 
     // Copy the raw_win contents into the panel
     copywin(raw_win, ui->win, 0, 0, 1, ui->width - raw_width - 1, raw_height, ui->width - 2, 0);
@@ -1527,8 +1599,8 @@ call_flow_handle_key(ui_t *ui, int key)
                 call_flow_set_group(info->group);
                 break;
             case ACTION_SAVE:
-                if (capture_sources_count() > 1) {
-                    dialog_run("Saving is not possible when multiple input sources are specified.");
+                if (!capture_sources_same_link()) {
+                    dialog_run("Saving is not possible when input sources have different link types.");
                     break;
                 }
                 next_ui = ui_create_panel(PANEL_SAVE);
@@ -399,16 +399,17 @@ call_flow_draw_raw_event(ui_t *ui, rtp_event_t *event);
 
 
 /**
- * @brief Draw raw panel with RTCP data
+ * @brief Draw raw panel with RTP stream data
  *
- * Draw the given stream data into the raw window.
+ * Draw the given stream statistics and its received RTCP reports
+ * into the raw window.
  *
  * @param ui UI structure pointer
- * @param rtcp stream containing the RTCP conection data
+ * @param stream RTP stream of the selected arrow
  * @return 0 in all cases
  */
 int
-call_flow_draw_raw_rtcp(ui_t *ui, rtp_stream_t *rtcp);
+call_flow_draw_raw_stream(ui_t *ui, rtp_stream_t *stream);
 
 /**
  * @brief Handle Call flow extended key strokes
@@ -122,6 +122,7 @@ call_list_create(ui_t *ui)
     // Apply initial configured filters
     filter_method_from_setting(setting_get_value(SETTING_FILTER_METHODS));
     filter_payload_from_setting(setting_get_value(SETTING_FILTER_PAYLOAD));
+    filter_media_from_setting(setting_get_value(SETTING_FILTER_MEDIA));
 }
 
 void
@@ -660,9 +661,12 @@ call_list_handle_key(ui_t *ui, int key)
             case ACTION_SHOW_STATS:
                 ui_create_panel(PANEL_STATS);
                 break;
+            case ACTION_SHOW_ORPHANS:
+                ui_create_panel(PANEL_ORPHANS);
+                break;
             case ACTION_SAVE:
-                if (capture_sources_count() > 1) {
-                    dialog_run("Saving is not possible when multiple input sources are specified.");
+                if (!capture_sources_same_link()) {
+                    dialog_run("Saving is not possible when input sources have different link types.");
                     break;
                 }
                 next_ui = ui_create_panel(PANEL_SAVE);
@@ -675,12 +679,16 @@ call_list_handle_key(ui_t *ui, int key)
             case ACTION_CLEAR_CALLS:
                 // Remove all stored calls
                 sip_calls_clear();
+                // Loaded files can not be indexed without these calls
+                capture_index_invalidate();
                 // Clear List
                 call_list_clear(ui);
                 break;
             case ACTION_CLEAR_CALLS_SOFT:
                 // Remove stored calls, keeping the currently displayed calls
                 sip_calls_clear_soft();
+                // Loaded files can not be indexed without these calls
+                capture_index_invalidate();
                 // Clear List
                 call_list_clear(ui);
                 break;
@@ -962,6 +970,7 @@ call_list_help(ui_t *ui)
     mvwprintw(help_win, 21, 2, "F10/t       Select displayed columns");
     mvwprintw(help_win, 22, 2, "i/I         Set display filter to invite");
     mvwprintw(help_win, 23, 2, "p           Stop/Resume packet capture");
+    mvwprintw(help_win, 24, 2, "u           Show RTP streams found without SDP");
 
     // Press any key to close
     wgetch(help_win);
@@ -240,8 +240,8 @@ call_raw_handle_key(ui_t *ui, int key)
                 info->scroll -= rnpag_steps;
                 break;
             case ACTION_SAVE:
-                if (capture_sources_count() > 1) {
-                    dialog_run("Saving is not possible when multiple input sources are specified.");
+                if (!capture_sources_same_link()) {
+                    dialog_run("Saving is not possible when input sources have different link types.");
                     break;
                 }
                 if (info->group) {
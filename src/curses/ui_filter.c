@@ -55,7 +55,7 @@ filter_create(ui_t *ui)
     const char *method, *payload;
 
     // Cerate a new indow for the panel and form
-    ui_panel_create(ui, 18, 50);
+    ui_panel_create(ui, 19, 50);
 
     // Initialize Filter panel specific data
     info = sng_malloc(sizeof(filter_info_t));
@@ -69,17 +69,18 @@ filter_create(ui_t *ui)
     info->fields[FLD_FILTER_SRC] = new_field(1, 18, 5, 18, 0, 0);
     info->fields[FLD_FILTER_DST] = new_field(1, 18, 6, 18, 0, 0);
     info->fields[FLD_FILTER_PAYLOAD] = new_field(1, 28, 7, 18, 0, 0);
-    info->fields[FLD_FILTER_REGISTER] = new_field(1, 1, 9, 15, 0, 0);
-    info->fields[FLD_FILTER_INVITE] = new_field(1, 1, 10, 15, 0, 0);
-    info->fields[FLD_FILTER_SUBSCRIBE] = new_field(1, 1, 11, 15, 0, 0);
-    info->fields[FLD_FILTER_NOTIFY] = new_field(1, 1, 12, 15, 0, 0);
-    info->fields[FLD_FILTER_INFO] = new_field(1, 1, 13, 15, 0, 0);
-    info->fields[FLD_FILTER_KDMQ] = new_field(1, 1, 14, 15, 0, 0);
-    info->fields[FLD_FILTER_OPTIONS] = new_field(1, 1, 9, 37, 0, 0);
-    info->fields[FLD_FILTER_PUBLISH] = new_field(1, 1, 10, 37, 0, 0);
-    info->fields[FLD_FILTER_MESSAGE] = new_field(1, 1, 11, 37, 0, 0);
-    info->fields[FLD_FILTER_REFER] = new_field(1, 1, 12, 37, 0, 0);
-    info->fields[FLD_FILTER_UPDATE] = new_field(1, 1, 13, 37, 0, 0);
+    info->fields[FLD_FILTER_MEDIA] = new_field(1, 18, 8, 18, 0, 0);
+    info->fields[FLD_FILTER_REGISTER] = new_field(1, 1, 10, 15, 0, 0);
+    info->fields[FLD_FILTER_INVITE] = new_field(1, 1, 11, 15, 0, 0);
+    info->fields[FLD_FILTER_SUBSCRIBE] = new_field(1, 1, 12, 15, 0, 0);
+    info->fields[FLD_FILTER_NOTIFY] = new_field(1, 1, 13, 15, 0, 0);
+    info->fields[FLD_FILTER_INFO] = new_field(1, 1, 14, 15, 0, 0);
+    info->fields[FLD_FILTER_KDMQ] = new_field(1, 1, 15, 15, 0, 0);
+    info->fields[FLD_FILTER_OPTIONS] = new_field(1, 1, 10, 37, 0, 0);
+    info->fields[FLD_FILTER_PUBLISH] = new_field(1, 1, 11, 37, 0, 0);
+    info->fields[FLD_FILTER_MESSAGE] = new_field(1, 1, 12, 37, 0, 0);
+    info->fields[FLD_FILTER_REFER] = new_field(1, 1, 13, 37, 0, 0);
+    info->fields[FLD_FILTER_UPDATE] = new_field(1, 1, 14, 37, 0, 0);
     info->fields[FLD_FILTER_FILTER] = new_field(1, 10, ui->height - 2, 11, 0, 0);
     info->fields[FLD_FILTER_CANCEL] = new_field(1, 10, ui->height - 2, 30, 0, 0);
     info->fields[FLD_FILTER_COUNT] = NULL;
@@ -90,6 +91,7 @@ filter_create(ui_t *ui)
     field_opts_off(info->fields[FLD_FILTER_SRC], O_AUTOSKIP | O_STATIC);
     field_opts_off(info->fields[FLD_FILTER_DST], O_AUTOSKIP | O_STATIC);
     field_opts_off(info->fields[FLD_FILTER_PAYLOAD], O_AUTOSKIP | O_STATIC);
+    field_opts_off(info->fields[FLD_FILTER_MEDIA], O_AUTOSKIP);
     field_opts_off(info->fields[FLD_FILTER_REGISTER], O_AUTOSKIP);
     field_opts_off(info->fields[FLD_FILTER_INVITE], O_AUTOSKIP);
     field_opts_off(info->fields[FLD_FILTER_SUBSCRIBE], O_AUTOSKIP);
@@ -114,6 +116,7 @@ filter_create(ui_t *ui)
     set_field_back(info->fields[FLD_FILTER_SRC], A_UNDERLINE);
     set_field_back(info->fields[FLD_FILTER_DST], A_UNDERLINE);
     set_field_back(info->fields[FLD_FILTER_PAYLOAD], A_UNDERLINE);
+    set_field_back(info->fields[FLD_FILTER_MEDIA], A_UNDERLINE);
 
     // Create the form and post it
     info->form = new_form(info->fields);
@@ -126,17 +129,18 @@ filter_create(ui_t *ui)
     mvwprintw(ui->win, 5, 3, "Source:");
     mvwprintw(ui->win, 6, 3, "Destination:");
     mvwprintw(ui->win, 7, 3, "Payload:");
-    mvwprintw(ui->win, 9, 3, "REGISTER   [ ]");
-    mvwprintw(ui->win, 10, 3, "INVITE     [ ]");
-    mvwprintw(ui->win, 11, 3, "SUBSCRIBE  [ ]");
-    mvwprintw(ui->win, 12, 3, "NOTIFY     [ ]");
-    mvwprintw(ui->win, 13, 3, "INFO       [ ]");
-    mvwprintw(ui->win, 14, 3, "KDMQ       [ ]");
-    mvwprintw(ui->win, 9, 25, "OPTIONS    [ ]");
-    mvwprintw(ui->win, 10, 25, "PUBLISH    [ ]");
-    mvwprintw(ui->win, 11, 25, "MESSAGE    [ ]");
-    mvwprintw(ui->win, 12, 25, "REFER      [ ]");
-    mvwprintw(ui->win, 13, 25, "UPDATE     [ ]");
+    mvwprintw(ui->win, 8, 3, "Media state:");
+    mvwprintw(ui->win, 10, 3, "REGISTER   [ ]");
+    mvwprintw(ui->win, 11, 3, "INVITE     [ ]");
+    mvwprintw(ui->win, 12, 3, "SUBSCRIBE  [ ]");
+    mvwprintw(ui->win, 13, 3, "NOTIFY     [ ]");
+    mvwprintw(ui->win, 14, 3, "INFO       [ ]");
+    mvwprintw(ui->win, 15, 3, "KDMQ       [ ]");
+    mvwprintw(ui->win, 10, 25, "OPTIONS    [ ]");
+    mvwprintw(ui->win, 11, 25, "PUBLISH    [ ]");
+    mvwprintw(ui->win, 12, 25, "MESSAGE    [ ]");
+    mvwprintw(ui->win, 13, 25, "REFER      [ ]");
+    mvwprintw(ui->win, 14, 25, "UPDATE     [ ]");
 
     // Get Method filter
     if (!(method = filter_get(FILTER_METHOD)))
@@ -152,6 +156,7 @@ filter_create(ui_t *ui)
     set_field_buffer(info->fields[FLD_FILTER_SRC], 0, filter_get(FILTER_SOURCE));
     set_field_buffer(info->fields[FLD_FILTER_DST], 0, filter_get(FILTER_DESTINATION));
     set_field_buffer(info->fields[FLD_FILTER_PAYLOAD], 0, filter_get(FILTER_PAYLOAD));
+    set_field_buffer(info->fields[FLD_FILTER_MEDIA], 0, filter_get(FILTER_MEDIA));
     set_field_buffer(info->fields[FLD_FILTER_REGISTER], 0,
                      strcasestr(method, sip_method_str(SIP_METHOD_REGISTER)) ? "*" : "");
     set_field_buffer(info->fields[FLD_FILTER_INVITE], 0,
@@ -181,9 +186,9 @@ filter_create(ui_t *ui)
     mvwprintw(ui->win, 1, 18, "Filter options");
     wattron(ui->win, COLOR_PAIR(CP_BLUE_ON_DEF));
     title_foot_box(ui->panel);
-    mvwhline(ui->win, 8, 1, ACS_HLINE, 49);
-    mvwaddch(ui->win, 8, 0, ACS_LTEE);
-    mvwaddch(ui->win, 8, 49, ACS_RTEE);
+    mvwhline(ui->win, 9, 1, ACS_HLINE, 49);
+    mvwaddch(ui->win, 9, 0, ACS_LTEE);
+    mvwaddch(ui->win, 9, 49, ACS_RTEE);
     wattroff(ui->win, COLOR_PAIR(CP_BLUE_ON_DEF));
 
     // Set default cursor position
@@ -233,7 +238,7 @@ filter_handle_key(ui_t *ui, int key)
                 // If this is a normal character on input field, print it
                 if (field_idx == FLD_FILTER_SIPFROM || field_idx == FLD_FILTER_SIPTO
                     || field_idx == FLD_FILTER_SRC || field_idx == FLD_FILTER_DST
-                    || field_idx == FLD_FILTER_PAYLOAD) {
+                    || field_idx == FLD_FILTER_PAYLOAD || field_idx == FLD_FILTER_MEDIA) {
                     form_driver(info->form, key);
                     break;
                 }
@@ -373,6 +378,9 @@ filter_save_options(ui_t *ui)
             case FLD_FILTER_PAYLOAD:
                 filter_set(FILTER_PAYLOAD, expr);
                 break;
+            case FLD_FILTER_MEDIA:
+                filter_set(FILTER_MEDIA, expr);
+                break;
             case FLD_FILTER_REGISTER:
             case FLD_FILTER_INVITE:
             case FLD_FILTER_SUBSCRIBE:
@@ -481,3 +489,9 @@ filter_payload_from_setting(const char *value)
     if (value) filter_set(FILTER_PAYLOAD, value);
 }
 
+void
+filter_media_from_setting(const char *value)
+{
+    if (value && strlen(value)) filter_set(FILTER_MEDIA, value);
+}
+
@@ -49,6 +49,7 @@ enum filter_field_list {
     FLD_FILTER_SRC,
     FLD_FILTER_DST,
     FLD_FILTER_PAYLOAD,
+    FLD_FILTER_MEDIA,
     FLD_FILTER_REGISTER,
     FLD_FILTER_INVITE,
     FLD_FILTER_SUBSCRIBE,
@@ -160,4 +161,10 @@ filter_method_from_setting(const char *value);
 void
 filter_payload_from_setting(const char *value);
 
+/**
+ * @brief Set Media state filter from filter.media setting
+ */
+void
+filter_media_from_setting(const char *value);
+
 #endif
@@ -0,0 +1,188 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file ui_orphans.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in ui_orphans.h
+ */
+/*
+ * +---------------------------------------------------------------------------------------------+
+ * |                                     Orphan RTP Streams                                      |
+ * +---------------------------------------------------------------------------------------------+
+ * | Tracked flows: 12  Discarded flows: 0  Discovered streams: 3                                |
+ * +---------------------------------------------------------------------------------------------+
+ * | Source                 Destination            Format       SSRC      Packets  Lost  Jitter  |
+ * | 10.0.0.1:10000         10.0.0.2:20000         PCMA   0x1A2B3C4D     1502  0.2%  1.2ms       |
+ * |                                                                                             |
+ * +---------------------------------------------------------------------------------------------+
+ * |                                    Press ESC to leave                                       |
+ * +---------------------------------------------------------------------------------------------+
+ */
+#include "config.h"
+#include <string.h>
+#include "vector.h"
+#include "rtp.h"
+#include "util.h"
+#include "ui_manager.h"
+#include "ui_orphans.h"
+
+/**
+ * Ui Structure definition for Orphan streams panel
+ */
+ui_t ui_orphans = {
+    .type = PANEL_ORPHANS,
+    .panel = NULL,
+    .create = orphans_create,
+    .destroy = orphans_destroy,
+    .draw = orphans_draw,
+    .handle_key = orphans_handle_key
+};
+
+void
+orphans_create(ui_t *ui)
+{
+    orphans_info_t *info;
+    int height = LINES - 4, width = COLS - 4;
+
+    // Calculate window dimensions
+    if (height > 30)
+        height = 30;
+    if (width > 96)
+        width = 96;
+    ui_panel_create(ui, height, width);
+
+    // Initialize Orphans panel specific data
+    info = sng_malloc(sizeof(orphans_info_t));
+    set_panel_userptr(ui->panel, (void*) info);
+}
+
+void
+orphans_destroy(ui_t *ui)
+{
+    sng_free(orphans_info(ui));
+    ui_panel_destroy(ui);
+}
+
+orphans_info_t *
+orphans_info(ui_t *ui)
+{
+    return (orphans_info_t*) panel_userptr(ui->panel);
+}
+
+int
+orphans_draw(ui_t *ui)
+{
+    orphans_info_t *info = orphans_info(ui);
+    rtp_orphan_stats_t stats = rtp_orphans_stats();
+    rtp_stream_t *stream;
+    vector_iter_t it;
+    char src[ADDRESSLEN + 7], dst[ADDRESSLEN + 7];
+    const char *format;
+    int line, count;
+
+    werase(ui->win);
+
+    // Set the window title and boxes
+    mvwprintw(ui->win, 1, ui->width / 2 - 9, "Orphan RTP Streams");
+    wattron(ui->win, COLOR_PAIR(CP_BLUE_ON_DEF));
+    title_foot_box(ui->panel);
+    mvwhline(ui->win, 4, 1, ACS_HLINE, ui->width - 1);
+    mvwaddch(ui->win, 4, 0, ACS_LTEE);
+    mvwaddch(ui->win, 4, ui->width - 1, ACS_RTEE);
+    mvwprintw(ui->win, ui->height - 2, ui->width / 2 - 9, "Press ESC to leave");
+    wattroff(ui->win, COLOR_PAIR(CP_BLUE_ON_DEF));
+
+    if (!rtp_orphans_enabled()) {
+        mvwprintw(ui->win, 3, 2, "Discovery of streams without SDP is disabled (capture.rtporphan)");
+        return 0;
+    }
+
+    mvwprintw(ui->win, 3, 2, "Tracked flows: %u  Discarded flows: %lu  Discovered streams: %lu",
+              stats.flows, (unsigned long) stats.evicted, (unsigned long) stats.promoted);
+
+    wattron(ui->win, A_BOLD);
+    mvwprintw(ui->win, 5, 2, "%-22s %-22s %-10s %-10s %8s %6s %8s",
+              "Source", "Destination", "Format", "SSRC", "Packets", "Lost", "Jitter");
+    wattroff(ui->win, A_BOLD);
+
+    // Keep scroll position inside the list
+    it = rtp_orphans_iterator();
+    count = vector_iterator_count(&it);
+    if (info->scroll > count - 1)
+        info->scroll = count - 1;
+    if (info->scroll < 0)
+        info->scroll = 0;
+
+    vector_iterator_set_current(&it, info->scroll - 1);
+    for (line = 6; line < ui->height - 3 && (stream = vector_iterator_next(&it)); line++) {
+        snprintf(src, sizeof(src), "%s:%u", stream->src.ip, stream->src.port);
+        snprintf(dst, sizeof(dst), "%s:%u", stream->dst.ip, stream->dst.port);
+        format = stream_get_format(stream);
+        if (stream_is_active(stream))
+            wattron(ui->win, COLOR_PAIR(CP_GREEN_ON_DEF));
+        mvwprintw(ui->win, line, 2, "%-22.22s %-22.22s %-10.10s 0x%08X %8u %5.1f%% %6.1fms",
+                  src, dst, format ? format : "", stream->stats.ssrc, stream_get_count(stream),
+                  stream_get_loss(stream), stream_get_jitter(stream));
+        wattroff(ui->win, COLOR_PAIR(CP_GREEN_ON_DEF));
+    }
+
+    if (!count)
+        mvwprintw(ui->win, 6, 2, "No streams without SDP found");
+
+    return 0;
+}
+
+int
+orphans_handle_key(ui_t *ui, int key)
+{
+    orphans_info_t *info = orphans_info(ui);
+    int action = -1;
+
+    // Check actions for this key
+    while ((action = key_find_action(key, action)) != ERR) {
+        // Check if we handle this action
+        switch (action) {
+            case ACTION_UP:
+                info->scroll--;
+                break;
+            case ACTION_DOWN:
+                info->scroll++;
+                break;
+            case ACTION_PPAGE:
+                info->scroll -= ui->height - 9;
+                break;
+            case ACTION_NPAGE:
+                info->scroll += ui->height - 9;
+                break;
+            default:
+                // Parse next action
+                continue;
+        }
+
+        // This panel has handled the key successfully
+        break;
+    }
+
+    // Return if this panel has handled or not the key
+    return (action == ERR) ? KEY_NOT_HANDLED : KEY_HANDLED;
+}
@@ -0,0 +1,100 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file ui_orphans.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to manage ui window for orphan RTP streams display
+ *
+ * Orphan streams are RTP streams discovered without SDP
+ * (see capture.rtporphan setting)
+ */
+#ifndef __SNGREP_UI_ORPHANS_H
+#define __SNGREP_UI_ORPHANS_H
+
+#include "config.h"
+#include "ui_manager.h"
+
+//! Sorter declaration of struct orphans_info
+typedef struct orphans_info orphans_info_t;
+
+/**
+ * @brief Orphan streams panel private information
+ */
+struct orphans_info {
+    //! First displayed stream
+    int scroll;
+};
+
+/**
+ * @brief Creates a new orphan streams panel
+ *
+ * This function allocates all required memory for
+ * displaying the orphan streams panel. It also draws all the
+ * static information of the panel that will never be
+ * redrawn.
+ *
+ * @param ui UI structure pointer
+ */
+void
+orphans_create(ui_t *ui);
+
+/**
+ * @brief Destroy orphan streams panel
+ *
+ * @param ui UI structure pointer
+ */
+void
+orphans_destroy(ui_t *ui);
+
+/**
+ * @brief Get custom information of given panel
+ *
+ * @param ui UI structure pointer
+ * @return a pointer to info structure of given panel
+ */
+orphans_info_t *
+orphans_info(ui_t *ui);
+
+/**
+ * @brief Draw the orphan streams list
+ *
+ * Streams statistics change while packets are received, so the list
+ * is drawn on every refresh.
+ *
+ * @param ui UI structure pointer
+ * @return 0 if the panel has been drawn, -1 otherwise
+ */
+int
+orphans_draw(ui_t *ui);
+
+/**
+ * @brief Manage pressed keys for orphan streams panel
+ *
+ * @param ui UI structure pointer
+ * @param key   key code
+ * @return enum @key_handler_ret
+ */
+int
+orphans_handle_key(ui_t *ui, int key);
+
+#endif /* __SNGREP_UI_ORPHANS_H */
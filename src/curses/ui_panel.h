@@ -74,6 +74,8 @@ enum panel_types {
     PANEL_SETTINGS,
     //! Stats panel
     PANEL_STATS,
+    //! Orphan RTP streams panel
+    PANEL_ORPHANS,
     //! Panel Counter
     PANEL_COUNT,
 };
@@ -34,6 +34,7 @@
 #include <form.h>
 #include <ctype.h>
 #include "ui_save.h"
+#include "audio.h"
 #include "setting.h"
 #include "capture.h"
 #include "filter.h"
@@ -60,7 +61,7 @@ save_create(ui_t *ui)
     capture_set_paused(1);
 
     // Cerate a new indow for the panel and form
-    ui_panel_create(ui, 15, 68);
+    ui_panel_create(ui, 16, 68);
 
     // Initialize save panel specific data
     info = sng_malloc(sizeof(save_info_t));
@@ -79,6 +80,8 @@ save_create(ui_t *ui)
     info->fields[FLD_SAVE_PCAP] = new_field(1, 1, 7, 36, 0, 0);
     info->fields[FLD_SAVE_PCAP_RTP] = new_field(1, 1, 8, 36, 0, 0);
     info->fields[FLD_SAVE_TXT] = new_field(1, 1, 9, 36, 0, 0);
+    info->fields[FLD_SAVE_WAV] = new_field(1, 1, 10, 36, 0, 0);
+    info->fields[FLD_SAVE_WAV_STEREO] = new_field(1, 1, 11, 36, 0, 0);
     info->fields[FLD_SAVE_SAVE] = new_field(1, 10, ui->height - 2, 20, 0, 0);
     info->fields[FLD_SAVE_CANCEL] = new_field(1, 10, ui->height - 2, 40, 0, 0);
     info->fields[FLD_SAVE_COUNT] = NULL;
@@ -102,8 +105,11 @@ save_create(ui_t *ui)
     set_field_back(info->fields[FLD_SAVE_FILE], A_UNDERLINE);
 
     // Disable Save RTP if RTP packets are not being captured
-    if (!setting_enabled(SETTING_CAPTURE_RTP))
+    if (!setting_enabled(SETTING_CAPTURE_RTP)) {
         field_opts_off(info->fields[FLD_SAVE_PCAP_RTP], O_ACTIVE);
+        field_opts_off(info->fields[FLD_SAVE_WAV], O_ACTIVE);
+        field_opts_off(info->fields[FLD_SAVE_WAV_STEREO], O_ACTIVE);
+    }
 
     // Create the form and post it
     info->form = new_form(info->fields);
@@ -142,11 +148,11 @@ save_create(ui_t *ui)
     mvwaddch(ui->win, 6, 34, ACS_ULCORNER);
     mvwhline(ui->win, 6, 35, ACS_HLINE, 30);
     mvwaddch(ui->win, 6, 64, ACS_URCORNER);
-    mvwvline(ui->win, 7, 34, ACS_VLINE, 3);
-    mvwvline(ui->win, 7, 64, ACS_VLINE, 3);
-    mvwaddch(ui->win, 10, 34, ACS_LLCORNER);
-    mvwhline(ui->win, 10, 35, ACS_HLINE, 30);
-    mvwaddch(ui->win, 10, 64, ACS_LRCORNER);
+    mvwvline(ui->win, 7, 34, ACS_VLINE, 5);
+    mvwvline(ui->win, 7, 64, ACS_VLINE, 5);
+    mvwaddch(ui->win, 12, 34, ACS_LLCORNER);
+    mvwhline(ui->win, 12, 35, ACS_HLINE, 30);
+    mvwaddch(ui->win, 12, 64, ACS_LRCORNER);
 
     wattroff(ui->win, COLOR_PAIR(CP_BLUE_ON_DEF));
 
@@ -229,6 +235,8 @@ save_draw(ui_t *ui)
     mvwprintw(ui->win, 7, 35, "( ) .pcap (SIP)");
     mvwprintw(ui->win, 8, 35, "( ) .pcap (SIP + RTP)");
     mvwprintw(ui->win, 9, 35, "( ) .txt");
+    mvwprintw(ui->win, 10, 35, "( ) .wav (RTP per direction)");
+    mvwprintw(ui->win, 11, 35, "( ) .wav (RTP stereo)");
 
     // Get filename field value.
     sng_strncpy(field_value, field_buffer(info->fields[FLD_SAVE_FILE], 0), sizeof(field_value));
@@ -239,11 +247,16 @@ save_draw(ui_t *ui)
         info->saveformat = (setting_enabled(SETTING_CAPTURE_RTP))? SAVE_PCAP_RTP : SAVE_PCAP;
     } else if (strstr(field_value, ".txt")) {
         info->saveformat = SAVE_TXT;
+    } else if (strstr(field_value, ".wav")) {
+        if (info->saveformat != SAVE_WAV && info->saveformat != SAVE_WAV_STEREO)
+            info->saveformat = SAVE_WAV;
     } else {
         if (info->saveformat == SAVE_PCAP || info->saveformat == SAVE_PCAP_RTP)
             mvwprintw(ui->win, 4, 60, ".pcap");
-        else
+        else if (info->saveformat == SAVE_TXT)
             mvwprintw(ui->win, 4, 60, ".txt ");
+        else
+            mvwprintw(ui->win, 4, 60, ".wav ");
     }
 
     set_field_buffer(info->fields[FLD_SAVE_ALL], 0, (info->savemode == SAVE_ALL) ? "*" : " ");
@@ -256,10 +269,16 @@ save_draw(ui_t *ui)
     set_field_buffer(info->fields[FLD_SAVE_PCAP], 0, (info->saveformat == SAVE_PCAP) ? "*" : " ");
     set_field_buffer(info->fields[FLD_SAVE_PCAP_RTP], 0, (info->saveformat == SAVE_PCAP_RTP) ? "*" : " ");
     set_field_buffer(info->fields[FLD_SAVE_TXT], 0, (info->saveformat == SAVE_TXT) ? "*" : " ");
+    set_field_buffer(info->fields[FLD_SAVE_WAV], 0, (info->saveformat == SAVE_WAV) ? "*" : " ");
+    set_field_buffer(info->fields[FLD_SAVE_WAV_STEREO], 0,
+                     (info->saveformat == SAVE_WAV_STEREO) ? "*" : " ");
 
     // Show disabled options with makers
-    if (!setting_enabled(SETTING_CAPTURE_RTP))
+    if (!setting_enabled(SETTING_CAPTURE_RTP)) {
         set_field_buffer(info->fields[FLD_SAVE_PCAP_RTP], 0, "-");
+        set_field_buffer(info->fields[FLD_SAVE_WAV], 0, "-");
+        set_field_buffer(info->fields[FLD_SAVE_WAV_STEREO], 0, "-");
+    }
 
     set_current_field(info->form, current_field(info->form));
     form_driver(info->form, REQ_VALIDATION);
@@ -341,6 +360,12 @@ save_handle_key(ui_t *ui, int key)
                     case FLD_SAVE_TXT:
                         info->saveformat = SAVE_TXT;
                         break;
+                    case FLD_SAVE_WAV:
+                        info->saveformat = SAVE_WAV;
+                        break;
+                    case FLD_SAVE_WAV_STEREO:
+                        info->saveformat = SAVE_WAV_STEREO;
+                        break;
                     case FLD_SAVE_FILE:
                         form_driver(info->form, key);
                         break;
@@ -415,10 +440,13 @@ save_to_file(ui_t *ui)
     pcap_dumper_t *pd = NULL;
     FILE *f = NULL;
     int cur = 0, total = 0;
+    bool single;
+    uint32_t idx;
     WINDOW *progress;
-    vector_iter_t calls, msgs, rtps, packets;
+    vector_iter_t calls, msgs, streams, packets;
     packet_t *packet;
-    vector_t *sorted;
+    rtp_stream_t *stream;
+    vector_t *sorted, *zipped, *rebuilt, *exported;
 
     // Get panel information
     save_info_t *info = save_info(ui);
@@ -441,9 +469,12 @@ save_to_file(ui_t *ui)
     if (info->saveformat == SAVE_PCAP || info->saveformat == SAVE_PCAP_RTP) {
         if (!strstr(savefile, ".pcap"))
             strcat(savefile, ".pcap");
-    } else {
+    } else if (info->saveformat == SAVE_TXT) {
         if (!strstr(savefile, ".txt"))
             strcat(savefile, ".txt");
+    } else {
+        if (!strstr(savefile, ".wav"))
+            strcat(savefile, ".wav");
     }
 
     // Absolute filename
@@ -467,7 +498,7 @@ save_to_file(ui_t *ui)
             dialog_run("%s", capture_last_error());
             return 1;
         }
-    } else {
+    } else if (info->saveformat == SAVE_TXT) {
         // Open a text file
         if (!(f = fopen(fullfile, "w"))) {
             dialog_run("Error: %s", strerror(errno));
@@ -494,12 +525,48 @@ save_to_file(ui_t *ui)
             break;
     }
 
+    if (info->saveformat == SAVE_WAV || info->saveformat == SAVE_WAV_STEREO) {
+        // Export audio of all selected dialogs
+        exported = vector_create(10, 10);
+        if (info->savemode == SAVE_MESSAGE) {
+            vector_append(exported, info->msg->call);
+        } else {
+            while ((call = vector_iterator_next(&calls)))
+                vector_append(exported, call);
+        }
+
+        progress = dialog_progress_run("Saving audio...");
+        dialog_progress_set_value(progress, 0);
+        total = audio_export_calls(exported, fullfile,
+                                   (info->saveformat == SAVE_WAV_STEREO) ? AUDIO_STEREO : AUDIO_SPLIT);
+        dialog_progress_destroy(progress);
+        // Stereo audio of a single dialog is saved to the given filename
+        single = (info->saveformat == SAVE_WAV_STEREO && vector_count(exported) == 1);
+        vector_destroy(exported);
+
+        if (total < 0) {
+            dialog_run("Error: %s", strerror(errno));
+            return 1;
+        } else if (total == 0) {
+            dialog_run("Unable to save: No RTP audio in selected dialogs.");
+            return 1;
+        }
+
+        if (single) {
+            dialog_run("Successfully saved audio to %s", savefile);
+        } else {
+            dialog_run("Successfully saved %d audio files named after %s", total, savefile);
+        }
+        return 0;
+    }
+
     if (info->savemode == SAVE_MESSAGE) {
         if (info->saveformat == SAVE_TXT) {
             // Save selected message to file
             save_msg_txt(f, info->msg);
         } else {
             // Save selected message packet to pcap
+            sip_call_decompress(info->msg->call);
             dump_packet(pd, info->msg->packet);
         }
     } else if (info->saveformat == SAVE_TXT) {
@@ -515,12 +582,20 @@ save_to_file(ui_t *ui)
         // Store all messages in a time sorted vector
         sorted = vector_create(100, 50);
         vector_set_sorter(sorted, capture_packet_time_sorter);
+        // Calls restored from compressed storage only while saving
+        zipped = vector_create(0, 10);
+        // RTP packets rebuilt from streams stores
+        rebuilt = vector_create(0, 100);
+        vector_set_destroyer(rebuilt, packet_destroyer);
 
         // Count packages for progress bar
         while ((call = vector_iterator_next(&calls))) {
             total += vector_count(call->msgs);
-            if (info->saveformat == SAVE_PCAP_RTP)
-                total += vector_count(call->rtp_packets);
+            if (info->saveformat == SAVE_PCAP_RTP) {
+                streams = vector_iterator(call->streams);
+                while ((stream = vector_iterator_next(&streams)))
+                    total += stream_store_count(stream);
+            }
         }
         vector_iterator_reset(&calls);
 
@@ -529,6 +604,11 @@ save_to_file(ui_t *ui)
 
         // Save selected packets to file
         while ((call = vector_iterator_next(&calls))) {
+#ifdef WITH_ZLIB
+            // Restore compressed call packets data
+            if (call->zdata && sip_call_decompress(call) == 0 && !call->locked)
+                vector_append(zipped, call);
+#endif
             msgs = vector_iterator(call->msgs);
             // Save SIP message content
             while ((msg = vector_iterator_next(&msgs))) {
@@ -539,11 +619,17 @@ save_to_file(ui_t *ui)
 
             // Save RTP packets
             if (info->saveformat == SAVE_PCAP_RTP) {
-                rtps = vector_iterator(call->rtp_packets);
-                while ((packet = vector_iterator_next(&rtps))) {
-                    // Update progress bar dialog
-                    dialog_progress_set_value(progress, (++cur * 100) / total);
-                    vector_append(sorted, packet);
+                streams = vector_iterator(call->streams);
+                while ((stream = vector_iterator_next(&streams))) {
+                    for (idx = 0; idx < stream_store_count(stream); idx++) {
+                        // Update progress bar dialog
+                        dialog_progress_set_value(progress, (++cur * 100) / total);
+                        // Rebuild packet frames from stored data
+                        if (!(packet = stream_store_get_packet(stream, idx)))
+                            continue;
+                        vector_append(rebuilt, packet);
+                        vector_append(sorted, packet);
+                    }
                 }
             }
         }
@@ -553,6 +639,15 @@ save_to_file(ui_t *ui)
         while ((packet = vector_iterator_next(&packets))) {
             dump_packet(pd, packet);
         }
+        vector_destroy(sorted);
+        vector_destroy(rebuilt);
+
+        // Compress again restored calls
+        packets = vector_iterator(zipped);
+        while ((call = vector_iterator_next(&packets))) {
+            sip_call_compress(call);
+        }
+        vector_destroy(zipped);
 
         dialog_progress_destroy(progress);
     }
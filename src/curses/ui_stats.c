@@ -49,15 +49,36 @@
  * |  BYE:       10 (0.5%)                                   |
  * |  CANCEL:    0 (0.0%)                                    |
  * +---------------------------------------------------------+
+ * |  Packets       1250   78.1K  RTP streams      4    1.2K |
+ * |  Frames        1250  512.3K  RTP packets    820  131.2K |
+ * |  Payloads      1250  420.8K  Reassembly       0      0B |
+ * |  Messages       430  102.4K  Hash tables     10    8.2K |
+ * |  SDP media       12    3.1K                             |
+ * +---------------------------------------------------------+
+ * |  Socket       Packets     Bytes     Parsed    Invalid   |
+ * |  tcp/1           1200    512.3K       1198          2   |
+ * +---------------------------------------------------------+
+ * |  Agent                       Packets     Bytes   Errors  |
+ * |  10.0.0.12                       800    340.1K        0  |
+ * |  10.0.0.13                       400    172.2K        2  |
+ * +---------------------------------------------------------+
+ * |  Client        Queued      Sent    Dropped     Errors   |
+ * |  udp              430       430          0          0   |
+ * +---------------------------------------------------------+
  * |               Press any key to continue                 |
  * +---------------------------------------------------------+
  *
  */
 #include "config.h"
+#include <inttypes.h>
 #include "vector.h"
 #include "sip.h"
+#include "util.h"
 #include "ui_manager.h"
 #include "ui_stats.h"
+#ifdef USE_EEP
+#include "capture_eep.h"
+#endif
 
 /**
  * Ui Structure definition for Stats panel
@@ -77,6 +98,31 @@ stats_create(ui_t *ui)
     vector_iter_t msgs;
     sip_call_t *call;
     sip_msg_t *msg;
+    memstat_t memstat;
+    char size[16];
+    int type, height = 31;
+#ifdef USE_EEP
+    capture_eep_listener_t listener;
+    capture_eep_agent_t agent;
+    capture_eep_send_stats_t send_stats;
+    int i, listeners = capture_eep_listener_count();
+    int agents = capture_eep_agent_count();
+    int y = 28;
+
+    // Add a line for each HEP socket
+    if (listeners)
+        height += listeners + 2;
+
+    // Add a line for HEP client
+    if (capture_eep_send_port())
+        height += 3;
+
+    // Add a line for each HEP agent connected over TCP, while they fit
+    if (agents > LINES - height - 2)
+        agents = LINES - height - 2;
+    if (agents > 0)
+        height += agents + 2;
+#endif
 
     // Counters!
     struct {
@@ -88,7 +134,7 @@ stats_create(ui_t *ui)
     memset(&stats, 0, sizeof(stats));
 
     // Calculate window dimensions
-    ui_panel_create(ui, 25, 60);
+    ui_panel_create(ui, height, 60);
 
     // Set the window title and boxes
     mvwprintw(ui->win, 1, ui->width / 2 - 9, "Stats Information");
@@ -97,9 +143,71 @@ stats_create(ui_t *ui)
     mvwhline(ui->win, 10, 1, ACS_HLINE, ui->width - 1);
     mvwaddch(ui->win, 10, 0, ACS_LTEE);
     mvwaddch(ui->win, 10, ui->width - 1, ACS_RTEE);
+    mvwhline(ui->win, 22, 1, ACS_HLINE, ui->width - 1);
+    mvwaddch(ui->win, 22, 0, ACS_LTEE);
+    mvwaddch(ui->win, 22, ui->width - 1, ACS_RTEE);
     mvwprintw(ui->win, ui->height - 2, ui->width / 2 - 9, "Press ESC to leave");
     wattroff(ui->win, COLOR_PAIR(CP_BLUE_ON_DEF));
 
+    // Print memory usage of each subsystem in two columns
+    for (type = 0; type < MEMSTAT_COUNT; type++) {
+        memstat = memstat_get(type);
+        mvwprintw(ui->win, 23 + type % 5, 3 + (type / 5) * 28, "%-11s %6zu %7s",
+                  memstat_name(type), memstat.objects, size_to_str(memstat.bytes, size));
+    }
+
+#ifdef USE_EEP
+    // Print counters of each HEP socket
+    if (listeners) {
+        wattron(ui->win, COLOR_PAIR(CP_BLUE_ON_DEF));
+        mvwhline(ui->win, y, 1, ACS_HLINE, ui->width - 1);
+        mvwaddch(ui->win, y, 0, ACS_LTEE);
+        mvwaddch(ui->win, y, ui->width - 1, ACS_RTEE);
+        wattroff(ui->win, COLOR_PAIR(CP_BLUE_ON_DEF));
+        mvwprintw(ui->win, y + 1, 3, "%-8s %11s %9s %10s %10s",
+                  "Socket", "Packets", "Bytes", "Parsed", "Invalid");
+        for (i = 0; i < listeners; i++) {
+            listener = capture_eep_listener_stats(i);
+            mvwprintw(ui->win, y + 2 + i, 3, "%s/%-4d %11" PRIu64 " %9s %10" PRIu64 " %10" PRIu64,
+                      (listener.proto == IPPROTO_TCP) ? "tcp" : "udp",
+                      i + 1, listener.received, size_to_str(listener.bytes, size),
+                      listener.parsed, listener.invalid);
+        }
+        y += listeners + 2;
+    }
+
+    // Print counters of each HEP agent
+    if (agents > 0) {
+        wattron(ui->win, COLOR_PAIR(CP_BLUE_ON_DEF));
+        mvwhline(ui->win, y, 1, ACS_HLINE, ui->width - 1);
+        mvwaddch(ui->win, y, 0, ACS_LTEE);
+        mvwaddch(ui->win, y, ui->width - 1, ACS_RTEE);
+        wattroff(ui->win, COLOR_PAIR(CP_BLUE_ON_DEF));
+        mvwprintw(ui->win, y + 1, 3, "%-24s %11s %9s %8s",
+                  "Agent", "Packets", "Bytes", "Errors");
+        for (i = 0; i < agents; i++) {
+            agent = capture_eep_agent_stats(i);
+            mvwprintw(ui->win, y + 2 + i, 3, "%-24.24s %11" PRIu64 " %9s %8" PRIu64,
+                      agent.addr.ip, agent.packets, size_to_str(agent.bytes, size), agent.errors);
+        }
+        y += agents + 2;
+    }
+
+    // Print HEP client counters
+    if (capture_eep_send_port()) {
+        send_stats = capture_eep_send_stats();
+        wattron(ui->win, COLOR_PAIR(CP_BLUE_ON_DEF));
+        mvwhline(ui->win, y, 1, ACS_HLINE, ui->width - 1);
+        mvwaddch(ui->win, y, 0, ACS_LTEE);
+        mvwaddch(ui->win, y, ui->width - 1, ACS_RTEE);
+        wattroff(ui->win, COLOR_PAIR(CP_BLUE_ON_DEF));
+        mvwprintw(ui->win, y + 1, 3, "%-8s %11s %9s %10s %10s",
+                  "Client", "Queued", "Sent", "Dropped", "Errors");
+        mvwprintw(ui->win, y + 2, 3, "%-8s %11" PRIu64 " %9" PRIu64 " %10" PRIu64 " %10" PRIu64,
+                  "udp", send_stats.queued, send_stats.sent, send_stats.dropped, send_stats.errors);
+    }
+#endif
+
     // Parse the data
     calls = sip_calls_iterator();
     stats.dtotal = vector_iterator_count(&calls);
@@ -113,6 +113,27 @@ filter_get(int type)
     return filters[type].expr;
 }
 
+/**
+ * @brief Check call media state against media filter
+ *
+ * Media state is not cached in call filtered flag because it changes
+ * while call streams receive packets.
+ *
+ * @return 1 if call matches media filter or there is no media filter
+ */
+static int
+filter_check_media(sip_call_t *call)
+{
+    char data[SIP_ATTR_MAXLEN];
+
+    if (!filters[FILTER_MEDIA].expr)
+        return 1;
+
+    memset(data, 0, sizeof(data));
+    call_get_attribute(call, SIP_ATTR_MEDIASTATE, data);
+    return filter_check_expr(filters[FILTER_MEDIA], data) == 0;
+}
+
 int
 filter_check_call(void *item)
 {
@@ -128,7 +149,7 @@ filter_check_call(void *item)
 
     // Filter for this call has already be processed
     if (call->filtered != -1)
-        return (call->filtered == 0);
+        return (call->filtered == 0) && filter_check_media(call);
 
     // By default, call matches all filters
     call->filtered = 0;
@@ -136,7 +157,7 @@ filter_check_call(void *item)
     // Check all filter types
     for (i=0; i < FILTER_COUNT; i++) {
         // If filter is not enabled, go to the next
-        if (!filters[i].expr)
+        if (!filters[i].expr || i == FILTER_MEDIA)
             continue;
 
         // Initialize
@@ -198,7 +219,7 @@ filter_check_call(void *item)
     }
 
     // Return the final filter status
-    return (call->filtered == 0);
+    return (call->filtered == 0) && filter_check_media(call);
 }
 
 int
@@ -71,6 +71,8 @@ enum filter_type {
     FILTER_PAYLOAD,
     //! Displayed line in call list
     FILTER_CALL_LIST,
+    //! Call media state (changes with each RTP packet)
+    FILTER_MEDIA,
     //! Number of available filter types
     FILTER_COUNT,
 };
@@ -109,6 +109,7 @@ call_group_add(sip_call_group_t *group, sip_call_t *call)
 
     if (!call_group_exists(group, call)) {
         call->locked = true;
+        sip_call_decompress(call);
         vector_append(group->calls, call);
     }
 }
@@ -122,6 +123,7 @@ call_group_add_calls(sip_call_group_t *group, vector_t *calls)
     // Get the call with the next chronological message
     while ((call = vector_iterator_next(&it))) {
         call->locked = true;
+        sip_call_decompress(call);
         if (!call_group_exists(group, call)) {
             vector_append(group->calls, call);
         }
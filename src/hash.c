@@ -27,6 +27,7 @@
  *
  */
 #include "hash.h"
+#include "util.h"
 #include <string.h>
 #include <stdlib.h>
 
@@ -49,6 +50,7 @@ htable_create(size_t size)
 
     // Initialize allocated memory
     memset(h->buckets, 0, sizeof(hentry_t) * size);
+    memstat_resize(MEMSTAT_HTABLES, 0, sizeof(htable_t) + sizeof(hentry_t) * size);
 
     // Return allocated table
     return h;
@@ -57,6 +59,19 @@ htable_create(size_t size)
 void
 htable_destroy(htable_t *table)
 {
+    hentry_t *entry, *next;
+    size_t pos;
+
+    // Remove remaining entries
+    for (pos = 0; pos < table->size; pos++) {
+        for (entry = table->buckets[pos]; entry; entry = next) {
+            next = entry->next;
+            memstat_free(MEMSTAT_HTABLES, sizeof(hentry_t));
+            free(entry);
+        }
+    }
+
+    memstat_resize(MEMSTAT_HTABLES, sizeof(htable_t) + sizeof(hentry_t) * table->size, 0);
     free(table->buckets);
     free(table);
 }
@@ -75,6 +90,7 @@ htable_insert(htable_t *table, const char *key, void *data)
     entry->key = key;
     entry->data = data;
     entry->next = 0;
+    memstat_alloc(MEMSTAT_HTABLES, sizeof(hentry_t));
 
     // Check if the hash position is in use
     hentry_t *exists = table->buckets[pos];
@@ -106,6 +122,7 @@ htable_remove(htable_t *table, const char *key)
                 table->buckets[pos] = entry->next;
             }
             // Remove item memory
+            memstat_free(MEMSTAT_HTABLES, sizeof(hentry_t));
             free(entry);
             return;
         }
@@ -32,10 +32,13 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <getopt.h>
+#include <errno.h>
+#include <string.h>
 #include "option.h"
 #include "vector.h"
 #include "capture.h"
 #include "capture_eep.h"
+#include "audio.h"
 #include "curses/ui_save.h"
 #ifdef WITH_GNUTLS
 #include "capture_gnutls.h"
@@ -45,6 +48,9 @@
 #endif
 #include "curses/ui_manager.h"
 
+//! Seconds between memory usage reports in no interface mode
+#define MEMSTAT_REPORT_INTERVAL 60
+
 /**
  * @brief Usage function
  *
@@ -53,7 +59,7 @@
 void
 usage()
 {
-    printf("Usage: %s [-hVcivNqrD] [-IO pcap_dump] [-d dev] [-l limit] [-B buffer]"
+    printf("Usage: %s [-hVcivNqrD] [-IO pcap_dump] [-d dev] [-l limit] [-m memlimit] [-B buffer] [-aA audio_file]"
 #if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
            " [-k keyfile]"
 #endif
@@ -70,19 +76,22 @@ usage()
            "    -c --calls\t\t Only display dialogs starting with INVITE\n"
            "    -r --rtp\t\t Capture RTP packets payload\n"
            "    -l --limit\t\t Set capture limit to N dialogs\n"
+           "    -m --memlimit\t Set memory limit for stored dialogs (bytes, K, M, G or cgroup)\n"
            "    -i --icase\t\t Make <match expression> case insensitive\n"
            "    -v --invert\t\t Invert <match expression>\n"
            "    -N --no-interface\t Don't display sngrep interface, just capture\n"
-           "    -q --quiet\t\t Don't print captured dialogs in no interface mode\n"
+           "    -q --quiet\t\t Don't print captured dialogs in no interface mode nor memory usage\n"
            "    -D --dump-config\t Print active configuration settings and exit\n"
            "    -f --config\t\t Read configuration from file\n"
            "    -F --no-config\t Do not read configuration from default config file\n"
            "    -T --text\t Save pcap to text file\n"
+           "    -a --audio\t\t Save RTP audio of each direction to files\n"
+           "    -A --audio-stereo\t Save RTP audio of each call to a stereo WAV file\n"
            "    -R --rotate\t\t Rotate calls when capture limit have been reached\n"
            "    -T --telephone-event\t\t capture and parse RTP telephone-event packets\n"
 #ifdef USE_EEP
            "    -H --eep-send\t Homer sipcapture url (udp:X.X.X.X:XXXX)\n"
-           "    -L --eep-listen\t Listen for encapsulated packets (udp:X.X.X.X:XXXX)\n"
+           "    -L --eep-listen\t Listen for encapsulated packets (udp|tcp:X.X.X.X:XXXX[:workers])\n"
            "    -E --eep-parse\t Enable EEP parsing in captured packets\n"
 #endif
 #if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
@@ -131,7 +140,8 @@ int
 main(int argc, char* argv[])
 {
     int opt, idx, limit, only_calls, no_incomplete, pcap_buffer_size, i;
-    const char *device, *outfile, *text_outfile = NULL;
+    const char *device, *outfile, *text_outfile = NULL, *audio_outfile = NULL;
+    enum audio_mode audio_mode = AUDIO_SPLIT;
     char bpf[512];
 #if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
     const char *keyfile;
@@ -157,6 +167,7 @@ main(int argc, char* argv[])
         { "calls", no_argument, 0, 'c' },
         { "rtp", no_argument, 0, 'r' },
         { "limit", required_argument, 0, 'l' },
+        { "memlimit", required_argument, 0, 'm' },
         { "icase", no_argument, 0, 'i' },
         { "invert", no_argument, 0, 'v' },
         { "no-interface", no_argument, 0, 'N' },
@@ -165,6 +176,8 @@ main(int argc, char* argv[])
         { "config", required_argument, 0, 'f' },
         { "no-config", no_argument, 0, 'F' },
         { "text", required_argument, 0, 'T' },
+        { "audio", required_argument, 0, 'a' },
+        { "audio-stereo", required_argument, 0, 'A' },
         { "telephone-event", no_argument, 0, 't' },
 #ifdef USE_EEP
         { "eep-listen", required_argument, 0, 'L' },
@@ -176,7 +189,7 @@ main(int argc, char* argv[])
 
     // Parse command line arguments that have high priority
     opterr = 0;
-    char *options = "hVd:I:O:B:pqtW:k:crl:ivNqDL:H:ERf:FT:t";
+    char *options = "hVd:I:O:B:pqtW:k:crl:m:ivNqDL:H:ERf:FT:ta:A:";
     while ((opt = getopt_long(argc, argv, options, long_options, &idx)) != -1) {
         switch (opt) {
             case 'h':
@@ -236,6 +249,15 @@ main(int argc, char* argv[])
                 no_interface = 1;
                 setting_set_value(SETTING_CAPTURE_STORAGE, "none");
                 break;
+            case 'a':
+            case 'A':
+                audio_outfile = optarg;
+                audio_mode = (opt == 'A') ? AUDIO_STEREO : AUDIO_SPLIT;
+                no_interface = 1;
+                rtp_capture = 1;
+                setting_set_value(SETTING_CAPTURE_RTP, SETTING_ON);
+                setting_set_value(SETTING_CAPTURE_STORAGE, "none");
+                break;
             case 'B':
                 if(!(pcap_buffer_size = atoi(optarg))) {
                     fprintf(stderr, "Invalid buffer size.\n");
@@ -252,6 +274,13 @@ main(int argc, char* argv[])
                     return 0;
                 }
                 break;
+            case 'm':
+                if (strcasecmp(optarg, "cgroup") && !size_from_str(optarg)) {
+                    fprintf(stderr, "Invalid memory limit value.\n");
+                    return 0;
+                }
+                setting_set_value(SETTING_CAPTURE_MEMLIMIT, optarg);
+                break;
             case 'k':
 #if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
                 keyfile = optarg;
@@ -358,12 +387,12 @@ main(int argc, char* argv[])
         return 0;
     }
 
-    // Initialize SIP Messages Storage
-    sip_init(limit, only_calls, no_incomplete);
-
     // Set capture options
     capture_init(limit, rtp_capture, rotate, pcap_buffer_size);
 
+    // Initialize SIP Messages Storage (retention depends on capture storage)
+    sip_init(limit, only_calls, no_incomplete);
+
 #ifdef USE_EEP
     // Disable HEP listen when input files are specified in command line, otherwise online and offline packets
     // will be mixed, and it will be confusing
@@ -488,9 +517,15 @@ main(int argc, char* argv[])
         ui_wait_for_input();
     } else {
         setbuf(stdout, NULL);
-        while(capture_is_running() && !was_sigterm_received()) {
-            if (!quiet)
+        for (i = 1; capture_is_running() && !was_sigterm_received(); i++) {
+            if (!quiet) {
                 printf("\rDialog count: %d", sip_calls_count_unrotated());
+                // Periodically report memory usage
+                if (i % (MEMSTAT_REPORT_INTERVAL * 2) == 0) {
+                    printf("\n");
+                    memstat_dump(stdout);
+                }
+            }
             usleep(500 * 1000);
         }
         if (!quiet)
@@ -523,12 +558,43 @@ main(int argc, char* argv[])
         }
         fclose(f);
     }
+
+    if (audio_outfile)
+    {
+        vector_iter_t calls;
+        sip_call_t *call = NULL;
+        vector_t *exported = vector_create(10, 10);
+
+        calls = sip_calls_iterator();
+        while ((call = vector_iterator_next(&calls)))
+            vector_append(exported, call);
+
+        switch (audio_export_calls(exported, audio_outfile, audio_mode)) {
+            case -1:
+                fprintf(stderr, "Couldn't save audio to %s: %s\n", audio_outfile, strerror(errno));
+                break;
+            case 0:
+                fprintf(stderr, "No RTP audio to save in captured calls\n");
+                break;
+        }
+        vector_destroy(exported);
+    }
+
     // Capture deinit
     capture_deinit();
 
+#ifdef USE_EEP
+    // Send pending EEP packets and close sockets
+    capture_eep_deinit();
+#endif
+
     // Deinitialize interface
     ncurses_deinit();
 
+    // Report memory usage at exit
+    if (!quiet)
+        memstat_dump(stdout);
+
     // Deinitialize configuration options
     deinit_options();
 
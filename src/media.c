@@ -46,6 +46,7 @@ media_create(struct sip_msg *msg)
     media->msg = msg;
     media->formats = vector_create(0, 1);
     vector_set_destroyer(media->formats, vector_generic_destroyer);
+    memstat_alloc(MEMSTAT_MEDIA, sizeof(sdp_media_t));
     return media;
 }
 
@@ -55,6 +56,8 @@ media_destroyer(void *item)
     sdp_media_t *media = (sdp_media_t *) item;
     if (!item)
         return;
+    memstat_free(MEMSTAT_MEDIA, sizeof(sdp_media_t)
+                 + sizeof(sdp_media_fmt_t) * vector_count(media->formats));
     vector_destroy(media->formats);
     sng_free(media);
 }
@@ -88,6 +91,7 @@ media_add_format(sdp_media_t *media, uint32_t code, const char *format)
     fmt->id = code;
     sng_strncpy(fmt->format, format, sizeof(fmt->format));
     vector_append(media->formats, fmt);
+    memstat_resize(MEMSTAT_MEDIA, 0, sizeof(sdp_media_fmt_t));
 }
 
 const char *
@@ -30,6 +30,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include "packet.h"
+#include "storage.h"
+#include "util.h"
 
 packet_t *
 packet_create(uint8_t ip_ver, uint8_t proto, address_t src, address_t dst, uint32_t id)
@@ -44,6 +46,7 @@ packet_create(uint8_t ip_ver, uint8_t proto, address_t src, address_t dst, uint3
     packet->ip_id = id;
     packet->src = src;
     packet->dst = dst;
+    memstat_alloc(MEMSTAT_PACKETS, sizeof(packet_t));
     return packet;
 }
 
@@ -77,14 +80,27 @@ packet_destroy(packet_t *packet)
     // Destroy frames
     vector_iter_t it = vector_iterator(packet->frames);
     while ((frame = vector_iterator_next(&it))) {
+        if (frame->data && !packet->segment) {
+            memstat_free(MEMSTAT_FRAMES, sizeof(frame_t) + sizeof(struct pcap_pkthdr) + frame->header->caplen);
+            free(frame->data);
+        } else {
+            memstat_free(MEMSTAT_FRAMES, sizeof(frame_t) + sizeof(struct pcap_pkthdr));
+        }
         free(frame->header);
-        free(frame->data);
     }
 
     // TODO Free remaining packet data
     vector_set_destroyer(packet->frames, vector_generic_destroyer);
     vector_destroy(packet->frames);
-    free(packet->payload);
+    if (packet->payload_owned) {
+        memstat_free(MEMSTAT_PAYLOADS, packet->payload_len + 1);
+        free(packet->payload);
+    }
+    if (packet->segment) {
+        // Data belongs to disk storage
+        storage_release_packet(packet);
+    }
+    memstat_free(MEMSTAT_PACKETS, sizeof(packet_t));
     free(packet);
 }
 
@@ -101,11 +117,113 @@ packet_free_frames(packet_t *pkt)
     vector_iter_t it = vector_iterator(pkt->frames);
 
     while ((frame = vector_iterator_next(&it))) {
-        free(frame->data);
+        if (frame->data && !pkt->segment) {
+            memstat_resize(MEMSTAT_FRAMES, frame->header->caplen, 0);
+            free(frame->data);
+        }
         frame->data = NULL;
     }
 }
 
+size_t
+packet_memsize(packet_t *packet, bool data)
+{
+    frame_t *frame;
+    size_t size = sizeof(packet_t);
+
+    // Packet payload
+    if (packet->payload)
+        size += packet->payload_len + 1;
+
+    // Frames headers and data
+    vector_iter_t it = vector_iterator(packet->frames);
+    while ((frame = vector_iterator_next(&it))) {
+        size += sizeof(frame_t) + sizeof(struct pcap_pkthdr);
+        if (data && frame->data)
+            size += frame->header->caplen;
+    }
+
+    return size;
+}
+
+size_t
+packet_data_pack(packet_t *packet, u_char *out)
+{
+    frame_t *frame;
+    size_t len = 0;
+
+    // Packet payload
+    if (out)
+        out[len] = (packet->payload != NULL);
+    len++;
+    if (packet->payload) {
+        if (out)
+            memcpy(out + len, packet->payload, packet->payload_len);
+        len += packet->payload_len;
+    }
+
+    // Frames data
+    vector_iter_t it = vector_iterator(packet->frames);
+    while ((frame = vector_iterator_next(&it))) {
+        if (out)
+            out[len] = (frame->data != NULL);
+        len++;
+        if (frame->data) {
+            if (out)
+                memcpy(out + len, frame->data, frame->header->caplen);
+            len += frame->header->caplen;
+        }
+    }
+
+    return len;
+}
+
+size_t
+packet_data_unpack(packet_t *packet, const u_char *in)
+{
+    frame_t *frame;
+    size_t len = 0;
+
+    // Packet payload
+    if (in[len++]) {
+        packet->payload = malloc(packet->payload_len + 1);
+        memstat_alloc(MEMSTAT_PAYLOADS, packet->payload_len + 1);
+        memcpy(packet->payload, in + len, packet->payload_len);
+        packet->payload[packet->payload_len] = '\0';
+        packet->payload_owned = true;
+        len += packet->payload_len;
+    }
+
+    // Frames data
+    vector_iter_t it = vector_iterator(packet->frames);
+    while ((frame = vector_iterator_next(&it))) {
+        if (in[len++]) {
+            frame->data = malloc(frame->header->caplen);
+            memstat_resize(MEMSTAT_FRAMES, 0, frame->header->caplen);
+            memcpy(frame->data, in + len, frame->header->caplen);
+            len += frame->header->caplen;
+        }
+    }
+
+    return len;
+}
+
+void
+packet_data_release(packet_t *packet)
+{
+    // Packet data belongs to disk storage
+    if (packet->segment)
+        return;
+
+    if (packet->payload_owned) {
+        memstat_free(MEMSTAT_PAYLOADS, packet->payload_len + 1);
+        free(packet->payload);
+        packet->payload_owned = false;
+    }
+    packet->payload = NULL;
+    packet_free_frames(packet);
+}
+
 packet_t *
 packet_set_transport_data(packet_t *pkt, uint16_t sport, uint16_t dport)
 {
@@ -123,6 +241,7 @@ packet_add_frame(packet_t *pkt, const struct pcap_pkthdr *header, const u_char *
     frame->data = malloc(header->caplen);
     memcpy(frame->data, packet, header->caplen);
     vector_append(pkt->frames, frame);
+    memstat_alloc(MEMSTAT_FRAMES, sizeof(frame_t) + sizeof(struct pcap_pkthdr) + header->caplen);
     return frame;
 }
 
@@ -135,18 +254,30 @@ packet_set_type(packet_t *packet, enum packet_type type)
 void
 packet_set_payload(packet_t *packet, u_char *payload, uint32_t payload_len)
 {
-    // Free previous payload
-    if (packet->payload)
-        free(packet->payload);
+    u_char *previous = packet->payload;
+    uint32_t previous_len = packet->payload_len;
+    bool previous_owned = packet->payload_owned;
+
+    packet->payload = NULL;
     packet->payload_len = 0;
+    packet->payload_owned = false;
+    packet->not_sip = false;
 
-    // Set new payload
+    // Set new payload (it may be part of the previous one)
     if (payload) {
         packet->payload = malloc(payload_len + 1);
         memset(packet->payload, 0, payload_len + 1);
         memcpy(packet->payload, payload, payload_len);
         packet->payload[payload_len] = '\0';
         packet->payload_len = payload_len;
+        packet->payload_owned = true;
+        memstat_alloc(MEMSTAT_PAYLOADS, payload_len + 1);
+    }
+
+    // Free previous payload unless it is stored in a disk segment
+    if (previous_owned) {
+        memstat_free(MEMSTAT_PAYLOADS, previous_len + 1);
+        free(previous);
     }
 }
 
@@ -38,6 +38,7 @@
 
 #include <time.h>
 #include <sys/types.h>
+#include <stdbool.h>
 #include <pcap.h>
 #include "address.h"
 #include "vector.h"
@@ -92,8 +93,14 @@ struct packet {
     u_char *payload;
     //! Payload length
     uint32_t payload_len;
+    //! Payload has been allocated for this packet (not stored in a segment)
+    bool payload_owned;
+    //! Payload first line is known not to be a SIP request or response
+    bool not_sip;
     //! Packet frame list (frame_t)
     vector_t *frames;
+    //! Disk storage segment holding packet data (NULL if data is in memory)
+    struct storage_segment *segment;
 };
 
 /**
@@ -153,6 +160,49 @@ packet_destroyer(void *packet);
 void
 packet_free_frames(packet_t *pkt);
 
+/**
+ * @brief Estimate memory used by a packet
+ *
+ * @param packet Packet structure pointer
+ * @param data Also count frames data (if not freed)
+ * @return size in bytes of the packet and its frames
+ */
+size_t
+packet_memsize(packet_t *packet, bool data);
+
+/**
+ * @brief Copy packet payload and frames data into a flat buffer
+ *
+ * Each buffer is prefixed with a byte flagging if the data was present,
+ * payload and frames lengths are not stored as they are kept in the
+ * packet structures.
+ *
+ * @param packet Packet structure pointer
+ * @param out Output buffer or NULL to only calculate required size
+ * @return number of bytes written to out buffer
+ */
+size_t
+packet_data_pack(packet_t *packet, u_char *out);
+
+/**
+ * @brief Restore packet payload and frames data from a flat buffer
+ *
+ * @param packet Packet structure pointer
+ * @param in Buffer filled by @packet_data_pack
+ * @return number of bytes read from in buffer
+ */
+size_t
+packet_data_unpack(packet_t *packet, const u_char *in);
+
+/**
+ * @brief Free packet payload and frames data
+ *
+ * Packet headers and lengths are kept so data can be restored later
+ * using @packet_data_unpack
+ */
+void
+packet_data_release(packet_t *packet);
+
 /**
  * @brief Set packet type
  */
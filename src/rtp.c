@@ -35,6 +35,8 @@
 #include "rtp.h"
 #include "sip.h"
 #include "vector.h"
+#include "setting.h"
+#include "util.h"
 
 /**
  * @brief Known RTP encodings
@@ -67,10 +69,58 @@ rtp_encoding_t encodings[] = {
     { 0, NULL, NULL }
 };
 
+/**
+ * @brief Codec impairment values (ITU-T G.113 Appendix I)
+ *
+ * Quality of streams with other codecs is not estimated.
+ */
+rtp_emodel_codec_t emodel_codecs[] = {
+    { "g711", 0, 25.1 },
+    { "pcm", 0, 25.1 },
+    { "g729", 11, 19.0 },
+    { "g723", 15, 16.1 },
+    { "gsm", 20, 10.0 },
+    { NULL, 0, 0 }
+};
+
+/**
+ * @brief Streams lookup index
+ *
+ * Index tables are hashed by stream address keys and contain buckets with
+ * all streams sharing the same key (rtp_bucket_t).
+ */
+static struct {
+    //! Streams without packets by destination address
+    htable_t *pending;
+    //! Streams with packets by source and destination addresses
+    htable_t *complete;
+} streams_index = { 0 };
+
+/**
+ * @brief Orphan streams discovery data
+ *
+ * Tables are only created if discovery is enabled
+ */
+static struct {
+    //! Unknown flows pool
+    rtp_flow_t *flows;
+    //! Unknown flows by source and destination addresses
+    htable_t *table;
+    //! Most and least recently used flows
+    rtp_flow_t *first, *last;
+    //! Orphan streams by source and destination addresses
+    htable_t *index;
+    //! Orphan streams in creation order (rtp_stream_t)
+    vector_t *streams;
+    //! Discovery counters
+    rtp_orphan_stats_t stats;
+} orphans = { 0 };
+
 rtp_stream_t *
 stream_create(sdp_media_t *media, address_t dst, int type)
 {
     rtp_stream_t *stream;
+    int gap;
 
     // Allocate memory for this stream structure
     if (!(stream = sng_malloc(sizeof(rtp_stream_t))))
@@ -81,29 +131,319 @@ stream_create(sdp_media_t *media, address_t dst, int type)
     stream->media = media;
     stream->dst = dst;
 
+    // Silence gaps longer than this are counted
+    if ((gap = setting_get_intvalue(SETTING_CAPTURE_RTPGAP)) > 0)
+        stream->activity.threshold = (gap + RTP_ACTIVITY_BUCKET - 1) / RTP_ACTIVITY_BUCKET;
+
+    memstat_alloc(MEMSTAT_STREAMS, sizeof(rtp_stream_t));
     return stream;
 }
 
+void
+stream_destroy(rtp_stream_t *stream)
+{
+    rtp_store_t *store = stream->store;
+    uint32_t i;
+
+    // Remove from lookup index
+    rtp_index_remove(stream);
+
+    // Remove stored packets
+    if (store) {
+        for (i = store->first; i < store->count; i++)
+            memstat_free(MEMSTAT_RTP_PACKETS, 0);
+        memstat_resize(MEMSTAT_RTP_PACKETS, store->memsize, 0);
+        vector_destroy(store->chunks);
+        sng_free(store->records);
+        sng_free(store);
+    }
+
+    // Remove received reports
+    if (stream->reports) {
+        memstat_resize(MEMSTAT_STREAMS, sizeof(rtcp_reports_t), 0);
+        sng_free(stream->reports);
+    }
+
+    if (stream->events) {
+        vector_set_destroyer(stream->events, vector_generic_destroyer);
+        vector_destroy(stream->events);
+    }
+
+    memstat_free(MEMSTAT_STREAMS, sizeof(rtp_stream_t));
+    sng_free(stream);
+}
+
+void
+stream_destroyer(void *stream)
+{
+    stream_destroy((rtp_stream_t *) stream);
+}
+
 rtp_stream_t *
 stream_complete(rtp_stream_t *stream, address_t src)
 {
-    stream->src = src;
+    // Streams with packets are indexed by its source address
+    if (stream->bucket && stream->pktcnt && !addressport_equals(stream->src, src)) {
+        rtp_index_remove(stream);
+        stream->src = src;
+        rtp_index_add(stream);
+    } else {
+        stream->src = src;
+    }
     return stream;
 }
 
+/**
+ * @brief Get RTP clock rate of stream format
+ *
+ * Clock rate is taken from the standard encoding name or the SDP rtpmap
+ * of the stream format (i.e. PCMU/8000)
+ */
+static uint32_t
+stream_clock_rate(rtp_stream_t *stream)
+{
+    const char *name = NULL, *rate;
+    int i;
+
+    // Standard format encoding name
+    for (i = 0; encodings[i].format; i++) {
+        if (encodings[i].id == stream->rtpinfo.fmtcode)
+            name = encodings[i].name;
+    }
+
+    // Format described in SDP
+    if (!name && stream->media)
+        name = media_get_format(stream->media, stream->rtpinfo.fmtcode);
+
+    if (name && (rate = strchr(name, '/')) && atoi(rate + 1) > 0)
+        return atoi(rate + 1);
+
+    return RTP_DEFAULT_CLOCK_RATE;
+}
+
+/**
+ * @brief Start sequence numbers statistics from given sequence
+ */
+static void
+stream_stats_init_seq(rtp_stats_t *stats, uint16_t seq)
+{
+    stats->base_seq = seq;
+    stats->max_seq = seq;
+    stats->bad_seq = 65536 + 1;
+    stats->cycles = 0;
+    stats->received = 0;
+    stats->seen = 1;
+    // Restart quality window counters
+    stats->win_expected = 0;
+    stats->win_received = 0;
+    stats->win_bursts = stats->bursts;
+}
+
+/**
+ * @brief Estimate R-factor of stream current quality window
+ *
+ * @return R-factor or -1 if no packets were expected in the window or
+ * stream codec has no known impairment values
+ */
+static double
+stream_window_rfactor(rtp_stream_t *stream)
+{
+    rtp_stats_t *stats = &stream->stats;
+    rtp_emodel_codec_t *codec;
+    const char *format = stream_get_format(stream);
+    uint32_t expected, received, lost, bursts;
+    double ppl, burstr, ie_eff, delay, id, r;
+
+    expected = stream_get_expected(stream) - stats->win_expected;
+    received = stats->received - stats->win_received;
+    bursts = stats->bursts - stats->win_bursts;
+    if (!expected)
+        return -1;
+
+    // Codec impairment values
+    for (codec = emodel_codecs; codec->format; codec++) {
+        if (format && !strncasecmp(format, codec->format, strlen(codec->format)))
+            break;
+    }
+    if (!codec->format)
+        return -1;
+
+    // Packet loss probability (%) and burst ratio
+    lost = (expected > received) ? expected - received : 0;
+    ppl = lost * 100.0 / expected;
+    burstr = 1;
+    if (bursts && lost < expected) {
+        burstr = ((double) lost / bursts) * (1 - ppl / 100);
+        if (burstr < 1)
+            burstr = 1;
+    }
+    ie_eff = codec->ie + (95 - codec->ie) * ppl / (ppl / burstr + codec->bpl);
+
+    // Delay impairment (assuming a jitter buffer of twice the jitter)
+    if (stream_get_rtt(stream) >= 0) {
+        delay = stream_get_rtt(stream) / 2.0 + 2 * stream_get_jitter(stream);
+    } else {
+        delay = RTP_EMODEL_BASE_DELAY + 2 * stream_get_jitter(stream);
+    }
+    id = 0.024 * delay;
+    if (delay > 177.3)
+        id += 0.11 * (delay - 177.3);
+
+    r = 93.2 - id - ie_eff;
+    if (r < 0)
+        r = 0;
+    return r;
+}
+
+/**
+ * @brief Increase received packets counter of given format
+ *
+ * Formats beyond STREAM_FORMATS_MAX are not counted.
+ */
+static void
+stream_count_format(rtp_stream_t *stream, uint32_t format)
+{
+    uint32_t i;
+
+    for (i = 0; i < stream->rtpinfo.fmtcount; i++) {
+        if (stream->rtpinfo.formats[i].code == format) {
+            stream->rtpinfo.formats[i].count++;
+            return;
+        }
+    }
+
+    if (stream->rtpinfo.fmtcount < STREAM_FORMATS_MAX) {
+        stream->rtpinfo.formats[i].code = format;
+        stream->rtpinfo.formats[i].count = 1;
+        stream->rtpinfo.fmtcount++;
+    }
+}
+
+/**
+ * @brief Update stream statistics with a new RTP packet
+ */
+static void
+stream_update_stats(rtp_stream_t *stream, packet_t *packet)
+{
+    rtp_stats_t *stats = &stream->stats;
+    const u_char *payload = packet_payload(packet);
+    struct timeval arrival = packet_time(packet);
+    uint16_t seq, delta;
+    uint32_t timestamp, format;
+    double elapsed, diff;
+
+    if (!payload || packet_payloadlen(packet) < RTP_HDR_LENGTH)
+        return;
+
+    // Count received packets of each format
+    format = RTP_PAYLOAD_TYPE(payload[1]);
+    stream_count_format(stream, format);
+
+    seq = (payload[2] << 8) | payload[3];
+    memcpy(&timestamp, payload + 4, sizeof(timestamp));
+    timestamp = ntohl(timestamp);
+    memcpy(&stats->ssrc, payload + 8, sizeof(stats->ssrc));
+    stats->ssrc = ntohl(stats->ssrc);
+
+    // First packet of the stream
+    if (stream->pktcnt == 0) {
+        stats->clock_rate = stream_clock_rate(stream);
+        stream_stats_init_seq(stats, seq);
+        stats->received = 1;
+        stats->last_timestamp = timestamp;
+        stats->last_arrival = arrival;
+        stats->format = format;
+        stats->win_start = arrival.tv_sec;
+        stats->rfactor = -1;
+        return;
+    }
+
+    delta = seq - stats->max_seq;
+    if (delta == 0) {
+        // Same sequence than the last packet
+        stats->duplicates++;
+        return;
+    } else if (delta < RTP_SEQ_MAX_DROPOUT) {
+        // In order, with permissible gap
+        if (seq < stats->max_seq)
+            stats->cycles += 65536;
+        if (delta > 1)
+            stats->bursts++;
+        stats->seen = (delta < 64) ? (stats->seen << delta) | 1 : 1;
+        stats->max_seq = seq;
+    } else if (delta <= 65536 - RTP_SEQ_MAX_MISORDER) {
+        // Big jump, restart if two sequential packets are received
+        if (seq != stats->bad_seq) {
+            stats->bad_seq = (seq + 1) & 0xFFFF;
+            return;
+        }
+        stream_stats_init_seq(stats, seq);
+    } else {
+        // Duplicate or reordered packet
+        delta = stats->max_seq - seq;
+        if (delta < 64) {
+            if (stats->seen & (1ULL << delta)) {
+                stats->duplicates++;
+                return;
+            }
+            stats->seen |= 1ULL << delta;
+        }
+        stats->out_of_order++;
+    }
+    stats->received++;
+
+    // Time between packets arrival
+    elapsed = (arrival.tv_sec - stats->last_arrival.tv_sec) * 1000.0
+              + (arrival.tv_usec - stats->last_arrival.tv_usec) / 1000.0;
+    if (elapsed > stats->max_delta)
+        stats->max_delta = elapsed;
+
+    // Interarrival jitter: difference of transit times of consecutive packets
+    // Timestamps are not comparable after a format change
+    if (format == stats->format) {
+        diff = elapsed * stats->clock_rate / 1000.0 - (int32_t) (timestamp - stats->last_timestamp);
+        if (diff < 0)
+            diff = -diff;
+        stats->jitter += (diff - stats->jitter) / 16.0;
+    }
+
+    stats->last_timestamp = timestamp;
+    stats->last_arrival = arrival;
+    stats->format = format;
+
+    // Estimate quality of completed window and start a new one
+    if (arrival.tv_sec >= stats->win_start + RTP_EMODEL_WINDOW) {
+        double rfactor = stream_window_rfactor(stream);
+        if (rfactor >= 0 && (stats->rfactor < 0 || rfactor < stats->rfactor))
+            stats->rfactor = rfactor;
+        stats->win_start = arrival.tv_sec;
+        stats->win_expected = stream_get_expected(stream);
+        stats->win_received = stats->received;
+        stats->win_bursts = stats->bursts;
+    }
+}
+
 void
 stream_set_format(rtp_stream_t *stream, uint32_t format)
 {
     stream->rtpinfo.fmtcode = format;
+    stream->stats.clock_rate = stream_clock_rate(stream);
+}
+
+/**
+ * @brief Check if given payload type is telephone-event in stream media
+ */
+static int
+stream_format_is_event(rtp_stream_t *stream, uint32_t format)
+{
+    const char *fmt = stream_get_format_name(stream, format);
+    return (fmt && !strncmp(fmt, "telephone-event", 15));
 }
 
 void
 stream_set_telephone_event(rtp_stream_t *stream)
 {
-    const char *fmt = stream_get_format(stream);
-    if(fmt && !strncmp(fmt, "telephone-event", 15)) {
-        stream->telephone_event = 1;
-    }
+    stream->telephone_event = stream_format_is_event(stream, stream->rtpinfo.fmtcode);
 }
 
 void
@@ -167,14 +507,415 @@ stream_add_event(rtp_stream_t *stream, packet_t *packet)
     vector_append(stream->events, event);
 }
 
+/**
+ * @brief Count a new RTP packet in stream activity histogram
+ *
+ * When the packet starts a new bucket, buckets without packets since the
+ * last one are cleared and the silence is measured.
+ */
+static void
+stream_update_activity(rtp_stream_t *stream, packet_t *packet)
+{
+    rtp_activity_t *activity = &stream->activity;
+    struct timeval arrival = packet_time(packet);
+    int64_t elapsed;
+    uint32_t bucket, gap, i;
+    uint8_t *count;
+
+    // Milliseconds since the first stream packet
+    elapsed = (int64_t) (arrival.tv_sec - stream->time.tv_sec) * 1000
+              + (arrival.tv_usec - stream->time.tv_usec) / 1000;
+    bucket = (elapsed > 0) ? elapsed / RTP_ACTIVITY_BUCKET : 0;
+
+    if (bucket > activity->last) {
+        // Empty buckets between last packet and this one
+        gap = bucket - activity->last - 1;
+        if (gap > activity->max_gap)
+            activity->max_gap = gap;
+        if (activity->threshold && gap >= activity->threshold)
+            activity->gaps++;
+
+        // Clear ring buckets not used since the last packet
+        for (i = 1; i <= gap + 1 && i <= RTP_ACTIVITY_BUCKETS; i++)
+            activity->buckets[(activity->last + i) % RTP_ACTIVITY_BUCKETS] = 0;
+        activity->last = bucket;
+    } else if (activity->last - bucket >= RTP_ACTIVITY_BUCKETS) {
+        // Late packet of a bucket not longer kept
+        return;
+    }
+
+    count = &activity->buckets[bucket % RTP_ACTIVITY_BUCKETS];
+    if (*count < UINT8_MAX)
+        (*count)++;
+}
+
 void
 stream_add_packet(rtp_stream_t *stream, packet_t *packet)
 {
+    // Index stream by its source address after its first packet
+    bool reindex = (stream->pktcnt == 0 && stream->bucket);
+
+    if (reindex)
+        rtp_index_remove(stream);
+
     if (stream->pktcnt == 0)
         stream->time = packet_time(packet);
 
+    // Update quality statistics and activity
+    if (stream->type == PACKET_RTP) {
+        stream_update_stats(stream, packet);
+        stream_update_activity(stream, packet);
+    }
+
     stream->lasttm = (int) time(NULL);
     stream->pktcnt++;
+
+    if (reindex)
+        rtp_index_add(stream);
+}
+
+/**
+ * @brief Create an empty packet store for a stream
+ */
+static rtp_store_t *
+stream_store_create()
+{
+    rtp_store_t *store;
+
+    if (!(store = sng_malloc(sizeof(rtp_store_t))))
+        return NULL;
+
+    store->chunks = vector_create(1, 4);
+    vector_set_destroyer(store->chunks, vector_generic_destroyer);
+    // Frames data is not required when storage is disabled
+    store->frames = !setting_has_value(SETTING_CAPTURE_STORAGE, "none");
+    // Stream time window
+    if ((store->window = setting_get_intvalue(SETTING_CAPTURE_RTPWINDOW)) < 0)
+        store->window = 0;
+    store->memsize = sizeof(rtp_store_t);
+    return store;
+}
+
+/**
+ * @brief Append data to the last chunk of the store
+ *
+ * @return absolute chunk number where data has been stored
+ */
+static uint32_t
+stream_store_data(rtp_store_t *store, const u_char *data, uint32_t len, uint32_t *offset)
+{
+    rtp_chunk_t *chunk = vector_last(store->chunks);
+    uint32_t size;
+
+    // Start a new chunk if data does not fit in the last one
+    if (!chunk || chunk->used + len > chunk->size) {
+        size = (len > RTP_STORE_CHUNK_SIZE) ? len : RTP_STORE_CHUNK_SIZE;
+        chunk = malloc(sizeof(rtp_chunk_t) + size);
+        chunk->used = 0;
+        chunk->size = size;
+        vector_append(store->chunks, chunk);
+        store->memsize += sizeof(rtp_chunk_t) + size;
+    }
+
+    memcpy(chunk->data + chunk->used, data, len);
+    *offset = chunk->used;
+    chunk->used += len;
+    return store->chunk_base + vector_count(store->chunks) - 1;
+}
+
+/**
+ * @brief Get a free record at the end of the store
+ */
+static rtp_record_t *
+stream_store_append(rtp_store_t *store)
+{
+    rtp_record_t *records;
+    uint32_t size;
+
+    if (store->count == store->size) {
+        if (store->first && store->first >= store->count / 2) {
+            // Reuse space of discarded records
+            memmove(store->records, store->records + store->first,
+                    sizeof(rtp_record_t) * (store->count - store->first));
+            store->count -= store->first;
+            store->first = 0;
+        } else {
+            // Grow records array
+            size = store->size ? store->size * 2 : 64;
+            if (!(records = realloc(store->records, sizeof(rtp_record_t) * size)))
+                return NULL;
+            store->records = records;
+            store->memsize += sizeof(rtp_record_t) * (size - store->size);
+            store->size = size;
+        }
+    }
+
+    memset(store->records + store->count, 0, sizeof(rtp_record_t));
+    return store->records + store->count++;
+}
+
+/**
+ * @brief Discard stored packets older than store time window
+ */
+static void
+stream_store_expire(rtp_store_t *store, uint32_t now)
+{
+    rtp_record_t *record;
+
+    if (!store->window || now < (uint32_t) store->window)
+        return;
+
+    // Discard old records
+    while (store->first < store->count) {
+        record = store->records + store->first;
+        if (record->sec >= now - store->window)
+            break;
+        store->first++;
+        memstat_free(MEMSTAT_RTP_PACKETS, 0);
+    }
+
+    // Release chunks without valid records
+    while (vector_count(store->chunks) > 1
+           && (store->first == store->count || store->records[store->first].chunk > store->chunk_base)) {
+        rtp_chunk_t *chunk = vector_first(store->chunks);
+        store->memsize -= sizeof(rtp_chunk_t) + chunk->size;
+        vector_remove(store->chunks, chunk);
+        store->chunk_base++;
+    }
+}
+
+void
+stream_store_packet(rtp_stream_t *stream, packet_t *packet)
+{
+    rtp_store_t *store;
+    rtp_record_t *record;
+    frame_t *frame;
+    struct timeval time;
+    const u_char *payload = packet_payload(packet);
+    uint32_t payload_len = packet_payloadlen(packet);
+    size_t memsize = stream_store_memsize(stream);
+
+    if (!stream->store && !(stream->store = stream_store_create()))
+        return;
+
+    store = stream->store;
+
+    vector_iter_t it = vector_iterator(packet->frames);
+    while ((frame = vector_iterator_next(&it))) {
+        if (!(record = stream_store_append(store)))
+            break;
+
+        record->sec = frame->header->ts.tv_sec;
+        record->usec = frame->header->ts.tv_usec;
+        record->len = frame->header->len;
+        record->hdroff = RTP_RECORD_NO_HEADER;
+
+        if (store->frames && frame->data) {
+            // Store full frame
+            record->caplen = frame->header->caplen;
+            record->chunk = stream_store_data(store, frame->data, record->caplen, &record->offset);
+            // RTP data is at the end of the frame
+            if (payload && record->caplen >= payload_len
+                && !memcmp(frame->data + record->caplen - payload_len, payload, payload_len))
+                record->hdroff = record->caplen - payload_len;
+        } else {
+            // Store only packet payload once
+            record->caplen = (vector_iterator_current(&it) == 0 && payload) ? payload_len : 0;
+            record->chunk = stream_store_data(store, payload, record->caplen, &record->offset);
+            if (record->caplen)
+                record->hdroff = 0;
+        }
+
+        // Store RTP header information
+        if (stream->type == PACKET_RTP && payload && payload_len >= RTP_HDR_LENGTH) {
+            record->mpt = payload[1];
+            record->seq = (payload[2] << 8) | payload[3];
+            record->timestamp = ntohl(*(uint32_t *) (payload + 4));
+            record->ssrc = ntohl(*(uint32_t *) (payload + 8));
+        } else if (payload && payload_len >= RTCP_HDR_LENGTH + 4) {
+            record->ssrc = ntohl(*(uint32_t *) (payload + RTCP_HDR_LENGTH));
+        }
+
+        memstat_alloc(MEMSTAT_RTP_PACKETS, 0);
+    }
+
+    // Discard packets out of the stream time window
+    time = packet_time(packet);
+    stream_store_expire(store, time.tv_sec);
+
+    memstat_resize(MEMSTAT_RTP_PACKETS, memsize, store->memsize);
+}
+
+uint32_t
+stream_store_count(rtp_stream_t *stream)
+{
+    if (!stream->store)
+        return 0;
+    return stream->store->count - stream->store->first;
+}
+
+size_t
+stream_store_memsize(rtp_stream_t *stream)
+{
+    if (!stream->store)
+        return 0;
+    return stream->store->memsize;
+}
+
+rtp_record_t *
+stream_store_record(rtp_stream_t *stream, uint32_t idx, const u_char **data)
+{
+    rtp_store_t *store = stream->store;
+    rtp_record_t *record;
+    rtp_chunk_t *chunk;
+
+    if (idx >= stream_store_count(stream))
+        return NULL;
+
+    record = store->records + store->first + idx;
+    if (data) {
+        chunk = vector_item(store->chunks, record->chunk - store->chunk_base);
+        *data = chunk->data + record->offset;
+    }
+    return record;
+}
+
+packet_t *
+stream_store_get_packet(rtp_stream_t *stream, uint32_t idx)
+{
+    rtp_record_t *record;
+    struct pcap_pkthdr header;
+    const u_char *data;
+    packet_t *packet;
+
+    if (!(record = stream_store_record(stream, idx, &data)))
+        return NULL;
+
+    // Only payload has been stored
+    if (!stream->store->frames)
+        return NULL;
+
+    header.ts.tv_sec = record->sec;
+    header.ts.tv_usec = record->usec;
+    header.caplen = record->caplen;
+    header.len = record->len;
+
+    packet = packet_create(strchr(stream->src.ip, ':') ? 6 : 4, IPPROTO_UDP, stream->src, stream->dst, 0);
+    packet_add_frame(packet, &header, data);
+    packet_set_type(packet, PACKET_RTP);
+    if (record->hdroff != RTP_RECORD_NO_HEADER)
+        packet_set_payload(packet, (u_char *) data + record->hdroff, record->caplen - record->hdroff);
+    return packet;
+}
+
+uint32_t
+stream_get_expected(rtp_stream_t *stream)
+{
+    rtp_stats_t *stats = &stream->stats;
+
+    if (stream->type != PACKET_RTP || !stream->pktcnt)
+        return 0;
+    return stats->cycles + stats->max_seq - stats->base_seq + 1;
+}
+
+uint32_t
+stream_get_lost(rtp_stream_t *stream)
+{
+    uint32_t expected = stream_get_expected(stream);
+
+    if (expected <= stream->stats.received)
+        return 0;
+    return expected - stream->stats.received;
+}
+
+double
+stream_get_loss(rtp_stream_t *stream)
+{
+    uint32_t expected = stream_get_expected(stream);
+
+    if (!expected)
+        return 0;
+    return stream_get_lost(stream) * 100.0 / expected;
+}
+
+double
+stream_get_jitter(rtp_stream_t *stream)
+{
+    if (!stream->stats.clock_rate)
+        return 0;
+    return stream->stats.jitter * 1000.0 / stream->stats.clock_rate;
+}
+
+uint32_t
+stream_get_report_count(rtp_stream_t *stream)
+{
+    if (!stream->reports)
+        return 0;
+    if (stream->reports->count > RTCP_REPORTS_MAX)
+        return RTCP_REPORTS_MAX;
+    return stream->reports->count;
+}
+
+rtcp_report_t *
+stream_get_report(rtp_stream_t *stream, uint32_t idx)
+{
+    if (idx >= stream_get_report_count(stream))
+        return NULL;
+    return &stream->reports->items[(stream->reports->count - 1 - idx) % RTCP_REPORTS_MAX];
+}
+
+int32_t
+stream_get_rtt(rtp_stream_t *stream)
+{
+    if (!stream->reports)
+        return -1;
+    return stream->reports->rtt;
+}
+
+double
+stream_get_rfactor(rtp_stream_t *stream)
+{
+    rtp_stats_t *stats = &stream->stats;
+    double rfactor;
+
+    if (stream->type != PACKET_RTP || !stream->pktcnt)
+        return -1;
+
+    // Current window is only used if it has enough packets or is the only one
+    if (stats->rfactor < 0
+        || stream_get_expected(stream) - stats->win_expected >= RTP_EMODEL_MIN_PACKETS) {
+        rfactor = stream_window_rfactor(stream);
+        if (stats->rfactor < 0 || (rfactor >= 0 && rfactor < stats->rfactor))
+            return rfactor;
+    }
+
+    return stats->rfactor;
+}
+
+double
+stream_get_mos(rtp_stream_t *stream)
+{
+    double r = stream_get_rfactor(stream);
+
+    if (r < 0)
+        return -1;
+    if (r > 100)
+        return 4.5;
+    return 1 + 0.035 * r + r * (r - 60) * (100 - r) * 7e-6;
+}
+
+uint32_t
+stream_get_max_gap(rtp_stream_t *stream)
+{
+    return stream->activity.max_gap * RTP_ACTIVITY_BUCKET;
+}
+
+uint32_t
+stream_get_activity(rtp_stream_t *stream, uint32_t ago)
+{
+    if (ago >= RTP_ACTIVITY_BUCKETS || ago > stream->activity.last)
+        return 0;
+    return stream->activity.buckets[(stream->activity.last - ago) % RTP_ACTIVITY_BUCKETS];
 }
 
 uint32_t
@@ -193,19 +934,27 @@ stream_get_call(rtp_stream_t *stream) {
 const char *
 stream_get_format(rtp_stream_t *stream)
 {
+    if (!stream)
+        return NULL;
+
+    return stream_get_format_name(stream, stream->rtpinfo.fmtcode);
+}
 
+const char *
+stream_get_format_name(rtp_stream_t *stream, uint32_t code)
+{
     const char *fmt;
 
     // Get format for media payload
-    if (!stream || !stream->media)
+    if (!stream)
         return NULL;
 
     // Try to get standard format form code
-    if ((fmt = rtp_get_standard_format(stream->rtpinfo.fmtcode)))
+    if ((fmt = rtp_get_standard_format(code)))
         return fmt;
 
     // Try to get format form SDP payload
-    if ((fmt = media_get_format(stream->media, stream->rtpinfo.fmtcode)))
+    if (stream->media && (fmt = media_get_format(stream->media, code)))
         return fmt;
 
     // Not found format for this code
@@ -226,25 +975,422 @@ rtp_get_standard_format(uint32_t code)
     return NULL;
 }
 
-rtp_stream_t *
-rtp_check_packet(packet_t *packet)
+/**
+ * @brief Get a new report slot in the stream reports ring
+ *
+ * @return empty report, overwritting the oldest one if ring is full
+ */
+static rtcp_report_t *
+stream_add_report(rtp_stream_t *stream, packet_t *packet, uint8_t type, uint32_t sender)
 {
-    address_t src, dst;
-    rtp_stream_t *stream;
-    rtp_stream_t *reverse;
-    u_char format = 0;
-    u_char *payload;
-    uint32_t size, bsize;
-    uint16_t len;
-    struct rtcp_hdr_generic hdr;
-    struct rtcp_hdr_sr hdr_sr;
-    struct rtcp_hdr_xr hdr_xr;
-    struct rtcp_blk_xr blk_xr;
-    struct rtcp_blk_xr_voip blk_xr_voip;
+    rtcp_report_t *report;
 
-    // Get packet data
-    payload = packet_payload(packet);
-    size = packet_payloadlen(packet);
+    if (!stream->reports) {
+        if (!(stream->reports = sng_malloc(sizeof(rtcp_reports_t))))
+            return NULL;
+        stream->reports->rtt = -1;
+        memstat_resize(MEMSTAT_STREAMS, 0, sizeof(rtcp_reports_t));
+    }
+
+    report = &stream->reports->items[stream->reports->count++ % RTCP_REPORTS_MAX];
+    memset(report, 0, sizeof(rtcp_report_t));
+    report->time = packet_time(packet);
+    report->type = type;
+    report->sender = sender;
+    report->rtt = -1;
+    return report;
+}
+
+/**
+ * @brief Store report round trip time as last known stream RTT
+ */
+static void
+stream_set_report_rtt(rtp_stream_t *stream, rtcp_report_t *report, int32_t rtt)
+{
+    report->rtt = rtt;
+    stream->reports->rtt = rtt;
+}
+
+/**
+ * @brief Find the RTP stream a RTCP report is about
+ *
+ * RTP streams of the call are matched by their SSRC. If no stream has
+ * received packets with that SSRC, streams between the same addresses are
+ * used: in the same direction of the RTCP packet for sender information
+ * or in the opposite direction for reception reports.
+ *
+ * @param rtcp RTCP stream of the report packet
+ * @param packet RTCP packet
+ * @param ssrc Source of the report
+ * @param reverse Reported stream is sent to the RTCP packet sender
+ * @return matching RTP stream or the RTCP stream if none matches
+ */
+static rtp_stream_t *
+rtcp_report_stream(rtp_stream_t *rtcp, packet_t *packet, uint32_t ssrc, bool reverse)
+{
+    sip_call_t *call = stream_get_call(rtcp);
+    rtp_stream_t *stream, *candidate = NULL;
+    address_t src = reverse ? packet->dst : packet->src;
+    address_t dst = reverse ? packet->src : packet->dst;
+    vector_iter_t it;
+
+    if (!call)
+        return rtcp;
+
+    it = vector_iterator(call->streams);
+    while ((stream = vector_iterator_next(&it))) {
+        if (stream->type != PACKET_RTP || !stream->pktcnt)
+            continue;
+        if (stream->stats.ssrc == ssrc)
+            return stream;
+        if (!candidate && address_equals(stream->src, src) && address_equals(stream->dst, dst))
+            candidate = stream;
+    }
+
+    return (candidate) ? candidate : rtcp;
+}
+
+/**
+ * @brief Store the reference time of a SR or XR reference time report
+ *
+ * @param stream Stream holding the report
+ * @param packet RTCP packet
+ * @param ssrc Report sender
+ * @param ntp Report NTP timestamp (network byte order, 64 bits)
+ */
+static void
+rtcp_add_reftime(rtp_stream_t *stream, packet_t *packet, uint32_t ssrc, const u_char *ntp)
+{
+    rtcp_reftime_t *reftime;
+    uint32_t sec, frac;
+
+    if (!stream->reports)
+        return;
+
+    memcpy(&sec, ntp, sizeof(sec));
+    memcpy(&frac, ntp + 4, sizeof(frac));
+
+    reftime = &stream->reports->reftimes[stream->reports->refcount++ % RTCP_REFTIMES_MAX];
+    reftime->ssrc = ssrc;
+    reftime->ntp = (ntohl(sec) << 16) | (ntohl(frac) >> 16);
+    reftime->time = packet_time(packet);
+}
+
+/**
+ * @brief Find a stored reference time in a stream
+ *
+ * @return true if the reference time has been found
+ */
+static bool
+stream_find_reftime(rtp_stream_t *stream, uint32_t ssrc, uint32_t ntp, struct timeval *time)
+{
+    uint32_t i, count;
+
+    if (!stream->reports)
+        return false;
+
+    count = stream->reports->refcount;
+    if (count > RTCP_REFTIMES_MAX)
+        count = RTCP_REFTIMES_MAX;
+
+    for (i = 0; i < count; i++) {
+        if (stream->reports->reftimes[i].ssrc == ssrc && stream->reports->reftimes[i].ntp == ntp) {
+            *time = stream->reports->reftimes[i].time;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Find the capture time of the report a LSR or LRR value refers to
+ *
+ * Reference times are searched in all streams of the call.
+ *
+ * @return true if the report has been found
+ */
+static bool
+rtcp_find_reftime(rtp_stream_t *rtcp, uint32_t ssrc, uint32_t ntp, struct timeval *time)
+{
+    sip_call_t *call = stream_get_call(rtcp);
+    rtp_stream_t *stream;
+    vector_iter_t it;
+
+    if (!call)
+        return stream_find_reftime(rtcp, ssrc, ntp, time);
+
+    it = vector_iterator(call->streams);
+    while ((stream = vector_iterator_next(&it))) {
+        if (stream_find_reftime(stream, ssrc, ntp, time))
+            return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Calculate round trip time of a report reply
+ *
+ * Round trip time is the time between the capture of the referenced report
+ * and its reply, minus the delay reported by the endpoint. Only capture
+ * times are compared, so endpoint clocks do not need to be synchronized.
+ *
+ * @param rtcp RTCP stream of the reply packet
+ * @param packet RTCP reply packet
+ * @param ssrc Sender of the referenced report
+ * @param lsr Referenced report time (compact NTP format)
+ * @param dlsr Delay since referenced report (1/65536 seconds)
+ * @return round trip time in milliseconds or -1 if not valid
+ */
+static int32_t
+rtcp_calc_rtt(rtp_stream_t *rtcp, packet_t *packet, uint32_t ssrc, uint32_t lsr, uint32_t dlsr)
+{
+    struct timeval sent, received;
+    int64_t rtt;
+
+    if (!lsr || !rtcp_find_reftime(rtcp, ssrc, lsr, &sent))
+        return -1;
+
+    received = packet_time(packet);
+    rtt = ((int64_t) received.tv_sec - sent.tv_sec) * 1000 + ((int64_t) received.tv_usec - sent.tv_usec) / 1000;
+    rtt -= ((uint64_t) dlsr * 1000) >> 16;
+
+    // Reply captured before the report delay has elapsed
+    if (rtt < 0 || rtt > INT32_MAX)
+        return -1;
+    return (int32_t) rtt;
+}
+
+/**
+ * @brief Parse SR and RR report blocks
+ */
+static void
+rtcp_parse_report_blocks(rtp_stream_t *rtcp, packet_t *packet, const u_char *payload,
+                         uint32_t len, uint8_t type, uint32_t sender, uint8_t count)
+{
+    struct rtcp_blk_sr blk;
+    rtcp_report_t *report;
+    rtp_stream_t *stream;
+    uint32_t ssrc;
+
+    while (count-- && len >= sizeof(blk)) {
+        memcpy(&blk, payload, sizeof(blk));
+        ssrc = ntohl(blk.ssrc);
+        stream = rtcp_report_stream(rtcp, packet, ssrc, true);
+
+        if ((report = stream_add_report(stream, packet, type, sender))) {
+            report->source = ssrc;
+            report->flost = blk.flost;
+            report->plost = (blk.plost.pl1 << 16) | (blk.plost.pl2 << 8) | blk.plost.pl3;
+            // Cumulative lost is a 24 bits signed value
+            if (report->plost & 0x800000)
+                report->plost -= 0x1000000;
+            report->hseq = ntohl(blk.hseq);
+            report->jitter = ntohl(blk.ijitter);
+            report->lsr = ntohl(blk.lsr);
+            report->dlsr = ntohl(blk.dlsr);
+            if (report->lsr)
+                stream_set_report_rtt(stream, report, rtcp_calc_rtt(rtcp, packet, ssrc, report->lsr, report->dlsr));
+        }
+
+        payload += sizeof(blk);
+        len -= sizeof(blk);
+    }
+}
+
+/**
+ * @brief Parse XR report blocks
+ */
+static void
+rtcp_parse_xr_blocks(rtp_stream_t *rtcp, packet_t *packet, const u_char *payload,
+                     uint32_t len, uint32_t sender)
+{
+    struct rtcp_blk_xr blk;
+    struct rtcp_blk_xr_voip voip;
+    rtcp_report_t *report;
+    rtp_stream_t *stream;
+    uint32_t blen, offset, ssrc, value;
+
+    while (len >= sizeof(blk)) {
+        // Read block header
+        memcpy(&blk, payload, sizeof(blk));
+        if ((blen = ntohs(blk.len) * 4 + 4) > len)
+            break;
+
+        // Check block type
+        switch (blk.type) {
+            case RTCP_XR_REF_TIME:
+                // Receiver reference time, replied with DLRR sub-blocks
+                if (blen < 12)
+                    break;
+                stream = rtcp_report_stream(rtcp, packet, sender, false);
+                if (!(report = stream_add_report(stream, packet, RTCP_XR, sender)))
+                    break;
+                report->block = blk.type;
+                report->source = sender;
+                rtcp_add_reftime(stream, packet, sender, payload + 4);
+                break;
+            case RTCP_XR_DLRR:
+                // Delay since last receiver reference time sub-blocks
+                for (offset = 4; offset + 12 <= blen; offset += 12) {
+                    memcpy(&ssrc, payload + offset, sizeof(ssrc));
+                    ssrc = ntohl(ssrc);
+                    // Sub-block is about the receiver that sent the reference time
+                    stream = rtcp_report_stream(rtcp, packet, ssrc, true);
+                    if (!(report = stream_add_report(stream, packet, RTCP_XR, sender)))
+                        break;
+                    report->block = blk.type;
+                    report->source = ssrc;
+                    memcpy(&value, payload + offset + 4, sizeof(value));
+                    report->lsr = ntohl(value);
+                    memcpy(&value, payload + offset + 8, sizeof(value));
+                    report->dlsr = ntohl(value);
+                    if (report->lsr)
+                        stream_set_report_rtt(stream, report, rtcp_calc_rtt(rtcp, packet, ssrc, report->lsr, report->dlsr));
+                }
+                break;
+            case RTCP_XR_STATS_SUMRY:
+                // Statistics summary (lost and duplicated packets, jitter)
+                if (blen < 32)
+                    break;
+                memcpy(&ssrc, payload + 4, sizeof(ssrc));
+                stream = rtcp_report_stream(rtcp, packet, ntohl(ssrc), true);
+                if (!(report = stream_add_report(stream, packet, RTCP_XR, sender)))
+                    break;
+                report->block = blk.type;
+                report->source = ntohl(ssrc);
+                memcpy(&value, payload + 12, sizeof(value));
+                report->plost = ntohl(value);
+                memcpy(&value, payload + 28, sizeof(value));
+                report->jitter = ntohl(value);
+                break;
+            case RTCP_XR_VOIP_METRCS:
+                // Only fields up to MOS-CQ are used
+                if (blen < offsetof(struct rtcp_blk_xr_voip, rxc))
+                    break;
+                memcpy(&voip, payload, offsetof(struct rtcp_blk_xr_voip, rxc));
+                rtcp->rtcpinfo.fdiscard = voip.drate;
+                rtcp->rtcpinfo.flost = voip.lrate;
+                rtcp->rtcpinfo.mosl = voip.moslq;
+                rtcp->rtcpinfo.mosc = voip.moscq;
+
+                stream = rtcp_report_stream(rtcp, packet, ntohl(voip.ssrc), true);
+                if (!(report = stream_add_report(stream, packet, RTCP_XR, sender)))
+                    break;
+                report->block = blk.type;
+                report->source = ntohl(voip.ssrc);
+                report->flost = voip.lrate;
+                report->fdiscard = voip.drate;
+                report->mosl = voip.moslq;
+                report->mosc = voip.moscq;
+                report->rfactor = voip.rfactor;
+                if (voip.rtd)
+                    stream_set_report_rtt(stream, report, ntohs(voip.rtd));
+                break;
+            default:
+                // Other blocks (RLE, receipt times) are skipped
+                break;
+        }
+
+        payload += blen;
+        len -= blen;
+    }
+}
+
+/**
+ * @brief Parse all RTCP packets of a compound RTCP payload
+ *
+ * Reports are stored in the RTP stream they are about (or the RTCP stream
+ * itself if no RTP stream matches)
+ */
+static void
+rtcp_parse_packet(rtp_stream_t *stream, packet_t *packet)
+{
+    const u_char *payload = packet_payload(packet);
+    uint32_t size = packet_payloadlen(packet);
+    uint32_t len, ssrc;
+    struct rtcp_hdr_generic hdr;
+    struct rtcp_hdr_sr hdr_sr;
+    rtcp_report_t *report;
+    rtp_stream_t *sender;
+
+    // Parse all packet payload headers
+    while (size >= sizeof(hdr)) {
+        memcpy(&hdr, payload, sizeof(hdr));
+
+        // Check RTP version
+        if (RTP_VERSION(hdr.version) != RTP_VERSION_RFC1889)
+            break;
+
+        // Header length
+        if ((len = ntohs(hdr.len) * 4 + 4) > size)
+            break;
+
+        // Check RTCP packet header type
+        switch (hdr.type) {
+            case RTCP_HDR_SR:
+                // Ensure there is enough payload to fill the header
+                if (len < RTCP_SR_LENGTH)
+                    break;
+
+                // Get Sender Report header
+                memcpy(&hdr_sr, payload, RTCP_SR_LENGTH);
+                ssrc = ntohl(hdr_sr.ssrc);
+                stream->rtcpinfo.spc = ntohl(hdr_sr.spc);
+
+                // Sender information is about the sender stream
+                sender = rtcp_report_stream(stream, packet, ssrc, false);
+                if ((report = stream_add_report(sender, packet, RTCP_HDR_SR, ssrc))) {
+                    report->source = ssrc;
+                    report->spc = ntohl(hdr_sr.spc);
+                    report->soc = ntohl(hdr_sr.soc);
+                    // Keep SR time to match later RR LSR values
+                    rtcp_add_reftime(sender, packet, ssrc, payload + 8);
+                }
+
+                rtcp_parse_report_blocks(stream, packet, payload + RTCP_SR_LENGTH,
+                                         len - RTCP_SR_LENGTH, RTCP_HDR_SR, ssrc, hdr.version & 0x1F);
+                break;
+            case RTCP_HDR_RR:
+                if (len < 8)
+                    break;
+                memcpy(&ssrc, payload + 4, sizeof(ssrc));
+                rtcp_parse_report_blocks(stream, packet, payload + 8, len - 8,
+                                         RTCP_HDR_RR, ntohl(ssrc), hdr.version & 0x1F);
+                break;
+            case RTCP_XR:
+                if (len < 8)
+                    break;
+                memcpy(&ssrc, payload + 4, sizeof(ssrc));
+                rtcp_parse_xr_blocks(stream, packet, payload + 8, len - 8, ntohl(ssrc));
+                break;
+            case RTCP_HDR_SDES:
+            case RTCP_HDR_BYE:
+            case RTCP_HDR_APP:
+            case RTCP_RTPFB:
+            case RTCP_PSFB:
+                break;
+            default:
+                // Not handled headers. Skip the rest of this packet
+                return;
+        }
+        payload += len;
+        size -= len;
+    }
+}
+
+rtp_stream_t *
+rtp_check_packet(packet_t *packet)
+{
+    address_t src, dst;
+    rtp_stream_t *stream;
+    rtp_stream_t *reverse;
+    u_char format = 0;
+    u_char *payload;
+    uint32_t size, ssrc;
+
+    // Get packet data
+    payload = packet_payload(packet);
+    size = packet_payloadlen(packet);
 
     // Get Addresses from packet
     src = packet->src;
@@ -252,24 +1398,31 @@ rtp_check_packet(packet_t *packet)
 
     if (data_is_rtp(payload, size) == 0) {
 
-        // Get RTP payload type
+        // Get RTP payload type and synchronization source
         format = RTP_PAYLOAD_TYPE(*(payload + 1));
+        memcpy(&ssrc, payload + 8, sizeof(ssrc));
+        ssrc = ntohl(ssrc);
 
         // Find the matching stream
-        stream = rtp_find_stream_format(src, dst, format);
+        stream = rtp_find_stream_format(src, dst, format, ssrc);
 
-        // Check if a valid stream has been found
+        // Check if a valid stream has been found (or discovered without SDP)
         if (!stream)
-            return NULL;
-
-        // We have found a stream, but with different format
-        if (stream_is_complete(stream) && stream->rtpinfo.fmtcode != format) {
-            // Create a new stream for this new format
-            stream = stream_create(stream->media, dst, PACKET_RTP);
-            stream_complete(stream, src);
-            stream_set_format(stream, format);
-            stream_set_telephone_event(stream);
-            call_add_stream(msg_get_call(stream->media->msg), stream);
+            return rtp_orphan_check_packet(packet, format, ssrc);
+
+        if (stream_is_complete(stream)) {
+            if (stream->stats.ssrc != ssrc
+                || stream->telephone_event != stream_format_is_event(stream, format)) {
+                // We have found a stream, but from other source or kind of payload
+                stream = stream_create(stream->media, dst, PACKET_RTP);
+                stream_complete(stream, src);
+                stream_set_format(stream, format);
+                stream_set_telephone_event(stream);
+                call_add_stream(msg_get_call(stream->media->msg), stream);
+            } else if (stream->rtpinfo.fmtcode != format) {
+                // Same source changed its codec
+                stream_set_format(stream, format);
+            }
         }
 
         // First packet for this stream, set source data
@@ -328,140 +1481,453 @@ rtp_check_packet(packet_t *packet)
     } else if (data_is_rtcp(payload, size) == 0) {
         // Find the matching stream
         if ((stream = rtp_find_rtcp_stream(src, dst))) {
+            // Parse all packet reports
+            rtcp_parse_packet(stream, packet);
+            // Add packet to stream
+            stream_complete(stream, src);
+            stream_add_packet(stream, packet);
+        }
+    } else {
+      return NULL;
+    }
 
-            // Parse all packet payload headers
-            while ((int32_t) size > 0) {
+    return stream;
+}
 
-                // Check we have at least rtcp generic info
-                if (size < sizeof(struct rtcp_hdr_generic))
-                    break;
+/**
+ * @brief Get the lookup index bucket of the given key
+ */
+static rtp_bucket_t *
+rtp_index_bucket(htable_t *table, const char *key)
+{
+    if (!table)
+        return NULL;
+    return htable_find(table, key);
+}
 
-                memcpy(&hdr, payload, sizeof(hdr));
+/**
+ * @brief Build lookup index key for given addresses
+ */
+static void
+rtp_index_key(address_t src, address_t dst, char *key)
+{
+    if (src.port) {
+        snprintf(key, RTP_INDEX_KEYLEN, "%s:%u-%s:%u", src.ip, src.port, dst.ip, dst.port);
+    } else {
+        snprintf(key, RTP_INDEX_KEYLEN, "%s:%u", dst.ip, dst.port);
+    }
+}
 
-                // Check RTP version
-                if (RTP_VERSION(hdr.version) != RTP_VERSION_RFC1889)
-                    break;
+/**
+ * @brief Check if a stream has been added after other
+ *
+ * Streams of newer calls are considered newer. Streams of the same call
+ * are compared by their position in the call streams list.
+ */
+static int
+rtp_index_newer(rtp_stream_t *one, rtp_stream_t *two)
+{
+    sip_call_t *call1, *call2;
 
-                // Header length
-                if ((len = ntohs(hdr.len) * 4 + 4) > size)
-                    break;
+    if (!two)
+        return 1;
 
-                // Check RTCP packet header typ
-                switch (hdr.type) {
-                    case RTCP_HDR_SR:
-                        // Ensure there is enough payload to fill the header
-                        if (size < sizeof(struct rtcp_hdr_sr))
-                            break;
+    call1 = stream_get_call(one);
+    call2 = stream_get_call(two);
+    if (call1 != call2)
+        return call1->index > call2->index;
 
-                        // Get Sender Report header
-                        memcpy(&hdr_sr, payload, sizeof(hdr_sr));
-                        stream->rtcpinfo.spc = ntohl(hdr_sr.spc);
-                        break;
-                    case RTCP_HDR_RR:
-                    case RTCP_HDR_SDES:
-                    case RTCP_HDR_BYE:
-                    case RTCP_HDR_APP:
-                    case RTCP_RTPFB:
-                    case RTCP_PSFB:
-                        break;
-                    case RTCP_XR:
-                        // Ensure there is enough payload to fill the header
-                        if (size < sizeof(struct rtcp_hdr_xr))
-                            break;
-
-                        // Get Sender Report Extended header
-                        memcpy(&hdr_xr, payload, sizeof(hdr_xr));
-                        bsize = sizeof(hdr_xr);
-
-                        // Read all report blocks
-                        while (bsize < ntohs(hdr_xr.len) * 4 + 4) {
-                            // Read block header
-                            memcpy(&blk_xr, payload + bsize, sizeof(blk_xr));
-                            // Check block type
-                            switch (blk_xr.type) {
-                                case RTCP_XR_VOIP_METRCS:
-                                    memcpy(&blk_xr_voip, payload + sizeof(hdr_xr), sizeof(blk_xr_voip));
-                                    stream->rtcpinfo.fdiscard = blk_xr_voip.drate;
-                                    stream->rtcpinfo.flost = blk_xr_voip.lrate;
-                                    stream->rtcpinfo.mosl = blk_xr_voip.moslq;
-                                    stream->rtcpinfo.mosc = blk_xr_voip.moscq;
-                                    break;
-                                default: break;
-                            }
-                            bsize += ntohs(blk_xr.len) * 4 + 4;
-                        }
-                        break;
-                    case RTCP_AVB:
-                    case RTCP_RSI:
-                    case RTCP_TOKEN:
-                    default:
-                        // Not handled headers. Skip the rest of this packet
-                        size = 0;
-                        break;
-                }
-                payload += len;
-                size -= len;
-            }
+    return vector_index(call1->streams, one) > vector_index(call2->streams, two);
+}
 
-            // Add packet to stream
-            stream_complete(stream, src);
-            stream_add_packet(stream, packet);
+void
+rtp_index_init(size_t size)
+{
+    streams_index.pending = htable_create(size);
+    streams_index.complete = htable_create(size);
+}
+
+void
+rtp_index_deinit()
+{
+    htable_destroy(streams_index.pending);
+    htable_destroy(streams_index.complete);
+    memset(&streams_index, 0, sizeof(streams_index));
+}
+
+void
+rtp_index_add(rtp_stream_t *stream)
+{
+    rtp_bucket_t *bucket;
+    htable_t *table;
+    char key[RTP_INDEX_KEYLEN];
+
+    if (stream->bucket || !streams_index.pending)
+        return;
+
+    if (stream->pktcnt) {
+        table = streams_index.complete;
+        rtp_index_key(stream->src, stream->dst, key);
+    } else {
+        table = streams_index.pending;
+        rtp_index_key((address_t) { 0 }, stream->dst, key);
+    }
+
+    // Create a new bucket for this key
+    if (!(bucket = htable_find(table, key))) {
+        if (!(bucket = sng_malloc(sizeof(rtp_bucket_t))))
+            return;
+        strcpy(bucket->key, key);
+        bucket->table = table;
+        bucket->streams = vector_create(1, 2);
+        htable_insert(table, bucket->key, bucket);
+        memstat_alloc(MEMSTAT_HTABLES, sizeof(rtp_bucket_t));
+    }
+
+    vector_append(bucket->streams, stream);
+    stream->bucket = bucket;
+}
+
+void
+rtp_index_remove(rtp_stream_t *stream)
+{
+    rtp_bucket_t *bucket = stream->bucket;
+
+    if (!bucket)
+        return;
+
+    stream->bucket = NULL;
+    vector_remove(bucket->streams, stream);
+
+    // Remove empty buckets
+    if (vector_count(bucket->streams) == 0) {
+        htable_remove(bucket->table, bucket->key);
+        vector_destroy(bucket->streams);
+        memstat_free(MEMSTAT_HTABLES, sizeof(rtp_bucket_t));
+        sng_free(bucket);
+    }
+}
+
+/**
+ * @brief Move a flow to the head of the LRU list
+ */
+static void
+rtp_orphan_flow_touch(rtp_flow_t *flow)
+{
+    if (orphans.first == flow)
+        return;
+
+    // Unlink from its current position
+    if (flow->prev)
+        flow->prev->next = flow->next;
+    if (flow->next)
+        flow->next->prev = flow->prev;
+    if (orphans.last == flow)
+        orphans.last = flow->prev;
+
+    // Link as most recently used
+    flow->prev = NULL;
+    flow->next = orphans.first;
+    if (orphans.first)
+        orphans.first->prev = flow;
+    orphans.first = flow;
+    if (!orphans.last)
+        orphans.last = flow;
+}
+
+/**
+ * @brief Get an unused flow for the given key
+ *
+ * Flows are taken from the pool until it is full, then the least recently
+ * used flow is reused.
+ */
+static rtp_flow_t *
+rtp_orphan_flow_create(const char *key)
+{
+    rtp_flow_t *flow;
+
+    if (orphans.stats.flows < RTP_ORPHAN_FLOWS) {
+        flow = &orphans.flows[orphans.stats.flows++];
+    } else {
+        flow = orphans.last;
+        if (flow->key[0]) {
+            htable_remove(orphans.table, flow->key);
+            orphans.stats.evicted++;
+        }
+    }
+
+    strcpy(flow->key, key);
+    htable_insert(orphans.table, flow->key, flow);
+    rtp_orphan_flow_touch(flow);
+    return flow;
+}
+
+/**
+ * @brief Release a flow once it has been promoted to an orphan stream
+ *
+ * Released flow is moved to the tail of the LRU list to be reused first.
+ */
+static void
+rtp_orphan_flow_release(rtp_flow_t *flow)
+{
+    htable_remove(orphans.table, flow->key);
+    flow->key[0] = '\0';
+
+    if (orphans.last == flow)
+        return;
+
+    if (flow->prev)
+        flow->prev->next = flow->next;
+    if (flow->next)
+        flow->next->prev = flow->prev;
+    if (orphans.first == flow)
+        orphans.first = flow->next;
+
+    flow->next = NULL;
+    flow->prev = orphans.last;
+    orphans.last->next = flow;
+    orphans.last = flow;
+}
+
+/**
+ * @brief Add an orphan stream to the orphan streams index
+ */
+static void
+rtp_orphan_index(rtp_stream_t *stream, const char *key)
+{
+    rtp_bucket_t *bucket;
+
+    if (!(bucket = sng_malloc(sizeof(rtp_bucket_t))))
+        return;
+    strcpy(bucket->key, key);
+    bucket->table = orphans.index;
+    bucket->streams = vector_create(1, 1);
+    htable_insert(orphans.index, bucket->key, bucket);
+    memstat_alloc(MEMSTAT_HTABLES, sizeof(rtp_bucket_t));
+
+    vector_append(bucket->streams, stream);
+    stream->bucket = bucket;
+}
+
+/**
+ * @brief Create a new orphan stream
+ *
+ * If there are too many orphan streams, the one that has not received
+ * packets for longer is removed.
+ */
+static rtp_stream_t *
+rtp_orphan_create(address_t src, address_t dst, uint32_t format)
+{
+    rtp_stream_t *stream, *oldest = NULL;
+    vector_iter_t it;
+
+    if (vector_count(orphans.streams) >= RTP_ORPHAN_STREAMS) {
+        it = vector_iterator(orphans.streams);
+        while ((stream = vector_iterator_next(&it))) {
+            if (!oldest || timeval_is_older(oldest->stats.last_arrival, stream->stats.last_arrival))
+                oldest = stream;
         }
+        vector_remove(orphans.streams, oldest);
+    }
+
+    if (!(stream = stream_create(NULL, dst, PACKET_RTP)))
+        return NULL;
+    stream_complete(stream, src);
+    stream_set_format(stream, format);
+    vector_append(orphans.streams, stream);
+    orphans.stats.promoted++;
+    return stream;
+}
+
+rtp_stream_t *
+rtp_orphan_check_packet(packet_t *packet, uint32_t format, uint32_t ssrc)
+{
+    rtp_bucket_t *bucket;
+    rtp_stream_t *stream;
+    rtp_flow_t *flow;
+    char key[RTP_INDEX_KEYLEN];
+    u_char *payload = packet_payload(packet);
+    uint16_t seq, delta;
+
+    if (!orphans.table)
+        return NULL;
+
+    // Packet of an already discovered stream
+    rtp_index_key(packet->src, packet->dst, key);
+    if ((bucket = htable_find(orphans.index, key))) {
+        stream = vector_first(bucket->streams);
+        if (stream->rtpinfo.fmtcode != format)
+            stream_set_format(stream, format);
+        stream_add_packet(stream, packet);
+        return stream;
+    }
+
+    seq = (payload[2] << 8) | payload[3];
+
+    // First packet of an unknown flow
+    if (!(flow = htable_find(orphans.table, key))) {
+        flow = rtp_orphan_flow_create(key);
+        flow->ssrc = ssrc;
+        flow->seq = seq;
+        flow->packets = 1;
+        return NULL;
+    }
+
+    rtp_orphan_flow_touch(flow);
+
+    // Count packets that follow the last one, start again otherwise
+    delta = seq - flow->seq;
+    if (flow->ssrc == ssrc && delta > 0 && delta <= RTP_ORPHAN_SEQ_GAP) {
+        flow->packets++;
     } else {
-      return NULL;
+        flow->ssrc = ssrc;
+        flow->packets = 1;
     }
+    flow->seq = seq;
+
+    if (flow->packets < RTP_ORPHAN_PACKETS)
+        return NULL;
 
+    // Sustained flow, promote it to an orphan stream
+    rtp_orphan_flow_release(flow);
+    if (!(stream = rtp_orphan_create(packet->src, packet->dst, format)))
+        return NULL;
+    stream_add_packet(stream, packet);
+    rtp_orphan_index(stream, key);
     return stream;
 }
 
+void
+rtp_orphans_init()
+{
+    if (!setting_enabled(SETTING_CAPTURE_RTPORPHAN))
+        return;
+
+    // Flows pool is allocated once (bigger than sng_malloc limit)
+    if (!(orphans.flows = calloc(RTP_ORPHAN_FLOWS, sizeof(rtp_flow_t))))
+        return;
+
+    orphans.table = htable_create(RTP_ORPHAN_FLOWS);
+    orphans.index = htable_create(RTP_ORPHAN_STREAMS);
+    orphans.streams = vector_create(0, 16);
+    vector_set_destroyer(orphans.streams, stream_destroyer);
+    memstat_alloc(MEMSTAT_HTABLES, sizeof(rtp_flow_t) * RTP_ORPHAN_FLOWS);
+}
+
+void
+rtp_orphans_deinit()
+{
+    if (!orphans.table)
+        return;
+
+    rtp_orphans_clear();
+    vector_destroy(orphans.streams);
+    htable_destroy(orphans.index);
+    htable_destroy(orphans.table);
+    memstat_free(MEMSTAT_HTABLES, sizeof(rtp_flow_t) * RTP_ORPHAN_FLOWS);
+    free(orphans.flows);
+    memset(&orphans, 0, sizeof(orphans));
+}
+
+void
+rtp_orphans_clear()
+{
+    uint32_t i;
+
+    if (!orphans.table)
+        return;
+
+    // Remove all orphan streams (and their index buckets)
+    vector_clear(orphans.streams);
+
+    // Forget all tracked flows
+    for (i = 0; i < orphans.stats.flows; i++) {
+        if (orphans.flows[i].key[0])
+            htable_remove(orphans.table, orphans.flows[i].key);
+    }
+    memset(orphans.flows, 0, sizeof(rtp_flow_t) * RTP_ORPHAN_FLOWS);
+    orphans.first = orphans.last = NULL;
+    memset(&orphans.stats, 0, sizeof(orphans.stats));
+}
+
+bool
+rtp_orphans_enabled()
+{
+    return orphans.table != NULL;
+}
+
+vector_iter_t
+rtp_orphans_iterator()
+{
+    return vector_iterator(orphans.streams);
+}
+
+rtp_orphan_stats_t
+rtp_orphans_stats()
+{
+    return orphans.stats;
+}
+
 rtp_stream_t *
-rtp_find_stream_format(address_t src, address_t dst, uint32_t format)
+rtp_find_stream_format(address_t src, address_t dst, uint32_t format, uint32_t ssrc)
 {
     // Structure for RTP packet streams
     rtp_stream_t *stream;
-    // Check if this is a RTP packet from active calls
-    sip_call_t *call;
-    // Iterator for active calls
-    vector_iter_t calls;
-    // Iterator for call streams
-    vector_iter_t streams;
+    // Matching stream
+    rtp_stream_t *found = NULL;
     // Candiate stream
     rtp_stream_t *candidate = NULL;
+    // Newest stream without packets
+    rtp_stream_t *pending = NULL;
+    // Index buckets for this packet addresses
+    rtp_bucket_t *bucket;
+    // Iterator for bucket streams
+    vector_iter_t streams;
+    char key[RTP_INDEX_KEYLEN];
 
-    // Get active calls (during conversation)
-    calls = sip_calls_iterator();
-    vector_iterator_set_current(&calls, vector_iterator_count(&calls));
-
-    while ((call = vector_iterator_prev(&calls))) {
-        streams = vector_iterator(call->streams);
-        vector_iterator_set_last(&streams);
-        while ((stream = vector_iterator_prev(&streams))) {
+    // Streams with packets from the same source and destination
+    rtp_index_key(src, dst, key);
+    if ((bucket = rtp_index_bucket(streams_index.complete, key))) {
+        streams = vector_iterator(bucket->streams);
+        while ((stream = vector_iterator_next(&streams))) {
             // Only look RTP packets
             if (stream->type != PACKET_RTP)
                 continue;
 
-            // Stream complete, check source, dst
-            if (stream_is_complete(stream)) {
-                if (addressport_equals(stream->src, src) &&
-                    addressport_equals(stream->dst, dst)) {
-                    // Exact searched stream format
-                    if (stream->rtpinfo.fmtcode == format) {
-                        return stream;
-                    } else {
-                        // Matching addresses but different format
-                        candidate = stream;
-                    }
-                }
+            if (stream->stats.ssrc == ssrc
+                && stream->telephone_event == stream_format_is_event(stream, format)) {
+                // Same source and kind of payload, whatever its format
+                if (rtp_index_newer(stream, found))
+                    found = stream;
             } else {
-                // Incomplete stream, if dst match is enough
-                if (addressport_equals(stream->dst, dst)) {
-                       return stream;
-                }
+                // Matching addresses but different source (oldest one)
+                if (!candidate || rtp_index_newer(candidate, stream))
+                    candidate = stream;
             }
         }
     }
 
-    return candidate;
+    // Incomplete streams, if dst match is enough
+    rtp_index_key((address_t) { 0 }, dst, key);
+    if ((bucket = rtp_index_bucket(streams_index.pending, key))) {
+        streams = vector_iterator(bucket->streams);
+        while ((stream = vector_iterator_next(&streams))) {
+            if (stream->type == PACKET_RTP && rtp_index_newer(stream, pending))
+                pending = stream;
+        }
+    }
+
+    if (pending && rtp_index_newer(pending, found)) {
+        // SDP re-offers of the same call keep the stream of this source,
+        // following the latest offered formats
+        if (found && stream_get_call(found) == stream_get_call(pending)) {
+            found->media = pending->media;
+        } else {
+            found = pending;
+        }
+    }
+
+    return (found) ? found : candidate;
 }
 
 rtp_stream_t *
@@ -469,27 +1935,36 @@ rtp_find_rtcp_stream(address_t src, address_t dst)
 {
     // Structure for RTP packet streams
     rtp_stream_t *stream;
-    // Check if this is a RTP packet from active calls
-    sip_call_t *call;
-    // Iterator for active calls
-    vector_iter_t calls;
-
-    // Get active calls (during conversation)
-    calls = sip_calls_iterator();
-    vector_iterator_set_current(&calls, vector_iterator_count(&calls));
-
-    while ((call = vector_iterator_prev(&calls))) {
-        // Check if this call has an RTP stream for current packet data
-        if ((stream = rtp_find_call_stream(call, src, dst))) {
-            if (stream->type != PACKET_RTCP)
-                continue;
-            return stream;
+    // Matching stream
+    rtp_stream_t *found = NULL;
+    // Index buckets for this packet addresses
+    rtp_bucket_t *bucket;
+    // Iterator for bucket streams
+    vector_iter_t streams;
+    char key[RTP_INDEX_KEYLEN];
+
+    // Incomplete streams with this destination
+    rtp_index_key((address_t) { 0 }, dst, key);
+    if ((bucket = rtp_index_bucket(streams_index.pending, key))) {
+        streams = vector_iterator(bucket->streams);
+        while ((stream = vector_iterator_next(&streams))) {
+            if (stream->type == PACKET_RTCP && rtp_index_newer(stream, found))
+                found = stream;
         }
     }
 
-    return NULL;
-}
+    // Complete streams with this source and destination
+    rtp_index_key(src, dst, key);
+    if ((bucket = rtp_index_bucket(streams_index.complete, key))) {
+        streams = vector_iterator(bucket->streams);
+        while ((stream = vector_iterator_next(&streams))) {
+            if (stream->type == PACKET_RTCP && rtp_index_newer(stream, found))
+                found = stream;
+        }
+    }
 
+    return found;
+}
 
 rtp_stream_t *
 rtp_find_call_stream(struct sip_call *call, address_t src, address_t dst)
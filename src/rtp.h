@@ -34,6 +34,7 @@
 
 #include "config.h"
 #include "capture.h"
+#include "hash.h"
 #include "media.h"
 
 // Version is the first 2 bits of the first octet
@@ -49,9 +50,55 @@
 
 // RTCP common header length
 #define RTCP_HDR_LENGTH 4
+// RTCP Sender Report header and sender information length
+#define RTCP_SR_LENGTH 28
 
 // If stream does not receive a packet in this seconds, we consider it inactive
 #define STREAM_INACTIVE_SECS 3
+// Streams without packets are removed after this seconds (longer than SIP Timer C)
+#define STREAM_PENDING_SECS 300
+// Number of payload types counted per stream
+#define STREAM_FORMATS_MAX 8
+
+// RFC 3550 A.1 sequence number validation limits
+#define RTP_SEQ_MAX_DROPOUT 3000
+#define RTP_SEQ_MAX_MISORDER 100
+// Default RTP clock rate if unknown
+#define RTP_DEFAULT_CLOCK_RATE 8000
+
+// Seconds of each quality estimation window
+#define RTP_EMODEL_WINDOW 10
+// Minimum expected packets to estimate quality of an open window
+#define RTP_EMODEL_MIN_PACKETS 50
+// Assumed one way delay without jitter buffer (ms)
+#define RTP_EMODEL_BASE_DELAY 40
+
+// Milliseconds of each stream activity bucket
+#define RTP_ACTIVITY_BUCKET 100
+// Number of activity buckets kept per stream
+#define RTP_ACTIVITY_BUCKETS 64
+
+// Number of RTCP reports kept per stream
+#define RTCP_REPORTS_MAX 16
+// Number of SR and XR reference times kept per stream
+#define RTCP_REFTIMES_MAX 8
+
+// Size of stored packets data chunks
+#define RTP_STORE_CHUNK_SIZE (64 * 1024)
+// Stored record without RTP header inside frame data
+#define RTP_RECORD_NO_HEADER 0xFFFF
+
+// Stream lookup index key length (source and destination addresses)
+#define RTP_INDEX_KEYLEN ((ADDRESSLEN + 6) * 2 + 1)
+
+// Unknown UDP flows tracked to discover streams without SDP
+#define RTP_ORPHAN_FLOWS 1024
+// Consecutive RTP packets of an unknown flow before creating an orphan stream
+#define RTP_ORPHAN_PACKETS 50
+// Max sequence increment between consecutive packets of an unknown flow
+#define RTP_ORPHAN_SEQ_GAP 10
+// Orphan streams kept
+#define RTP_ORPHAN_STREAMS 256
 
 // RTCP header types
 //! http://www.iana.org/assignments/rtp-parameters/rtp-parameters.xhtml
@@ -101,6 +148,20 @@ typedef struct rtp_encoding rtp_encoding_t;
 typedef struct rtp_stream rtp_stream_t;
 //! Shorter declaration of rtp_event structure
 typedef struct rtp_event rtp_event_t;
+//! Shorter declaration of rtp store structures
+typedef struct rtp_record rtp_record_t;
+typedef struct rtp_chunk rtp_chunk_t;
+typedef struct rtp_store rtp_store_t;
+typedef struct rtp_bucket rtp_bucket_t;
+typedef struct rtp_stats rtp_stats_t;
+typedef struct rtp_emodel_codec rtp_emodel_codec_t;
+typedef struct rtcp_report rtcp_report_t;
+typedef struct rtcp_reports rtcp_reports_t;
+typedef struct rtcp_reftime rtcp_reftime_t;
+typedef struct rtp_format_count rtp_format_count_t;
+typedef struct rtp_activity rtp_activity_t;
+typedef struct rtp_flow rtp_flow_t;
+typedef struct rtp_orphan_stats rtp_orphan_stats_t;
 
 struct rtp_encoding {
     uint32_t id;
@@ -108,6 +169,284 @@ struct rtp_encoding {
     const char *format;
 };
 
+/**
+ * @brief Received packets of a stream payload type
+ */
+struct rtp_format_count {
+    //! RTP payload type
+    uint32_t code;
+    //! Received packets with this payload type
+    uint32_t count;
+};
+
+/**
+ * @brief RTP stream activity histogram
+ *
+ * Received packets are counted in fixed time buckets since the first
+ * packet of the stream. Only the last buckets are kept in a ring, but
+ * silence gaps are measured for the whole stream.
+ */
+struct rtp_activity {
+    //! Received packets in each bucket (ring indexed by bucket number)
+    uint8_t buckets[RTP_ACTIVITY_BUCKETS];
+    //! Bucket number of the last received packet
+    uint32_t last;
+    //! Longest bucket count without packets
+    uint32_t max_gap;
+    //! Silences longer than gap threshold
+    uint32_t gaps;
+    //! Gap threshold in buckets
+    uint32_t threshold;
+};
+
+/**
+ * @brief Codec impairment values for E-model estimation
+ */
+struct rtp_emodel_codec {
+    //! Format name prefix
+    const char *format;
+    //! Equipment impairment factor
+    double ie;
+    //! Packet loss robustness factor
+    double bpl;
+};
+
+/**
+ * @brief RTP stream quality statistics
+ *
+ * Statistics are updated with each received RTP packet header following
+ * RFC 3550 appendix A.1 (sequence numbers) and A.8 (interarrival jitter).
+ */
+struct rtp_stats {
+    //! First extended sequence number
+    uint32_t base_seq;
+    //! Highest sequence number received
+    uint16_t max_seq;
+    //! Shifted count of sequence number cycles
+    uint32_t cycles;
+    //! Last sequence number after a big jump (plus one)
+    uint32_t bad_seq;
+    //! Received packets (without duplicates)
+    uint32_t received;
+    //! Packets received after a packet with higher sequence
+    uint32_t out_of_order;
+    //! Packets received more than once
+    uint32_t duplicates;
+    //! Received sequence numbers mask (bit N is max_seq - N)
+    uint64_t seen;
+    //! RTP clock rate of stream format
+    uint32_t clock_rate;
+    //! Interarrival jitter (timestamp units)
+    double jitter;
+    //! RTP timestamp of the last packet
+    uint32_t last_timestamp;
+    //! Arrival time of the last packet
+    struct timeval last_arrival;
+    //! Max time between two consecutive packets (ms)
+    double max_delta;
+    //! Gaps of consecutive lost packets
+    uint32_t bursts;
+    //! Start time of current quality window (seconds)
+    uint32_t win_start;
+    //! Expected packets, received packets and bursts before window start
+    uint32_t win_expected, win_received, win_bursts;
+    //! Worst R-factor of completed quality windows (-1 if none)
+    double rfactor;
+    //! SSRC of the last received packet
+    uint32_t ssrc;
+    //! Payload type of the last received packet
+    uint32_t format;
+};
+
+/**
+ * @brief Information of a received RTCP report
+ *
+ * Each SR sender information, report block or XR block creates a report
+ * in the stream the report is about. Only fields present in the report
+ * type are filled.
+ */
+struct rtcp_report {
+    //! Capture time of the RTCP packet
+    struct timeval time;
+    //! RTCP packet type (SR, RR or XR)
+    uint8_t type;
+    //! XR block type (XR only)
+    uint8_t block;
+    //! SSRC of the report sender
+    uint32_t sender;
+    //! SSRC of the reported source
+    uint32_t source;
+    //! Sender packet and octet count (SR sender information)
+    uint32_t spc, soc;
+    //! Fraction lost x/256
+    uint8_t flost;
+    //! Fraction discarded x/256 (XR VoIP metrics)
+    uint8_t fdiscard;
+    //! Cumulative number of packets lost
+    int32_t plost;
+    //! Extended highest sequence number received
+    uint32_t hseq;
+    //! Interarrival jitter (timestamp units)
+    uint32_t jitter;
+    //! Last SR timestamp and delay since last SR (1/65536 seconds)
+    uint32_t lsr, dlsr;
+    //! Round trip time in milliseconds (-1 if unknown)
+    int32_t rtt;
+    //! MOS Listening and Conversational Quality x10 (XR VoIP metrics)
+    uint8_t mosl, mosc;
+    //! R-factor (XR VoIP metrics)
+    uint8_t rfactor;
+};
+
+/**
+ * @brief Reference time sent in a SR or XR receiver reference time report
+ *
+ * Replies to the report (RR LSR or XR DLRR) carry the same time value,
+ * so round trip time can be measured with capture times only.
+ */
+struct rtcp_reftime {
+    //! SSRC of the report sender
+    uint32_t ssrc;
+    //! Middle 32 bits of the report NTP timestamp
+    uint32_t ntp;
+    //! Capture time of the report
+    struct timeval time;
+};
+
+/**
+ * @brief Ring of the last received RTCP reports of a stream
+ */
+struct rtcp_reports {
+    //! Received reports (oldest ones are overwritten)
+    rtcp_report_t items[RTCP_REPORTS_MAX];
+    //! Number of received reports
+    uint32_t count;
+    //! Sent reference times (oldest ones are overwritten)
+    rtcp_reftime_t reftimes[RTCP_REFTIMES_MAX];
+    //! Number of sent reference times
+    uint32_t refcount;
+    //! Last known round trip time in milliseconds (-1 if unknown)
+    int32_t rtt;
+};
+
+/**
+ * @brief Stored RTP frame information
+ *
+ * Fixed size record of a captured frame of a stream. Frame data is stored
+ * in the stream data chunks.
+ */
+struct rtp_record {
+    //! Capture time seconds
+    uint32_t sec;
+    //! Capture time microseconds
+    uint32_t usec;
+    //! Frame original length
+    uint32_t len;
+    //! Frame stored data length
+    uint32_t caplen;
+    //! RTP timestamp
+    uint32_t timestamp;
+    //! RTP synchronization source
+    uint32_t ssrc;
+    //! Chunk holding frame data (absolute chunk number)
+    uint32_t chunk;
+    //! Frame data offset inside chunk
+    uint32_t offset;
+    //! RTP sequence number
+    uint16_t seq;
+    //! RTP header offset inside frame data
+    uint16_t hdroff;
+    //! RTP marker bit and payload type
+    uint8_t mpt;
+};
+
+/**
+ * @brief Stored frames data chunk
+ */
+struct rtp_chunk {
+    //! Bytes used in this chunk
+    uint32_t used;
+    //! Chunk data size
+    uint32_t size;
+    //! Chunk data
+    u_char data[];
+};
+
+/**
+ * @brief Compact storage of stream captured packets
+ *
+ * Stream packets are stored as records in a growable array and their frame
+ * data is appended to fixed size chunks. If a time window is configured,
+ * records older than the window are discarded when new packets arrive.
+ */
+struct rtp_store {
+    //! Stored records
+    rtp_record_t *records;
+    //! First valid record
+    uint32_t first;
+    //! Number of records (including discarded ones before first)
+    uint32_t count;
+    //! Allocated records
+    uint32_t size;
+    //! Frames data chunks (rtp_chunk_t)
+    vector_t *chunks;
+    //! Absolute number of the first chunk in chunks vector
+    uint32_t chunk_base;
+    //! Store full frames (or only packet payload)
+    bool frames;
+    //! Seconds of packets to keep (0 to keep all)
+    int window;
+    //! Allocated memory for this store
+    size_t memsize;
+};
+
+/**
+ * @brief Streams sharing the same lookup index key
+ *
+ * Streams without packets are indexed by their destination address, as
+ * any source is accepted for their first packet. Once they receive
+ * packets, they are indexed by their source and destination addresses.
+ */
+struct rtp_bucket {
+    //! Index key of this bucket streams
+    char key[RTP_INDEX_KEYLEN];
+    //! Index table this bucket belongs to
+    htable_t *table;
+    //! Streams with this key in insertion order (rtp_stream_t)
+    vector_t *streams;
+};
+
+/**
+ * @brief Unknown UDP flow carrying RTP packets
+ *
+ * Flows are kept in a fixed size pool ordered by last received packet,
+ * the least recently used flow is reused when the pool is full.
+ */
+struct rtp_flow {
+    //! Source and destination addresses key (empty if unused)
+    char key[RTP_INDEX_KEYLEN];
+    //! SSRC of the last packet
+    uint32_t ssrc;
+    //! Sequence number of the last packet
+    uint16_t seq;
+    //! Consecutive packets with the same SSRC
+    uint32_t packets;
+    //! Previous (more recent) and next flows in LRU list
+    rtp_flow_t *prev, *next;
+};
+
+/**
+ * @brief Orphan streams discovery counters
+ */
+struct rtp_orphan_stats {
+    //! Tracked unknown flows
+    uint32_t flows;
+    //! Unknown flows discarded to track newer ones
+    uint64_t evicted;
+    //! Unknown flows promoted to orphan streams
+    uint64_t promoted;
+};
+
 struct rtp_stream {
     //! Determine stream type
     uint32_t type;
@@ -127,12 +466,26 @@ struct rtp_stream {
     int telephone_event;
     //! Telephone events of this stream (rtp_event_t)
     vector_t *events;
+    //! Captured packets of this stream
+    rtp_store_t *store;
+    //! Lookup index bucket of this stream (NULL if not indexed)
+    rtp_bucket_t *bucket;
+    //! RTP quality statistics
+    rtp_stats_t stats;
+    //! Received RTCP reports about this stream
+    rtcp_reports_t *reports;
+    //! Packets activity histogram
+    rtp_activity_t activity;
 
     // Stream information (depending on type)
     union {
         struct {
-            //! Format of first received packet of stre
+            //! Format of last received packet of stream
             uint32_t fmtcode;
+            //! Number of different received formats
+            uint32_t fmtcount;
+            //! Received packets of each format
+            rtp_format_count_t formats[STREAM_FORMATS_MAX];
         } rtpinfo;
         struct {
             //! Sender packet count
@@ -216,6 +569,10 @@ struct rtcp_blk_sr
     uint32_t hseq;
     //! interarrival jitter: 32 bits
     uint32_t ijitter;
+    //! last SR (LSR): 32 bits
+    uint32_t lsr;
+    //! delay since last SR (DLSR): 32 bits
+    uint32_t dlsr;
 };
 
 struct rtcp_hdr_xr
@@ -307,6 +664,12 @@ struct rtcp_blk_xr_voip
 rtp_stream_t *
 stream_create(sdp_media_t *media, address_t dst, int type);
 
+void
+stream_destroy(rtp_stream_t *stream);
+
+void
+stream_destroyer(void *stream);
+
 rtp_stream_t *
 stream_complete(rtp_stream_t *stream, address_t src);
 
@@ -316,6 +679,146 @@ stream_set_format(rtp_stream_t *stream, uint32_t format);
 void
 stream_add_packet(rtp_stream_t *stream, packet_t *packet);
 
+/**
+ * @brief Get number of expected RTP packets of the stream
+ *
+ * Expected packets are calculated from the first and highest received
+ * extended sequence numbers.
+ */
+uint32_t
+stream_get_expected(rtp_stream_t *stream);
+
+/**
+ * @brief Get number of lost RTP packets of the stream
+ */
+uint32_t
+stream_get_lost(rtp_stream_t *stream);
+
+/**
+ * @brief Get percentage of lost RTP packets of the stream
+ */
+double
+stream_get_loss(rtp_stream_t *stream);
+
+/**
+ * @brief Get stream interarrival jitter in milliseconds
+ */
+double
+stream_get_jitter(rtp_stream_t *stream);
+
+/**
+ * @brief Get number of stored RTCP reports of the stream
+ */
+uint32_t
+stream_get_report_count(rtp_stream_t *stream);
+
+/**
+ * @brief Get a stored RTCP report of the stream
+ *
+ * @param idx Report index (0 is the most recent report)
+ * @return report or NULL if there is no report with that index
+ */
+rtcp_report_t *
+stream_get_report(rtp_stream_t *stream, uint32_t idx);
+
+/**
+ * @brief Get last round trip time reported by RTCP for the stream
+ *
+ * Round trip time is calculated from the capture times of a SR (or XR
+ * receiver reference time) report and the RR (or XR DLRR) block replying
+ * to it, minus the reported delay. XR VoIP metrics round trip delay is
+ * also used.
+ *
+ * @return round trip time in milliseconds or -1 if unknown
+ */
+int32_t
+stream_get_rtt(rtp_stream_t *stream);
+
+/**
+ * @brief Get estimated stream R-factor
+ *
+ * R-factor is estimated with a simplified ITU-T G.107 E-model from the
+ * stream codec, packet loss, loss burstiness, jitter and RTCP round trip
+ * time (if known) of each quality window. The worst window of the stream
+ * is returned.
+ *
+ * Streams with codecs not listed in the impairment values table (G.722,
+ * Opus, dynamic payload types...) are not estimated.
+ *
+ * @return R-factor (0-100) or -1 if it can not be estimated
+ */
+double
+stream_get_rfactor(rtp_stream_t *stream);
+
+/**
+ * @brief Get estimated stream MOS
+ *
+ * @return MOS (1-4.5) from stream R-factor or -1 if it can not be estimated
+ */
+double
+stream_get_mos(rtp_stream_t *stream);
+
+/**
+ * @brief Get the longest silence of the stream
+ *
+ * @return longest time without packets in milliseconds
+ */
+uint32_t
+stream_get_max_gap(rtp_stream_t *stream);
+
+/**
+ * @brief Get received packets in a stream activity bucket
+ *
+ * @param stream RTP stream
+ * @param ago Number of buckets before the last received packet
+ * @return received packets in that bucket (0 if not kept)
+ */
+uint32_t
+stream_get_activity(rtp_stream_t *stream, uint32_t ago);
+
+/**
+ * @brief Store packet data in stream packet store
+ *
+ * Store frames data of given packet in stream chunks. Packet is not
+ * referenced after this call, so it can be destroyed.
+ */
+void
+stream_store_packet(rtp_stream_t *stream, packet_t *packet);
+
+/**
+ * @brief Get number of packets stored in stream
+ */
+uint32_t
+stream_store_count(rtp_stream_t *stream);
+
+/**
+ * @brief Get allocated memory of stream packet store
+ */
+size_t
+stream_store_memsize(rtp_stream_t *stream);
+
+/**
+ * @brief Get a stored record of the stream
+ *
+ * @param stream RTP stream
+ * @param idx Record index (0 for the oldest stored packet)
+ * @param data Filled with record frame data pointer if not NULL
+ * @return record or NULL if index is out of range
+ */
+rtp_record_t *
+stream_store_record(rtp_stream_t *stream, uint32_t idx, const u_char **data);
+
+/**
+ * @brief Rebuild a full packet from a stored record
+ *
+ * Returned packet is not owned by the stream and must be destroyed
+ * by the caller.
+ *
+ * @return a new packet or NULL if frames data is not stored
+ */
+packet_t *
+stream_store_get_packet(rtp_stream_t *stream, uint32_t idx);
+
 uint32_t
 stream_get_count(rtp_stream_t *stream);
 
@@ -325,14 +828,35 @@ stream_get_call(rtp_stream_t *stream);
 const char *
 stream_get_format(rtp_stream_t *stream);
 
+/**
+ * @brief Get format name of a payload type in the stream media
+ *
+ * Standard payload types are checked first, then the stream SDP rtpmap.
+ *
+ * @return format name or NULL if unknown
+ */
+const char *
+stream_get_format_name(rtp_stream_t *stream, uint32_t code);
+
 const char *
 rtp_get_standard_format(uint32_t code);
 
 rtp_stream_t *
 rtp_check_packet(packet_t *packet);
 
+/**
+ * @brief Find the stream of a RTP packet
+ *
+ * Streams with packets are matched by their addresses and SSRC, so codec
+ * changes of the same source are kept in the same stream. Telephone-event
+ * packets are kept in their own stream. Streams without packets from newer
+ * calls are preferred.
+ *
+ * If only streams with other SSRC or kind of payload match the addresses,
+ * the oldest one is returned, so a new stream can be created from its media.
+ */
 rtp_stream_t *
-rtp_find_stream_format(address_t src, address_t dst, uint32_t format);
+rtp_find_stream_format(address_t src, address_t dst, uint32_t format, uint32_t ssrc);
 
 rtp_stream_t *
 rtp_find_rtcp_stream(address_t src, address_t dst);
@@ -343,6 +867,97 @@ rtp_find_call_stream(struct sip_call *call, address_t src, address_t dst);
 rtp_stream_t *
 rtp_find_call_exact_stream(struct sip_call *call, address_t src, address_t dst);
 
+/**
+ * @brief Initialize streams lookup index
+ *
+ * @param size Number of buckets of index hash tables (power of 2)
+ */
+void
+rtp_index_init(size_t size);
+
+/**
+ * @brief Deinitialize streams lookup index
+ *
+ * All indexed streams must be removed from the index before this call
+ */
+void
+rtp_index_deinit();
+
+/**
+ * @brief Initialize orphan streams discovery
+ *
+ * If capture.rtporphan is enabled, UDP flows with RTP packets that do not
+ * match any stream from SDP are tracked in a fixed size table. Flows with
+ * enough consecutive packets of the same SSRC become orphan streams.
+ * Orphan streams only keep statistics, their packets are not stored.
+ */
+void
+rtp_orphans_init();
+
+/**
+ * @brief Check if a RTP packet without stream belongs to an orphan stream
+ *
+ * Unknown flows only count consecutive packets of the same SSRC with small
+ * sequence increments, so random UDP traffic that looks like RTP is not
+ * promoted to an orphan stream.
+ *
+ * @param packet RTP packet that matches no stream from SDP
+ * @param format RTP payload type of the packet
+ * @param ssrc RTP synchronization source of the packet
+ * @return orphan stream of the packet or NULL
+ */
+rtp_stream_t *
+rtp_orphan_check_packet(packet_t *packet, uint32_t format, uint32_t ssrc);
+
+/**
+ * @brief Deinitialize orphan streams discovery
+ */
+void
+rtp_orphans_deinit();
+
+/**
+ * @brief Remove all orphan streams and tracked flows
+ */
+void
+rtp_orphans_clear();
+
+/**
+ * @brief Check if orphan streams discovery is enabled
+ */
+bool
+rtp_orphans_enabled();
+
+/**
+ * @brief Get an iterator of orphan streams (rtp_stream_t)
+ */
+vector_iter_t
+rtp_orphans_iterator();
+
+/**
+ * @brief Get orphan streams discovery counters
+ */
+rtp_orphan_stats_t
+rtp_orphans_stats();
+
+/**
+ * @brief Add a call stream to the lookup index
+ *
+ * Only indexed streams are found while looking for the stream of
+ * captured RTP and RTCP packets.
+ *
+ * @param stream Stream already added to a call
+ */
+void
+rtp_index_add(rtp_stream_t *stream);
+
+/**
+ * @brief Remove a stream from the lookup index
+ *
+ * @param stream Indexed stream
+ */
+void
+rtp_index_remove(rtp_stream_t *stream);
+
 /**
  * @brief Check if a message is older than other
  *
@@ -47,16 +47,29 @@ setting_t settings[SETTING_COUNT] = {
     { SETTING_CAPTURE_DEVICE,     "capture.device",     SETTING_FMT_STRING,  "any",       NULL },
     { SETTING_CAPTURE_OUTFILE,    "capture.outfile",    SETTING_FMT_STRING,  "",          NULL },
     { SETTING_CAPTURE_BUFFER,     "capture.buffer",     SETTING_FMT_NUMBER,  "2",         NULL },
+    { SETTING_CAPTURE_PARSEWORKERS, "capture.parseworkers", SETTING_FMT_NUMBER, "0",       NULL },
+    { SETTING_CAPTURE_INDEX,      "capture.index",      SETTING_FMT_ENUM,    SETTING_OFF, SETTING_ENUM_ONOFF },
 #if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
     { SETTING_CAPTURE_KEYFILE,    "capture.keyfile",    SETTING_FMT_STRING,  "",          NULL },
     { SETTING_CAPTURE_TLSSERVER,  "capture.tlsserver",  SETTING_FMT_STRING,  "",          NULL },
+    { SETTING_CAPTURE_TLSWORKERS, "capture.tlsworkers", SETTING_FMT_NUMBER,  "0",         NULL },
 #endif
 #ifdef USE_EEP
     { SETTING_CAPTURE_EEP,        "capture.eep",        SETTING_FMT_ENUM,    SETTING_OFF, SETTING_ENUM_ONOFF },
 #endif
     { SETTING_CAPTURE_RTP,        "capture.rtp",        SETTING_FMT_ENUM,    SETTING_OFF, SETTING_ENUM_ONOFF },
+    { SETTING_CAPTURE_RTPWINDOW,  "capture.rtpwindow",  SETTING_FMT_NUMBER,  "0",         NULL },
+    { SETTING_CAPTURE_RTPGAP,     "capture.rtpgap",     SETTING_FMT_NUMBER,  "2000",      NULL },
+    { SETTING_CAPTURE_RTPORPHAN,  "capture.rtporphan",  SETTING_FMT_ENUM,    SETTING_OFF, SETTING_ENUM_ONOFF },
     { SETTING_CAPTURE_STORAGE,    "capture.storage",    SETTING_FMT_ENUM,    "memory",    SETTING_ENUM_STORAGE },
+    { SETTING_CAPTURE_SPOOLDIR,   "capture.spooldir",   SETTING_FMT_STRING,  "",          NULL },
     { SETTING_CAPTURE_ROTATE,     "capture.rotate",     SETTING_FMT_ENUM,    SETTING_OFF, SETTING_ENUM_ONOFF },
+    { SETTING_CAPTURE_MEMLIMIT,   "capture.memlimit",   SETTING_FMT_STRING,  "",          NULL },
+    { SETTING_CAPTURE_MAXAGE,     "capture.maxage",     SETTING_FMT_NUMBER,  "0",         NULL },
+    { SETTING_CAPTURE_QUOTA,      "capture.quota",      SETTING_FMT_STRING,  "",          NULL },
+#ifdef WITH_ZLIB
+    { SETTING_CAPTURE_COMPRESS,   "capture.compress",   SETTING_FMT_ENUM,    SETTING_OFF, SETTING_ENUM_ONOFF },
+#endif
     { SETTING_SIP_NOINCOMPLETE,   "sip.noincomplete",   SETTING_FMT_ENUM,    SETTING_ON,  SETTING_ENUM_ONOFF },
     { SETTING_SIP_HEADER_X_CID,   "sip.xcid",           SETTING_FMT_STRING,  "X-Call-ID|X-CID", NULL },
     { SETTING_SIP_CALLS,          "sip.calls",          SETTING_FMT_ENUM,    SETTING_OFF, SETTING_ENUM_ONOFF },
@@ -83,6 +96,7 @@ setting_t settings[SETTING_COUNT] = {
     { SETTING_CR_NON_ASCII,       "cr.nonascii",        SETTING_FMT_STRING,  ".",        NULL },
     { SETTING_FILTER_PAYLOAD,     "filter.payload",     SETTING_FMT_STRING,  "",          NULL },
     { SETTING_FILTER_METHODS,     "filter.methods",     SETTING_FMT_STRING,  "",          NULL },
+    { SETTING_FILTER_MEDIA,       "filter.media",       SETTING_FMT_STRING,  "",          NULL },
     { SETTING_TELEPHONE_EVENT,    "telephone_event",    SETTING_FMT_ENUM,    SETTING_OFF, SETTING_ENUM_ONOFF },
 #ifdef USE_EEP
     { SETTING_EEP_SEND,           "eep.send",           SETTING_FMT_ENUM,    SETTING_OFF, SETTING_ENUM_ONOFF },
@@ -93,9 +107,11 @@ setting_t settings[SETTING_COUNT] = {
     { SETTING_EEP_SEND_ID,        "eep.send.id",        SETTING_FMT_NUMBER,  "2002",      NULL },
     { SETTING_EEP_LISTEN,         "eep.listen",         SETTING_FMT_ENUM,    SETTING_OFF, SETTING_ENUM_ONOFF },
     { SETTING_EEP_LISTEN_VER,     "eep.listen.version", SETTING_FMT_ENUM,    "3",         SETTING_ENUM_HEPVERSION },
+    { SETTING_EEP_LISTEN_PROTO,   "eep.listen.proto",   SETTING_FMT_ENUM,    "udp",       SETTING_ENUM_HEPPROTO },
     { SETTING_EEP_LISTEN_ADDR,    "eep.listen.address", SETTING_FMT_STRING,  "0.0.0.0",   NULL },
     { SETTING_EEP_LISTEN_PORT,    "eep.listen.port",    SETTING_FMT_NUMBER,  "9060",      NULL },
     { SETTING_EEP_LISTEN_PASS,    "eep.listen.pass",    SETTING_FMT_STRING,  "",          NULL },
+    { SETTING_EEP_LISTEN_WORKERS, "eep.listen.workers", SETTING_FMT_NUMBER,  "1",         NULL },
     { SETTING_EEP_LISTEN_UUID,    "eep.listen.uuid",    SETTING_FMT_ENUM,    SETTING_OFF, SETTING_ENUM_ONOFF },
 #endif
 };
@@ -58,8 +58,9 @@ typedef struct setting_option setting_t;
 #define SETTING_ENUM_COLORMODE   (const char *[]){ "request", "cseq", "callid", NULL }
 #define SETTING_ENUM_HIGHLIGHT   (const char *[]){ "bold", "reverse", "reversebold", NULL }
 #define SETTING_ENUM_SDP_INFO    (const char *[]){ "off", "first", "full", "compressed", NULL}
-#define SETTING_ENUM_STORAGE     (const char *[]){ "none", "memory", NULL }
+#define SETTING_ENUM_STORAGE     (const char *[]){ "none", "memory", "disk", NULL }
 #define SETTING_ENUM_HEPVERSION  (const char *[]){ "2", "3", NULL }
+#define SETTING_ENUM_HEPPROTO    (const char *[]){ "udp", "tcp", NULL }
 #define SETTING_ENUM_MEDIA       (const char *[]){ "off", "on", "active", NULL }
 
 //! Other useful defines
@@ -83,16 +84,29 @@ enum setting_id {
     SETTING_CAPTURE_DEVICE,
     SETTING_CAPTURE_OUTFILE,
     SETTING_CAPTURE_BUFFER,
+    SETTING_CAPTURE_PARSEWORKERS,
+    SETTING_CAPTURE_INDEX,
 #if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
     SETTING_CAPTURE_KEYFILE,
     SETTING_CAPTURE_TLSSERVER,
+    SETTING_CAPTURE_TLSWORKERS,
 #endif
 #ifdef USE_EEP
     SETTING_CAPTURE_EEP,
 #endif
     SETTING_CAPTURE_RTP,
+    SETTING_CAPTURE_RTPWINDOW,
+    SETTING_CAPTURE_RTPGAP,
+    SETTING_CAPTURE_RTPORPHAN,
     SETTING_CAPTURE_STORAGE,
+    SETTING_CAPTURE_SPOOLDIR,
     SETTING_CAPTURE_ROTATE,
+    SETTING_CAPTURE_MEMLIMIT,
+    SETTING_CAPTURE_MAXAGE,
+    SETTING_CAPTURE_QUOTA,
+#ifdef WITH_ZLIB
+    SETTING_CAPTURE_COMPRESS,
+#endif
     SETTING_SIP_NOINCOMPLETE,
     SETTING_SIP_HEADER_X_CID,
     SETTING_SIP_CALLS,
@@ -119,6 +133,7 @@ enum setting_id {
     SETTING_CR_NON_ASCII,
     SETTING_FILTER_PAYLOAD,
     SETTING_FILTER_METHODS,
+    SETTING_FILTER_MEDIA,
     SETTING_TELEPHONE_EVENT,
 #ifdef USE_EEP
     SETTING_EEP_SEND,
@@ -129,9 +144,11 @@ enum setting_id {
     SETTING_EEP_SEND_ID,
     SETTING_EEP_LISTEN,
     SETTING_EEP_LISTEN_VER,
+    SETTING_EEP_LISTEN_PROTO,
     SETTING_EEP_LISTEN_ADDR,
     SETTING_EEP_LISTEN_PORT,
     SETTING_EEP_LISTEN_PASS,
+    SETTING_EEP_LISTEN_WORKERS,
     SETTING_EEP_LISTEN_UUID,
 #endif
     SETTING_COUNT
@@ -36,6 +36,10 @@
 #include "option.h"
 #include "setting.h"
 #include "filter.h"
+#include "capture.h"
+#ifdef WITH_ZLIB
+#include <zlib.h>
+#endif
 
 /**
  * @brief Linked list of parsed calls
@@ -137,6 +141,89 @@ sip_code_t sip_codes[] = {
     { -1 , NULL },
 };
 
+/**
+ * @brief Get Call-Ids hash table size for the given capture limit
+ *
+ * Hash positions are masked with the table size, so it must be a
+ * power of two.
+ */
+static size_t
+sip_callids_hashsize(int limit)
+{
+    size_t size = SIP_CALLIDS_HASH_MIN;
+    while (limit > 0 && size < (size_t) limit && size < SIP_CALLIDS_HASH_MAX)
+        size <<= 1;
+    return size;
+}
+
+/**
+ * @brief Parse retention settings
+ *
+ * Read the memory limit, max age and per method quotas from settings.
+ * Memory limit can be expressed in bytes (with an optional K, M or G
+ * suffix) or 'cgroup' to use a fraction of the process cgroup limit.
+ * Invalid values are reported and ignored.
+ */
+static void
+sip_retention_init()
+{
+    const char *value;
+    char *quotas, *token, *saveptr, *sep;
+    size_t size;
+    int method;
+
+    memset(&calls.retention, 0, sizeof(sip_retention_t));
+
+    // Frames data is only kept in memory with memory storage
+    // Disk storage falls back to memory if spool directory is not usable
+    calls.retention.frames = (capture_storage() == CAPTURE_STORAGE_MEMORY);
+
+#ifdef WITH_ZLIB
+    // Compress packets of finished calls (not required if stored in disk)
+    calls.retention.compress = setting_enabled(SETTING_CAPTURE_COMPRESS)
+                               && capture_storage() != CAPTURE_STORAGE_DISK;
+    calls.retention.pending = vector_create(0, 50);
+#endif
+
+    // Max seconds without activity
+    if (setting_get_intvalue(SETTING_CAPTURE_MAXAGE) > 0)
+        calls.retention.maxage = setting_get_intvalue(SETTING_CAPTURE_MAXAGE);
+
+    // Max memory for all stored dialogs
+    if ((value = setting_get_value(SETTING_CAPTURE_MEMLIMIT))) {
+        if (!strcasecmp(value, "cgroup")) {
+            if ((size = cgroup_memory_limit())) {
+                calls.retention.memlimit = size / 100 * SIP_RETENTION_CGROUP_PCT;
+            } else {
+                fprintf(stderr, "%s: unable to read cgroup memory limit, ignoring.\n",
+                        setting_name(SETTING_CAPTURE_MEMLIMIT));
+            }
+        } else if (!(calls.retention.memlimit = size_from_str(value))) {
+            fprintf(stderr, "%s: invalid size %s, ignoring.\n",
+                    setting_name(SETTING_CAPTURE_MEMLIMIT), value);
+        }
+    }
+
+    // Per method quotas with METHOD:size[,METHOD:size] format
+    if ((value = setting_get_value(SETTING_CAPTURE_QUOTA))) {
+        quotas = strdup(value);
+        for (token = strtok_r(quotas, ", ", &saveptr); token; token = strtok_r(NULL, ", ", &saveptr)) {
+            if ((sep = strchr(token, ':'))) {
+                *sep++ = '\0';
+                method = sip_method_from_str(token);
+                if (method > 0 && method < SIP_METHOD_COUNT && (size = size_from_str(sep))) {
+                    calls.retention.quota[method] = size;
+                    continue;
+                }
+            }
+            fprintf(stderr, "%s: invalid quota %s, ignoring.\n",
+                    setting_name(SETTING_CAPTURE_QUOTA), token);
+        }
+        sng_free(quotas);
+    }
+}
+
+
 void
 sip_init(int limit, int only_calls, int no_incomplete)
 {
@@ -158,7 +245,14 @@ sip_init(int limit, int only_calls, int no_incomplete)
     calls.active = vector_create(10, 10);
 
     // Create hash table for callid search
-    calls.callids = htable_create(calls.limit);
+    calls.callids = htable_create(sip_callids_hashsize(calls.limit));
+
+    // Create lookup index for RTP streams
+    rtp_index_init(sip_callids_hashsize(calls.limit));
+    rtp_orphans_init();
+
+    // Initialize memory based retention
+    sip_retention_init();
 
     // Set default sorting field
     if (sip_attr_from_name(setting_get_value(SETTING_CL_SORTFIELD)) >= 0) {
@@ -212,9 +306,15 @@ sip_deinit()
     sip_calls_clear();
     // Remove Call-id hash table
     htable_destroy(calls.callids);
+    // Remove RTP streams lookup index
+    rtp_orphans_deinit();
+    rtp_index_deinit();
     // Remove calls vector
     vector_destroy(calls.list);
     vector_destroy(calls.active);
+#ifdef WITH_ZLIB
+    vector_destroy(calls.retention.pending);
+#endif
     // Deallocate regular expressions
     regfree(&calls.reg_method);
     regfree(&calls.reg_callid);
@@ -272,6 +372,43 @@ sip_get_xcallid(const char *payload, char *xcallid)
     return xcallid;
 }
 
+/**
+ * @brief Check if a byte can be part of a method or URI scheme name
+ *
+ * Non ASCII bytes are accepted, as they may match letter ranges of the
+ * first line expressions in some locales.
+ */
+static bool
+sip_precheck_letter(u_char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c >= 0x80;
+}
+
+void
+sip_precheck_packet(packet_t *packet)
+{
+    const u_char *payload = packet_payload(packet);
+    uint32_t len = packet_payloadlen(packet);
+    uint32_t i, start;
+
+    if (!payload || !len)
+        return;
+
+    // Responses start with SIP version
+    if (len >= 7 && !strncasecmp((const char *) payload, "SIP/2.0", 7))
+        return;
+
+    // Requests start with method, space and request URI scheme
+    for (i = 0; i < len && sip_precheck_letter(payload[i]); i++);
+    if (i > 0 && i < len && payload[i] == ' ') {
+        for (start = ++i; i < len && sip_precheck_letter(payload[i]); i++);
+        if (i > start && i < len && payload[i] == ':')
+            return;
+    }
+
+    packet->not_sip = true;
+}
+
 int
 sip_validate_packet(packet_t *packet)
 {
@@ -357,6 +494,10 @@ sip_check_packet(packet_t *packet)
     if (packet->payload_len > MAX_SIP_PAYLOAD)
         return NULL;
 
+    // First line has already been checked
+    if (packet->not_sip)
+        return NULL;
+
     // Initialize local variables
     memset(callid, 0, sizeof(callid));
     memset(xcallid, 0, sizeof(xcallid));
@@ -422,6 +563,9 @@ sip_check_packet(packet_t *packet)
     // At this point we know we're handling an interesting SIP Packet
     msg->packet = packet;
 
+    // Restore call packets before adding new ones
+    sip_call_decompress(call);
+
     // Always parse first call message
     if (call_msg_count(call) == 0) {
         // Parse SIP payload
@@ -458,6 +602,13 @@ sip_check_packet(packet_t *packet)
             if (sip_call_is_active(call)) {
                 vector_remove(calls.active, call);
             }
+#ifdef WITH_ZLIB
+            // Queue finished call for compression
+            if (calls.retention.compress && !call->zpending) {
+                vector_append(calls.retention.pending, call);
+                call->zpending = true;
+            }
+#endif
         }
     }
 
@@ -611,6 +762,7 @@ sip_get_msg_reqresp(sip_msg_t *msg, const u_char *payload)
             resp_def = sip_method_str(msg->reqresp);
             if (!resp_def || strcmp(resp_def, resp_str)) {
                 msg->resp_str = strdup(resp_str);
+                memstat_resize(MEMSTAT_MSGS, 0, strlen(resp_str) + 1);
             }
         }
     }
@@ -660,6 +812,9 @@ sip_parse_msg_payload(sip_msg_t *msg, const u_char *payload)
         sng_strncpy(msg->sip_to, "<malformed>", 12);
     }
 
+    // Account parsed headers memory
+    memstat_resize(MEMSTAT_MSGS, 0, strlen(msg->sip_from) + strlen(msg->sip_to) + 2);
+
     return 0;
 }
 
@@ -672,7 +827,7 @@ sip_parse_msg_media(sip_msg_t *msg, const u_char *payload)
         if (!rtp_find_call_stream(call, src, stream->dst)) { \
           call_add_stream(call, stream); \
       } else { \
-          sng_free(stream); \
+          stream_destroy(stream); \
           stream = NULL; \
       } \
     }
@@ -805,49 +960,451 @@ sip_calls_clear()
 {
     // Create again the callid hash table
     htable_destroy(calls.callids);
-    calls.callids = htable_create(calls.limit);
+    calls.callids = htable_create(sip_callids_hashsize(calls.limit));
 
     // Remove all items from vector
     vector_clear(calls.list);
     vector_clear(calls.active);
+
+    // Remove streams discovered without SDP
+    rtp_orphans_clear();
 }
 
 void
 sip_calls_clear_soft()
 {
+        sip_call_t *call, *next;
+        rtp_stream_t *stream;
+        vector_iter_t streams;
+
         // Create again the callid hash table
         htable_destroy(calls.callids);
-        calls.callids = htable_create(calls.limit);
+        calls.callids = htable_create(sip_callids_hashsize(calls.limit));
+
+        // Remove all streams from lookup index
+        vector_iter_t it = vector_iterator(calls.list);
+        while ((call = vector_iterator_next(&it))) {
+            streams = vector_iterator(call->streams);
+            while ((stream = vector_iterator_next(&streams)))
+                rtp_index_remove(stream);
+        }
+
+        // Stop accounting calls not fitting the current filter
+        for (call = calls.retention.first; call; call = next) {
+            next = call->lru_next;
+            if (!filter_check_call(call))
+                sip_calls_unaccount(call);
+        }
 
         // Repopulate list applying current filter
         calls.list = vector_copy_if(sip_calls_vector(), filter_check_call);
         calls.active = vector_copy_if(sip_active_calls_vector(), filter_check_call);
 
-        // Repopulate callids based on filtered list
-        sip_call_t *call;
-        vector_iter_t it = vector_iterator(calls.list);
+        // Repopulate callids and streams index based on filtered list
+        it = vector_iterator(calls.list);
 
         while ((call = vector_iterator_next(&it)))
         {
                 htable_insert(calls.callids, call->callid, call);
+                streams = vector_iterator(call->streams);
+                while ((stream = vector_iterator_next(&streams)))
+                    rtp_index_add(stream);
+        }
+}
+
+/**
+ * @brief Remove a call from call list and free its memory
+ *
+ * @param call SIP call structure
+ */
+static void
+sip_calls_remove(sip_call_t *call)
+{
+    sip_call_t *parent;
+
+    // Remove from callids hash
+    htable_remove(calls.callids, call->callid);
+    // Remove from its X-Call-Id parent related calls
+    if (strlen(call->xcallid) && (parent = sip_find_by_callid(call->xcallid)))
+        vector_remove(parent->xcalls, call);
+    // Remove from active and call lists
+    vector_remove(calls.active, call);
+    vector_remove(calls.list, call);
+    // Mark the list as changed
+    calls.changed = true;
+}
+
+/**
+ * @brief Return the method index used for quotas of a call
+ *
+ * @return first request method of the call or 0 if unknown
+ */
+static int
+sip_calls_quota_method(sip_call_t *call)
+{
+    sip_msg_t *first = vector_first(call->msgs);
+    if (first && first->reqresp > 0 && first->reqresp < SIP_METHOD_COUNT)
+        return first->reqresp;
+    return 0;
+}
+
+/**
+ * @brief Find the least recently active call that can be evicted
+ *
+ * @param skip Call that must not be evicted
+ * @param method Only consider calls with this quota method (0 for all)
+ * @return call to be evicted or NULL
+ */
+static sip_call_t *
+sip_calls_evictable(sip_call_t *skip, int method)
+{
+    sip_call_t *call;
+    for (call = calls.retention.first; call; call = call->lru_next) {
+        if (call == skip || call->locked)
+            continue;
+        if (method && sip_calls_quota_method(call) != method)
+            continue;
+        return call;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Evict calls until all retention limits are honoured
+ *
+ * @param skip Call that is being updated and must not be evicted
+ */
+static void
+sip_calls_retention(sip_call_t *skip)
+{
+    sip_retention_t *ret = &calls.retention;
+    sip_call_t *call, *next;
+    int method;
+
+    // Remove calls without activity in the last maxage seconds
+    if (ret->maxage) {
+        call = ret->first;
+        while (call && call->last_activity.tv_sec + ret->maxage < ret->last_time.tv_sec) {
+            next = call->lru_next;
+            if (call != skip && !call->locked)
+                sip_calls_remove(call);
+            call = next;
+        }
+    }
+
+    // Remove calls while per method quotas are exceeded
+    if (skip && ret->quota[(method = sip_calls_quota_method(skip))]) {
+        while (ret->quota_used[method] > ret->quota[method]
+               && (call = sip_calls_evictable(skip, method))) {
+            sip_calls_remove(call);
+        }
+    }
+
+    // Remove calls while global memory limit is exceeded
+    if (ret->memlimit) {
+        while (ret->memsize > ret->memlimit && (call = sip_calls_evictable(skip, 0))) {
+            sip_calls_remove(call);
+        }
+    }
+}
+
+/**
+ * @brief Update the memory used by a call without changing its activity
+ *
+ * @param call SIP call structure
+ * @param memsize New call memory in bytes
+ */
+static void
+sip_calls_resize(sip_call_t *call, size_t memsize)
+{
+    int method = sip_calls_quota_method(call);
+
+    if (!call->accounted) {
+        call->memsize = memsize;
+        return;
+    }
+
+    calls.retention.memsize -= call->memsize;
+    calls.retention.quota_used[method] -= call->memsize;
+    call->memsize = memsize;
+    calls.retention.memsize += call->memsize;
+    calls.retention.quota_used[method] += call->memsize;
+}
+
+#ifdef WITH_ZLIB
+/**
+ * @brief Get all packets of a call in storage order
+ *
+ * RTP packets are not included, as they are kept in their stream store.
+ *
+ * @return a new vector with call messages packets
+ */
+static vector_t *
+sip_call_packets(sip_call_t *call)
+{
+    sip_msg_t *msg;
+    vector_t *packets = vector_create(vector_count(call->msgs), 1);
+    vector_iter_t it = vector_iterator(call->msgs);
+
+    while ((msg = vector_iterator_next(&it)))
+        vector_append(packets, msg->packet);
+    return packets;
+}
+
+/**
+ * @brief Compress finished calls without recent activity
+ *
+ * Calls are queued when they reach a final state, so the first queued
+ * calls are the first candidates to be compressed.
+ */
+static void
+sip_calls_compress_pending()
+{
+    sip_call_t *call;
+
+    while ((call = vector_first(calls.retention.pending))) {
+        // Wait until the call has been inactive for a while
+        if (call->last_activity.tv_sec + SIP_COMPRESS_DELAY >= calls.retention.last_time.tv_sec)
+            break;
+
+        // Calls being displayed are checked again later
+        if (call->locked) {
+            vector_remove(calls.retention.pending, call);
+            vector_append(calls.retention.pending, call);
+            break;
         }
+
+        vector_remove(calls.retention.pending, call);
+        call->zpending = false;
+
+        // Call may have restarted (re-INVITE)
+        if (!call_is_active(call))
+            sip_call_compress(call);
+    }
+}
+#endif
+
+int
+sip_call_compress(sip_call_t *call)
+{
+#ifdef WITH_ZLIB
+    vector_t *packets;
+    vector_iter_t it;
+    packet_t *packet;
+    u_char *raw;
+    Bytef *zdata;
+    uLongf zlen;
+    size_t rawlen = 0, len = 0, before = 0, after = 0;
+
+    // Already compressed
+    if (call->zdata)
+        return 0;
+
+    // Calculate required size for all call packets data
+    packets = sip_call_packets(call);
+    it = vector_iterator(packets);
+    while ((packet = vector_iterator_next(&it))) {
+        rawlen += packet_data_pack(packet, NULL);
+        before += packet_memsize(packet, calls.retention.frames);
+    }
+
+    // Copy all packets data into a single buffer
+    raw = malloc(rawlen);
+    zlen = compressBound(rawlen);
+    zdata = malloc(zlen);
+    if (!raw || !zdata) {
+        free(raw);
+        free(zdata);
+        vector_destroy(packets);
+        return 1;
+    }
+
+    vector_iterator_reset(&it);
+    while ((packet = vector_iterator_next(&it)))
+        len += packet_data_pack(packet, raw + len);
+
+    // Only keep compressed data if it is worth it
+    if (compress2(zdata, &zlen, raw, rawlen, Z_DEFAULT_COMPRESSION) != Z_OK || zlen >= rawlen) {
+        free(raw);
+        free(zdata);
+        vector_destroy(packets);
+        return 1;
+    }
+    free(raw);
+
+    call->zdata = realloc(zdata, zlen);
+    call->zlen = zlen;
+    call->rawlen = rawlen;
+
+    // Free uncompressed data
+    vector_iterator_reset(&it);
+    while ((packet = vector_iterator_next(&it))) {
+        packet_data_release(packet);
+        after += packet_memsize(packet, calls.retention.frames);
+    }
+    vector_destroy(packets);
+
+    // Update call memory
+    sip_calls_resize(call, call->memsize - before + after + call->zlen);
+    return 0;
+#else
+    return 1;
+#endif
+}
+
+int
+sip_call_decompress(sip_call_t *call)
+{
+#ifdef WITH_ZLIB
+    vector_t *packets;
+    vector_iter_t it;
+    packet_t *packet;
+    u_char *raw;
+    uLongf rawlen = call->rawlen;
+    size_t len = 0, before = 0, after = 0;
+
+    // Not compressed
+    if (!call->zdata)
+        return 0;
+
+    if (!(raw = malloc(call->rawlen)))
+        return 1;
+
+    if (uncompress(raw, &rawlen, call->zdata, call->zlen) != Z_OK || rawlen != call->rawlen) {
+        free(raw);
+        return 1;
+    }
+
+    // Restore each packet data
+    packets = sip_call_packets(call);
+    it = vector_iterator(packets);
+    while ((packet = vector_iterator_next(&it))) {
+        before += packet_memsize(packet, calls.retention.frames);
+        len += packet_data_unpack(packet, raw + len);
+        after += packet_memsize(packet, calls.retention.frames);
+    }
+    vector_destroy(packets);
+    free(raw);
+
+    // Update call memory
+    sip_calls_resize(call, call->memsize - before + after - call->zlen);
+    free(call->zdata);
+    call->zdata = NULL;
+    call->zlen = call->rawlen = 0;
+
+    // Compress again once it is no longer displayed
+    if (calls.retention.compress && !call->zpending && !call_is_active(call)) {
+        vector_append(calls.retention.pending, call);
+        call->zpending = true;
+    }
+#endif
+    return 0;
 }
 
 void
 sip_calls_rotate()
 {
     sip_call_t *call;
-    vector_iter_t it = vector_iterator(calls.list);
-    while ((call = vector_iterator_next(&it))) {
-        if (!call->locked) {
-            // Remove from callids hash
-            htable_remove(calls.callids, call->callid);
-            // Remove first call from active and call lists
-            vector_remove(calls.active, call);
-            vector_remove(calls.list, call);
-            return;
-        }
+    if ((call = sip_calls_evictable(NULL, 0)))
+        sip_calls_remove(call);
+}
+
+void
+sip_calls_account(sip_call_t *call, packet_t *packet, ssize_t delta)
+{
+    sip_retention_t *ret = &calls.retention;
+    size_t size = (delta > 0) ? (size_t) delta : 0;
+    size_t freed = (delta < 0) ? (size_t) -delta : 0;
+    int method;
+
+    // Add packet memory and update activity time
+    if (packet) {
+        // RTP packets memory is accounted by their stream store
+        if (packet->type != PACKET_RTP)
+            size += packet_memsize(packet, ret->frames);
+        call->last_activity = packet_time(packet);
+        if (timeval_is_older(call->last_activity, ret->last_time))
+            ret->last_time = call->last_activity;
+    }
+
+    if (!call->accounted) {
+        // Add call initial memory on first accounting
+        size += call->memsize;
+        call->memsize = 0;
+        call->accounted = true;
+    } else {
+        // Unlink the call from its current list position
+        if (call == ret->last)
+            goto accounted;
+        if (call->lru_prev)
+            call->lru_prev->lru_next = call->lru_next;
+        else
+            ret->first = call->lru_next;
+        call->lru_next->lru_prev = call->lru_prev;
+    }
+
+    // Link as most recently active call
+    call->lru_prev = ret->last;
+    call->lru_next = NULL;
+    if (ret->last)
+        ret->last->lru_next = call;
+    else
+        ret->first = call;
+    ret->last = call;
+
+accounted:
+    // Update memory counters
+    method = sip_calls_quota_method(call);
+    call->memsize = call->memsize + size - freed;
+    ret->memsize = ret->memsize + size - freed;
+    ret->quota_used[method] = ret->quota_used[method] + size - freed;
+
+    // Check if any other call must be removed
+    sip_calls_retention(call);
+
+#ifdef WITH_ZLIB
+    // Check if any finished call must be compressed
+    sip_calls_compress_pending();
+#endif
+}
+
+void
+sip_calls_unaccount(sip_call_t *call)
+{
+    sip_retention_t *ret = &calls.retention;
+
+    if (!call->accounted)
+        return;
+
+    // Unlink from retention list
+    if (call->lru_prev)
+        call->lru_prev->lru_next = call->lru_next;
+    else
+        ret->first = call->lru_next;
+    if (call->lru_next)
+        call->lru_next->lru_prev = call->lru_prev;
+    else
+        ret->last = call->lru_prev;
+    call->lru_prev = call->lru_next = NULL;
+    call->accounted = false;
+
+    // Release call memory from counters
+    ret->memsize -= call->memsize;
+    ret->quota_used[sip_calls_quota_method(call)] -= call->memsize;
+
+#ifdef WITH_ZLIB
+    // Remove from compression queue
+    if (call->zpending) {
+        vector_remove(ret->pending, call);
+        call->zpending = false;
     }
+#endif
+}
+
+size_t
+sip_calls_memsize()
+{
+    return calls.retention.memsize;
 }
 
 int
@@ -857,6 +1414,8 @@ sip_set_match_expression(const char *expr, int insensitive, int invert)
     calls.match_expr = expr;
     // Set invert flag
     calls.match_invert = invert;
+    // Set case flag
+    calls.match_insensitive = insensitive;
 
 #ifdef WITH_PCRE
     const char *re_err = NULL;
@@ -898,6 +1457,14 @@ sip_get_match_expression()
     return calls.match_expr;
 }
 
+int
+sip_get_parse_options(char *out, size_t len)
+{
+    return snprintf(out, len, "limit=%d\ncalls=%d\nincomplete=%d\nmatch=%s\ninsensitive=%d\ninvert=%d\n",
+                    calls.limit, calls.only_calls, calls.ignore_incomplete,
+                    calls.match_expr ? calls.match_expr : "", calls.match_insensitive, calls.match_invert);
+}
+
 int
 sip_check_match_expression(const char *payload)
 {
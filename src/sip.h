@@ -34,6 +34,7 @@
 
 #include "config.h"
 #include <stdbool.h>
+#include <sys/types.h>
 #include <regex.h>
 #ifdef WITH_PCRE
 #include <pcre.h>
@@ -58,6 +59,8 @@ typedef struct sip_code sip_code_t;
 typedef struct sip_stats sip_stats_t;
 //! Shorter declaration of sip sort
 typedef struct sip_sort sip_sort_t;
+//! Shorter declaration of sip retention
+typedef struct sip_retention sip_retention_t;
 
 //! SIP Methods
 enum sip_methods {
@@ -78,6 +81,18 @@ enum sip_methods {
     SIP_METHOD_PRACK,
 };
 
+//! Number of entries required to index any SIP Method
+#define SIP_METHOD_COUNT (SIP_METHOD_PRACK + 1)
+
+//! Minimum number of buckets of Call-Ids hash table
+#define SIP_CALLIDS_HASH_MIN 1024
+//! Maximum number of buckets of Call-Ids hash table
+#define SIP_CALLIDS_HASH_MAX (1 << 20)
+//! Percentage of cgroup memory limit used for stored dialogs
+#define SIP_RETENTION_CGROUP_PCT 75
+//! Seconds without activity before compressing a finished call
+#define SIP_COMPRESS_DELAY 5
+
 //! Return values for sip_validate_packet
 enum validate_result {
     VALIDATE_NOT_SIP        = -1,
@@ -117,6 +132,41 @@ struct sip_sort
     bool asc;
 };
 
+/**
+ * @brief Dialog retention configuration and memory accounting
+ *
+ * Every stored dialog is linked in a list sorted by its last activity,
+ * so the least recently active unlocked dialogs are the first ones to
+ * be evicted when any of the configured limits is exceeded.
+ */
+struct sip_retention
+{
+    //! Max memory used by stored dialogs in bytes. 0 for disabling
+    size_t memlimit;
+    //! Max seconds since the last activity of a dialog. 0 for disabling
+    int maxage;
+    //! Max memory used by dialogs starting with each method. 0 for disabling
+    size_t quota[SIP_METHOD_COUNT];
+    //! Memory used by dialogs starting with each method
+    size_t quota_used[SIP_METHOD_COUNT];
+    //! Memory used by all stored dialogs
+    size_t memsize;
+    //! Frames data is kept in memory after being parsed
+    bool frames;
+    //! Timestamp of the most recent accounted packet
+    struct timeval last_time;
+    //! Least recently active dialog
+    sip_call_t *first;
+    //! Most recently active dialog
+    sip_call_t *last;
+#ifdef WITH_ZLIB
+    //! Compress packets of finished dialogs
+    bool compress;
+    //! Finished dialogs waiting to be compressed (sorted by finish time)
+    vector_t *pending;
+#endif
+};
+
 /**
  * @brief call structures head list
  *
@@ -140,6 +190,8 @@ struct sip_call_list {
     int call_count_unrotated;
     // Max call limit
     int limit;
+    //! Memory based retention of stored calls
+    sip_retention_t retention;
     //! Only store dialogs starting with INVITE
     int only_calls;
     //! Only store dialogs starting with some Methods
@@ -158,6 +210,8 @@ struct sip_call_list {
 #endif
     //! Invert match expression result
     int match_invert;
+    //! Match expression ignores case
+    int match_insensitive;
 
     //! Regexp for payload matching
     regex_t reg_method;
@@ -245,6 +299,19 @@ sip_validate_packet(packet_t *packet);
 sip_msg_t *
 sip_check_packet(packet_t *packet);
 
+/**
+ * @brief Check if packet payload can be a SIP message
+ *
+ * Only the first line format is checked, without using any parser state,
+ * so this can be run from decoding threads before the packet is parsed.
+ * Packets that can not be SIP are skipped by sip_check_packet without
+ * copying their payload.
+ *
+ * @param packet Packet structure pointer
+ */
+void
+sip_precheck_packet(packet_t *packet);
+
 /**
  * @brief Return if the call list has changed
  *
@@ -369,14 +436,70 @@ void
 sip_calls_clear_soft();
 
 /**
- * @brief Remove first call in the call list
+ * @brief Remove least recently active call in the call list
  *
- * This function removes the first call in the calls vector avoiding
- * reaching the capture limit.
+ * This function removes the unlocked call with the oldest activity
+ * avoiding reaching the capture limit.
  */
 void
 sip_calls_rotate();
 
+/**
+ * @brief Account memory and activity of a call
+ *
+ * Add the packet and the given amount of bytes to the call memory, mark
+ * the call as the most recently active one and evict other calls if any
+ * retention limit has been exceeded.
+ *
+ * @param call SIP call structure
+ * @param packet Last packet added to the call or NULL
+ * @param delta Extra bytes to be added to (or removed from) the call memory
+ */
+void
+sip_calls_account(sip_call_t *call, packet_t *packet, ssize_t delta);
+
+/**
+ * @brief Remove a call from memory accounting
+ *
+ * This function must be invoked before the call memory is freed.
+ *
+ * @param call SIP call structure
+ */
+void
+sip_calls_unaccount(sip_call_t *call);
+
+/**
+ * @brief Compress payload and frames data of all call packets
+ *
+ * Packets are kept in the call but their data is stored in a single
+ * zlib compressed block. Only headers and parsed attributes remain
+ * uncompressed, so the call list can be displayed without restoring
+ * the call data.
+ *
+ * @param call SIP call structure
+ * @return 0 if call has been compressed, 1 otherwise
+ */
+int
+sip_call_compress(sip_call_t *call);
+
+/**
+ * @brief Restore packet data of a compressed call
+ *
+ * This function does nothing for uncompressed calls, so it can be
+ * safely invoked before accessing any call packet payload or frame.
+ *
+ * @param call SIP call structure
+ * @return 0 if call data is available, 1 otherwise
+ */
+int
+sip_call_decompress(sip_call_t *call);
+
+/**
+ * @brief Return memory used by all stored calls in bytes
+ */
+size_t
+sip_calls_memsize();
+
 /**
  * @brief Get message Request/Response code
  *
@@ -451,6 +574,18 @@ sip_set_match_expression(const char *expr, int insensitive, int invert);
 const char *
 sip_get_match_expression();
 
+/**
+ * @brief Get a text describing the options that select stored calls
+ *
+ * Loading the same packets with the same options stores the same calls.
+ *
+ * @param out Buffer to fill with options text
+ * @param len Buffer size
+ * @return number of characters of the whole text, as snprintf
+ */
+int
+sip_get_parse_options(char *out, size_t len);
+
 /**
  * @brief Checks if a given payload matches expression
  *
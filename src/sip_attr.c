@@ -56,7 +56,13 @@ static sip_attr_hdr_t attrs[SIP_ATTR_COUNT] = {
     { SIP_ATTR_REASON_TXT,  "reason",      "Reason Text",   "Reason Text", 25 },
     { SIP_ATTR_WARNING,     "warning",     "Warning", "Warning code", 4 },
     { SIP_ATTR_DISCONNECT_BY,  "disconnectby",  "Disconnect By", "Who Disconnected", 20 },
-    { SIP_ATTR_DISCONNECT_CODE, "disconnectcode", "Disc Code", "Disconnect SIP Code", 15 }
+    { SIP_ATTR_DISCONNECT_CODE, "disconnectcode", "Disc Code", "Disconnect SIP Code", 15 },
+    { SIP_ATTR_RTPLOSS,     "rtploss",     "Loss", "RTP Packet Loss", 6 },
+    { SIP_ATTR_RTPJITTER,   "rtpjitter",   "Jitter", "RTP Jitter",  8 },
+    { SIP_ATTR_RTPSEQERR,   "rtpseqerr",   "SeqErr", "RTP Sequence Errors", 6 },
+    { SIP_ATTR_MOS,         "mos",         "MOS",  "Estimated MOS", 4 },
+    { SIP_ATTR_RFACTOR,     "rfactor",     "R",    "Estimated R-factor", 4 },
+    { SIP_ATTR_MEDIASTATE,  "mediastate",  "Media", "Media State",  8, sip_attr_color_media }
 };
 
 sip_attr_hdr_t *
@@ -175,3 +181,17 @@ sip_attr_color_state(const char *value)
         return COLOR_PAIR(CP_CYAN_ON_DEF);
     return 0;
 }
+
+int
+sip_attr_color_media(const char *value)
+{
+    if (!strcmp(value, call_media_state_to_str(SIP_MEDIASTATE_OK)))
+        return COLOR_PAIR(CP_GREEN_ON_DEF);
+    if (!strcmp(value, call_media_state_to_str(SIP_MEDIASTATE_GAPS)))
+        return COLOR_PAIR(CP_YELLOW_ON_DEF);
+    if (!strcmp(value, call_media_state_to_str(SIP_MEDIASTATE_STOPPED)))
+        return COLOR_PAIR(CP_MAGENTA_ON_DEF);
+    if (!strcmp(value, call_media_state_to_str(SIP_MEDIASTATE_ONEWAY)))
+        return COLOR_PAIR(CP_RED_ON_DEF);
+    return 0;
+}
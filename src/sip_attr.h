@@ -89,6 +89,18 @@ enum sip_attr_id {
     SIP_ATTR_DISCONNECT_BY,
     //! SIP Code of disconnection response
     SIP_ATTR_DISCONNECT_CODE,
+    //! Worst RTP packet loss of call streams
+    SIP_ATTR_RTPLOSS,
+    //! Worst RTP interarrival jitter of call streams
+    SIP_ATTR_RTPJITTER,
+    //! Worst RTP out of order and duplicated packets of call streams
+    SIP_ATTR_RTPSEQERR,
+    //! Worst estimated MOS of call streams
+    SIP_ATTR_MOS,
+    //! Worst estimated R-factor of call streams
+    SIP_ATTR_RFACTOR,
+    //! Call audio streams state
+    SIP_ATTR_MEDIASTATE,
     //! SIP Attribute count
     SIP_ATTR_COUNT
 };
@@ -221,4 +233,13 @@ sip_attr_color_method(const char *value);
 int
 sip_attr_color_state(const char *value);
 
+/**
+ * @brief Determine the color of the attribute in Call List
+ *
+ * This function can be used to show the media state attribute
+ * with different colours in Call List.
+ */
+int
+sip_attr_color_media(const char *value);
+
 #endif /* __SNGREP_SIP_ATTR_H */
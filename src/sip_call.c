@@ -46,15 +46,9 @@ call_create(char *callid, char *xcallid)
     call->msgs = vector_create(2, 2);
     vector_set_destroyer(call->msgs, msg_destroyer);
 
-    // Create an empty vector to store rtp packets
-    if (setting_enabled(SETTING_CAPTURE_RTP)) {
-        call->rtp_packets = vector_create(0, 40);
-        vector_set_destroyer(call->rtp_packets, packet_destroyer);
-    }
-
     // Create an empty vector to strore stream data
     call->streams = vector_create(0, 2);
-    vector_set_destroyer(call->streams, vector_generic_destroyer);
+    vector_set_destroyer(call->streams, stream_destroyer);
 
     // Create an empty vector to store x-calls
     call->xcalls = vector_create(0, 1);
@@ -66,18 +60,21 @@ call_create(char *callid, char *xcallid)
     call->callid = strdup(callid);
     call->xcallid = strdup(xcallid);
 
+    // Initial call memory (accounted with its first message)
+    call->memsize = sizeof(sip_call_t) + strlen(callid) + strlen(xcallid) + 2;
+
     return call;
 }
 
 void
 call_destroy(sip_call_t *call)
 {
+    // Remove call from memory accounting
+    sip_calls_unaccount(call);
     // Remove all call messages
     vector_destroy(call->msgs);
     // Remove all call streams
     vector_destroy(call->streams);
-    // Remove all call rtp packets
-    vector_destroy(call->rtp_packets);
     // Remove all xcalls
     vector_destroy(call->xcalls);
     // Deallocate call memory
@@ -86,6 +83,9 @@ call_destroy(sip_call_t *call)
     sng_free(call->reasontxt);
     sng_free(call->disconnect_by);
     sng_free(call->disconnect_code);
+#ifdef WITH_ZLIB
+    free(call->zdata);
+#endif
     sng_free(call);
 }
 
@@ -110,24 +110,68 @@ call_add_message(sip_call_t *call, sip_msg_t *msg)
     msg->index = vector_append(call->msgs, msg);
     // Flag this call as changed
     call->changed = true;
+    // Account message memory
+    sip_calls_account(call, msg->packet, sizeof(sip_msg_t)
+                      + (msg->sip_from ? strlen(msg->sip_from) + 1 : 0)
+                      + (msg->sip_to ? strlen(msg->sip_to) + 1 : 0)
+                      + (msg->resp_str ? strlen(msg->resp_str) + 1 : 0));
+}
+
+/**
+ * @brief Remove call streams that will not receive any packet
+ *
+ * Streams without packets are removed when a newer stream of the call
+ * has the same destination (it would be matched first) or once they are
+ * STREAM_PENDING_SECS older than the newer stream.
+ */
+static void
+call_prune_streams(sip_call_t *call, rtp_stream_t *newer)
+{
+    rtp_stream_t *stream;
+    struct timeval limit = msg_get_time(newer->media->msg);
+    int i;
+
+    limit.tv_sec -= STREAM_PENDING_SECS;
+
+    for (i = vector_count(call->streams) - 1; i >= 0; i--) {
+        stream = vector_item(call->streams, i);
+        if (stream_is_complete(stream))
+            continue;
+
+        if ((stream->type == newer->type && addressport_equals(stream->dst, newer->dst))
+            || timeval_is_older(limit, msg_get_time(stream->media->msg))) {
+            vector_remove(call->streams, stream);
+            sip_calls_account(call, NULL, -(ssize_t) sizeof(rtp_stream_t));
+        }
+    }
 }
 
 void
 call_add_stream(sip_call_t *call, rtp_stream_t *stream)
 {
+    // Remove previous streams without packets
+    call_prune_streams(call, stream);
     // Store stream
     vector_append(call->streams, stream);
+    // Allow finding this stream from its packets addresses
+    rtp_index_add(stream);
     // Flag this call as changed
     call->changed = true;
+    // Account stream memory
+    sip_calls_account(call, NULL, sizeof(rtp_stream_t));
 }
 
 void
-call_add_rtp_packet(sip_call_t *call, packet_t *packet)
+call_add_rtp_packet(sip_call_t *call, rtp_stream_t *stream, packet_t *packet)
 {
-    // Store packet
-    vector_append(call->rtp_packets, packet);
+    size_t memsize = stream_store_memsize(stream);
+
+    // Copy packet data into stream store
+    stream_store_packet(stream, packet);
     // Flag this call as changed
     call->changed = true;
+    // Account stream store growth
+    sip_calls_account(call, packet, (ssize_t) stream_store_memsize(stream) - (ssize_t) memsize);
 }
 
 int
@@ -502,10 +546,152 @@ call_update_state(sip_call_t *call, sip_msg_t *msg)
     }
 }
 
+/**
+ * @brief Get the worst RTP quality value of call streams
+ *
+ * Worst value is the highest for error statistics and the lowest for
+ * quality estimations.
+ *
+ * @param call SIP call structure
+ * @param id RTP quality attribute
+ * @return worst value of RTP streams with packets or -1 if there are none
+ */
+static double
+call_get_rtp_stat(sip_call_t *call, enum sip_attr_id id)
+{
+    rtp_stream_t *stream;
+    double value, worst = -1;
+    vector_iter_t it = vector_iterator(call->streams);
+
+    while ((stream = vector_iterator_next(&it))) {
+        if (stream->type != PACKET_RTP || !stream_get_count(stream))
+            continue;
+
+        switch (id) {
+            case SIP_ATTR_RTPLOSS:
+                value = stream_get_loss(stream);
+                break;
+            case SIP_ATTR_RTPJITTER:
+                value = stream_get_jitter(stream);
+                break;
+            case SIP_ATTR_RTPSEQERR:
+                value = stream->stats.out_of_order + stream->stats.duplicates;
+                break;
+            case SIP_ATTR_MOS:
+                value = stream_get_mos(stream);
+                break;
+            case SIP_ATTR_RFACTOR:
+                value = stream_get_rfactor(stream);
+                break;
+            default:
+                return -1;
+        }
+
+        if (value < 0)
+            continue;
+
+        if (id == SIP_ATTR_MOS || id == SIP_ATTR_RFACTOR) {
+            if (worst < 0 || value < worst)
+                worst = value;
+        } else if (value > worst) {
+            worst = value;
+        }
+    }
+
+    return worst;
+}
+
+/**
+ * @brief Check if a stream must be considered for call media state
+ *
+ * Only audio streams with packets are checked, telephone-event streams
+ * are only sent while a key is pressed.
+ */
+static bool
+call_stream_has_audio(rtp_stream_t *stream)
+{
+    return stream->type == PACKET_RTP && !stream->telephone_event && stream_get_count(stream);
+}
+
+/**
+ * @brief Check if any call stream has received audio packets
+ */
+static bool
+call_has_audio(sip_call_t *call)
+{
+    rtp_stream_t *stream;
+    vector_iter_t it = vector_iterator(call->streams);
+
+    while ((stream = vector_iterator_next(&it))) {
+        if (call_stream_has_audio(stream))
+            return true;
+    }
+    return false;
+}
+
+int
+call_get_media_state(sip_call_t *call)
+{
+    rtp_stream_t *stream, *other, *first = NULL;
+    vector_iter_t it, oit;
+    struct timeval newest = { 0 }, last;
+    int64_t silence;
+    int gap = setting_get_intvalue(SETTING_CAPTURE_RTPGAP);
+    bool twoway = false, gaps = false;
+
+    // Find the last received packet of all streams
+    it = vector_iterator(call->streams);
+    while ((stream = vector_iterator_next(&it))) {
+        if (!call_stream_has_audio(stream))
+            continue;
+        if (!first) {
+            first = stream;
+        } else if (!addressport_equals(first->src, stream->src)) {
+            twoway = true;
+        }
+        if (stream->activity.gaps)
+            gaps = true;
+        if (timeval_is_older(stream->stats.last_arrival, newest))
+            newest = stream->stats.last_arrival;
+    }
+
+    if (!first)
+        return 0;
+
+    if (!twoway)
+        return SIP_MEDIASTATE_ONEWAY;
+
+    if (gap <= 0)
+        return SIP_MEDIASTATE_OK;
+
+    // Check the last received packet of each source
+    vector_iterator_reset(&it);
+    while ((stream = vector_iterator_next(&it))) {
+        if (!call_stream_has_audio(stream))
+            continue;
+
+        last = stream->stats.last_arrival;
+        oit = vector_iterator(call->streams);
+        while ((other = vector_iterator_next(&oit))) {
+            if (call_stream_has_audio(other) && addressport_equals(stream->src, other->src)
+                && timeval_is_older(other->stats.last_arrival, last))
+                last = other->stats.last_arrival;
+        }
+
+        silence = (int64_t) (newest.tv_sec - last.tv_sec) * 1000
+                  + (newest.tv_usec - last.tv_usec) / 1000;
+        if (silence >= gap)
+            return SIP_MEDIASTATE_STOPPED;
+    }
+
+    return (gaps) ? SIP_MEDIASTATE_GAPS : SIP_MEDIASTATE_OK;
+}
+
 const char *
 call_get_attribute(sip_call_t *call, enum sip_attr_id id, char *value)
 {
     sip_msg_t *first, *last;
+    double stat;
 
     if (!call)
         return NULL;
@@ -656,6 +842,30 @@ call_get_attribute(sip_call_t *call, enum sip_attr_id id, char *value)
                 sprintf(value, "BYE");
             }
             break;
+        case SIP_ATTR_RTPLOSS:
+            if ((stat = call_get_rtp_stat(call, id)) >= 0)
+                sprintf(value, "%.1f%%", stat);
+            break;
+        case SIP_ATTR_RTPJITTER:
+            if ((stat = call_get_rtp_stat(call, id)) >= 0)
+                sprintf(value, "%.1fms", stat);
+            break;
+        case SIP_ATTR_RTPSEQERR:
+            if ((stat = call_get_rtp_stat(call, id)) >= 0)
+                sprintf(value, "%.0f", stat);
+            break;
+        case SIP_ATTR_RFACTOR:
+        case SIP_ATTR_MOS:
+            if ((stat = call_get_rtp_stat(call, id)) >= 0) {
+                sprintf(value, (id == SIP_ATTR_MOS) ? "%.2f" : "%.0f", stat);
+            } else if (call_has_audio(call)) {
+                // Audio codecs can not be estimated
+                sprintf(value, "n/a");
+            }
+            break;
+        case SIP_ATTR_MEDIASTATE:
+            sprintf(value, "%s", call_media_state_to_str(call_get_media_state(call)));
+            break;
         default:
             return msg_get_attribute(vector_first(call->msgs), id, value);
             break;
@@ -686,6 +896,22 @@ call_state_to_str(int state)
     return "";
 }
 
+const char *
+call_media_state_to_str(int state)
+{
+    switch (state) {
+        case SIP_MEDIASTATE_OK:
+            return "OK";
+        case SIP_MEDIASTATE_GAPS:
+            return "GAPS";
+        case SIP_MEDIASTATE_STOPPED:
+            return "STOPPED";
+        case SIP_MEDIASTATE_ONEWAY:
+            return "ONE WAY";
+    }
+    return "";
+}
+
 int
 call_attr_compare(sip_call_t *one, sip_call_t *two, enum sip_attr_id id)
 {
@@ -704,6 +930,22 @@ call_attr_compare(sip_call_t *one, sip_call_t *two, enum sip_attr_id id)
             twointvalue = call_msg_count(two);
             comparetype = 1;
             break;
+        case SIP_ATTR_RTPLOSS:
+        case SIP_ATTR_RTPJITTER:
+        case SIP_ATTR_RTPSEQERR:
+        case SIP_ATTR_MOS:
+        case SIP_ATTR_RFACTOR:
+            // Compare in hundredths (calls without RTP first)
+            oneintvalue = call_get_rtp_stat(one, id) * 100;
+            twointvalue = call_get_rtp_stat(two, id) * 100;
+            comparetype = 1;
+            break;
+        case SIP_ATTR_MEDIASTATE:
+            // Compare by severity
+            oneintvalue = call_get_media_state(one);
+            twointvalue = call_get_media_state(two);
+            comparetype = 1;
+            break;
         default:
             // Get attribute values
             memset(onevalue, 0, sizeof(onevalue));
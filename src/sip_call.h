@@ -52,6 +52,15 @@ enum call_state
     SIP_CALLSTATE_COMPLETED
 };
 
+//! SIP Call media state (from less to more severe)
+enum call_media_state
+{
+    SIP_MEDIASTATE_OK = 1,
+    SIP_MEDIASTATE_GAPS,
+    SIP_MEDIASTATE_STOPPED,
+    SIP_MEDIASTATE_ONEWAY
+};
+
 /**
  * @brief Contains all information of a call and its messages
  *
@@ -92,8 +101,24 @@ struct sip_call {
     sip_msg_t *cstart_msg, *cend_msg;
     //! RTP streams for this call (rtp_stream_t *)
     vector_t *streams;
-    //! RTP packets for this call (capture_packet_t *)
-    vector_t *rtp_packets;
+    //! Estimated memory used by this call in bytes
+    size_t memsize;
+    //! Capture time of the last packet added to this call
+    struct timeval last_activity;
+    //! Previous and next calls sorted by activity (retention list)
+    struct sip_call *lru_prev, *lru_next;
+    //! Flag this call is part of the retention list
+    bool accounted;
+#ifdef WITH_ZLIB
+    //! Compressed payload and frames data of all call packets
+    u_char *zdata;
+    //! Compressed data size
+    size_t zlen;
+    //! Uncompressed data size
+    size_t rawlen;
+    //! Flag this call is waiting to be compressed
+    bool zpending;
+#endif
 };
 
 /**
@@ -166,11 +191,15 @@ call_add_stream(sip_call_t *call, rtp_stream_t *stream);
 /**
  * @brief Append a new RTP packet to the call
  *
+ * Packet data is copied into the stream store, so the packet itself
+ * can be destroyed after this call.
+ *
  * @param call pointer to the call owner of the stream
+ * @param stream stream the packet belongs to
  * @param packet new RTP packet from call rtp streams
  */
 void
-call_add_rtp_packet(sip_call_t *call, packet_t *packet);
+call_add_rtp_packet(sip_call_t *call, rtp_stream_t *stream, packet_t *packet);
 
 /**
  * @brief Getter for call messages linked list size
@@ -252,6 +281,27 @@ call_get_attribute(struct sip_call *call, enum sip_attr_id id, char *value);
 const char *
 call_state_to_str(int state);
 
+/**
+ * @brief Determine the media state of a call
+ *
+ * Call audio streams are grouped by source address. If only one source
+ * has sent packets, the call has one-way audio. If a source stopped
+ * sending packets longer than capture.rtpgap before the others, its
+ * audio stopped mid-call. Otherwise, streams with silences longer than
+ * capture.rtpgap are reported as gaps.
+ *
+ * @param call SIP call structure
+ * @return media state or 0 if call has no audio streams with packets
+ */
+int
+call_get_media_state(struct sip_call *call);
+
+/**
+ * @brief Return the string represtation of a call media state
+ */
+const char *
+call_media_state_to_str(int state);
+
 /**
  * @brief Compare two calls based on a given attribute
  *
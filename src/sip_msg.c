@@ -38,6 +38,7 @@ msg_create()
     sip_msg_t *msg;
     if (!(msg = sng_malloc(sizeof(sip_msg_t))))
         return NULL;
+    memstat_alloc(MEMSTAT_MSGS, sizeof(sip_msg_t));
     return msg;
 }
 
@@ -50,6 +51,11 @@ msg_destroy(sip_msg_t *msg)
 
     // Free message packets
     packet_destroy(msg->packet);
+    // Remove message memory accounting
+    memstat_free(MEMSTAT_MSGS, sizeof(sip_msg_t)
+                 + (msg->sip_from ? strlen(msg->sip_from) + 1 : 0)
+                 + (msg->sip_to ? strlen(msg->sip_to) + 1 : 0)
+                 + (msg->resp_str ? strlen(msg->resp_str) + 1 : 0));
     // Free all memory
     sng_free(msg->resp_str);
     sng_free(msg->sip_from);
@@ -100,6 +106,9 @@ msg_add_media(sip_msg_t *msg, sdp_media_t *media)
 const char *
 msg_get_payload(sip_msg_t *msg)
 {
+    // Restore payload if message call is compressed
+    if (msg->call)
+        sip_call_decompress(msg->call);
     return (const char *) packet_payload(msg->packet);
 }
 
@@ -0,0 +1,271 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file storage.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source code of functions defined in storage.h
+ *
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "storage.h"
+#include "util.h"
+
+/**
+ * @brief Disk storage global data
+ *
+ * Spool directory is only set while disk storage is initialized
+ */
+static storage_t storage = { 0 };
+
+/**
+ * @brief Create a new segment file in the spool directory
+ *
+ * The file is unlinked as soon as it is mapped, so its disk space is
+ * reclaimed when the segment is destroyed or sngrep exits.
+ *
+ * @return new segment or NULL on failure
+ */
+static storage_segment_t *
+storage_segment_create()
+{
+    storage_segment_t *segment;
+    char path[PATH_MAX];
+
+    if (!(segment = sng_malloc(sizeof(storage_segment_t))))
+        return NULL;
+
+    snprintf(path, sizeof(path), "%s/sngrep-XXXXXX", storage.spooldir);
+    if ((segment->fd = mkstemp(path)) == -1) {
+        sng_free(segment);
+        return NULL;
+    }
+    unlink(path);
+
+    // Reserve segment space (without allocating disk blocks)
+    if (ftruncate(segment->fd, STORAGE_SEGMENT_SIZE) != 0) {
+        close(segment->fd);
+        sng_free(segment);
+        return NULL;
+    }
+
+    // Map the whole segment. Written data is visible through the mapping.
+    segment->map = mmap(NULL, STORAGE_SEGMENT_SIZE, PROT_READ, MAP_SHARED, segment->fd, 0);
+    if (segment->map == MAP_FAILED) {
+        close(segment->fd);
+        sng_free(segment);
+        return NULL;
+    }
+
+    vector_append(storage.segments, segment);
+    return segment;
+}
+
+/**
+ * @brief Unmap and close a segment file
+ */
+static void
+storage_segment_destroy(storage_segment_t *segment)
+{
+    vector_remove(storage.segments, segment);
+    munmap(segment->map, STORAGE_SEGMENT_SIZE);
+    close(segment->fd);
+    sng_free(segment);
+}
+
+/**
+ * @brief Append data at the end of the segment
+ *
+ * @return 0 if all data has been written, 1 otherwise
+ */
+static int
+storage_segment_write(storage_segment_t *segment, const u_char *data, size_t len)
+{
+    ssize_t written;
+    size_t offset = 0;
+
+    while (offset < len) {
+        written = pwrite(segment->fd, data + offset, len - offset, segment->used + offset);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return 1;
+        }
+        offset += written;
+    }
+
+    segment->used += len;
+    return 0;
+}
+
+int
+storage_init(const char *spooldir)
+{
+    // Default spool directory
+    if (!spooldir && !(spooldir = getenv("TMPDIR")))
+        spooldir = "/tmp";
+
+    // Check we can create segment files in spool directory
+    if (access(spooldir, W_OK | X_OK) != 0)
+        return 1;
+
+    storage.spooldir = strdup(spooldir);
+    storage.segments = vector_create(1, 10);
+    storage.written = 0;
+    pthread_mutex_init(&storage.lock, NULL);
+
+    // Create first segment to report errors as soon as possible
+    if (!(storage.current = storage_segment_create())) {
+        storage_deinit();
+        return 1;
+    }
+
+    return 0;
+}
+
+void
+storage_deinit()
+{
+    storage_segment_t *segment;
+
+    if (!storage.spooldir)
+        return;
+
+    while ((segment = vector_first(storage.segments)))
+        storage_segment_destroy(segment);
+
+    vector_destroy(storage.segments);
+    pthread_mutex_destroy(&storage.lock);
+    free(storage.spooldir);
+    memset(&storage, 0, sizeof(storage_t));
+}
+
+int
+storage_store_packet(packet_t *packet)
+{
+    frame_t *frame;
+    storage_segment_t *segment;
+    size_t len = 0, offset;
+    vector_iter_t it;
+
+    // Disk storage not initialized or packet already stored
+    if (!storage.spooldir || packet->segment)
+        return 1;
+
+    // Calculate stored data size
+    if (packet->payload)
+        len += packet->payload_len + 1;
+    it = vector_iterator(packet->frames);
+    while ((frame = vector_iterator_next(&it))) {
+        if (frame->data)
+            len += frame->header->caplen;
+    }
+
+    // Nothing to store or too big to fit in a segment
+    if (len == 0 || len > STORAGE_SEGMENT_SIZE)
+        return 1;
+
+    pthread_mutex_lock(&storage.lock);
+
+    // Start a new segment if current one is full
+    if (!storage.current || storage.current->used + len > STORAGE_SEGMENT_SIZE) {
+        if (storage.current && storage.current->packets == 0)
+            storage_segment_destroy(storage.current);
+        storage.current = storage_segment_create();
+    }
+
+    if (!(segment = storage.current)) {
+        pthread_mutex_unlock(&storage.lock);
+        return 1;
+    }
+
+    // Write payload (including its NULL terminator) followed by frames data
+    offset = segment->used;
+    if (packet->payload && storage_segment_write(segment, packet->payload, packet->payload_len + 1) != 0)
+        goto write_error;
+
+    vector_iterator_reset(&it);
+    while ((frame = vector_iterator_next(&it))) {
+        if (frame->data && storage_segment_write(segment, frame->data, frame->header->caplen) != 0)
+            goto write_error;
+    }
+
+    // Point packet data to the mapped segment
+    if (packet->payload) {
+        memstat_free(MEMSTAT_PAYLOADS, packet->payload_len + 1);
+        free(packet->payload);
+        packet->payload = segment->map + offset;
+        packet->payload_owned = false;
+        offset += packet->payload_len + 1;
+    }
+
+    vector_iterator_reset(&it);
+    while ((frame = vector_iterator_next(&it))) {
+        if (frame->data) {
+            memstat_resize(MEMSTAT_FRAMES, frame->header->caplen, 0);
+            free(frame->data);
+            frame->data = segment->map + offset;
+            offset += frame->header->caplen;
+        }
+    }
+
+    packet->segment = segment;
+    segment->packets++;
+    storage.written += len;
+    pthread_mutex_unlock(&storage.lock);
+    return 0;
+
+write_error:
+    // Discard partially written data, packet is kept in memory
+    segment->used = offset;
+    pthread_mutex_unlock(&storage.lock);
+    return 1;
+}
+
+void
+storage_release_packet(packet_t *packet)
+{
+    storage_segment_t *segment = packet->segment;
+
+    packet->segment = NULL;
+    if (!storage.spooldir || !segment)
+        return;
+
+    pthread_mutex_lock(&storage.lock);
+    // Remove segments without packets once they are not longer written
+    if (--segment->packets == 0 && segment != storage.current)
+        storage_segment_destroy(segment);
+    pthread_mutex_unlock(&storage.lock);
+}
+
+size_t
+storage_written()
+{
+    return storage.written;
+}
@@ -0,0 +1,135 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file storage.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to manage disk backed packet storage
+ *
+ * When capture storage is set to disk, packet payload and frames data are
+ * appended to segment files in the spool directory after being parsed.
+ * Segments are mapped in memory, so stored packets point to the mapped
+ * region and the kernel can page their data out as required.
+ *
+ * Segment files are unlinked right after being created, so they are
+ * removed from disk when sngrep exits (even if it does not exit cleanly).
+ * A segment is released once all packets stored in it are destroyed.
+ */
+
+#ifndef __SNGREP_STORAGE_H_
+#define __SNGREP_STORAGE_H_
+
+#include "config.h"
+#include <stdint.h>
+#include <pthread.h>
+#include "packet.h"
+#include "vector.h"
+
+//! Size of each segment file
+#define STORAGE_SEGMENT_SIZE    (64 * 1024 * 1024)
+
+//! Shorter declaration of storage structures
+typedef struct storage_segment storage_segment_t;
+typedef struct storage storage_t;
+
+/**
+ * @brief Spool file holding stored packets data
+ */
+struct storage_segment {
+    //! Segment file descriptor
+    int fd;
+    //! Segment file mapped contents
+    u_char *map;
+    //! Bytes already written in this segment
+    size_t used;
+    //! Number of stored packets pointing to this segment
+    uint32_t packets;
+};
+
+/**
+ * @brief Disk storage global data
+ */
+struct storage {
+    //! Directory where segment files are created
+    char *spooldir;
+    //! List of open segments (storage_segment_t)
+    vector_t *segments;
+    //! Segment where new packets are appended
+    storage_segment_t *current;
+    //! Bytes of packet data written to segments
+    size_t written;
+    //! Storage lock
+    pthread_mutex_t lock;
+};
+
+/**
+ * @brief Initialize disk storage
+ *
+ * Check the spool directory is writable and prepare storage data.
+ * If no directory is given, TMPDIR or /tmp will be used.
+ *
+ * @param spooldir Directory where segment files will be created
+ * @return 0 on success, 1 otherwise
+ */
+int
+storage_init(const char *spooldir);
+
+/**
+ * @brief Deinitialize disk storage
+ *
+ * Unmap and close all open segments. Packets still pointing to segment data
+ * must not be accessed after this call.
+ */
+void
+storage_deinit();
+
+/**
+ * @brief Move packet data to disk storage
+ *
+ * Append packet payload and frames data to the current segment and
+ * replace packet data pointers with the mapped segment contents.
+ * If data can not be written, packet is left untouched in memory.
+ *
+ * @param packet Parsed packet to be stored
+ * @return 0 if packet has been stored, 1 otherwise
+ */
+int
+storage_store_packet(packet_t *packet);
+
+/**
+ * @brief Release packet data from disk storage
+ *
+ * This function is invoked when a stored packet is destroyed. Once all
+ * packets of a segment are released, the segment is removed.
+ *
+ * @param packet Stored packet
+ */
+void
+storage_release_packet(packet_t *packet);
+
+/**
+ * @brief Get the number of bytes written to disk storage
+ */
+size_t
+storage_written();
+
+#endif /* __SNGREP_STORAGE_H_ */
@@ -33,8 +33,12 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <signal.h>
+#include <limits.h>
 #include "util.h"
 
+//! cgroup v1 reports a huge number instead of 'max' for unlimited groups
+#define CGROUP_UNLIMITED (1ULL << 62)
+
 #if __STDC_VERSION__ >= 201112L && __STDC_NO_ATOMICS__ != 1
 // modern C with atomics
 #include <stdatomic.h>
@@ -46,11 +50,134 @@ typedef volatile sig_atomic_t signal_flag_type;
 
 static signal_flag_type sigterm_received = 0;
 
+//! Memory accounting counters, updated atomically from capture, decoding and interface threads
+static memstat_t memstats[MEMSTAT_COUNT];
+
+//! Memory accounting subsystems names
+static const char *memstat_names[MEMSTAT_COUNT] = {
+    [MEMSTAT_PACKETS]       = "Packets",
+    [MEMSTAT_FRAMES]        = "Frames",
+    [MEMSTAT_PAYLOADS]      = "Payloads",
+    [MEMSTAT_MSGS]          = "Messages",
+    [MEMSTAT_MEDIA]         = "SDP media",
+    [MEMSTAT_STREAMS]       = "RTP streams",
+    [MEMSTAT_RTP_PACKETS]   = "RTP packets",
+    [MEMSTAT_REASM]         = "Reassembly",
+    [MEMSTAT_HTABLES]       = "Hash tables",
+};
+
 static void sigterm_handler(int signum)
 {
     sigterm_received = 1;
 }
 
+size_t
+size_from_str(const char *str)
+{
+    char *end;
+    unsigned long long size;
+
+    if (!str || !isdigit(*str))
+        return 0;
+
+    size = strtoull(str, &end, 10);
+    switch (toupper(*end)) {
+        case 'G':
+            size <<= 10;
+            /* fall through */
+        case 'M':
+            size <<= 10;
+            /* fall through */
+        case 'K':
+            size <<= 10;
+            end++;
+            break;
+        case '\0':
+            break;
+        default:
+            return 0;
+    }
+
+    // Allow a trailing B (as in 512MB)
+    if (toupper(*end) == 'B')
+        end++;
+
+    return (*end == '\0') ? (size_t) size : 0;
+}
+
+const char *
+size_to_str(size_t size, char *out)
+{
+    if (size >= 1024 * 1024 * 1024) {
+        sprintf(out, "%.1fG", (double) size / (1024 * 1024 * 1024));
+    } else if (size >= 1024 * 1024) {
+        sprintf(out, "%.1fM", (double) size / (1024 * 1024));
+    } else if (size >= 1024) {
+        sprintf(out, "%.1fK", (double) size / 1024);
+    } else {
+        sprintf(out, "%zuB", size);
+    }
+    return out;
+}
+
+/**
+ * @brief Read a cgroup memory limit file
+ *
+ * @return limit in bytes or 0 if unlimited or not readable
+ */
+static size_t
+cgroup_read_limit(const char *path)
+{
+    FILE *fp;
+    unsigned long long limit = 0;
+
+    if (!(fp = fopen(path, "r")))
+        return 0;
+
+    // cgroup v2 uses 'max' string for unlimited groups
+    if (fscanf(fp, "%llu", &limit) != 1 || limit >= CGROUP_UNLIMITED)
+        limit = 0;
+
+    fclose(fp);
+    return (size_t) limit;
+}
+
+size_t
+cgroup_memory_limit()
+{
+    FILE *fp;
+    char line[PATH_MAX], path[PATH_MAX + 64];
+    char *group;
+    size_t limit = 0;
+
+    // Check process cgroup in each hierarchy
+    if ((fp = fopen("/proc/self/cgroup", "r"))) {
+        while (!limit && fgets(line, sizeof(line), fp)) {
+            strtrim(line);
+            // Lines have hierarchy-ID:controller-list:cgroup-path format
+            if (!(group = strchr(line, ':')) || !(group = strchr(group + 1, ':')))
+                continue;
+            if (!strncmp(line, "0::", 3)) {
+                snprintf(path, sizeof(path), "/sys/fs/cgroup%s/memory.max", group + 1);
+            } else if (strstr(line, ":memory:")) {
+                snprintf(path, sizeof(path), "/sys/fs/cgroup/memory%s/memory.limit_in_bytes", group + 1);
+            } else {
+                continue;
+            }
+            limit = cgroup_read_limit(path);
+        }
+        fclose(fp);
+    }
+
+    // Inside containers the process cgroup is usually the mounted root
+    if (!limit)
+        limit = cgroup_read_limit("/sys/fs/cgroup/memory.max");
+    if (!limit)
+        limit = cgroup_read_limit("/sys/fs/cgroup/memory/memory.limit_in_bytes");
+
+    return limit;
+}
+
 void setup_sigterm_handler(void)
 {
     // set up SIGTERM handler (also used for SIGINT and SIGQUIT)
@@ -209,3 +336,57 @@ strtrim(char *str)
 
     return str;
 }
+
+void
+memstat_alloc(enum memstat_type type, size_t bytes)
+{
+    __atomic_fetch_add(&memstats[type].objects, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&memstats[type].bytes, bytes, __ATOMIC_RELAXED);
+}
+
+void
+memstat_free(enum memstat_type type, size_t bytes)
+{
+    __atomic_fetch_sub(&memstats[type].objects, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&memstats[type].bytes, bytes, __ATOMIC_RELAXED);
+}
+
+void
+memstat_resize(enum memstat_type type, size_t oldsize, size_t newsize)
+{
+    if (newsize > oldsize) {
+        __atomic_fetch_add(&memstats[type].bytes, newsize - oldsize, __ATOMIC_RELAXED);
+    } else {
+        __atomic_fetch_sub(&memstats[type].bytes, oldsize - newsize, __ATOMIC_RELAXED);
+    }
+}
+
+memstat_t
+memstat_get(enum memstat_type type)
+{
+    memstat_t stat;
+    stat.objects = __atomic_load_n(&memstats[type].objects, __ATOMIC_RELAXED);
+    stat.bytes = __atomic_load_n(&memstats[type].bytes, __ATOMIC_RELAXED);
+    return stat;
+}
+
+const char *
+memstat_name(enum memstat_type type)
+{
+    return memstat_names[type];
+}
+
+void
+memstat_dump(FILE *out)
+{
+    memstat_t stat;
+    char size[16];
+    int type;
+
+    fprintf(out, "Memory usage:\n");
+    for (type = 0; type < MEMSTAT_COUNT; type++) {
+        stat = memstat_get(type);
+        fprintf(out, "  %-12s %10zu objects %10s\n",
+                memstat_name(type), stat.objects, size_to_str(stat.bytes, size));
+    }
+}
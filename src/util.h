@@ -35,6 +35,33 @@
 // Max Memmory allocation
 #define MALLOC_MAX_SIZE 102400
 
+//! Memory accounting subsystems
+enum memstat_type {
+    MEMSTAT_PACKETS = 0,
+    MEMSTAT_FRAMES,
+    MEMSTAT_PAYLOADS,
+    MEMSTAT_MSGS,
+    MEMSTAT_MEDIA,
+    MEMSTAT_STREAMS,
+    MEMSTAT_RTP_PACKETS,
+    MEMSTAT_REASM,
+    MEMSTAT_HTABLES,
+    MEMSTAT_COUNT
+};
+
+//! Shorter declaration of memstat structure
+typedef struct memstat memstat_t;
+
+/**
+ * @brief Memory accounting counters of a subsystem
+ */
+struct memstat {
+    //! Number of allocated objects
+    size_t objects;
+    //! Number of allocated bytes
+    size_t bytes;
+};
+
 // Stringify numbers for concatenation
 #define STRINGIFY_ARG(x)    #x
 #define STRINGIFY(x)        STRINGIFY_ARG(x)
@@ -105,6 +132,86 @@ timeval_to_delta(struct timeval start, struct timeval end, char *out);
 char *
 strtrim(char *str);
 
+/**
+ * @brief Convert a size string to bytes
+ *
+ * Size can have an optional K, M or G suffix (case insensitive)
+ *
+ * @param str Size string (for example 512M)
+ * @return size in bytes or 0 if string is not a valid size
+ */
+size_t
+size_from_str(const char *str);
+
+/**
+ * @brief Convert a size in bytes to a human readable string
+ *
+ * @param size Size in bytes
+ * @param out Output buffer (at least 16 bytes)
+ * @return out buffer pointer
+ */
+const char *
+size_to_str(size_t size, char *out);
+
+/**
+ * @brief Get the memory limit of the cgroup this process belongs to
+ *
+ * Both cgroup v2 (memory.max) and v1 (memory.limit_in_bytes)
+ * hierarchies are checked.
+ *
+ * @return limit in bytes or 0 if there is no limit or it can not be read
+ */
+size_t
+cgroup_memory_limit();
+
+/**
+ * @brief Account a new allocated object of a subsystem
+ *
+ * @param type Memory accounting subsystem
+ * @param bytes Allocated bytes for this object
+ */
+void
+memstat_alloc(enum memstat_type type, size_t bytes);
+
+/**
+ * @brief Account a deallocated object of a subsystem
+ *
+ * @param type Memory accounting subsystem
+ * @param bytes Bytes accounted for this object
+ */
+void
+memstat_free(enum memstat_type type, size_t bytes);
+
+/**
+ * @brief Account a size change of an allocated object
+ *
+ * @param type Memory accounting subsystem
+ * @param oldsize Bytes previously accounted for the object
+ * @param newsize Bytes currently allocated for the object
+ */
+void
+memstat_resize(enum memstat_type type, size_t oldsize, size_t newsize);
+
+/**
+ * @brief Get current counters of a subsystem
+ */
+memstat_t
+memstat_get(enum memstat_type type);
+
+/**
+ * @brief Get subsystem display name
+ */
+const char *
+memstat_name(enum memstat_type type);
+
+/**
+ * @brief Print all memory accounting counters
+ *
+ * @param out Output stream
+ */
+void
+memstat_dump(FILE *out);
+
 /**
  * @brief Set up handler for SIGTERM, SIGINT and SIGQUIT
  */
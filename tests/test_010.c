@@ -30,6 +30,7 @@
 #include <assert.h>
 #include <string.h>
 #include "../src/hash.h"
+#include "../src/util.h"
 
 int main ()
 {
@@ -97,8 +98,15 @@ int main ()
     // Search a not found entry
     assert(htable_find(table, "key7") == NULL);
 
+    // Only the first entry remains
+    assert(memstat_get(MEMSTAT_HTABLES).objects == 1);
+
     // Destroy the table
     htable_destroy(table);
 
+    // All table memory has been released
+    assert(memstat_get(MEMSTAT_HTABLES).objects == 0);
+    assert(memstat_get(MEMSTAT_HTABLES).bytes == 0);
+
     return 0;
 }
@@ -0,0 +1,130 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file test_012.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * Merge order test of split traces from aaa.pcap
+ *
+ * Records of aaa.pcap are split in two files and both are read together,
+ * which must give the same output of reading the original file.
+ */
+
+#include "test_output.c"
+#include <assert.h>
+#include <stdint.h>
+
+/**
+ * @brief Get the capture time of a pcap record in microseconds
+ */
+static uint64_t
+record_time(const char *record)
+{
+    uint32_t sec, usec;
+    memcpy(&sec, record, sizeof(sec));
+    memcpy(&usec, record + 4, sizeof(usec));
+    return (uint64_t) sec * 1000000 + usec;
+}
+
+/**
+ * @brief Get the total size of a pcap record
+ */
+static size_t
+record_size(const char *record)
+{
+    uint32_t caplen;
+    memcpy(&caplen, record + 8, sizeof(caplen));
+    return TEST_PCAP_RECLEN + caplen;
+}
+
+int main ()
+{
+    char *data, *split[2];
+    size_t len, splitlen[2], pos, size, count = 0;
+    uint64_t last = 0;
+    int i;
+
+    test_init();
+
+    char *config = test_path("sngreprc");
+    char *first = test_path("first.pcap");
+    char *second = test_path("second.pcap");
+    char *output = test_path("output.pcap");
+    char *text = test_path("output.txt");
+    char *merged = test_path("merged.pcap");
+    char *mergedtext = test_path("merged.txt");
+
+    // Split records in two files, one record each
+    data = test_read("aaa.pcap", &len);
+    assert(data && len > TEST_PCAP_HDRLEN);
+    for (i = 0; i < 2; i++) {
+        split[i] = malloc(len);
+        memcpy(split[i], data, TEST_PCAP_HDRLEN);
+        splitlen[i] = TEST_PCAP_HDRLEN;
+    }
+    for (pos = TEST_PCAP_HDRLEN; pos + TEST_PCAP_RECLEN <= len; pos += size, count++) {
+        size = record_size(data + pos);
+        assert(pos + size <= len);
+        memcpy(split[count % 2] + splitlen[count % 2], data + pos, size);
+        splitlen[count % 2] += size;
+    }
+    assert(count > 2);
+    assert(test_write(first, split[0], splitlen[0]) == 0);
+    assert(test_write(second, split[1], splitlen[1]) == 0);
+    assert(test_write(config, "", 0) == 0);
+
+    // Read the original file
+    const char *original[] = { "aaa.pcap", NULL };
+    assert(test_run(config, original, output, text) == 0);
+
+    // Read split files, the one starting later first
+    const char *inputs[] = { second, first, NULL };
+    assert(test_run(config, inputs, merged, mergedtext) == 0);
+
+    // Same packets and dialogs must be found in the same order
+    assert(test_compare(output, merged, TEST_PCAP_HDRLEN));
+    assert(test_compare(text, mergedtext, 0));
+
+    // And saved packets are sorted by capture time
+    free(data);
+    data = test_read(merged, &len);
+    assert(data && len > TEST_PCAP_HDRLEN);
+    for (pos = TEST_PCAP_HDRLEN; pos + TEST_PCAP_RECLEN <= len; pos += record_size(data + pos)) {
+        assert(record_time(data + pos) >= last);
+        last = record_time(data + pos);
+    }
+    assert(pos == len);
+
+    free(data);
+    free(split[0]);
+    free(split[1]);
+    free(config);
+    free(first);
+    free(second);
+    free(output);
+    free(text);
+    free(merged);
+    free(mergedtext);
+    test_deinit();
+
+    return 0;
+}
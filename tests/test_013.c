@@ -0,0 +1,71 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file test_013.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * Parse workers test from aaa.pcap and ipip.pcap
+ *
+ * Files parsed with decoding threads must give the same calls and
+ * messages than files parsed by the capture thread.
+ */
+
+#include "test_output.c"
+#include <assert.h>
+
+const char *pcaps[] = { "aaa.pcap", "ipip.pcap", NULL };
+
+int main ()
+{
+    const char *inputs[2] = { NULL, NULL };
+    int i;
+
+    test_init();
+
+    char *noworkers = test_path("noworkers.rc");
+    char *workers = test_path("workers.rc");
+    char *output = test_path("output.pcap");
+    char *text = test_path("output.txt");
+    char *woutput = test_path("workers.pcap");
+    char *wtext = test_path("workers.txt");
+
+    assert(test_write(noworkers, "set capture.parseworkers 0\n", 27) == 0);
+    assert(test_write(workers, "set capture.parseworkers 4\n", 27) == 0);
+
+    for (i = 0; pcaps[i]; i++) {
+        inputs[0] = pcaps[i];
+        assert(test_run(noworkers, inputs, output, text) == 0);
+        assert(test_run(workers, inputs, woutput, wtext) == 0);
+        assert(test_compare(output, woutput, 0));
+        assert(test_compare(text, wtext, 0));
+    }
+
+    free(noworkers);
+    free(workers);
+    free(output);
+    free(text);
+    free(woutput);
+    free(wtext);
+    test_deinit();
+
+    return 0;
+}
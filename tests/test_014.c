@@ -0,0 +1,100 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file test_014.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * Index file test from aaa.pcap
+ *
+ * Index file of a pcap file must be reused while the file is not changed
+ * and rewritten when its modification time changes, giving always the
+ * same output.
+ */
+
+#include "test_output.c"
+#include <assert.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+int main ()
+{
+    struct stat created, reused, rewritten, pcap;
+    struct timespec times[2];
+    char *data;
+    size_t len;
+
+    test_init();
+
+    char *config = test_path("sngreprc");
+    char *input = test_path("input.pcap");
+    char *index = test_path("input.pcap.sngidx");
+    char *output = test_path("output.pcap");
+    char *text = test_path("output.txt");
+    char *ioutput = test_path("indexed.pcap");
+    char *itext = test_path("indexed.txt");
+    const char *inputs[] = { input, NULL };
+
+    // Index files are created next to the input file
+    data = test_read("aaa.pcap", &len);
+    assert(data && len > TEST_PCAP_HDRLEN);
+    assert(test_write(input, data, len) == 0);
+    assert(test_write(config, "set capture.index on\n", 21) == 0);
+
+    // First read creates the index file
+    assert(test_run(config, inputs, output, text) == 0);
+    assert(stat(index, &created) == 0);
+
+    // Second read only uses the index file
+    assert(test_run(config, inputs, ioutput, itext) == 0);
+    assert(test_compare(output, ioutput, 0));
+    assert(test_compare(text, itext, 0));
+    assert(stat(index, &reused) == 0);
+    assert(reused.st_ino == created.st_ino);
+    assert(reused.st_mtim.tv_sec == created.st_mtim.tv_sec);
+    assert(reused.st_mtim.tv_nsec == created.st_mtim.tv_nsec);
+
+    // Changing input file modification time nanoseconds invalidates the index
+    assert(stat(input, &pcap) == 0);
+    times[0] = pcap.st_atim;
+    times[1] = pcap.st_mtim;
+    times[1].tv_nsec = (times[1].tv_nsec + 1) % 1000000000;
+    assert(utimensat(AT_FDCWD, input, times, 0) == 0);
+
+    // Third read rewrites the index file
+    assert(test_run(config, inputs, ioutput, itext) == 0);
+    assert(test_compare(output, ioutput, 0));
+    assert(test_compare(text, itext, 0));
+    assert(stat(index, &rewritten) == 0);
+    assert(rewritten.st_ino != created.st_ino);
+
+    free(data);
+    free(config);
+    free(input);
+    free(index);
+    free(output);
+    free(text);
+    free(ioutput);
+    free(itext);
+    test_deinit();
+
+    return 0;
+}
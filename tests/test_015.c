@@ -0,0 +1,135 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file test_015.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * Basic testing of RTCP sender and receiver reports parsing
+ */
+
+#include "config.h"
+#include <assert.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "../src/rtp.h"
+#include "../src/address.h"
+#include "../src/capture.h"
+
+/* Symbols of sources not linked in this test */
+enum capture_storage capture_storage() { return CAPTURE_STORAGE_MEMORY; }
+int filter_check_call(void *item) { return 1; }
+const char *get_alias_value(const char *address) { return address; }
+
+/* Sender Report from 10.0.0.1 (SSRC 0x1111) with NTP time 0x00010002.00030000 */
+const unsigned char rtcp_sr[] = {
+    0x80, 200, 0x00, 0x06,
+    0x00, 0x00, 0x11, 0x11,
+    0x00, 0x01, 0x00, 0x02, 0x00, 0x03, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0xa0,
+    0x00, 0x00, 0x00, 0x32,
+    0x00, 0x00, 0x1f, 0x40
+};
+
+/* Receiver Report from 10.0.0.2 (SSRC 0x2222) about SSRC 0x1111 sent 250ms after that SR */
+const unsigned char rtcp_rr[] = {
+    0x81, 201, 0x00, 0x07,
+    0x00, 0x00, 0x22, 0x22,
+    0x00, 0x00, 0x11, 0x11,
+    0x0a, 0x00, 0x00, 0x03,
+    0x00, 0x00, 0x01, 0x00,
+    0x00, 0x00, 0x00, 0x10,
+    0x00, 0x02, 0x00, 0x03,
+    0x00, 0x00, 0x40, 0x00
+};
+
+static packet_t *
+rtcp_packet(const char *src, const char *dst, long sec, long usec, const unsigned char *data, size_t len)
+{
+    struct pcap_pkthdr header;
+    packet_t *packet;
+
+    memset(&header, 0, sizeof(header));
+    header.ts.tv_sec = sec;
+    header.ts.tv_usec = usec;
+    header.caplen = header.len = len;
+
+    packet = packet_create(4, IPPROTO_UDP, address_from_str(src), address_from_str(dst), 0);
+    packet_add_frame(packet, &header, data);
+    packet_set_payload(packet, (u_char *) data, len);
+    return packet;
+}
+
+int main ()
+{
+    rtp_stream_t *stream;
+    rtcp_report_t *report;
+    packet_t *sr, *rr, *rrlate;
+
+    rtp_index_init(16);
+
+    // RTCP stream without call keeps all the reports it receives
+    stream = stream_create(NULL, address_from_str("10.0.0.3:4001"), PACKET_RTCP);
+    assert(stream);
+    rtp_index_add(stream);
+
+    // Sender report is stored with sender information
+    sr = rtcp_packet("10.0.0.1:5001", "10.0.0.3:4001", 1000, 0, rtcp_sr, sizeof(rtcp_sr));
+    assert(rtp_check_packet(sr) == stream);
+    assert(stream_get_report_count(stream) == 1);
+    report = stream_get_report(stream, 0);
+    assert(report->type == RTCP_HDR_SR);
+    assert(report->sender == 0x1111);
+    assert(report->spc == 0x32);
+    assert(report->soc == 0x1f40);
+    assert(stream_get_rtt(stream) == -1);
+
+    // Receiver report replies the sender report after its delay plus 50ms
+    rr = rtcp_packet("10.0.0.1:5001", "10.0.0.3:4001", 1000, 300000, rtcp_rr, sizeof(rtcp_rr));
+    assert(rtp_check_packet(rr) == stream);
+    assert(stream_get_report_count(stream) == 2);
+    report = stream_get_report(stream, 0);
+    assert(report->type == RTCP_HDR_RR);
+    assert(report->sender == 0x2222);
+    assert(report->source == 0x1111);
+    assert(report->flost == 0x0a);
+    assert(report->plost == 3);
+    assert(report->hseq == 0x100);
+    assert(report->jitter == 0x10);
+    assert(report->lsr == 0x00020003);
+    assert(report->dlsr == 0x4000);
+    assert(report->rtt == 50);
+    assert(stream_get_rtt(stream) == 50);
+
+    // Replies captured before the reported delay has elapsed are discarded
+    rrlate = rtcp_packet("10.0.0.1:5001", "10.0.0.3:4001", 1000, 200000, rtcp_rr, sizeof(rtcp_rr));
+    assert(rtp_check_packet(rrlate) == stream);
+    assert(stream_get_report_count(stream) == 3);
+    assert(stream_get_report(stream, 0)->rtt == -1);
+
+    packet_destroy(sr);
+    packet_destroy(rr);
+    packet_destroy(rrlate);
+    stream_destroy(stream);
+    rtp_index_deinit();
+
+    return 0;
+}
@@ -0,0 +1,222 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file test_output.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * Basic output runner for sngrep testing
+ *
+ * Runs sngrep without interface over test pcap files and stores its pcap
+ * and text output in a temporary directory, so tests can compare them.
+ */
+#include "config.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/wait.h>
+
+#ifndef TEST_MAX_DURATION
+#define TEST_MAX_DURATION 60
+#endif
+
+#ifdef CMAKE_CURRENT_BINARY_DIR
+#define TEST_SNGREP CMAKE_CURRENT_BINARY_DIR "/sngrep"
+#else
+#define TEST_SNGREP "../src/sngrep"
+#endif
+
+//! Classic pcap file header size
+#define TEST_PCAP_HDRLEN    24
+//! Classic pcap record header size
+#define TEST_PCAP_RECLEN    16
+
+//! Temporary directory for test files
+char test_dir[] = "/tmp/sngrep-test-XXXXXX";
+
+/**
+ * @brief Create the temporary directory for test files
+ */
+void
+test_init()
+{
+    // Max test duration
+    alarm(TEST_MAX_DURATION);
+
+    if (!mkdtemp(test_dir)) {
+        fprintf(stderr, "Fatal: unable to create test directory.\n");
+        exit(127);
+    }
+}
+
+/**
+ * @brief Remove the temporary directory and all its files
+ */
+void
+test_deinit()
+{
+    char path[1024];
+    struct dirent *entry;
+    DIR *dir;
+
+    if (!(dir = opendir(test_dir)))
+        return;
+
+    while ((entry = readdir(dir))) {
+        if (entry->d_name[0] == '.')
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", test_dir, entry->d_name);
+        unlink(path);
+    }
+    closedir(dir);
+    rmdir(test_dir);
+}
+
+/**
+ * @brief Get the path of a file in the temporary directory
+ *
+ * Returned path must be freed by the caller
+ */
+char *
+test_path(const char *name)
+{
+    char *path = malloc(strlen(test_dir) + strlen(name) + 2);
+    sprintf(path, "%s/%s", test_dir, name);
+    return path;
+}
+
+/**
+ * @brief Read the full content of a file
+ *
+ * @param filename File to read
+ * @param len Filled with the number of read bytes
+ * @return allocated file content or NULL if file can not be read
+ */
+char *
+test_read(const char *filename, size_t *len)
+{
+    char *data = NULL, *tmp;
+    size_t size = 0, n;
+    FILE *fp;
+
+    *len = 0;
+    if (!(fp = fopen(filename, "rb")))
+        return NULL;
+
+    do {
+        if (!(tmp = realloc(data, size + 4096))) {
+            free(data);
+            fclose(fp);
+            return NULL;
+        }
+        data = tmp;
+        size += 4096;
+        n = fread(data + *len, 1, size - *len, fp);
+        *len += n;
+    } while (*len == size);
+
+    fclose(fp);
+    return data;
+}
+
+/**
+ * @brief Write data to a file, replacing its previous content
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int
+test_write(const char *filename, const char *data, size_t len)
+{
+    FILE *fp;
+    int ret;
+
+    if (!(fp = fopen(filename, "wb")))
+        return -1;
+    ret = (fwrite(data, 1, len, fp) == len) ? 0 : -1;
+    if (fclose(fp) != 0)
+        ret = -1;
+    return ret;
+}
+
+/**
+ * @brief Check two files have the same content
+ *
+ * @param skip Number of initial bytes not compared
+ * @return 1 if both files could be read and are equal, 0 otherwise
+ */
+int
+test_compare(const char *one, const char *two, size_t skip)
+{
+    char *data1, *data2;
+    size_t len1, len2;
+    int equal;
+
+    data1 = test_read(one, &len1);
+    data2 = test_read(two, &len2);
+    equal = data1 && data2 && len1 == len2 && len1 >= skip
+            && memcmp(data1 + skip, data2 + skip, len1 - skip) == 0;
+    free(data1);
+    free(data2);
+    return equal;
+}
+
+/**
+ * @brief Run sngrep without interface
+ *
+ * Captured messages and RTP packets are saved to output pcap file and
+ * dialogs are saved to output text file.
+ *
+ * @param config Configuration file with test settings
+ * @param inputs NULL terminated list of input pcap files
+ * @param output Output pcap file
+ * @param text Output text file
+ * @return sngrep exit status
+ */
+int
+test_run(const char *config, const char *inputs[], const char *output, const char *text)
+{
+    const char *argv[32] = { TEST_SNGREP, "-F", "-f", config, "-N", "-q", "-r", "-O", output, "-T", text };
+    int argc = 11;
+    int child, ret = 0;
+
+    while (*inputs && argc < 30) {
+        argv[argc++] = "-I";
+        argv[argc++] = *inputs++;
+    }
+    argv[argc] = NULL;
+
+    if ((child = fork()) < 0) {
+        fprintf(stderr, "Fatal: unable to fork test.\n");
+        return 127;
+    } else if (child == 0) {
+        // Child process, run sngrep with test pcaps
+        execv(argv[0], (char **) argv);
+        _exit(127);
+    }
+
+    // Parent process, wait sngrep to parse all input files
+    if (waitpid(child, &ret, 0) < 0 || !WIFEXITED(ret))
+        return 127;
+    return WEXITSTATUS(ret);
+}